@@ -58,6 +58,7 @@
 #include <matching.h>
 #include <match_scope.h>
 #include <instrumentation.h>
+#include <profiling.h>
 #include <promises.h>
 #include <unix.h>
 #include <attributes.h>
@@ -85,6 +86,7 @@
 #include <cfnet.h>
 #include <repair.h>
 #include <dbm_api.h>                    /* CheckDBRepairFlagFile() */
+#include <data_file_cache.h>            /* DataFileCacheSetPersistent() */
 #include <sys/types.h>                  /* checking umask on writing setxid log */
 #include <sys/stat.h>                   /* checking umask on writing setxid log */
 #include <simulate_mode.h>              /* ManifestChangedFiles(), DiffChangedFiles() */
@@ -119,6 +121,13 @@ static int CFA_BACKGROUND_LIMIT = 1; /* GLOBAL_P */
 
 static Item *PROCESSREFRESH = NULL; /* GLOBAL_P */
 
+/* Promises evaluated again in later passes, and those skipped because none
+ * of the classes and variables they depend on changed since. */
+static uint64_t PASS_PROMISES_REEVALUATED = 0; /* GLOBAL_X */
+static uint64_t PASS_PROMISES_SKIPPED = 0; /* GLOBAL_X */
+
+static char *PROFILE_FILE = NULL; /* GLOBAL_P */
+
 static const char *const AGENT_TYPESEQUENCE[] =
 {
     "meta",
@@ -208,6 +217,8 @@ static const struct option OPTIONS[] =
     {"skip-bootstrap-policy-run", no_argument, 0, 0 },
     {"skip-db-check", optional_argument, 0, 0 },
     {"simulate", required_argument, 0, 0},
+    {"parse-jobs", required_argument, 0, 0},
+    {"profile", required_argument, 0, 0},
     {NULL, 0, 0, '\0'}
 };
 
@@ -240,6 +251,8 @@ static const char *const HINTS[] =
     "Do not run policy as the last step of the bootstrap process",
     "Do not run database integrity checks and repairs at startup",
     "Run in simulate mode, either 'manifest', 'manifest-full' or 'diff'",
+    "Parse policy files missing from the policy cache in this many parallel processes",
+    "Profile the evaluation and write a JSON report of the time spent in each bundle, promise and function call to the given file",
     NULL
 };
 
@@ -328,6 +341,8 @@ int main(int argc, char *argv[])
 
     GenerateReports(config, ctx);
 
+    /* These work on the lock database itself. */
+    SetLockCaching(false);
     PurgeLocks();
     BackupLockDatabase();
 
@@ -355,6 +370,13 @@ int main(int argc, char *argv[])
 
     Nova_NoteAgentExecutionPerformance(config->input_file, start);
 
+    if (PROFILE_FILE != NULL)
+    {
+        ProfilingWriteReport(PROFILE_FILE);
+        ProfilingStop();
+        free(PROFILE_FILE);
+    }
+
     GenericAgentFinalize(ctx, config);
 
     StringSetDestroy(SINGLE_COPY_CACHE);
@@ -750,6 +772,24 @@ static GenericAgentConfig *CheckOpts(int argc, char **argv)
                     DoCleanupAndExit(EXIT_FAILURE);
                 }
             }
+            else if (StringEqual(option_name, "parse-jobs"))
+            {
+                long jobs = StringToLongExitOnError(optarg);
+                if (jobs < 1)
+                {
+                    Log(LOG_LEVEL_ERR,
+                        "Invalid argument for --parse-jobs, a positive number required, not '%s'",
+                        optarg);
+                    DoCleanupAndExit(EXIT_FAILURE);
+                }
+                config->parse_jobs = jobs;
+            }
+            else if (StringEqual(option_name, "profile"))
+            {
+                free(PROFILE_FILE);
+                PROFILE_FILE = xstrdup(optarg);
+                ProfilingStart();
+            }
             break;
         }
         default:
@@ -937,6 +977,10 @@ static void KeepPromises(EvalContext *ctx, const Policy *policy, GenericAgentCon
         return;
     }
     KeepPromiseBundles(ctx, policy, config);
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Evaluated %ju promises again in later passes, skipped %ju whose inputs did not change",
+        (uintmax_t) PASS_PROMISES_REEVALUATED, (uintmax_t) PASS_PROMISES_SKIPPED);
 }
 
 /*******************************************************************/
@@ -1308,6 +1352,32 @@ static void KeepControlPromises(EvalContext *ctx, const Policy *policy, GenericA
                     config->agent_specific.agent.report_class_log? "true" : "false");
                 continue;
             }
+
+            if (strcmp(cp->lval, CFA_CONTROLBODY[AGENT_CONTROL_LOCK_CACHE].lval) == 0)
+            {
+                const bool lock_cache = BooleanFromString(value);
+                Log(LOG_LEVEL_VERBOSE, "Setting lock_cache to %s",
+                    lock_cache ? "true" : "false");
+                SetLockCaching(lock_cache);
+                continue;
+            }
+
+            if (strcmp(cp->lval, CFA_CONTROLBODY[AGENT_CONTROL_FILES_HASH_THREADS].lval) == 0)
+            {
+                const int threads = IntFromString(value);
+                Log(LOG_LEVEL_VERBOSE, "Setting files_hash_threads to %d", threads);
+                SetFileHashThreads(threads);
+                continue;
+            }
+
+            if (strcmp(cp->lval, CFA_CONTROLBODY[AGENT_CONTROL_DATA_FILE_CACHE].lval) == 0)
+            {
+                const bool data_file_cache = BooleanFromString(value);
+                Log(LOG_LEVEL_VERBOSE, "Setting data_file_cache to %s",
+                    data_file_cache ? "true" : "false");
+                DataFileCacheSetPersistent(data_file_cache);
+                continue;
+            }
         }
     }
 
@@ -1521,8 +1591,83 @@ static void AllClassesReport(const EvalContext *ctx)
     }
 }
 
-PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
-// NB - this function can be called recursively through "methods"
+/**
+ * Can we tell when evaluating #pp again in a later pass would make no
+ * difference? Only for promises that just define classes and variables from
+ * other classes and variables, or report them.
+ */
+static bool PromiseInputsTrackable(const Promise *pp)
+{
+    const char *type = PromiseGetPromiseType(pp);
+    if (!StringEqual(type, "vars") && !StringEqual(type, "classes") &&
+        !StringEqual(type, "meta") && !StringEqual(type, "reports"))
+    {
+        return false;
+    }
+
+    /* Depends on the outcome of other promises, or on chance. */
+    return PromiseGetConstraint(pp, "depends_on") == NULL &&
+           PromiseGetConstraint(pp, "dist") == NULL;
+}
+
+static void PromiseInputsArrayDestroy(PromiseInputs **inputs, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        PromiseInputsDestroy(inputs[i]);
+    }
+    free(inputs);
+}
+
+/**
+ * Evaluate #pp, unless nothing it depends on changed since it was last
+ * recorded in #inputs.
+ */
+static PromiseResult KeepAgentPromiseInPass(EvalContext *ctx, Promise *pp, int pass,
+                                            PromiseInputs **inputs,
+                                            size_t *reevaluated, size_t *skipped)
+{
+    if (*inputs != NULL && !EvalContextPromiseInputsChanged(ctx, *inputs))
+    {
+        (*skipped)++;
+        return PROMISE_RESULT_SKIPPED;
+    }
+
+    if (pass > 1)
+    {
+        (*reevaluated)++;
+    }
+
+    if (!PromiseInputsTrackable(pp))
+    {
+        return ExpandPromise(ctx, pp, KeepAgentPromise, NULL);
+    }
+
+    if (*inputs == NULL)
+    {
+        *inputs = PromiseInputsNew();
+    }
+    PromiseInputs *previous = EvalContextPromiseInputsBegin(ctx, *inputs);
+    PromiseResult result = ExpandPromise(ctx, pp, KeepAgentPromise, NULL);
+    EvalContextPromiseInputsEnd(ctx, previous);
+
+    return result;
+}
+
+static void NotePassConvergence(const Bundle *bp, size_t reevaluated, size_t skipped)
+{
+    PASS_PROMISES_REEVALUATED += reevaluated;
+    PASS_PROMISES_SKIPPED += skipped;
+
+    if (skipped > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Bundle '%s': evaluated %zu promises again in later passes, skipped %zu whose inputs did not change",
+            bp->name, reevaluated, skipped);
+    }
+}
+
+static PromiseResult EvaluateAgentBundle(EvalContext *ctx, const Bundle *bp)
 {
     assert(bp != NULL);
 
@@ -1538,8 +1683,22 @@ PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
 
     PromiseResult result = PROMISE_RESULT_SKIPPED;
 
+    /* What each built-in promise depended on when it was last evaluated, in
+     * the order they are evaluated in. */
+    size_t n_promises = 0;
+    for (TypeSequence type = 0; AGENT_TYPESEQUENCE[type] != NULL; type++)
+    {
+        const BundleSection *sp = BundleGetSection((Bundle *)bp, AGENT_TYPESEQUENCE[type]);
+        n_promises += (sp != NULL) ? SeqLength(sp->promises) : 0;
+    }
+    PromiseInputs **inputs = xcalloc(n_promises, sizeof(PromiseInputs *));
+    size_t reevaluated = 0;
+    size_t skipped = 0;
+
     for (int pass = 1; pass < CF_DONEPASSES; pass++)
     {
+        size_t index = 0;
+
         // Evaluate built-in (non-custom) promise types, according to type sequence (normal order):
         for (TypeSequence type = 0; AGENT_TYPESEQUENCE[type] != NULL; type++)
         {
@@ -1561,13 +1720,17 @@ PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
 
                 EvalContextSetPass(ctx, pass);
 
-                PromiseResult promise_result = ExpandPromise(ctx, pp, KeepAgentPromise, NULL);
+                PromiseResult promise_result =
+                    KeepAgentPromiseInPass(ctx, pp, pass, &inputs[index++],
+                                           &reevaluated, &skipped);
                 result = PromiseResultUpdate(result, promise_result);
 
                 if (EvalAborted(ctx) || BundleAbort(ctx))
                 {
                     DeleteTypeContext(ctx, type);
                     EvalContextStackPopFrame(ctx);
+                    PromiseInputsArrayDestroy(inputs, n_promises);
+                    NotePassConvergence(bp, reevaluated, skipped);
                     NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
                     return result;
                 }
@@ -1604,6 +1767,8 @@ PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
                 if (EvalAborted(ctx) || BundleAbort(ctx))
                 {
                     EvalContextStackPopFrame(ctx);
+                    PromiseInputsArrayDestroy(inputs, n_promises);
+                    NotePassConvergence(bp, reevaluated, skipped);
                     NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
                     return result;
                 }
@@ -1612,10 +1777,27 @@ PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
         }
     }
 
+    PromiseInputsArrayDestroy(inputs, n_promises);
+    NotePassConvergence(bp, reevaluated, skipped);
     NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
     return result;
 }
 
+PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
+// NB - this function can be called recursively through "methods"
+{
+    assert(bp != NULL);
+
+    ProfileEnter(PROFILE_FRAME_BUNDLE, bp->type, bp->name);
+    PromiseResult result = EvaluateAgentBundle(ctx, bp);
+    ProfileLeave();
+
+    /* With lock_cache, the locks of the bundle are written now. */
+    FlushLockCache();
+
+    return result;
+}
+
 /*********************************************************************/
 
 #ifdef __MINGW32__
@@ -0,0 +1,274 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <files_copy_pool.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <map.h>
+#include <sequence.h>
+#include <mutex.h>                                      /* ThreadLock */
+#include <client_code.h>                                /* CopyRegularFileNet */
+#include <connection_info.h>
+
+typedef enum
+{
+    COPY_JOB_QUEUED,
+    COPY_JOB_RUNNING,
+    COPY_JOB_DONE,
+    COPY_JOB_CANCELLED,
+} CopyJobState;
+
+typedef struct
+{
+    char *source;                                /* also the key in the map */
+    char *dest;
+    off_t size;
+    CopyJobState state;
+    bool copied;
+    bool claimed;
+} CopyJob;
+
+typedef struct
+{
+    FileCopyPool *pool;
+    AgentConnection *conn;
+    pthread_t tid;
+} CopyWorker;
+
+struct FileCopyPool_
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                 /* a job was queued or finished */
+
+    /* All protected by lock. */
+    Seq *jobs;                           /* in queueing order, owns them */
+    size_t next_job;                     /* first job that may be queued */
+    Map *by_source;                      /* source -> job */
+    bool stopping;
+
+    bool encrypt;
+    CopyWorker *workers;
+    size_t num_workers;
+};
+
+static void CopyJobDestroy(void *data)
+{
+    CopyJob *job = data;
+    free(job->source);
+    free(job->dest);
+    free(job);
+}
+
+/* Call with pool->lock held. */
+static CopyJob *NextQueuedJob(FileCopyPool *pool)
+{
+    while (pool->next_job < SeqLength(pool->jobs))
+    {
+        CopyJob *job = SeqAt(pool->jobs, pool->next_job);
+        pool->next_job++;
+        if (job->state == COPY_JOB_QUEUED)
+        {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void *CopyWorkerMain(void *arg)
+{
+    CopyWorker *worker = arg;
+    FileCopyPool *pool = worker->pool;
+
+    ThreadLock(&pool->lock);
+    while (!pool->stopping)
+    {
+        CopyJob *job = NextQueuedJob(pool);
+        if (job == NULL)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+
+        job->state = COPY_JOB_RUNNING;
+        ThreadUnlock(&pool->lock);
+
+        /* The job's strings don't change while it's running. */
+        bool copied = CopyRegularFileNet(job->source, job->dest, job->size,
+                                         pool->encrypt, worker->conn);
+
+        ThreadLock(&pool->lock);
+        job->state = COPY_JOB_DONE;
+        job->copied = copied;
+        pthread_cond_broadcast(&pool->cond);
+
+        if (worker->conn->conn_info->status != CONNECTIONINFO_STATUS_ESTABLISHED)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Lost a connection to '%s', fetching with one less",
+                worker->conn->this_server);
+            break;
+        }
+    }
+    ThreadUnlock(&pool->lock);
+
+    return NULL;
+}
+
+FileCopyPool *FileCopyPoolNew(AgentConnection *const *conns, size_t num_conns,
+                              bool encrypt)
+{
+    assert(conns != NULL);
+    assert(num_conns > 0);
+
+    FileCopyPool *pool = xcalloc(1, sizeof(FileCopyPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->jobs = SeqNew(128, CopyJobDestroy);
+    pool->by_source = MapNew(StringHash_untyped, StringEqual_untyped,
+                             NULL, NULL);
+    pool->encrypt = encrypt;
+    pool->workers = xcalloc(num_conns, sizeof(CopyWorker));
+
+    for (size_t i = 0; i < num_conns; i++)
+    {
+        CopyWorker *worker = &pool->workers[pool->num_workers];
+        worker->pool = pool;
+        worker->conn = conns[i];
+
+        int ret = pthread_create(&worker->tid, NULL, CopyWorkerMain, worker);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to start file copy thread (pthread_create: %s)",
+                GetErrorStrFromCode(ret));
+            break;
+        }
+        pool->num_workers++;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Fetching files over %zu parallel connections",
+        pool->num_workers);
+    return pool;
+}
+
+void FileCopyPoolQueue(FileCopyPool *pool, const char *source,
+                       const char *dest, off_t size)
+{
+    if (pool->num_workers == 0)
+    {
+        return;
+    }
+
+    ThreadLock(&pool->lock);
+    if (MapGet(pool->by_source, source) == NULL)
+    {
+        CopyJob *job = xcalloc(1, sizeof(CopyJob));
+        job->source = xstrdup(source);
+        job->dest = xstrdup(dest);
+        job->size = size;
+        job->state = COPY_JOB_QUEUED;
+
+        SeqAppend(pool->jobs, job);
+        MapInsert(pool->by_source, job->source, job);
+        pthread_cond_signal(&pool->cond);
+    }
+    ThreadUnlock(&pool->lock);
+}
+
+FileCopyPoolResult FileCopyPoolClaim(FileCopyPool *pool, const char *source,
+                                     const char *dest)
+{
+    FileCopyPoolResult result = FILE_COPY_POOL_NOT_QUEUED;
+
+    ThreadLock(&pool->lock);
+    CopyJob *job = MapGet(pool->by_source, source);
+    if (job != NULL && !job->claimed && strcmp(job->dest, dest) == 0)
+    {
+        if (job->state == COPY_JOB_QUEUED)
+        {
+            job->state = COPY_JOB_CANCELLED;
+        }
+        while (job->state == COPY_JOB_RUNNING)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        job->claimed = true;
+        if (job->state == COPY_JOB_DONE)
+        {
+            result = job->copied ? FILE_COPY_POOL_COPIED : FILE_COPY_POOL_FAILED;
+        }
+    }
+    ThreadUnlock(&pool->lock);
+
+    return result;
+}
+
+void FileCopyPoolDestroy(FileCopyPool *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    ThreadLock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->cond);
+    ThreadUnlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->num_workers; i++)
+    {
+        pthread_join(pool->workers[i].tid, NULL);
+    }
+
+    size_t fetched = 0, wasted = 0;
+    const size_t num_jobs = SeqLength(pool->jobs);
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        CopyJob *job = SeqAt(pool->jobs, i);
+        if (job->state != COPY_JOB_DONE)
+        {
+            continue;
+        }
+
+        fetched++;
+        if (!job->claimed)
+        {
+            /* Fetched in vain, the file turned out not to need copying. */
+            wasted++;
+            unlink(job->dest);
+        }
+    }
+    Log(LOG_LEVEL_VERBOSE,
+        "Fetched %zu files in parallel, %zu of them were not needed",
+        fetched, wasted);
+
+    MapDestroy(pool->by_source);
+    SeqDestroy(pool->jobs);
+    free(pool->workers);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
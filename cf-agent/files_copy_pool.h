@@ -0,0 +1,79 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_FILES_COPY_POOL_H
+#define CFENGINE_FILES_COPY_POOL_H
+
+#include <platform.h>
+#include <cfnet.h>                                       /* AgentConnection */
+
+/**
+ * Fetches files of a recursive copy_from in the background, one worker
+ * thread per connection, while the agent goes through the tree in order.
+ *
+ * Files are queued ahead of time, when the agent enters their directory, and
+ * fetched into the temporary file CopyRegularFile() would fetch them into.
+ * CopyRegularFile() then claims the result instead of fetching the file
+ * itself, so everything but the transfer (backups, renames, permissions and
+ * ownership) still happens in the agent's thread, in the usual order.
+ */
+typedef struct FileCopyPool_ FileCopyPool;
+
+typedef enum
+{
+    FILE_COPY_POOL_NOT_QUEUED,        /* never queued, or cancelled: copy it */
+    FILE_COPY_POOL_COPIED,            /* #dest holds the fetched file */
+    FILE_COPY_POOL_FAILED,            /* fetching failed, copy it yourself */
+} FileCopyPoolResult;
+
+/**
+ * @param conns established connections to one server, one worker each; they
+ *              remain the caller's and must outlive the pool
+ * @param encrypt as the "encrypt" attribute of copy_from
+ */
+FileCopyPool *FileCopyPoolNew(AgentConnection *const *conns, size_t num_conns,
+                              bool encrypt);
+
+/**
+ * Queue fetching remote #source into local #dest, a file that must not exist
+ * or be used by anything else until claimed.
+ */
+void FileCopyPoolQueue(FileCopyPool *pool, const char *source,
+                       const char *dest, off_t size);
+
+/**
+ * Take the result of fetching #source into #dest, waiting for it if it's
+ * being fetched right now. A file still waiting in the queue is cancelled,
+ * the caller fetching it is just as fast.
+ */
+FileCopyPoolResult FileCopyPoolClaim(FileCopyPool *pool, const char *source,
+                                     const char *dest);
+
+/**
+ * Wait for the workers to finish the files they are fetching, and remove
+ * every fetched file that was never claimed.
+ */
+void FileCopyPoolDestroy(FileCopyPool *pool);
+
+#endif
@@ -176,11 +176,162 @@ end:
     if (ec != NULL)
     {
         DeleteItemList(ec->file_start);
+        if (ec->line_counts != NULL)
+        {
+            MapDestroy(ec->line_counts);
+        }
         free(ec->changes_filename);
         free(ec);
     }
 }
 
+/*********************************************************************/
+
+static void LineCountAdd(Map *counts, const char *line)
+{
+    size_t *count = MapGet(counts, line);
+    if (count != NULL)
+    {
+        (*count)++;
+    }
+    else
+    {
+        count = xmalloc(sizeof(size_t));
+        *count = 1;
+        MapInsert(counts, xstrdup(line), count);
+    }
+}
+
+static void LineCountRemove(Map *counts, const char *line)
+{
+    size_t *count = MapGet(counts, line);
+    assert(count != NULL);
+    if (count != NULL && --(*count) == 0)
+    {
+        MapRemove(counts, line);
+    }
+}
+
+static void EditLineIndexBuild(EditContext *ec)
+{
+    if (ec->line_counts != NULL)
+    {
+        return;
+    }
+
+    ec->line_counts = MapNew(StringHash_untyped, StringEqual_untyped, free, free);
+    ec->last_line = NULL;
+    for (Item *ip = ec->file_start; ip != NULL; ip = ip->next)
+    {
+        LineCountAdd(ec->line_counts, ip->name);
+        ec->last_line = ip;
+    }
+}
+
+static void EditLineIndexAdd(EditContext *ec, Item *ip)
+{
+    if (ec->line_counts != NULL)
+    {
+        LineCountAdd(ec->line_counts, ip->name);
+        if (ip->next == NULL)
+        {
+            ec->last_line = ip;
+        }
+    }
+}
+
+void EditLinePrepend(EditContext *ec, const char *line)
+{
+    assert(ec != NULL);
+
+    PrependItemList(&(ec->file_start), line);
+    EditLineIndexAdd(ec, ec->file_start);
+}
+
+void EditLineInsertAfter(EditContext *ec, Item *prev, const char *line)
+{
+    assert(ec != NULL);
+
+    if (prev == NULL && ec->file_start != NULL)
+    {
+        /* Append, without looking for the end of the list. */
+        prev = EditLineLast(ec);
+    }
+
+    if (prev == NULL)
+    {
+        PrependItemList(&(ec->file_start), line);
+        EditLineIndexAdd(ec, ec->file_start);
+    }
+    else
+    {
+        InsertAfter(&(ec->file_start), prev, line);
+        EditLineIndexAdd(ec, prev->next);
+    }
+}
+
+Item *EditLineDelete(EditContext *ec, Item *ip, Item *prev)
+{
+    assert(ec != NULL);
+    assert(ip != NULL);
+    assert((prev == NULL) ? (ec->file_start == ip) : (prev->next == ip));
+
+    Item *next = ip->next;
+    if (prev == NULL)
+    {
+        ec->file_start = next;
+    }
+    else
+    {
+        prev->next = next;
+    }
+
+    if (ec->line_counts != NULL)
+    {
+        LineCountRemove(ec->line_counts, ip->name);
+        if (ec->last_line == ip)
+        {
+            ec->last_line = prev;
+        }
+    }
+
+    free(ip->name);
+    free(ip->classes);
+    free(ip);
+
+    return next;
+}
+
+void EditLineRename(EditContext *ec, Item *ip, char *name)
+{
+    assert(ec != NULL);
+    assert(ip != NULL);
+
+    if (ec->line_counts != NULL)
+    {
+        LineCountRemove(ec->line_counts, ip->name);
+        LineCountAdd(ec->line_counts, name);
+    }
+    free(ip->name);
+    ip->name = name;
+}
+
+bool EditLineExists(EditContext *ec, const char *line)
+{
+    assert(ec != NULL);
+
+    EditLineIndexBuild(ec);
+    return (MapGet(ec->line_counts, line) != NULL);
+}
+
+Item *EditLineLast(EditContext *ec)
+{
+    assert(ec != NULL);
+
+    EditLineIndexBuild(ec);
+    return ec->last_line;
+}
+
 /*********************************************************************/
 /* Level                                                             */
 /*********************************************************************/
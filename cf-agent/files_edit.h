@@ -27,6 +27,7 @@
 
 #include <cf3.defs.h>
 #include <file_lib.h>
+#include <map.h>
 
 #ifdef HAVE_LIBXML2
 #include <libxml/parser.h>
@@ -46,6 +47,10 @@ typedef struct
     char *filename;
     char *changes_filename;
     Item *file_start;
+    /* Index of the lines of file_start, built by the first lookup and kept
+     * up to date by the EditLine*() functions below. */
+    Map *line_counts;
+    Item *last_line;
     int num_edits;
 #ifdef HAVE_LIBXML2
     xmlDocPtr xmldoc;
@@ -59,6 +64,22 @@ void FinishEditContext(EvalContext *ctx, EditContext *ec,
                        const Attributes *a, const Promise *pp,
                        PromiseResult *result);
 
+/*
+ * Changes to the lines of file_start. Going through these instead of the Item
+ * list functions keeps the index in step, so that big files can be edited
+ * without walking all of their lines for each line inserted.
+ */
+void EditLinePrepend(EditContext *ec, const char *line);
+/* Appends #line if #prev is NULL. */
+void EditLineInsertAfter(EditContext *ec, Item *prev, const char *line);
+/* Unlinks and frees #ip, #prev being the line before it. Returns the next one. */
+Item *EditLineDelete(EditContext *ec, Item *ip, Item *prev);
+/* Takes ownership of #name. */
+void EditLineRename(EditContext *ec, Item *ip, char *name);
+
+bool EditLineExists(EditContext *ec, const char *line);
+Item *EditLineLast(EditContext *ec);
+
 #ifdef HAVE_LIBXML2
 bool LoadFileAsXmlDoc(xmlDocPtr *doc, const char *file, EditDefaults ed, bool only_checks);
 bool SaveXmlDocAsFile(xmlDocPtr doc, const char *file,
@@ -1046,6 +1046,24 @@ static bool InsertMultipleLinesToRegion(EvalContext *ctx, Item **start, Item *be
 
     // Insert at the end of the region / else end of the file
 
+    if (a->location.before_after == EDIT_ORDER_AFTER &&
+        begin_ptr == *start && end_ptr == NULL &&
+        !allow_multi_lines && strchr(pp->promiser, '\n') == NULL)
+    {
+        /* A single line appended to the whole file, the index tells all the
+         * loop below would. The line before the last one is only needed when
+         * inserting before. */
+        if (EditLineExists(edcontext, pp->promiser))
+        {
+            RecordNoChange(ctx, pp, a, "Promised chunk '%s' exists within selected region of %s",
+                           pp->promiser, edcontext->filename);
+            return false;
+        }
+
+        return InsertMultipleLinesAtLocation(ctx, start, begin_ptr, end_ptr, EditLineLast(edcontext), NULL,
+                                             a, pp, edcontext, result);
+    }
+
     if (a->location.before_after == EDIT_ORDER_AFTER)
     {
         /* As region was already selected by SelectRegion() and we know
@@ -1114,7 +1132,7 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
     assert(pp != NULL);
     assert(edcontext != NULL);
 
-    Item *ip, *np = NULL, *lp, *initiator = begin, *terminator = NULL;
+    Item *ip, *np = NULL, *initiator = begin, *terminator = NULL;
     int i, matches, noedits = true;
     bool retval = false;
 
@@ -1157,6 +1175,23 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
         }
     }
 
+// Keep track of the line before, so that deleting doesn't need to look for it
+
+    Item *ip_prev = NULL;
+    if (initiator != *start)
+    {
+        if (begin != NULL && initiator == begin->next)
+        {
+            ip_prev = begin;
+        }
+        else
+        {
+            for (ip_prev = *start; ip_prev->next != initiator; ip_prev = ip_prev->next)
+            {
+            }
+        }
+    }
+
 // Now do the deletion
 
     for (ip = initiator; ip != terminator && ip != NULL; ip = np)
@@ -1181,6 +1216,7 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
 
         if (!SelectLine(ctx, ip->name, a))       // Start search from location
         {
+            ip_prev = ip;
             np = ip->next;
             continue;
         }
@@ -1192,6 +1228,7 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
             if (!MakingChanges(ctx, pp, a, result, "delete line '%s' from %s",
                                ip->name, edcontext->filename))
             {
+                ip_prev = ip;
                 np = ip->next;
                 noedits = false;
             }
@@ -1205,35 +1242,7 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
                     retval = true;
                     noedits = false;
 
-                    if (ip->name != NULL)
-                    {
-                        free(ip->name);
-                    }
-
-                    np = ip->next;
-
-                    if (ip == *start)
-                    {
-                        if (initiator == *start)
-                        {
-                            initiator = np;
-                        }
-                        *start = np;
-                    }
-                    else
-                    {
-                        if (ip == initiator)
-                        {
-                            initiator = *start;
-                        }
-
-                        for (lp = initiator; lp->next != ip; lp = lp->next)
-                        {
-                        }
-
-                        lp->next = np;
-                    }
-                    free((char *) ip);
+                    np = EditLineDelete(edcontext, ip, ip_prev);
 
                     (edcontext->num_edits)++;
 
@@ -1243,6 +1252,7 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
         }
         else
         {
+            ip_prev = ip;
             np = ip->next;
         }
     }
@@ -1350,8 +1360,7 @@ static bool ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end,
         }
         else if (replaced)
         {
-            free(ip->name);
-            ip->name = xstrdup(line_buff);
+            EditLineRename(edcontext, ip, xstrdup(line_buff));
             RecordChange(ctx, pp, a, "Replaced pattern '%s' in '%s'", pp->promiser, edcontext->filename);
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
             (edcontext->num_edits)++;
@@ -1448,8 +1457,7 @@ static bool EditColumns(EvalContext *ctx, Item *file_start, Item *file_end, cons
 
         if (retval)
         {
-            free(ip->name);
-            ip->name = Rlist2String(columns, separator);
+            EditLineRename(edcontext, ip, Rlist2String(columns, separator));
         }
 
         RlistDestroy(columns);
@@ -1800,8 +1808,15 @@ static bool MatchPolicy(EvalContext *ctx, const char *camel, const char *haystac
     return ok;
 }
 
-static bool IsItemInRegion(EvalContext *ctx, const char *item, const Item *begin_ptr, const Item *end_ptr, Rlist *insert_match, const Promise *pp)
+static bool IsItemInRegion(EvalContext *ctx, EditContext *edcontext, const char *item, const Item *begin_ptr, const Item *end_ptr,
+                           Rlist *insert_match, const Promise *pp)
 {
+    if (insert_match == NULL && begin_ptr == edcontext->file_start && end_ptr == NULL)
+    {
+        /* Exact match anywhere in the file, no need to look at every line. */
+        return EditLineExists(edcontext, item);
+    }
+
     for (const Item *ip = begin_ptr; ((ip != end_ptr) && (ip != NULL)); ip = ip->next)
     {
         if (MatchPolicy(ctx, item, ip->name, insert_match, pp))
@@ -1868,7 +1883,7 @@ static bool InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr
             continue;
         }
 
-        if (!preserve_block && IsItemInRegion(ctx, BufferData(exp), begin_ptr, end_ptr, a->insert_match, pp))
+        if (!preserve_block && IsItemInRegion(ctx, edcontext, BufferData(exp), begin_ptr, end_ptr, a->insert_match, pp))
         {
             RecordNoChange(ctx, pp, a, "Promised file line '%s' exists within file '%s'",
                            BufferData(exp), edcontext->filename);
@@ -1980,7 +1995,7 @@ static bool InsertCompoundLineAtLocation(EvalContext *ctx, const char *chunk, It
             continue;
         }
 
-        if (!preserve_block && IsItemInRegion(ctx, buf, begin_ptr, end_ptr, a->insert_match, pp))
+        if (!preserve_block && IsItemInRegion(ctx, edcontext, buf, begin_ptr, end_ptr, a->insert_match, pp))
         {
             RecordNoChange(ctx, pp, a,
                            "Promised chunk '%s' exists within selected region of '%s'",
@@ -2080,7 +2095,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
                 }
                 else
                 {
-                    PrependItemList(start, newline);
+                    EditLinePrepend(edcontext, newline);
                     (edcontext->num_edits)++;
                     RecordChange(ctx, pp, a, "Inserted the promised line '%s' into '%s'",
                                  newline, edcontext->filename);
@@ -2098,7 +2113,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
                 }
                 else
                 {
-                    PrependItemList(start, newline);
+                    EditLinePrepend(edcontext, newline);
                     (edcontext->num_edits)++;
                     RecordChange(ctx, pp, a, "Prepended the promised line '%s' to %s", newline,
                                  edcontext->filename);
@@ -2132,7 +2147,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
             }
             else
             {
-                InsertAfter(start, prev, newline);
+                EditLineInsertAfter(edcontext, prev, newline);
                 (edcontext->num_edits)++;
                 RecordChange(ctx, pp, a, "Inserted the promised line '%s' into '%s' before locator",
                              newline, edcontext->filename);
@@ -2158,7 +2173,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
             }
             else
             {
-                InsertAfter(start, location, newline);
+                EditLineInsertAfter(edcontext, location, newline);
                 RecordChange(ctx, pp, a, "Inserted the promised line '%s' into '%s' after locator",
                              newline, edcontext->filename);
                 *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
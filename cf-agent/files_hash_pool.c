@@ -0,0 +1,404 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <files_hash_pool.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <map.h>
+#include <sequence.h>
+#include <mutex.h>                                      /* ThreadLock */
+#include <string_lib.h>                                 /* StringFormat */
+#include <file_lib.h>                                   /* FILE_SEPARATOR */
+#include <hash.h>                                       /* HashFile */
+#include <dir.h>
+
+/* Files hashed ahead of the agent and not claimed yet, at most. Files left
+ * out are hashed by the agent itself. */
+#define HASH_POOL_MAX_AHEAD 4096
+
+typedef enum
+{
+    HASH_JOB_QUEUED,
+    HASH_JOB_RUNNING,
+    HASH_JOB_DONE,
+    HASH_JOB_CANCELLED,
+} HashJobState;
+
+typedef struct
+{
+    char *key;                                   /* also the key in the map */
+    char *path;
+    HashMethod type;
+    bool directory;                              /* list it, hash its files */
+    HashJobState state;
+    bool hashed;                                 /* digest is usable */
+    bool claimed;
+    struct stat sb;                              /* as it was hashed */
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+} HashJob;
+
+struct FileHashPool_
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                 /* a job was queued or finished */
+
+    /* All protected by lock. */
+    Seq *jobs;                           /* in queueing order, owns them */
+    size_t next_job;                     /* first job that may be queued */
+    Map *by_key;                         /* key -> job */
+    size_t ahead;                        /* file jobs neither claimed nor cancelled */
+    size_t pending;                      /* jobs queued or running */
+    bool stopping;
+
+    pthread_t *workers;
+    size_t num_workers;
+};
+
+static void HashJobDestroy(void *data)
+{
+    HashJob *job = data;
+    free(job->key);
+    free(job->path);
+    free(job);
+}
+
+static char *HashJobKey(const char *path, HashMethod type, bool directory)
+{
+    return StringFormat("%c%d:%s", directory ? 'd' : 'f', (int) type, path);
+}
+
+static bool SameFile(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev   == b->st_dev   &&
+           a->st_ino   == b->st_ino   &&
+           a->st_size  == b->st_size  &&
+           a->st_mtime == b->st_mtime &&
+           a->st_ctime == b->st_ctime;
+}
+
+/* Call with pool->lock held, takes #key. */
+static void QueueJob(FileHashPool *pool, char *key, const char *path,
+                     HashMethod type, bool directory)
+{
+    if (MapGet(pool->by_key, key) != NULL)
+    {
+        free(key);
+        return;
+    }
+
+    HashJob *job = xcalloc(1, sizeof(HashJob));
+    job->key = key;
+    job->path = xstrdup(path);
+    job->type = type;
+    job->directory = directory;
+    job->state = HASH_JOB_QUEUED;
+
+    SeqAppend(pool->jobs, job);
+    MapInsert(pool->by_key, job->key, job);
+    if (!directory)
+    {
+        pool->ahead++;
+    }
+    pool->pending++;
+    pthread_cond_signal(&pool->cond);
+}
+
+/* Call with pool->lock held. */
+static HashJob *NextQueuedJob(FileHashPool *pool)
+{
+    while (pool->next_job < SeqLength(pool->jobs))
+    {
+        HashJob *job = SeqAt(pool->jobs, pool->next_job);
+        pool->next_job++;
+        if (job->state == HASH_JOB_QUEUED)
+        {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+/* Without pool->lock, the job's strings don't change while it's running. */
+static void HashJobRun(HashJob *job)
+{
+    struct stat before;
+    if (stat(job->path, &before) == -1 || !S_ISREG(before.st_mode))
+    {
+        return;
+    }
+
+    const time_t hashed_at = time(NULL);
+    HashFile(job->path, job->digest, job->type, false);
+
+    /* HashFile() leaves the digest alone if it can't read the file. */
+    static const unsigned char no_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+    if (memcmp(job->digest, no_digest, sizeof(no_digest)) == 0)
+    {
+        return;
+    }
+
+    /* Timestamps only have a resolution of one second, so a file modified
+     * within the second we hashed it in could change again without its
+     * stat changing: leave it to the agent. */
+    struct stat after;
+    if (before.st_mtime >= hashed_at || before.st_ctime >= hashed_at ||
+        stat(job->path, &after) == -1 || !SameFile(&before, &after))
+    {
+        return;
+    }
+
+    job->sb = before;
+    job->hashed = true;
+}
+
+/* Without pool->lock. Returns the regular files of the directory. */
+static Seq *ListDirectoryFiles(const char *path)
+{
+    Seq *files = SeqNew(64, free);
+
+    const size_t path_len = strlen(path);
+    Dir *dirh = DirOpen(path);
+    if (dirh == NULL)
+    {
+        return files;
+    }
+
+    const struct dirent *dirp;
+    while ((dirp = DirRead(dirh)) != NULL)
+    {
+        if (strcmp(dirp->d_name, ".") == 0 || strcmp(dirp->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        /* Named like the agent names it, to be found when claimed. */
+        char *file = (path_len > 0 && IsFileSep(path[path_len - 1])) ?
+            StringFormat("%s%s", path, dirp->d_name) :
+            StringFormat("%s%c%s", path, FILE_SEPARATOR, dirp->d_name);
+        struct stat sb;
+        if (lstat(file, &sb) == 0 && S_ISREG(sb.st_mode))
+        {
+            SeqAppend(files, file);
+        }
+        else
+        {
+            free(file);
+        }
+    }
+    DirClose(dirh);
+
+    return files;
+}
+
+static void *HashWorkerMain(void *arg)
+{
+    FileHashPool *pool = arg;
+
+    ThreadLock(&pool->lock);
+    while (!pool->stopping)
+    {
+        HashJob *job = NextQueuedJob(pool);
+        if (job == NULL)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+
+        job->state = HASH_JOB_RUNNING;
+        ThreadUnlock(&pool->lock);
+
+        Seq *files = NULL;
+        if (job->directory)
+        {
+            files = ListDirectoryFiles(job->path);
+        }
+        else
+        {
+            HashJobRun(job);
+        }
+
+        ThreadLock(&pool->lock);
+        job->state = HASH_JOB_DONE;
+        if (files != NULL)
+        {
+            const size_t length = SeqLength(files);
+            for (size_t i = 0; i < length && pool->ahead < HASH_POOL_MAX_AHEAD; i++)
+            {
+                const char *file = SeqAt(files, i);
+                QueueJob(pool, HashJobKey(file, job->type, false), file,
+                         job->type, false);
+            }
+            SeqDestroy(files);
+        }
+        pool->pending--;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    ThreadUnlock(&pool->lock);
+
+    return NULL;
+}
+
+FileHashPool *FileHashPoolNew(size_t num_workers)
+{
+    assert(num_workers > 0);
+
+    FileHashPool *pool = xcalloc(1, sizeof(FileHashPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->jobs = SeqNew(128, HashJobDestroy);
+    pool->by_key = MapNew(StringHash_untyped, StringEqual_untyped,
+                          NULL, NULL);
+    pool->workers = xcalloc(num_workers, sizeof(pthread_t));
+
+    for (size_t i = 0; i < num_workers; i++)
+    {
+        int ret = pthread_create(&pool->workers[pool->num_workers], NULL,
+                                 HashWorkerMain, pool);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to start file hashing thread (pthread_create: %s)",
+                GetErrorStrFromCode(ret));
+            break;
+        }
+        pool->num_workers++;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Hashing files on %zu threads", pool->num_workers);
+    return pool;
+}
+
+void FileHashPoolQueueDirectory(FileHashPool *pool, const char *path,
+                                HashMethod type)
+{
+    if (pool->num_workers == 0)
+    {
+        return;
+    }
+
+    ThreadLock(&pool->lock);
+    QueueJob(pool, HashJobKey(path, type, true), path, type, true);
+    ThreadUnlock(&pool->lock);
+}
+
+bool FileHashPoolClaim(FileHashPool *pool, const char *path, HashMethod type,
+                       unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    bool hashed = false;
+    struct stat sb = { 0 };
+    unsigned char job_digest[EVP_MAX_MD_SIZE + 1];
+
+    char *key = HashJobKey(path, type, false);
+    ThreadLock(&pool->lock);
+    HashJob *job = MapGet(pool->by_key, key);
+    if (job != NULL && !job->claimed)
+    {
+        if (job->state == HASH_JOB_QUEUED)
+        {
+            job->state = HASH_JOB_CANCELLED;
+            pool->pending--;
+        }
+        while (job->state == HASH_JOB_RUNNING)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        job->claimed = true;
+        pool->ahead--;
+        if (job->state == HASH_JOB_DONE && job->hashed)
+        {
+            hashed = true;
+            sb = job->sb;
+            memcpy(job_digest, job->digest, sizeof(job->digest));
+        }
+    }
+    ThreadUnlock(&pool->lock);
+    free(key);
+
+    /* The agent may have changed it since. */
+    struct stat now;
+    if (!hashed || stat(path, &now) == -1 || !SameFile(&sb, &now))
+    {
+        return false;
+    }
+
+    memcpy(digest, job_digest, sizeof(job_digest));
+    return true;
+}
+
+void FileHashPoolWait(FileHashPool *pool)
+{
+    ThreadLock(&pool->lock);
+    while (pool->pending > 0 && pool->num_workers > 0)
+    {
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    ThreadUnlock(&pool->lock);
+}
+
+void FileHashPoolDestroy(FileHashPool *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    ThreadLock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->cond);
+    ThreadUnlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->num_workers; i++)
+    {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    size_t hashed = 0, wasted = 0;
+    const size_t num_jobs = SeqLength(pool->jobs);
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        HashJob *job = SeqAt(pool->jobs, i);
+        if (job->directory || !job->hashed)
+        {
+            continue;
+        }
+
+        hashed++;
+        if (!job->claimed)
+        {
+            wasted++;
+        }
+    }
+    Log(LOG_LEVEL_VERBOSE,
+        "Hashed %zu files in parallel, %zu of them were not needed",
+        hashed, wasted);
+
+    MapDestroy(pool->by_key);
+    SeqDestroy(pool->jobs);
+    free(pool->workers);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_FILES_HASH_POOL_H
+#define CFENGINE_FILES_HASH_POOL_H
+
+#include <platform.h>
+#include <hash_method.h>                                    /* HashMethod */
+#include <openssl/evp.h>                               /* EVP_MAX_MD_SIZE */
+
+/**
+ * Hashes files of a depth search or a local copy on worker threads, while
+ * the agent goes through the tree in order.
+ *
+ * A directory is queued when the agent enters it, and its regular files are
+ * hashed ahead of the agent. The agent then claims the digests instead of
+ * hashing the files itself. Only hashing runs in parallel: comparing
+ * digests, recording changes, repairs, classes and logging all stay in the
+ * agent's thread, in the usual order, so results don't depend on timing.
+ *
+ * The workers only ever use absolute paths, the agent changes its working
+ * directory during depth searches.
+ */
+typedef struct FileHashPool_ FileHashPool;
+
+FileHashPool *FileHashPoolNew(size_t num_workers);
+
+/**
+ * Queue hashing the regular files directly in directory #path (absolute)
+ * with #type. The listing itself is read by a worker.
+ */
+void FileHashPoolQueueDirectory(FileHashPool *pool, const char *path,
+                                HashMethod type);
+
+/**
+ * Take the digest of #path, waiting for it if it's being hashed right now.
+ * A file still waiting in the queue is cancelled. Returns false if the file
+ * was not hashed, or changed since: hash it yourself then.
+ */
+bool FileHashPoolClaim(FileHashPool *pool, const char *path, HashMethod type,
+                       unsigned char digest[EVP_MAX_MD_SIZE + 1]);
+
+/**
+ * Wait until everything queued so far, and the files of the directories
+ * among it, is hashed or cancelled.
+ */
+void FileHashPoolWait(FileHashPool *pool);
+
+/**
+ * Wait for the workers to finish the files they are hashing, and drop
+ * digests that were never claimed.
+ */
+void FileHashPoolDestroy(FileHashPool *pool);
+
+#endif
@@ -35,7 +35,16 @@
 #include <eval_context.h>
 #include <known_dirs.h>
 
-bool CompareFileHashes(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn)
+static void ClaimOrHashFile(FileHashPool *pool, const char *file,
+                            unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    if (pool == NULL || !FileHashPoolClaim(pool, file, CF_DEFAULT_DIGEST, digest))
+    {
+        HashFile(file, digest, CF_DEFAULT_DIGEST, false);
+    }
+}
+
+bool CompareFileHashes(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn, FileHashPool *pool)
 {
     unsigned char digest1[EVP_MAX_MD_SIZE + 1] = { 0 }, digest2[EVP_MAX_MD_SIZE + 1] = { 0 };
     int i;
@@ -48,8 +57,8 @@ bool CompareFileHashes(const char *file1, const char *file2, const struct stat *
 
     if (conn == NULL)
     {
-        HashFile(file1, digest1, CF_DEFAULT_DIGEST, false);
-        HashFile(file2, digest2, CF_DEFAULT_DIGEST, false);
+        ClaimOrHashFile(pool, file1, digest1);
+        ClaimOrHashFile(pool, file2, digest2);
 
         for (i = 0; i < EVP_MAX_MD_SIZE; i++)
         {
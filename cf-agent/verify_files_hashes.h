@@ -24,11 +24,14 @@
 
 #include <cf3.defs.h>
 #include <cfnet.h>                                       /* AgentConnection */
+#include <files_hash_pool.h>
 
 #ifndef CFENGINE_VERIFY_FILES_HASHES_H
 #define CFENGINE_VERIFY_FILES_HASHES_H
 
-bool CompareFileHashes(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn);
+/* Digests of local files are claimed from #pool where it has them, #pool may
+ * be NULL. */
+bool CompareFileHashes(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn, FileHashPool *pool);
 bool CompareBinaryFiles(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn);
 
 #endif
@@ -63,7 +63,9 @@
 #include <retcode.h>
 #include <cf-agent-enterprise-stubs.h>
 #include <conn_cache.h>
-#include <stat_cache.h>                      /* remote_stat,StatCacheLookup */
+#include <stat_cache.h>   /* remote_stat,StatCacheLookup,StatCacheForgetManifest */
+#include <files_copy_pool.h>
+#include <files_hash_pool.h>
 #include <known_dirs.h>
 #include <changes_chroot.h>     /* PrepareChangesChroot(), RecordFileChangedInChroot() */
 #include <unix.h>               /* GetGroupName(), GetUserName() */
@@ -79,6 +81,19 @@ static Item *VSETXIDLIST = NULL;
 const Rlist *SINGLE_COPY_LIST = NULL; /* GLOBAL_P */
 StringSet *SINGLE_COPY_CACHE = NULL; /* GLOBAL_X */
 
+/* Fetches files ahead of CopyRegularFile() while a recursive copy_from with
+ * parallel_connections is in progress, over the connections in
+ * COPY_POOL_CONNS. */
+static FileCopyPool *COPY_POOL = NULL; /* GLOBAL_X */
+static AgentConnection **COPY_POOL_CONNS = NULL; /* GLOBAL_X */
+static size_t COPY_POOL_NUM_CONNS = 0; /* GLOBAL_X */
+
+/* Hashes files ahead of the agent during a depth search with content change
+ * detection or a local recursive copy comparing digests, on HASH_THREADS
+ * threads if more than 0. */
+static int HASH_THREADS = 0; /* GLOBAL_P */
+static FileHashPool *HASH_POOL = NULL; /* GLOBAL_X */
+
 static bool TransformFile(EvalContext *ctx, char *file, const Attributes *attr, const Promise *pp, PromiseResult *result);
 static PromiseResult VerifyName(EvalContext *ctx, char *path, const struct stat *sb, const Attributes *attr, const Promise *pp);
 static PromiseResult VerifyDelete(EvalContext *ctx,
@@ -119,6 +134,14 @@ static int VerifyFinderType(EvalContext *ctx, const char *file, const Attributes
 static void VerifyFileChanges(EvalContext *ctx, const char *file, const struct stat *sb,
                               const Attributes *attr, const Promise *pp, PromiseResult *result);
 static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, const Attributes *attr, const Promise *pp);
+static void CopyPoolStart(const EvalContext *ctx, const Attributes *attr, AgentConnection *conn);
+static void CopyPoolQueueDirectory(const char *from, const char *to, const Attributes *attr, AgentConnection *conn);
+static void CopyPoolStop(void);
+static bool HashPoolStart(void);
+static void HashPoolStop(void);
+static void PoolHashFile(const char *file, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type);
+static bool DoDepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel, const Attributes *attr,
+                          const Promise *pp, dev_t rootdevice, PromiseResult *result);
 
 extern Attributes GetExpandedAttributes(EvalContext *ctx, const Promise *pp, const Attributes *attr);
 extern void ClearExpandedAttributes(Attributes *a);
@@ -128,6 +151,11 @@ void SetFileAutoDefineList(const Rlist *auto_define_list)
     AUTO_DEFINE_LIST = auto_define_list;
 }
 
+void SetFileHashThreads(int threads)
+{
+    HASH_THREADS = threads;
+}
+
 void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, ARG_UNUSED const Attributes *attr, const Promise *pp, PromiseResult *result)
 {
     // FIXME: This function completely ignores it's attr argument
@@ -184,6 +212,20 @@ void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, ARG_UNU
 }
 
 /* Checks whether item matches a list of wildcards */
+/* The scalars of #list, borrowed from it. */
+static Seq *RlistScalarsToSeq(const Rlist *list)
+{
+    Seq *scalars = SeqNew(8, NULL);
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        if (rp->val.type == RVAL_TYPE_SCALAR)
+        {
+            SeqAppend(scalars, RlistScalarValue(rp));
+        }
+    }
+    return scalars;
+}
+
 static bool MatchRlistItem(EvalContext *ctx, const Rlist *listofregex, const char *teststring)
 {
     for (const Rlist *rp = listofregex; rp != NULL; rp = rp->next)
@@ -863,6 +905,16 @@ static PromiseResult SourceSearchAndCopy(EvalContext *ctx, const char *from, cha
         return result;
     }
 
+    if (COPY_POOL != NULL)
+    {
+        CopyPoolQueueDirectory(from, to, attr, conn);
+    }
+    if (HASH_POOL != NULL && conn == NULL)
+    {
+        FileHashPoolQueueDirectory(HASH_POOL, from, CF_DEFAULT_DIGEST);
+        FileHashPoolQueueDirectory(HASH_POOL, to, CF_DEFAULT_DIGEST);
+    }
+
     /* No backslashes over the network. */
     const char sep = (conn != NULL) ? '/' : FILE_SEPARATOR;
 
@@ -1550,8 +1602,30 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, con
             return false;
         }
 
-        if (!CopyRegularFileNet(source, ToChangesPath(new),
-                                sstat->st_size, attr->copy.encrypt, conn))
+        /* Maybe another connection fetched it already. */
+        FileCopyPoolResult fetched = FILE_COPY_POOL_NOT_QUEUED;
+        if (COPY_POOL != NULL)
+        {
+            fetched = FileCopyPoolClaim(COPY_POOL, source, ToChangesPath(new));
+        }
+
+        bool copied = (fetched == FILE_COPY_POOL_COPIED);
+
+        /* Only fetch what changed, using our current copy as the basis. */
+        if (!copied && attr->copy.delta_transfer &&
+            dest_exists && S_ISREG(dest_stat.st_mode) &&
+            ProtocolSupportsDelta(conn->conn_info->protocol))
+        {
+            char basis[CF_BUFSIZE];
+            strlcpy(basis, ToChangesPath(dest), sizeof(basis));
+            copied = CopyRegularFileNetDelta(source, basis, ToChangesPath(new),
+                                             sstat->st_size, conn);
+        }
+
+        if (!copied &&
+            (conn->conn_info->status != CONNECTIONINFO_STATUS_ESTABLISHED ||
+             !CopyRegularFileNet(source, ToChangesPath(new),
+                                 sstat->st_size, attr->copy.encrypt, conn)))
         {
             RecordFailure(ctx, pp, attr, "Failed to copy file '%s' from '%s'",
                           source, conn->remoteip);
@@ -1801,7 +1875,7 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, con
     {
         Log(LOG_LEVEL_VERBOSE, "Final verification of transmission ...");
 
-        if (CompareFileHashes(source, changes_new, sstat, &new_stat, &(attr->copy), conn))
+        if (CompareFileHashes(source, changes_new, sstat, &new_stat, &(attr->copy), conn, NULL))
         {
             RecordFailure(ctx, pp, attr,
                           "New file '%s' seems to have been corrupted in transit, aborting.", new);
@@ -2705,6 +2779,27 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
                 const Promise *pp, dev_t rootdevice, PromiseResult *result)
 {
     assert(attr != NULL);
+
+    /* Every file of the tree gets hashed, in DoDepthSearch()'s order. */
+    const bool hash_ahead =
+        (attr->havedepthsearch && attr->havechange &&
+         (attr->change.report_changes == FILE_CHANGE_REPORT_CONTENT_CHANGE ||
+          attr->change.report_changes == FILE_CHANGE_REPORT_ALL));
+    const bool started = hash_ahead && HashPoolStart();
+
+    bool ret = DoDepthSearch(ctx, name, sb, rlevel, attr, pp, rootdevice, result);
+
+    if (started)
+    {
+        HashPoolStop();
+    }
+    return ret;
+}
+
+static bool DoDepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel, const Attributes *attr,
+                          const Promise *pp, dev_t rootdevice, PromiseResult *result)
+{
+    assert(attr != NULL);
     Dir *dirh;
     int goback;
     const struct dirent *dirp;
@@ -2763,6 +2858,19 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
         return false;
     }
 
+    if (HASH_POOL != NULL && attr->havechange)
+    {
+        if (attr->change.hash == HASH_METHOD_BEST)
+        {
+            FileHashPoolQueueDirectory(HASH_POOL, name, HASH_METHOD_MD5);
+            FileHashPoolQueueDirectory(HASH_POOL, name, HASH_METHOD_SHA1);
+        }
+        else
+        {
+            FileHashPoolQueueDirectory(HASH_POOL, name, attr->change.hash);
+        }
+    }
+
     if (attr->havechange)
     {
         db_file_set = SeqNew(1, &free);
@@ -2853,7 +2961,7 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
             if ((attr->recursion.depth > 1) && (rlevel <= attr->recursion.depth))
             {
                 Log(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
-                goback = DepthSearch(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
+                goback = DoDepthSearch(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
                 if (!PopDirState(ctx, pp, attr, goback, name, sb, attr->recursion, result))
                 {
                     FatalError(ctx, "Not safe to continue");
@@ -3176,11 +3284,50 @@ static PromiseResult CopyFileSources(EvalContext *ctx, char *destination, const
 
         Log(LOG_LEVEL_VERBOSE, "Entering directory '%s'", source);
 
+        if (conn != NULL && source[0] != '\0')
+        {
+            /* Fetch the whole tree's stats, and digests if we compare them,
+             * in one reply instead of a round trip per file. The server
+             * can't evaluate file_select, so if only some files get copied
+             * their digests are asked for one by one, as they get compared. */
+            const bool want_digests =
+                (!attr->haveselect &&
+                 (attr->copy.compare == FILE_COMPARATOR_CHECKSUM ||
+                  attr->copy.compare == FILE_COMPARATOR_HASH ||
+                  attr->copy.compare == FILE_COMPARATOR_BINARY));
+            Seq *exclude_dirs = RlistScalarsToSeq(attr->recursion.exclude_dirs);
+            Seq *include_dirs = RlistScalarsToSeq(attr->recursion.include_dirs);
+            RemoteManifest(conn, source, attr->recursion.depth, want_digests,
+                           exclude_dirs, include_dirs);
+            SeqDestroy(exclude_dirs);
+            SeqDestroy(include_dirs);
+
+            CopyPoolStart(ctx, attr, conn);
+        }
+
+        /* Local files compared by digest get hashed ahead. */
+        const bool hash_ahead =
+            (conn == NULL &&
+             (attr->copy.compare == FILE_COMPARATOR_CHECKSUM ||
+              attr->copy.compare == FILE_COMPARATOR_HASH));
+        const bool started = hash_ahead && HashPoolStart();
+
         result = PromiseResultUpdate(
             result, SourceSearchAndCopy(ctx, source, destination,
                                         attr->recursion.depth, attr, pp,
                                         ssb.st_dev, &inode_cache, conn));
 
+        CopyPoolStop();
+        if (started)
+        {
+            HashPoolStop();
+        }
+        if (conn != NULL)
+        {
+            /* The next copy, or the next pass, asks the server again. */
+            StatCacheForgetManifest(conn);
+        }
+
         if (stat(ToChangesPath(destination), &dsb) != -1)
         {
             if (attr->copy.check_root)
@@ -3251,7 +3398,8 @@ static AgentConnection *FileCopyConnectionOpen(const EvalContext *ctx,
         .cache_connection = !background,
         .force_ipv4 = fc->force_ipv4,
         .trust_server = fc->trustkey,
-        .off_the_record = false
+        .off_the_record = false,
+        .compress = fc->compress
     };
 
     unsigned int conntimeout = fc->timeout;
@@ -3320,6 +3468,205 @@ void FileCopyConnectionClose(AgentConnection *conn)
     }
 }
 
+/**
+ * Start fetching the files of a recursive copy over more connections, if the
+ * copy_from asks for parallel_connections. Only files listed in a MANIFEST
+ * are fetched ahead, see CopyPoolQueueDirectory().
+ */
+static void CopyPoolStart(const EvalContext *ctx, const Attributes *attr,
+                          AgentConnection *conn)
+{
+    assert(COPY_POOL == NULL);
+
+    if (attr->copy.parallel_connections < 2 ||
+        !ProtocolSupportsManifest(conn->conn_info->protocol) ||
+        EVAL_MODE == EVAL_MODE_DRY_RUN ||
+        attr->transaction.action == cfa_warn)
+    {
+        return;
+    }
+
+    /* Our own connection keeps serving the agent, and fetches whatever the
+     * others haven't started on yet. */
+    COPY_POOL_CONNS = xcalloc(attr->copy.parallel_connections - 1,
+                              sizeof(AgentConnection *));
+    for (int i = 1; i < attr->copy.parallel_connections; i++)
+    {
+        AgentConnection *extra = FileCopyConnectionOpen(
+            ctx, conn->this_server, &(attr->copy),
+            attr->transaction.background);
+        if (extra == NULL)
+        {
+            break;
+        }
+        COPY_POOL_CONNS[COPY_POOL_NUM_CONNS++] = extra;
+    }
+
+    if (COPY_POOL_NUM_CONNS == 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Unable to open more connections to '%s', copying serially",
+            conn->this_server);
+        free(COPY_POOL_CONNS);
+        COPY_POOL_CONNS = NULL;
+        return;
+    }
+
+    COPY_POOL = FileCopyPoolNew(COPY_POOL_CONNS, COPY_POOL_NUM_CONNS,
+                                attr->copy.encrypt);
+}
+
+/**
+ * Queue the regular files in #from that VerifyCopy() is likely to copy into
+ * #to. The guess only looks at what it can without a round trip: the stat
+ * in the MANIFEST and the local file; anything fetched for nothing is removed
+ * by CopyPoolStop().
+ */
+static void CopyPoolQueueDirectory(const char *from, const char *to,
+                                   const Attributes *attr,
+                                   AgentConnection *conn)
+{
+    const Seq *names = StatCacheLookupListing(conn, from);
+    if (names == NULL)
+    {
+        return;                                   /* not in the manifest */
+    }
+
+    const size_t length = SeqLength(names);
+    for (size_t i = 0; i < length; i++)
+    {
+        const char *name = SeqAt(names, i);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            continue;
+        }
+
+        /* Named like ConsiderAbstractFile() stats it... */
+        char stat_name[CF_BUFSIZE];
+        int ret = snprintf(stat_name, sizeof(stat_name), "%s/%s", from, name);
+        if (ret < 0 || (size_t) ret >= sizeof(stat_name))
+        {
+            continue;
+        }
+
+        /* ...and like SourceSearchAndCopy() copies it. */
+        char source[CF_BUFSIZE];
+        char dest[CF_BUFSIZE];
+        strlcpy(source, from, sizeof(source));
+        strlcpy(dest, to, sizeof(dest));
+        if (!PathAppend(source, sizeof(source), name, '/') ||
+            !PathAppend(dest, sizeof(dest), name, FILE_SEPARATOR))
+        {
+            continue;
+        }
+
+        const Stat *sp = StatCacheLookup(conn, stat_name, conn->this_server);
+        if (sp == NULL || sp->cf_failed || sp->cf_lmode != 0 ||
+            !S_ISREG(sp->cf_mode) ||
+            (size_t) sp->cf_size < attr->copy.min_size ||
+            (size_t) sp->cf_size > attr->copy.max_size)
+        {
+            continue;
+        }
+
+        struct stat dsb;
+        bool likely;
+        if (lstat(ToChangesPath(dest), &dsb) == -1)
+        {
+            likely = (errno == ENOENT);
+        }
+        else if (!S_ISREG(dsb.st_mode) || attr->copy.delta_transfer)
+        {
+            /* Existing files are updated by delta in CopyRegularFile(). */
+            likely = false;
+        }
+        else if (attr->copy.force_update)
+        {
+            likely = true;
+        }
+        else
+        {
+            switch (attr->copy.compare)
+            {
+            case FILE_COMPARATOR_CHECKSUM:
+            case FILE_COMPARATOR_HASH:
+            case FILE_COMPARATOR_BINARY:
+                likely = (dsb.st_size != sp->cf_size);
+                break;
+            case FILE_COMPARATOR_MTIME:
+                likely = (dsb.st_mtime < sp->cf_mtime);
+                break;
+            case FILE_COMPARATOR_EXISTS:
+                likely = false;
+                break;
+            default:
+                likely = (dsb.st_ctime < sp->cf_ctime) ||
+                         (dsb.st_mtime < sp->cf_mtime);
+                break;
+            }
+        }
+
+        /* Into the same temporary file as CopyRegularFile(). */
+        if (likely && JoinSuffix(dest, sizeof(dest), CF_NEW))
+        {
+            FileCopyPoolQueue(COPY_POOL, source, ToChangesPath(dest),
+                              sp->cf_size);
+        }
+    }
+}
+
+static void CopyPoolStop(void)
+{
+    if (COPY_POOL == NULL)
+    {
+        return;
+    }
+
+    FileCopyPoolDestroy(COPY_POOL);
+    COPY_POOL = NULL;
+
+    for (size_t i = 0; i < COPY_POOL_NUM_CONNS; i++)
+    {
+        FileCopyConnectionClose(COPY_POOL_CONNS[i]);
+    }
+    free(COPY_POOL_CONNS);
+    COPY_POOL_CONNS = NULL;
+    COPY_POOL_NUM_CONNS = 0;
+}
+
+/**
+ * Start hashing files ahead of the agent, see DepthSearch() and
+ * CopyFileSources() for what gets queued. Not with changes chroots,
+ * the paths hashed and compared differ there.
+ *
+ * @return whether it was started, and needs HashPoolStop()
+ */
+static bool HashPoolStart(void)
+{
+    if (HASH_THREADS < 1 || HASH_POOL != NULL || ChrootChanges())
+    {
+        return false;
+    }
+
+    HASH_POOL = FileHashPoolNew(HASH_THREADS);
+    return true;
+}
+
+static void HashPoolStop(void)
+{
+    FileHashPoolDestroy(HASH_POOL);
+    HASH_POOL = NULL;
+}
+
+static void PoolHashFile(const char *file, unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                         HashMethod type)
+{
+    if (HASH_POOL == NULL || !FileHashPoolClaim(HASH_POOL, file, type, digest))
+    {
+        HashFile(file, digest, type, false);
+    }
+}
+
 PromiseResult ScheduleCopyOperation(EvalContext *ctx, char *destination, const Attributes *attr, const Promise *pp)
 {
     assert(attr != NULL);
@@ -3576,8 +3923,8 @@ static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, con
     bool changed = false;
     if (attr->change.hash == HASH_METHOD_BEST)
     {
-        HashFile(file, digest1, HASH_METHOD_MD5, false);
-        HashFile(file, digest2, HASH_METHOD_SHA1, false);
+        PoolHashFile(file, digest1, HASH_METHOD_MD5);
+        PoolHashFile(file, digest2, HASH_METHOD_SHA1);
 
         changed = (changed ||
                    FileChangesCheckAndUpdateHash(ctx, file, digest1, HASH_METHOD_MD5, attr, pp, &result));
@@ -3586,7 +3933,7 @@ static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, con
     }
     else
     {
-        HashFile(file, digest1, attr->change.hash, false);
+        PoolHashFile(file, digest1, attr->change.hash);
 
         changed = (changed ||
                    FileChangesCheckAndUpdateHash(ctx, file, digest1, attr->change.hash, attr, pp, &result));
@@ -3652,7 +3999,7 @@ static bool CompareForFileCopy(char *sourcefile, char *destfile, const struct st
 
         if (S_ISREG(dsb->st_mode) && S_ISREG(ssb->st_mode))
         {
-            ok_to_copy = CompareFileHashes(changes_sourcefile, changes_destfile, ssb, dsb, fc, conn);
+            ok_to_copy = CompareFileHashes(changes_sourcefile, changes_destfile, ssb, dsb, fc, conn, HASH_POOL);
         }
         else
         {
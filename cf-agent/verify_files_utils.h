@@ -33,6 +33,7 @@ extern const Rlist *SINGLE_COPY_LIST;
 extern StringSet *SINGLE_COPY_CACHE;
 
 void SetFileAutoDefineList(const Rlist *auto_define_list);
+void SetFileHashThreads(int threads);
 
 void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, const Attributes *attr, const Promise *pp, PromiseResult *result);
 bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel, const Attributes *attr, const Promise *pp, dev_t rootdevice, PromiseResult *result);
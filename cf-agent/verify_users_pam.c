@@ -35,6 +35,9 @@
 #include <files_lib.h>
 #include <eval_context.h>
 #include <regex.h> // CompileRegex()
+#include <map.h>
+#include <sequence.h>
+#include <printsize.h>
 
 #include <cf3.defs.h>
 #include <verify_methods.h>
@@ -76,6 +79,517 @@ typedef enum
 
 static bool SupportsOption(const char *cmd, const char *option);
 
+#ifdef __FreeBSD__
+struct passwd *fgetpwent(FILE *stream)
+{
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+
+    struct passwd *pw = NULL;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    int pwd_scanflag = 0;
+
+    while ((linelen = getline(&line, &linecap, stream)) > 0)
+    {
+        /* Skip comments and empty lines */
+        if (*line == '\n' || *line == '#')
+        {
+            continue;
+        }
+        /* trim latest \n */
+        if (line[linelen - 1 ] == '\n')
+        {
+            line[linelen - 1] = '\0';
+        }
+        pw = pw_scan(line, pwd_scanflag);
+        if (pw != NULL)
+        {
+            break;
+        }
+    }
+    free(line);
+
+    return pw;
+}
+
+struct group *fgetgrent(FILE *stream)
+{
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+
+    struct group *gr = NULL;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+
+    while ((linelen = getline(&line, &linecap, stream)) > 0)
+    {
+        /* Skip comments and empty lines */
+        if (*line == '\n' || *line == '#')
+        {
+            continue;
+        }
+        /* trim latest \n */
+        if (line[linelen - 1] == '\n')
+        {
+            line[linelen - 1] = '\0';
+        }
+        gr = gr_scan(line);
+        if (gr != NULL)
+        {
+            break;
+        }
+    }
+    free(line);
+
+    return gr;
+}
+#endif
+
+/*********************************************************************/
+/* Snapshot of the local user and group databases                    */
+/*********************************************************************/
+
+/*
+ * Users, groups and shadow entries are read with fgetpwent(), fgetgrent()
+ * and fgetspent() instead of getpwnam() and friends, to guarantee that they
+ * are local, and not for example from LDAP. Each file is read once, on first
+ * use, into copies of its entries indexed by name (and gid), and secondary
+ * group memberships are indexed by user. The entries stay valid until
+ * UserDbRefresh(), called before every users promise, drops the files that
+ * changed since they were read, or all of them after UserDbInvalidate(),
+ * called once a promise changed users.
+ */
+
+typedef struct
+{
+    const char *path;
+    bool loaded;
+    int error;                          /* errno of opening it, 0 if read */
+    struct stat sb;                     /* as it was when read */
+} UserDbFile;
+
+static struct
+{
+    bool stale;
+
+    UserDbFile passwd_file;
+    Map *users;                         /* name -> struct passwd */
+
+    UserDbFile group_file;
+    bool group_read_failed;
+    Seq *groups;                        /* struct group, in file order */
+    Map *groups_by_name;                /* first ones in #groups */
+    Map *groups_by_gid;                 /* gid as a string -> first in #groups */
+    Map *memberships;                   /* user name -> StringSet of group names */
+
+#if HAVE_FGETSPENT
+    UserDbFile shadow_file;
+    Map *shadow;                        /* name -> struct spwd */
+#endif
+} USER_DB = {
+    .passwd_file = { .path = "/etc/passwd" },
+    .group_file = { .path = "/etc/group" },
+#if HAVE_FGETSPENT
+    .shadow_file = { .path = "/etc/shadow" },
+#endif
+};
+
+/* The entries of pw_scan() and gr_scan() are allocated, others are in static
+ * buffers overwritten by the next call. Only the POSIX fields are copied, the
+ * platform specific ones are not used here. */
+static struct passwd *PasswdEntryCopy(struct passwd *pw)
+{
+#ifdef __FreeBSD__
+    return pw;
+#else
+    struct passwd *copy = xmemdup(pw, sizeof(*pw));
+    copy->pw_name = SafeStringDuplicate(pw->pw_name);
+    copy->pw_passwd = SafeStringDuplicate(pw->pw_passwd);
+    copy->pw_gecos = SafeStringDuplicate(pw->pw_gecos);
+    copy->pw_dir = SafeStringDuplicate(pw->pw_dir);
+    copy->pw_shell = SafeStringDuplicate(pw->pw_shell);
+    return copy;
+#endif
+}
+
+static void PasswdEntryDestroy(void *entry)
+{
+#ifndef __FreeBSD__
+    struct passwd *pw = entry;
+    free(pw->pw_name);
+    free(pw->pw_passwd);
+    free(pw->pw_gecos);
+    free(pw->pw_dir);
+    free(pw->pw_shell);
+#endif
+    free(entry);
+}
+
+static struct group *GroupEntryCopy(struct group *gr)
+{
+#ifdef __FreeBSD__
+    return gr;
+#else
+    struct group *copy = xmemdup(gr, sizeof(*gr));
+    copy->gr_name = SafeStringDuplicate(gr->gr_name);
+    copy->gr_passwd = SafeStringDuplicate(gr->gr_passwd);
+    if (gr->gr_mem != NULL)
+    {
+        size_t n_members = 0;
+        while (gr->gr_mem[n_members] != NULL)
+        {
+            n_members++;
+        }
+        copy->gr_mem = xcalloc(n_members + 1, sizeof(char *));
+        for (size_t i = 0; i < n_members; i++)
+        {
+            copy->gr_mem[i] = xstrdup(gr->gr_mem[i]);
+        }
+    }
+    return copy;
+#endif
+}
+
+static void GroupEntryDestroy(void *entry)
+{
+#ifndef __FreeBSD__
+    struct group *gr = entry;
+    free(gr->gr_name);
+    free(gr->gr_passwd);
+    if (gr->gr_mem != NULL)
+    {
+        for (size_t i = 0; gr->gr_mem[i] != NULL; i++)
+        {
+            free(gr->gr_mem[i]);
+        }
+        free(gr->gr_mem);
+    }
+#endif
+    free(entry);
+}
+
+#if HAVE_FGETSPENT
+static struct spwd *ShadowEntryCopy(const struct spwd *sp)
+{
+    struct spwd *copy = xmemdup(sp, sizeof(*sp));
+    copy->sp_namp = SafeStringDuplicate(sp->sp_namp);
+    copy->sp_pwdp = SafeStringDuplicate(sp->sp_pwdp);
+    return copy;
+}
+
+static void ShadowEntryDestroy(void *entry)
+{
+    struct spwd *sp = entry;
+    free(sp->sp_namp);
+    free(sp->sp_pwdp);
+    free(sp);
+}
+#endif
+
+static FILE *UserDbFileOpen(UserDbFile *file)
+{
+    file->loaded = true;
+    file->error = 0;
+    memset(&file->sb, 0, sizeof(file->sb));
+
+    FILE *fptr = safe_fopen(file->path, "r");
+    if (fptr == NULL)
+    {
+        file->error = (errno != 0) ? errno : ENOENT;
+        Log(LOG_LEVEL_ERR, "Could not open '%s': %s", file->path, GetErrorStr());
+        return NULL;
+    }
+
+    if (fstat(fileno(fptr), &file->sb) == -1)
+    {
+        /* Never matches, so it's read again before the next promise. */
+        memset(&file->sb, 0, sizeof(file->sb));
+    }
+    return fptr;
+}
+
+static bool UserDbFileChanged(const UserDbFile *file)
+{
+    if (!file->loaded)
+    {
+        return false;
+    }
+    if (file->error != 0)
+    {
+        return true;
+    }
+
+    struct stat sb;
+    if (stat(file->path, &sb) == -1)
+    {
+        return true;
+    }
+
+    return (sb.st_dev != file->sb.st_dev ||
+            sb.st_ino != file->sb.st_ino ||
+            sb.st_mtime != file->sb.st_mtime ||
+            sb.st_ctime != file->sb.st_ctime ||
+            sb.st_size != file->sb.st_size);
+}
+
+static void UserDbUnloadUsers(void)
+{
+    MapDestroy(USER_DB.users);
+    USER_DB.users = NULL;
+    USER_DB.passwd_file.loaded = false;
+}
+
+static void UserDbLoadUsers(void)
+{
+    USER_DB.users = MapNew(StringHash_untyped, StringEqual_untyped, NULL, PasswdEntryDestroy);
+
+    FILE *fptr = UserDbFileOpen(&USER_DB.passwd_file);
+    if (fptr == NULL)
+    {
+        return;
+    }
+
+    struct passwd *passwd_info;
+    while ((passwd_info = fgetpwent(fptr)))
+    {
+        if (MapHasKey(USER_DB.users, passwd_info->pw_name))
+        {
+            /* The first one is the one that counts. */
+#ifdef __FreeBSD__
+            free(passwd_info);
+#endif
+            continue;
+        }
+
+        struct passwd *copy = PasswdEntryCopy(passwd_info);
+        MapInsert(USER_DB.users, copy->pw_name, copy);
+    }
+    fclose(fptr);
+
+    Log(LOG_LEVEL_DEBUG, "Read %zu users from '%s'",
+        MapSize(USER_DB.users), USER_DB.passwd_file.path);
+}
+
+static void UserDbUnloadGroups(void)
+{
+    MapDestroy(USER_DB.memberships);
+    MapDestroy(USER_DB.groups_by_gid);
+    MapDestroy(USER_DB.groups_by_name);
+    SeqDestroy(USER_DB.groups);
+    USER_DB.memberships = NULL;
+    USER_DB.groups_by_gid = NULL;
+    USER_DB.groups_by_name = NULL;
+    USER_DB.groups = NULL;
+    USER_DB.group_file.loaded = false;
+    USER_DB.group_read_failed = false;
+}
+
+static void StringSetDestroy_untyped(void *set)
+{
+    StringSetDestroy(set);
+}
+
+static void UserDbLoadGroups(void)
+{
+    USER_DB.groups = SeqNew(100, GroupEntryDestroy);
+    USER_DB.groups_by_name = MapNew(StringHash_untyped, StringEqual_untyped, NULL, NULL);
+    USER_DB.groups_by_gid = MapNew(StringHash_untyped, StringEqual_untyped, free, NULL);
+    USER_DB.memberships = MapNew(StringHash_untyped, StringEqual_untyped,
+                                 free, StringSetDestroy_untyped);
+
+    FILE *fptr = UserDbFileOpen(&USER_DB.group_file);
+    if (fptr == NULL)
+    {
+        return;
+    }
+
+    while (true)
+    {
+        errno = 0;
+        struct group *group_info = fgetgrent(fptr);
+        if (!group_info)
+        {
+            // Documentation among Unices is conflicting on return codes. When there
+            // are no more entries, this happens:
+            // Linux = ENOENT
+            // AIX = ESRCH
+            if (errno && errno != ENOENT && errno != ESRCH)
+            {
+                Log(LOG_LEVEL_ERR, "Error while getting group list. (fgetgrent: '%s')", GetErrorStr());
+                USER_DB.group_read_failed = true;
+            }
+            break;
+        }
+
+        struct group *copy = GroupEntryCopy(group_info);
+        SeqAppend(USER_DB.groups, copy);
+
+        if (!MapHasKey(USER_DB.groups_by_name, copy->gr_name))
+        {
+            MapInsert(USER_DB.groups_by_name, copy->gr_name, copy);
+        }
+
+        char *gid = StringFormat("%ju", (uintmax_t) copy->gr_gid);
+        if (!MapHasKey(USER_DB.groups_by_gid, gid))
+        {
+            MapInsert(USER_DB.groups_by_gid, gid, copy);
+        }
+        else
+        {
+            free(gid);
+        }
+
+        // At least on FreeBSD, gr_mem can be NULL:
+        for (int i = 0; copy->gr_mem != NULL && copy->gr_mem[i] != NULL; i++)
+        {
+            StringSet *member_of = MapGet(USER_DB.memberships, copy->gr_mem[i]);
+            if (member_of == NULL)
+            {
+                member_of = StringSetNew();
+                MapInsert(USER_DB.memberships, xstrdup(copy->gr_mem[i]), member_of);
+            }
+            StringSetAdd(member_of, xstrdup(copy->gr_name));
+        }
+    }
+    fclose(fptr);
+
+    Log(LOG_LEVEL_DEBUG, "Read %zu groups from '%s'",
+        SeqLength(USER_DB.groups), USER_DB.group_file.path);
+}
+
+#if HAVE_FGETSPENT
+static void UserDbUnloadShadow(void)
+{
+    MapDestroy(USER_DB.shadow);
+    USER_DB.shadow = NULL;
+    USER_DB.shadow_file.loaded = false;
+}
+
+static void UserDbLoadShadow(void)
+{
+    USER_DB.shadow = MapNew(StringHash_untyped, StringEqual_untyped, NULL, ShadowEntryDestroy);
+
+    FILE *fptr = UserDbFileOpen(&USER_DB.shadow_file);
+    if (fptr == NULL)
+    {
+        return;
+    }
+
+    struct spwd *spwd_info;
+    while ((spwd_info = fgetspent(fptr)))
+    {
+        if (!MapHasKey(USER_DB.shadow, spwd_info->sp_namp))
+        {
+            struct spwd *copy = ShadowEntryCopy(spwd_info);
+            MapInsert(USER_DB.shadow, copy->sp_namp, copy);
+        }
+    }
+    fclose(fptr);
+}
+#endif // HAVE_FGETSPENT
+
+/* Drop what changed, invalidates all the entries returned so far. */
+static void UserDbRefresh(void)
+{
+    if (USER_DB.stale || UserDbFileChanged(&USER_DB.passwd_file))
+    {
+        UserDbUnloadUsers();
+    }
+    if (USER_DB.stale || UserDbFileChanged(&USER_DB.group_file))
+    {
+        UserDbUnloadGroups();
+    }
+#if HAVE_FGETSPENT
+    if (USER_DB.stale || UserDbFileChanged(&USER_DB.shadow_file))
+    {
+        UserDbUnloadShadow();
+    }
+#endif
+    USER_DB.stale = false;
+}
+
+/* Users or groups were changed, don't trust the timestamps to tell. */
+static void UserDbInvalidate(void)
+{
+    USER_DB.stale = true;
+}
+
+/* Failure to find an entry means we just set errno to zero. Perhaps not
+ * optimal, but we cannot pass ENOENT, because the fopen might fail for this
+ * reason, and that should not be treated the same. */
+static void *UserDbLookup(const UserDbFile *file, Map *index, const char *key)
+{
+    if (file->error != 0)
+    {
+        errno = file->error;
+        return NULL;
+    }
+
+    void *entry = MapGet(index, key);
+    if (entry == NULL)
+    {
+        errno = 0;
+    }
+    return entry;
+}
+
+static struct passwd *GetPwEntry(const char *puser)
+{
+    if (!USER_DB.passwd_file.loaded)
+    {
+        UserDbLoadUsers();
+    }
+    return UserDbLookup(&USER_DB.passwd_file, USER_DB.users, puser);
+}
+
+static struct group *GetGrEntryByName(const char *name)
+{
+    if (!USER_DB.group_file.loaded)
+    {
+        UserDbLoadGroups();
+    }
+    return UserDbLookup(&USER_DB.group_file, USER_DB.groups_by_name, name);
+}
+
+static struct group *GetGrEntryByGid(const char *key)
+{
+    if (!USER_DB.group_file.loaded)
+    {
+        UserDbLoadGroups();
+    }
+
+    unsigned long gid;
+    int ret = StringToUlong(key, &gid);
+    if (ret != 0)
+    {
+        LogStringToLongError(key, "GetGrEntryByGid", ret);
+        errno = 0;
+        return NULL;
+    }
+
+    char gid_str[PRINTSIZE(gid)];
+    xsnprintf(gid_str, sizeof(gid_str), "%lu", gid);
+    return UserDbLookup(&USER_DB.group_file, USER_DB.groups_by_gid, gid_str);
+}
+
+#if HAVE_FGETSPENT
+static struct spwd *GetSpEntry(const char *puser)
+{
+    if (!USER_DB.shadow_file.loaded)
+    {
+        UserDbLoadShadow();
+    }
+    return UserDbLookup(&USER_DB.shadow_file, USER_DB.shadow, puser);
+}
+#endif // HAVE_FGETSPENT
+
 static const char *GetPlatformSpecificExpirationDate()
 {
      // 2nd January 1970.
@@ -213,46 +727,6 @@ end:
 }
 #endif // _AIX
 
-#if HAVE_FGETSPENT
-// Uses fgetspent() instead of getspnam(), to guarantee that the returned user
-// is a local user, and not for example from LDAP.
-static struct spwd *GetSpEntry(const char *puser)
-{
-    FILE *fptr = safe_fopen("/etc/shadow", "r");
-    if (!fptr)
-    {
-        Log(LOG_LEVEL_ERR, "Could not open '/etc/shadow': %s", GetErrorStr());
-        return NULL;
-    }
-
-    struct spwd *spwd_info;
-    bool found = false;
-    while ((spwd_info = fgetspent(fptr)))
-    {
-        if (strcmp(puser, spwd_info->sp_namp) == 0)
-        {
-            found = true;
-            break;
-        }
-    }
-
-    fclose(fptr);
-
-    if (found)
-    {
-        return spwd_info;
-    }
-    else
-    {
-        // Failure to find the user means we just set errno to zero.
-        // Perhaps not optimal, but we cannot pass ENOENT, because the fopen might
-        // fail for this reason, and that should not be treated the same.
-        errno = 0;
-        return NULL;
-    }
-}
-#endif // HAVE_FGETSPENT
-
 static bool GetPasswordHash(const char *puser, const struct passwd *passwd_info, const char **result)
 {
     // Silence warning.
@@ -909,13 +1383,13 @@ static void TransformGidsToGroups(StringSet **list);
 static bool GetGroupInfo (const char *user, const User *u, StringSet **groups_to_set, StringSet **groups_missing, StringSet **current_secondary_groups)
 {
     assert(u != NULL);
-    bool ret = true;
-    struct group *group_info;
 
-    FILE *fptr = safe_fopen("/etc/group", "r");
-    if (!fptr)
+    if (!USER_DB.group_file.loaded)
+    {
+        UserDbLoadGroups();
+    }
+    if (USER_DB.group_file.error != 0)
     {
-        Log(LOG_LEVEL_ERR, "Could not open '/etc/group': %s", GetErrorStr());
         return false;
     }
 
@@ -931,161 +1405,36 @@ static bool GetGroupInfo (const char *user, const User *u, StringSet **groups_to
         TransformGidsToGroups(&wanted_groups);
     }
 
-    while (true)
+    StringSetIterator it = StringSetIteratorInit(wanted_groups);
+    const char *group_name;
+    while ((group_name = StringSetIteratorNext(&it)) != NULL)
     {
-        errno = 0;
-        // Use fgetgrent() instead of getgrent(), to guarantee that the
-        // returned group is a local group, and not for example from LDAP.
-        group_info = fgetgrent(fptr);
-        if (!group_info)
+        const struct group *group_info = MapGet(USER_DB.groups_by_name, group_name);
+        if (group_info != NULL)
         {
-            // Documentation among Unices is conflicting on return codes. When there
-            // are no more entries, this happens:
-            // Linux = ENOENT
-            // AIX = ESRCH
-            if (errno && errno != ENOENT && errno != ESRCH)
-            {
-                Log(LOG_LEVEL_ERR, "Error while getting group list. (fgetgrent: '%s')", GetErrorStr());
-                ret = false;
-            }
-            break;
-        }
+            StringSetRemove(*groups_missing, group_name);
 
-        if (StringSetContains(wanted_groups, group_info->gr_name))
-        {
-            StringSetRemove(*groups_missing, group_info->gr_name);
-        }
-
-        // At least on FreeBSD, gr_mem can be NULL:
-        if (group_info->gr_mem != NULL)
-        {
-            bool found = false;
-            for (int i = 0; !found && group_info->gr_mem[i] != NULL; i++)
-            {
-                if (strcmp(user, group_info->gr_mem[i]) == 0)
-                {
-                    found = true;
-                    StringSetAdd(*current_secondary_groups, xstrdup(group_info->gr_name));
-                    if (StringSetContains(wanted_groups, group_info->gr_name))
-                    {
-                        StringSetAdd(*groups_to_set, xstrdup(group_info->gr_name));
-                    }
-                }
-            }
-            if (!found && StringSetContains(wanted_groups, group_info->gr_name))
+            // At least on FreeBSD, gr_mem can be NULL:
+            if (group_info->gr_mem != NULL)
             {
-                StringSetAdd(*groups_to_set, xstrdup(group_info->gr_name));
+                StringSetAdd(*groups_to_set, xstrdup(group_name));
             }
         }
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
     }
 
-    StringSetDestroy(wanted_groups);
-    fclose(fptr);
-
-    return ret;
-}
-
-static bool EqualGid(const char *key, const struct group *entry)
-{
-    assert(entry != NULL);
-
-    unsigned long gid; 
-    int ret = StringToUlong(key, &gid);
-    if (ret != 0)
+    StringSet *member_of = MapGet(USER_DB.memberships, user);
+    if (member_of != NULL)
     {
-        LogStringToLongError(key, "EqualGid", ret);
-        return false;
-    }   
-
-    return (gid == entry->gr_gid);
-}
-
-static bool EqualGroupName(const char *key, const struct group *entry)
-{
-    assert(entry != NULL);
-    return (strcmp(key, entry->gr_name) == 0);
-}
-
-#ifdef __FreeBSD__
-struct group *fgetgrent(FILE *stream)
-{
-    if (stream == NULL)
-    {
-        return NULL;
-    }
-
-    struct group *gr = NULL;
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-
-    while ((linelen = getline(&line, &linecap, stream)) > 0)
-    {
-        /* Skip comments and empty lines */
-        if (*line == '\n' || *line == '#')
-        {
-            continue;
-        }
-        /* trim latest \n */
-        if (line[linelen - 1] == '\n')
-        {
-            line[linelen - 1] = '\0';
-        }
-        gr = gr_scan(line);
-        if (gr != NULL)
+        it = StringSetIteratorInit(member_of);
+        while ((group_name = StringSetIteratorNext(&it)) != NULL)
         {
-            break;
+            StringSetAdd(*current_secondary_groups, xstrdup(group_name));
         }
     }
-    free(line);
-
-    return gr;
-}
-#endif
 
-// Uses fgetgrent() instead of getgrnam(), to guarantee that the returned group
-// is a local group, and not for example from LDAP.
-static struct group *GetGrEntry(const char *key,
-                                bool (*equal_fn)(const char *key, const struct group *entry))
-{
-    FILE *fptr = safe_fopen("/etc/group", "r");
-    if (!fptr)
-    {
-        Log(LOG_LEVEL_ERR, "Could not open '/etc/group': %s", GetErrorStr());
-        return NULL;
-    }
-
-    struct group *group_info;
-    bool found = false;
-    while ((group_info = fgetgrent(fptr)))
-    {
-        if (equal_fn(key, group_info))
-        {
-            found = true;
-            break;
-        }
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
-    }
-
-    fclose(fptr);
+    StringSetDestroy(wanted_groups);
 
-    if (found)
-    {
-        return group_info;
-    }
-    else
-    {
-        // Failure to find the user means we just set errno to zero.
-        // Perhaps not optimal, but we cannot pass ENOENT, because the fopen might
-        // fail for this reason, and that should not be treated the same.
-        errno = 0;
-        return NULL;
-    }
+    return !USER_DB.group_read_failed;
 }
 
 static void TransformGidsToGroups(StringSet **list)
@@ -1102,12 +1451,12 @@ static void TransformGidsToGroups(StringSet **list)
             continue;
         }
         // In groups vs gids, groups take precedence. So check if it exists.
-        struct group *group_info = GetGrEntry(data, &EqualGroupName);
+        struct group *group_info = GetGrEntryByName(data);
         if (!group_info)
         {
             if (errno == 0)
             {
-                group_info = GetGrEntry(data, &EqualGid);
+                group_info = GetGrEntryByGid(data);
                 if (!group_info)
                 {
                     if (errno != 0)
@@ -1136,9 +1485,6 @@ static void TransformGidsToGroups(StringSet **list)
         {
             StringSetAdd(new_list, xstrdup(data));
         }
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
     }
     StringSet *old_list = *list;
     *list = new_list;
@@ -1209,8 +1555,7 @@ static bool VerifyIfUserNeedsModifs(const char *puser, const User *u,
 
         // We try name first, even if it looks like a gid. Only fall back to gid.
         errno = 0;
-        struct group *group_info = GetGrEntry(u->group_primary, 
-                                              &EqualGroupName);
+        struct group *group_info = GetGrEntryByName(u->group_primary);
         if (group_info == NULL && errno != 0)
         {
             Log(LOG_LEVEL_ERR, 
@@ -1248,10 +1593,6 @@ static bool VerifyIfUserNeedsModifs(const char *puser, const User *u,
                 CFUSR_SETBIT(*changemap, i_group);
             }
         }
-
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
     }
 
     ////////////////////////////////////////////
@@ -1757,90 +2098,13 @@ static bool DoModifyUser (const char *puser, const User *u, const struct passwd
     return true;
 }
 
-#ifdef __FreeBSD__
-struct passwd *fgetpwent(FILE *stream)
-{
-    if (stream == NULL)
-    {
-        return NULL;
-    }
-
-    struct passwd *pw = NULL;
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    int pwd_scanflag = 0;
-
-    while ((linelen = getline(&line, &linecap, stream)) > 0)
-    {
-        /* Skip comments and empty lines */
-        if (*line == '\n' || *line == '#')
-        {
-            continue;
-        }
-        /* trim latest \n */
-        if (line[linelen - 1 ] == '\n')
-        {
-            line[linelen - 1] = '\0';
-        }
-        pw = pw_scan(line, pwd_scanflag);
-        if (pw != NULL)
-        {
-            break;
-        }
-    }
-    free(line);
-
-    return pw;
-}
-#endif
-
-// Uses fgetpwent() instead of getpwnam(), to guarantee that the returned user
-// is a local user, and not for example from LDAP.
-static struct passwd *GetPwEntry(const char *puser)
-{
-    FILE *fptr = safe_fopen("/etc/passwd", "r");
-    if (!fptr)
-    {
-        Log(LOG_LEVEL_ERR, "Could not open '/etc/passwd': %s", GetErrorStr());
-        return NULL;
-    }
-
-    struct passwd *passwd_info;
-    bool found = false;
-    while ((passwd_info = fgetpwent(fptr)))
-    {
-        if (strcmp(puser, passwd_info->pw_name) == 0)
-        {
-            found = true;
-            break;
-        }
-#ifdef __FreeBSD__
-        free(passwd_info);
-#endif
-    }
-
-    fclose(fptr);
-
-    if (found)
-    {
-        return passwd_info;
-    }
-    else
-    {
-        // Failure to find the user means we just set errno to zero.
-        // Perhaps not optimal, but we cannot pass ENOENT, because the fopen might
-        // fail for this reason, and that should not be treated the same.
-        errno = 0;
-        return NULL;
-    }
-}
-
 void VerifyOneUsersPromise (const char *puser, const User *u, PromiseResult *result, enum cfopaction action,
                             EvalContext *ctx, const Attributes *a, const Promise *pp)
 {
     assert(u != NULL);
 
+    UserDbRefresh();
+
     struct passwd *passwd_info = GetPwEntry(puser);
     if (!passwd_info && errno != 0)
     {
@@ -1863,6 +2127,7 @@ void VerifyOneUsersPromise (const char *puser, const User *u, PromiseResult *res
                 if (VerifyIfUserNeedsModifs (puser, u, passwd_info, &cmap, groups_to_set, current_secondary_groups))
                 {
                     res = DoModifyUser (puser, u, passwd_info, cmap, action, groups_to_set);
+                    UserDbInvalidate();
                     if (res)
                     {
                         Log(LOG_LEVEL_INFO, "Modified user '%s'", puser);
@@ -1890,6 +2155,7 @@ void VerifyOneUsersPromise (const char *puser, const User *u, PromiseResult *res
         else
         {
             res = DoCreateUser (puser, u, action, ctx, a, pp);
+            UserDbInvalidate();
             if (res)
             {
                 Log(LOG_LEVEL_INFO, "Created user '%s'", puser);
@@ -1907,6 +2173,7 @@ void VerifyOneUsersPromise (const char *puser, const User *u, PromiseResult *res
         if (passwd_info != NULL)
         {
             res = DoRemoveUser (puser, action);
+            UserDbInvalidate();
             if (res)
             {
                 Log(LOG_LEVEL_INFO, "Removed user '%s'", puser);
@@ -1923,7 +2190,4 @@ void VerifyOneUsersPromise (const char *puser, const User *u, PromiseResult *res
             *result = PROMISE_RESULT_NOOP;
         }
     }
-#ifdef __FreeBSD__
-    free(passwd_info);
-#endif
 }
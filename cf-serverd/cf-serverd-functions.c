@@ -41,6 +41,9 @@
 #include <unix.h>
 #include <man.h>
 #include <server_tls.h>                              /* ServerTLSInitialize */
+#include <server_workers.h>                     /* ServerWorkerPoolLogStats */
+#include <server_digest_cache.h>              /* ServerDigestCacheLogStats */
+#include <server_compress_cache.h>          /* ServerCompressCacheLogStats */
 #include <timeout.h>
 #include <known_dirs.h>
 #include <sysinfo.h>
@@ -58,6 +61,9 @@
 
 #define WAIT_INCOMING_TIMEOUT 10
 
+/* How often to log worker pool queue metrics in verbose mode. */
+#define WORKER_STATS_INTERVAL 60
+
 /* see man:listen(3) */
 #define DEFAULT_LISTEN_QUEUE_SIZE 128
 #define MAX_LISTEN_QUEUE_SIZE 2048
@@ -753,6 +759,12 @@ static void PolicyUpdateIfSafe(EvalContext *ctx, Policy **policy,
     }
     ThreadUnlock(cft_server_children);
 
+    /* Pick up changes in worker_pool_size or maxconnections: */
+    ServerConfigureWorkers();
+    ServerConfigureDigestCache();
+    ServerConfigureCompressCache();
+    ServerConfigureLastseenCommit();
+
     /* Check for change in call-collect interval: */
     if (prior != COLLECT_INTERVAL)
     {
@@ -790,6 +802,20 @@ static void AcceptAndHandle(EvalContext *ctx, int sd)
     ServerEntryPoint(ctx, MapAddress(ipaddr), info);
 }
 
+static void LogServerStatsIfDue(void)
+{
+    static time_t last_logged = 0;
+
+    time_t now = time(NULL);
+    if (now - last_logged >= WORKER_STATS_INTERVAL)
+    {
+        ServerWorkerPoolLogStats(LOG_LEVEL_VERBOSE);
+        ServerDigestCacheLogStats(LOG_LEVEL_VERBOSE);
+        ServerCompressCacheLogStats(LOG_LEVEL_VERBOSE);
+        last_logged = now;
+    }
+}
+
 static size_t GetListenQueueSize(void)
 {
     const char *const queue_size_var = getenv("CF_SERVERD_LISTEN_QUEUE_SIZE");
@@ -828,9 +854,13 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     size_t queue_size = GetListenQueueSize();
     int sd = SetServerListenState(ctx, queue_size, NULL, SERVER_LISTEN, &InitServer);
 
-    /* Necessary for our use of select() to work in WaitForIncoming(): */
+    /* Necessary for our use of select() to work in WaitForIncoming(). With
+     * epoll it is only used if epoll_create1() fails, and then checked there
+     * too. */
+#ifndef HAVE_SYS_EPOLL_H
     assert((size_t) sd < sizeof(fd_set) * CHAR_BIT &&
            (size_t) GetSignalPipe() < sizeof(fd_set) * CHAR_BIT);
+#endif
 
     Policy *server_cfengine_policy = PolicyNew();
     CfLock thislock = AcquireServerLock(ctx, config, server_cfengine_policy);
@@ -845,6 +875,11 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     }
 
     PrepareServer(sd);
+    /* Only after PrepareServer(), threads don't survive fork(). */
+    ServerConfigureWorkers();
+    ServerConfigureDigestCache();
+    ServerConfigureCompressCache();
+    ServerConfigureLastseenCommit();
     CollectCallStart(COLLECT_INTERVAL);
 
     while (!IsPendingTermination())
@@ -853,17 +888,18 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
 
         int selected = WaitForIncoming(sd, WAIT_INCOMING_TIMEOUT);
 
-        Log(LOG_LEVEL_DEBUG, "select(): %d", selected);
+        Log(LOG_LEVEL_DEBUG, "WaitForIncoming(): %d", selected);
         if (selected == -1)
         {
             Log(LOG_LEVEL_ERR,
-                "Error while waiting for connections. (select: %s)",
+                "Error while waiting for connections. (WaitForIncoming: %s)",
                 GetErrorStr());
             break;
         }
         else if (selected >= 0) /* timeout or success */
         {
             PolicyUpdateIfSafe(ctx, policy, config);
+            LogServerStatsIfDue();
 
             /* Is there a new connection pending at our listening socket? */
             if (selected > 0)
@@ -884,6 +920,10 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     Log(LOG_LEVEL_NOTICE, "Cleaning up and exiting...");
 
     CollectCallStop();
+    ServerStopWorkers();
+    ServerStopDigestCache();
+    ServerStopCompressCache();
+    ServerStopLastseenCommit();
     if (sd != -1)
     {
         Log(LOG_LEVEL_VERBOSE, "Closing listening socket");
@@ -48,6 +48,10 @@
 #include <cf-windows-functions.h>
 #include <logging_priv.h>                          /* LoggingPrivSetContext */
 #include <printsize.h>
+#include <server_workers.h>                             /* ServerWorkerPool* */
+#include <server_digest_cache.h>                      /* ServerDigestCache* */
+#include <server_compress_cache.h>                  /* ServerCompressCache* */
+#include <dbm_api.h>                                      /* DBSetGroupCommit */
 
 #include "server_classic.h"                    /* BusyWithClassicConnection */
 
@@ -58,6 +62,13 @@
 
   void ServerEntryPoint(EvalContext *ctx, const char *ipaddr, ConnectionInfo *info);
 
+  plus ServerConfigureWorkers() and ServerStopWorkers() that manage the pool
+  of threads running HandleConnection(), and ServerConfigureDigestCache(),
+  ServerStopDigestCache(), ServerConfigureCompressCache(),
+  ServerStopCompressCache(), ServerConfigureLastseenCommit() and
+  ServerStopLastseenCommit() that apply the digest and compressed file cache
+  and lastseen commit settings.
+
   TODO move this file to cf-serverd-functions.c or most probably server_common.c.
 */
 
@@ -75,6 +86,11 @@ bool LOGENCRYPT = false; /* GLOBAL_P */
 int COLLECT_INTERVAL = 0; /* GLOBAL_P */
 int COLLECT_WINDOW = 30; /* GLOBAL_P */
 bool SERVER_LISTEN = true; /* GLOBAL_P */
+int SERVER_WORKER_POOL_SIZE = 0; /* GLOBAL_P */
+int SERVER_DIGEST_CACHE_SIZE = SERVER_DIGEST_CACHE_DEFAULT_SIZE; /* GLOBAL_P */
+bool SERVER_DIGEST_CACHE_PERSISTENT = false; /* GLOBAL_P */
+int SERVER_COMPRESS_CACHE_SIZE = SERVER_COMPRESS_CACHE_DEFAULT_SIZE; /* GLOBAL_P */
+int SERVER_LASTSEEN_COMMIT_INTERVAL = 0; /* GLOBAL_P */
 
 ServerAccess SERVER_ACCESS = { 0 }; /* GLOBAL_P */
 
@@ -87,6 +103,8 @@ static void PurgeOldConnections(Item **list, time_t now);
 static void *HandleConnection(void *conn);
 static ServerConnectionState *NewConn(EvalContext *ctx, ConnectionInfo *info);
 static void DeleteConn(ServerConnectionState *conn);
+static void HandleConnectionJob(void *conn);
+static void DiscardConnectionJob(void *conn);
 
 /****************************************************************************/
 
@@ -205,6 +223,25 @@ static void SpawnConnection(EvalContext *ctx, const char *ipaddr, ConnectionInfo
     int sd_accepted = ConnectionInfoSocket(info);
     strlcpy(conn->ipaddr, ipaddr, CF_MAX_IP_LEN );
 
+    if (ServerWorkerPoolIsRunning())
+    {
+        if (ServerWorkerPoolSubmit(conn))
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "New connection (from %s, sd %d), queued for worker pool",
+                conn->ipaddr, sd_accepted);
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR,
+                "Worker pool queue is full, dropping connection from %s! "
+                "Increase server worker_pool_size or maxconnections?",
+                conn->ipaddr);
+            DiscardConnectionJob(conn);
+        }
+        return;
+    }
+
     Log(LOG_LEVEL_VERBOSE,
         "New connection (from %s, sd %d), spawning new thread...",
         conn->ipaddr, sd_accepted);
@@ -285,9 +322,11 @@ static void *HandleConnection(void *c)
     ServerConnectionState *conn = c;
     int ret;
 
-    /* Set logging prefix to be the IP address for all of thread's lifetime. */
-    /* These stack-allocated variables should be valid for all the lifetime of
-     * the thread. */
+    /* Set logging prefix to be the IP address for all of connection's
+     * lifetime. These stack-allocated variables are only valid until we
+     * return, so the prior context is restored at the end; the thread might
+     * be a pooled worker that goes on serving other connections. */
+    LoggingPrivContext *prior_log_ctx = LoggingPrivGetContext();
     char aligned_ipaddr[CF_MAX_IP_LEN + 2];
     LoggingPrivContext log_ctx = {
         .log_hook = LogHook,
@@ -440,9 +479,135 @@ static void *HandleConnection(void *c)
         CollectCallMarkProcessed();
     }
     DeleteConn(conn);
+    LoggingPrivSetContext(prior_log_ctx);
     return NULL;
 }
 
+static void HandleConnectionJob(void *conn)
+{
+    HandleConnection(conn);
+}
+
+/* Connection was accepted but never handled, e.g. the worker pool was full
+ * or stopped while it was still queued. */
+static void DiscardConnectionJob(void *c)
+{
+    ServerConnectionState *conn = c;
+
+    if (conn->conn_info->is_call_collect)
+    {
+        CollectCallMarkProcessed();
+    }
+    DeleteConn(conn);
+}
+
+/**
+ * Start, resize or stop the pool of connection worker threads according to
+ * body server control "worker_pool_size". With a size of 0 (the default) we
+ * spawn a new thread per connection.
+ *
+ * Called from the main thread only; resizing is postponed while the pool is
+ * busy so that no queued connection is discarded.
+ */
+void ServerConfigureWorkers(void)
+{
+    const size_t wanted = (SERVER_WORKER_POOL_SIZE > 0) ?
+        (size_t) SERVER_WORKER_POOL_SIZE : 0;
+    /* Connections waiting for a free worker count against maxconnections. */
+    const size_t queue_max = (CFD_MAXPROCESSES > 0) ?
+        (size_t) CFD_MAXPROCESSES : 1;
+
+    ServerWorkerPoolStats stats;
+    if (ServerWorkerPoolGetStats(&stats))
+    {
+        if (stats.workers == wanted && stats.queue_max == queue_max)
+        {
+            return;
+        }
+        if (stats.busy > 0 || stats.queued > 0)
+        {
+            Log(LOG_LEVEL_DEBUG,
+                "Worker pool is busy, postponing its reconfiguration");
+            return;
+        }
+        ServerWorkerPoolStop();
+    }
+
+    if (wanted > 0)
+    {
+        if (!ServerWorkerPoolStart(wanted, queue_max,
+                                   HandleConnectionJob, DiscardConnectionJob))
+        {
+            Log(LOG_LEVEL_ERR,
+                "Unable to start worker pool, "
+                "falling back to spawning a thread per connection");
+            /* Don't retry on every main loop iteration. */
+            SERVER_WORKER_POOL_SIZE = 0;
+        }
+    }
+}
+
+void ServerStopWorkers(void)
+{
+    ServerWorkerPoolLogStats(LOG_LEVEL_VERBOSE);
+    ServerWorkerPoolStop();
+}
+
+void ServerConfigureDigestCache(void)
+{
+    ServerDigestCacheConfigure((SERVER_DIGEST_CACHE_SIZE > 0) ?
+                               (size_t) SERVER_DIGEST_CACHE_SIZE : 0,
+                               SERVER_DIGEST_CACHE_PERSISTENT);
+}
+
+void ServerStopDigestCache(void)
+{
+    ServerDigestCacheLogStats(LOG_LEVEL_VERBOSE);
+    ServerDigestCacheClear();
+}
+
+void ServerConfigureCompressCache(void)
+{
+    /* compress_cache_size is in megabytes. */
+    ServerCompressCacheConfigure((SERVER_COMPRESS_CACHE_SIZE > 0) ?
+                                 (size_t) SERVER_COMPRESS_CACHE_SIZE << 20 : 0);
+}
+
+void ServerStopCompressCache(void)
+{
+    ServerCompressCacheLogStats(LOG_LEVEL_VERBOSE);
+    ServerCompressCacheClear();
+}
+
+/* The lastseen_commit_interval in effect. */
+static int LASTSEEN_COMMIT_INTERVAL = 0;                         /* GLOBAL_X */
+
+void ServerConfigureLastseenCommit(void)
+{
+    const int interval = MAX(SERVER_LASTSEEN_COMMIT_INTERVAL, 0);
+    if (interval == LASTSEEN_COMMIT_INTERVAL)
+    {
+        return;
+    }
+
+    /* Every connection updates lastseen, commit them together. */
+    if (DBSetGroupCommit(dbid_lastseen,
+                         (interval > 0) ? SERVER_LASTSEEN_COMMIT_MAX_PENDING : 0,
+                         interval))
+    {
+        LASTSEEN_COMMIT_INTERVAL = interval;
+    }
+}
+
+void ServerStopLastseenCommit(void)
+{
+    if (LASTSEEN_COMMIT_INTERVAL > 0)
+    {
+        DBSetGroupCommit(dbid_lastseen, 0, 0);
+        LASTSEEN_COMMIT_INTERVAL = 0;
+    }
+}
+
 
 /***************************************************************/
 /* Toolkit/Class: conn                                         */
@@ -138,6 +138,14 @@ typedef struct
 
 /* Used in cf-serverd-functions.c. */
 void ServerEntryPoint(EvalContext *ctx, const char *ipaddr, ConnectionInfo *info);
+void ServerConfigureWorkers(void);
+void ServerStopWorkers(void);
+void ServerConfigureDigestCache(void);
+void ServerStopDigestCache(void);
+void ServerConfigureCompressCache(void);
+void ServerStopCompressCache(void);
+void ServerConfigureLastseenCommit(void);
+void ServerStopLastseenCommit(void);
 
 
 AgentConnection *ExtractCallBackChannel(ServerConnectionState *conn);
@@ -147,6 +155,9 @@ AgentConnection *ExtractCallBackChannel(ServerConnectionState *conn);
 //*******************************************************************
 
 #define CLOCK_DRIFT 3600
+#define SERVER_DIGEST_CACHE_DEFAULT_SIZE 10000
+#define SERVER_COMPRESS_CACHE_DEFAULT_SIZE 64                    /* MB */
+#define SERVER_LASTSEEN_COMMIT_MAX_PENDING 1000
 
 
 extern int ACTIVE_THREADS;
@@ -156,6 +167,11 @@ extern int MAXTRIES;
 extern bool LOGENCRYPT;
 extern int COLLECT_INTERVAL;
 extern bool SERVER_LISTEN;
+extern int SERVER_WORKER_POOL_SIZE;
+extern int SERVER_DIGEST_CACHE_SIZE;
+extern bool SERVER_DIGEST_CACHE_PERSISTENT;
+extern int SERVER_COMPRESS_CACHE_SIZE;
+extern int SERVER_LASTSEEN_COMMIT_INTERVAL;
 extern ServerAccess SERVER_ACCESS;
 extern char CFRUNCOMMAND[CF_MAXVARSIZE];
 extern bool NEED_REVERSE_LOOKUP;
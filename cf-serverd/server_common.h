@@ -29,6 +29,9 @@
 
 #define CF_BUFEXT 128
 
+/* Most entries listed in one MANIFEST reply. */
+#define MANIFEST_MAX_ENTRIES 100000
+
 
 #include <platform.h>
 
@@ -44,9 +47,28 @@ bool MatchClasses(const EvalContext *ctx, ServerConnectionState *conn);
 void Terminate(ConnectionInfo *connection);
 void CfGetFile(ServerFileGetState *args);
 void CfEncryptGetFile(ServerFileGetState *args);
+void CfDeltaFile(ServerConnectionState *conn, const char *replyfile,
+                 const unsigned char *signatures, size_t num_blocks,
+                 size_t block_size, off_t basis_size);
+void CfGetFileCompressed(ServerConnectionState *conn, const char *replyfile);
 int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename);
 void ReplyServerContext(ServerConnectionState *conn, int encrypted, Item *classes);
 int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirname);
+int CfStatDirectory(ServerConnectionState *conn, char *sendbuffer,
+                    char *oldDirname, const char *no_stat_reason);
+/* Subdirectories a MANIFEST doesn't descend into, as the client's
+ * SkipDirLinks() would skip them. */
+typedef struct
+{
+    char *client_root;                /* the directory as the client named it */
+    Seq *exclude_dirs;                /* regexes */
+    Seq *include_dirs;                /* regexes, empty to include all */
+} ManifestFilter;
+
+void ManifestFilterDestroy(ManifestFilter *filter);
+int CfManifest(ServerConnectionState *conn, char *sendbuffer,
+               char *oldDirname, int max_depth, bool with_digests,
+               const ManifestFilter *filter);
 int CfSecOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *dirname);
 void GetServerLiteral(EvalContext *ctx, ServerConnectionState *conn, char *sendbuffer, char *recvbuffer, int encrypted);
 bool GetServerQuery(ServerConnectionState *conn, char *recvbuffer, int encrypted);
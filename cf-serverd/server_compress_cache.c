@@ -0,0 +1,317 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <server_compress_cache.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <map.h>
+#include <file_compress.h>                          /* CompressFileToBuffer */
+
+/* Files whose compressed contents take more than this part of the cache
+ * are sent, but not kept. */
+#define COMPRESS_CACHE_MAX_ENTRY_SHARE 4
+
+struct CompressCacheEntry_
+{
+    char *path;                      /* the key in the map, NULL if not in */
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    int64_t ctime;
+
+    unsigned char *data;
+    size_t len;
+
+    /* One reference for being in the cache, one per worker sending it. */
+    int refcount;
+
+    /* Least recently used list, most recent first. */
+    CompressCacheEntry *prev;
+    CompressCacheEntry *next;
+};
+
+static pthread_mutex_t CACHE_LOCK = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+/* All protected by CACHE_LOCK. */
+static Map *CACHE = NULL;                                     /* GLOBAL_X */
+static CompressCacheEntry *LRU_FIRST = NULL;                  /* GLOBAL_X */
+static CompressCacheEntry *LRU_LAST = NULL;                   /* GLOBAL_X */
+static ServerCompressCacheStats STATS = { 0 };                /* GLOBAL_X */
+
+static void EntrySetStat(CompressCacheEntry *e, const struct stat *sb)
+{
+    e->ino = (uint64_t) sb->st_ino;
+    e->size = (int64_t) sb->st_size;
+    e->mtime = (int64_t) sb->st_mtime;
+    e->ctime = (int64_t) sb->st_ctime;
+}
+
+static bool EntryMatches(const CompressCacheEntry *e, const struct stat *sb)
+{
+    return e->ino   == (uint64_t) sb->st_ino  &&
+           e->size  == (int64_t) sb->st_size  &&
+           e->mtime == (int64_t) sb->st_mtime &&
+           e->ctime == (int64_t) sb->st_ctime;
+}
+
+/* Call with CACHE_LOCK held. */
+static void EntryUnref(CompressCacheEntry *e)
+{
+    assert(e->refcount > 0);
+    e->refcount--;
+    if (e->refcount == 0)
+    {
+        assert(e->path == NULL);
+        free(e->data);
+        free(e);
+    }
+}
+
+static void LRUUnlink(CompressCacheEntry *e)
+{
+    if (e->prev != NULL)
+    {
+        e->prev->next = e->next;
+    }
+    else
+    {
+        LRU_FIRST = e->next;
+    }
+    if (e->next != NULL)
+    {
+        e->next->prev = e->prev;
+    }
+    else
+    {
+        LRU_LAST = e->prev;
+    }
+    e->prev = NULL;
+    e->next = NULL;
+}
+
+static void LRUPushFront(CompressCacheEntry *e)
+{
+    e->prev = NULL;
+    e->next = LRU_FIRST;
+    if (LRU_FIRST != NULL)
+    {
+        LRU_FIRST->prev = e;
+    }
+    LRU_FIRST = e;
+    if (LRU_LAST == NULL)
+    {
+        LRU_LAST = e;
+    }
+}
+
+/* Call with CACHE_LOCK held. */
+static void CacheDrop(CompressCacheEntry *e)
+{
+    assert(e->path != NULL);
+    LRUUnlink(e);
+    MapRemove(CACHE, e->path);
+    free(e->path);
+    e->path = NULL;
+    STATS.bytes -= e->len;
+    EntryUnref(e);
+}
+
+/* Call with CACHE_LOCK held. */
+static void EvictDownTo(size_t max_bytes)
+{
+    while (LRU_LAST != NULL && STATS.bytes > max_bytes)
+    {
+        CacheDrop(LRU_LAST);
+        STATS.evictions++;
+    }
+}
+
+/* Call with CACHE_LOCK held. */
+static void DropAll(void)
+{
+    while (LRU_FIRST != NULL)
+    {
+        CacheDrop(LRU_FIRST);
+    }
+}
+
+void ServerCompressCacheConfigure(size_t max_bytes)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+
+    if (max_bytes == 0)
+    {
+        if (CACHE != NULL)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Disabling compressed file cache");
+            DropAll();
+            MapDestroy(CACHE);
+            CACHE = NULL;
+        }
+        STATS = (ServerCompressCacheStats) { 0 };
+        pthread_mutex_unlock(&CACHE_LOCK);
+        return;
+    }
+
+    if (CACHE == NULL)
+    {
+        CACHE = MapNew(StringHash_untyped, StringEqual_untyped, NULL, NULL);
+    }
+    if (max_bytes != STATS.max_bytes)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Setting compressed file cache size to %zu bytes",
+            max_bytes);
+        EvictDownTo(max_bytes);
+        STATS.max_bytes = max_bytes;
+    }
+
+    pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+CompressCacheEntry *ServerCompressCacheGet(const char *filename, int fd,
+                                           const struct stat *sb)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+    if (CACHE == NULL || (uintmax_t) sb->st_size > STATS.max_bytes)
+    {
+        pthread_mutex_unlock(&CACHE_LOCK);
+        return NULL;
+    }
+
+    CompressCacheEntry *e = MapGet(CACHE, filename);
+    if (e != NULL && EntryMatches(e, sb))
+    {
+        LRUUnlink(e);
+        LRUPushFront(e);
+        e->refcount++;
+        STATS.hits++;
+        pthread_mutex_unlock(&CACHE_LOCK);
+        return e;
+    }
+    STATS.misses++;
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    /* Compress without holding the lock, concurrent misses on the same file
+     * just compress it more than once. */
+    const time_t compressed_at = time(NULL);
+    unsigned char *data;
+    size_t len;
+    if (!CompressFileToBuffer(fd, sb->st_size, &data, &len))
+    {
+        lseek(fd, 0, SEEK_SET);
+        return NULL;
+    }
+
+    e = xcalloc(1, sizeof(*e));
+    EntrySetStat(e, sb);
+    e->data = data;
+    e->len = len;
+    e->refcount = 1;                                        /* the caller's */
+
+    /* As in the digest cache, don't keep files that were modified within
+     * the second we read them in, or changed while we did. */
+    struct stat sb_after;
+    if (sb->st_mtime >= compressed_at || sb->st_ctime >= compressed_at ||
+        fstat(fd, &sb_after) == -1 || !EntryMatches(e, &sb_after))
+    {
+        return e;
+    }
+
+    pthread_mutex_lock(&CACHE_LOCK);
+    if (CACHE != NULL &&
+        len <= STATS.max_bytes / COMPRESS_CACHE_MAX_ENTRY_SHARE)
+    {
+        CompressCacheEntry *old = MapGet(CACHE, filename);
+        if (old != NULL)
+        {
+            CacheDrop(old);
+        }
+        EvictDownTo(STATS.max_bytes - len);
+
+        e->path = xstrdup(filename);
+        MapInsert(CACHE, e->path, e);
+        LRUPushFront(e);
+        e->refcount++;
+        STATS.bytes += len;
+    }
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    return e;
+}
+
+const unsigned char *CompressCacheEntryData(const CompressCacheEntry *entry,
+                                            size_t *len)
+{
+    *len = entry->len;
+    return entry->data;
+}
+
+void ServerCompressCacheRelease(CompressCacheEntry *entry)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+    EntryUnref(entry);
+    pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+void ServerCompressCacheClear(void)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+    if (CACHE != NULL)
+    {
+        DropAll();
+    }
+    pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+bool ServerCompressCacheGetStats(ServerCompressCacheStats *stats)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+    bool enabled = (CACHE != NULL);
+    if (enabled)
+    {
+        *stats = STATS;
+        stats->entries = MapSize(CACHE);
+    }
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    return enabled;
+}
+
+void ServerCompressCacheLogStats(LogLevel level)
+{
+    ServerCompressCacheStats stats;
+    if (!ServerCompressCacheGetStats(&stats))
+    {
+        return;
+    }
+
+    Log(level,
+        "Compressed file cache: %zu entries, %zu/%zu bytes, %ju hits, "
+        "%ju misses, %ju evictions",
+        stats.entries, stats.bytes, stats.max_bytes,
+        (uintmax_t) stats.hits, (uintmax_t) stats.misses,
+        (uintmax_t) stats.evictions);
+}
@@ -0,0 +1,88 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_SERVER_COMPRESS_CACHE_H
+#define CFENGINE_SERVER_COMPRESS_CACHE_H
+
+
+#include <platform.h>
+#include <logging.h>                                          /* LogLevel */
+
+
+/**
+ * Process-wide cache of the zlib compressed contents of files served with
+ * GETZ, so that a hot file is compressed once instead of once per client.
+ * Like the digest cache, an entry is only reused while the file's inode,
+ * size, mtime and ctime are unchanged. The least recently used entries are
+ * evicted to stay within the configured number of bytes.
+ *
+ * Entries are reference counted, an entry evicted while a worker is still
+ * sending it is freed when released. All functions are thread-safe.
+ */
+
+typedef struct CompressCacheEntry_ CompressCacheEntry;
+
+typedef struct
+{
+    size_t entries;                        /* entries currently in memory */
+    size_t bytes;                          /* compressed bytes in memory */
+    size_t max_bytes;                      /* capacity, 0 if disabled */
+    uint64_t hits;                         /* served from memory */
+    uint64_t misses;                       /* file had to be compressed */
+    uint64_t evictions;                    /* dropped to stay within capacity */
+} ServerCompressCacheStats;
+
+/**
+ * (Re)configure the cache, evicting entries if it shrinks.
+ *
+ * @param max_bytes maximum number of compressed bytes kept in memory, 0
+ *                  disables the cache altogether
+ */
+void ServerCompressCacheConfigure(size_t max_bytes);
+
+/**
+ * Get the compressed contents of #filename, open at #fd with stat #sb,
+ * compressing it if they are not cached yet.
+ *
+ * @return NULL if the cache is disabled, the file is too large to be cached
+ *         or it could not be compressed, in which case the caller should
+ *         compress it on the fly from the start of #fd. Otherwise an entry
+ *         to release with ServerCompressCacheRelease().
+ */
+CompressCacheEntry *ServerCompressCacheGet(const char *filename, int fd,
+                                           const struct stat *sb);
+const unsigned char *CompressCacheEntryData(const CompressCacheEntry *entry,
+                                            size_t *len);
+void ServerCompressCacheRelease(CompressCacheEntry *entry);
+
+/**
+ * Drop all entries, those still being sent are freed once released.
+ */
+void ServerCompressCacheClear(void);
+
+bool ServerCompressCacheGetStats(ServerCompressCacheStats *stats);
+void ServerCompressCacheLogStats(LogLevel level);
+
+#endif
@@ -0,0 +1,409 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <server_digest_cache.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <hash.h>                                             /* HashFile */
+#include <map.h>
+#include <dbm_api.h>
+
+#define DIGEST_CACHE_SUBDB "cf-serverd"
+
+/* Stored as-is in the database, so only use fixed-size types. */
+typedef struct
+{
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    int64_t ctime;
+    int32_t type;                                           /* HashMethod */
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+} FileDigestRecord;
+
+typedef struct DigestCacheEntry_ DigestCacheEntry;
+struct DigestCacheEntry_
+{
+    char *path;                                  /* also the key in the map */
+    FileDigestRecord record;
+
+    /* Least recently used list, most recent first. */
+    DigestCacheEntry *prev;
+    DigestCacheEntry *next;
+};
+
+static pthread_mutex_t CACHE_LOCK = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+/* All protected by CACHE_LOCK. */
+static Map *CACHE = NULL;                                     /* GLOBAL_X */
+static DigestCacheEntry *LRU_FIRST = NULL;                    /* GLOBAL_X */
+static DigestCacheEntry *LRU_LAST = NULL;                     /* GLOBAL_X */
+/* Only keeps the database open between requests, see DigestDBRead(). */
+static DBHandle *CACHE_DB = NULL;                             /* GLOBAL_X */
+static ServerDigestCacheStats STATS = { 0 };                  /* GLOBAL_X */
+
+static void DigestCacheEntryDestroy(void *entry)
+{
+    DigestCacheEntry *e = entry;
+    free(e->path);
+    free(e);
+}
+
+static void RecordFromStat(FileDigestRecord *record, const struct stat *sb,
+                           HashMethod type)
+{
+    memset(record, 0, sizeof(*record));
+    record->ino = (uint64_t) sb->st_ino;
+    record->size = (int64_t) sb->st_size;
+    record->mtime = (int64_t) sb->st_mtime;
+    record->ctime = (int64_t) sb->st_ctime;
+    record->type = (int32_t) type;
+}
+
+static bool RecordMatches(const FileDigestRecord *cached,
+                          const FileDigestRecord *current)
+{
+    return cached->ino   == current->ino   &&
+           cached->size  == current->size  &&
+           cached->mtime == current->mtime &&
+           cached->ctime == current->ctime &&
+           cached->type  == current->type;
+}
+
+static void LRUUnlink(DigestCacheEntry *e)
+{
+    if (e->prev != NULL)
+    {
+        e->prev->next = e->next;
+    }
+    else
+    {
+        LRU_FIRST = e->next;
+    }
+    if (e->next != NULL)
+    {
+        e->next->prev = e->prev;
+    }
+    else
+    {
+        LRU_LAST = e->prev;
+    }
+    e->prev = NULL;
+    e->next = NULL;
+}
+
+static void LRUPushFront(DigestCacheEntry *e)
+{
+    e->prev = NULL;
+    e->next = LRU_FIRST;
+    if (LRU_FIRST != NULL)
+    {
+        LRU_FIRST->prev = e;
+    }
+    LRU_FIRST = e;
+    if (LRU_LAST == NULL)
+    {
+        LRU_LAST = e;
+    }
+}
+
+/* Call with CACHE_LOCK held. */
+static void EvictDownTo(size_t max_entries)
+{
+    while (CACHE != NULL && MapSize(CACHE) > max_entries)
+    {
+        DigestCacheEntry *victim = LRU_LAST;
+        assert(victim != NULL);
+        LRUUnlink(victim);
+        MapRemove(CACHE, victim->path);           /* frees victim */
+        STATS.evictions++;
+    }
+}
+
+/* Call with CACHE_LOCK held. */
+static void CacheStore(const char *path, const FileDigestRecord *record)
+{
+    DigestCacheEntry *e = MapGet(CACHE, path);
+    if (e != NULL)
+    {
+        LRUUnlink(e);
+    }
+    else
+    {
+        EvictDownTo(STATS.max_entries - 1);
+
+        e = xcalloc(1, sizeof(*e));
+        e->path = xstrdup(path);
+        MapInsert(CACHE, e->path, e);
+    }
+    e->record = *record;
+    LRUPushFront(e);
+}
+
+/* Call with CACHE_LOCK held. */
+static void CloseCacheDB(void)
+{
+    if (CACHE_DB != NULL)
+    {
+        CloseDB(CACHE_DB);
+        CACHE_DB = NULL;
+    }
+    STATS.persistent = false;
+}
+
+/* LMDB transactions belong to the thread that started them and are only
+ * committed on CloseDB(), so every access opens its own handle and commits
+ * right away. Otherwise a worker thread would keep its write transaction open
+ * for good, blocking every other writer, or lose its writes when it exits.
+ * Called without CACHE_LOCK, as the writer may have to wait for another
+ * process' transaction. */
+static bool DigestDBRead(const char *path, FileDigestRecord *record)
+{
+    DBHandle *db;
+    if (!OpenSubDB(&db, dbid_checksums, DIGEST_CACHE_SUBDB))
+    {
+        return false;
+    }
+    bool found = ReadDB(db, path, record, sizeof(*record));
+    CloseDB(db);
+    return found;
+}
+
+static void DigestDBWrite(const char *path, const FileDigestRecord *record)
+{
+    DBHandle *db;
+    if (OpenSubDB(&db, dbid_checksums, DIGEST_CACHE_SUBDB))
+    {
+        WriteDB(db, path, record, sizeof(*record));
+        CloseDB(db);
+    }
+}
+
+void ServerDigestCacheConfigure(size_t max_entries, bool persistent)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+
+    if (max_entries == 0)
+    {
+        if (CACHE != NULL)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Disabling digest cache");
+            LRU_FIRST = NULL;
+            LRU_LAST = NULL;
+            MapDestroy(CACHE);
+            CACHE = NULL;
+        }
+        CloseCacheDB();
+        STATS = (ServerDigestCacheStats) { 0 };
+        pthread_mutex_unlock(&CACHE_LOCK);
+        return;
+    }
+
+    if (CACHE == NULL)
+    {
+        CACHE = MapNew(StringHash_untyped, StringEqual_untyped,
+                       NULL, DigestCacheEntryDestroy);
+    }
+    if (max_entries != STATS.max_entries)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Setting digest cache size to %zu entries",
+            max_entries);
+        EvictDownTo(max_entries);
+        STATS.max_entries = max_entries;
+    }
+
+    if (persistent && CACHE_DB == NULL)
+    {
+        if (OpenSubDB(&CACHE_DB, dbid_checksums, DIGEST_CACHE_SUBDB))
+        {
+            STATS.persistent = true;
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Unable to open digest cache database, "
+                "caching digests in memory only");
+            CACHE_DB = NULL;
+        }
+    }
+    else if (!persistent)
+    {
+        CloseCacheDB();
+    }
+
+    pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+void ServerDigestCacheHashFile(const char *filename,
+                               unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                               HashMethod type)
+{
+    struct stat sb;
+    pthread_mutex_lock(&CACHE_LOCK);
+    bool enabled = (CACHE != NULL);
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    if (!enabled || stat(filename, &sb) == -1 || !S_ISREG(sb.st_mode))
+    {
+        HashFile(filename, digest, type, false);
+        return;
+    }
+
+    FileDigestRecord current;
+    RecordFromStat(&current, &sb, type);
+
+    pthread_mutex_lock(&CACHE_LOCK);
+    bool persistent = false;
+    if (CACHE != NULL)
+    {
+        DigestCacheEntry *e = MapGet(CACHE, filename);
+        if (e != NULL && RecordMatches(&e->record, &current))
+        {
+            memcpy(digest, e->record.digest, sizeof(e->record.digest));
+            LRUUnlink(e);
+            LRUPushFront(e);
+            STATS.hits++;
+            pthread_mutex_unlock(&CACHE_LOCK);
+            return;
+        }
+        persistent = STATS.persistent;
+    }
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    FileDigestRecord stored;
+    if (persistent &&
+        DigestDBRead(filename, &stored) &&
+        RecordMatches(&stored, &current))
+    {
+        memcpy(digest, stored.digest, sizeof(stored.digest));
+        pthread_mutex_lock(&CACHE_LOCK);
+        if (CACHE != NULL)
+        {
+            CacheStore(filename, &stored);
+            STATS.db_hits++;
+        }
+        pthread_mutex_unlock(&CACHE_LOCK);
+        return;
+    }
+
+    pthread_mutex_lock(&CACHE_LOCK);
+    if (CACHE != NULL)
+    {
+        STATS.misses++;
+    }
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    /* Hash without holding the lock, concurrent misses on the same file
+     * just hash it more than once. */
+    const time_t hashed_at = time(NULL);
+    memset(digest, 0, EVP_MAX_MD_SIZE + 1);
+    HashFile(filename, digest, type, false);
+
+    /* Timestamps only have a resolution of one second, so a file modified
+     * within the second we hashed it in could change again without its
+     * stat changing: don't cache it until it has settled. */
+    if (sb.st_mtime >= hashed_at || sb.st_ctime >= hashed_at)
+    {
+        return;
+    }
+
+    /* HashFile() leaves the digest alone if it can't read the file. */
+    static const unsigned char no_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+    if (memcmp(digest, no_digest, sizeof(no_digest)) == 0)
+    {
+        return;
+    }
+
+    struct stat sb_after;
+    if (stat(filename, &sb_after) == -1)
+    {
+        return;
+    }
+    FileDigestRecord after;
+    RecordFromStat(&after, &sb_after, type);
+    if (!RecordMatches(&current, &after))
+    {
+        return;                          /* changed while we were hashing */
+    }
+    memcpy(current.digest, digest, sizeof(current.digest));
+
+    pthread_mutex_lock(&CACHE_LOCK);
+    persistent = false;
+    if (CACHE != NULL)
+    {
+        CacheStore(filename, &current);
+        persistent = STATS.persistent;
+    }
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    if (persistent)
+    {
+        DigestDBWrite(filename, &current);
+    }
+}
+
+void ServerDigestCacheClear(void)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+    LRU_FIRST = NULL;
+    LRU_LAST = NULL;
+    if (CACHE != NULL)
+    {
+        MapClear(CACHE);
+    }
+    CloseCacheDB();
+    pthread_mutex_unlock(&CACHE_LOCK);
+}
+
+bool ServerDigestCacheGetStats(ServerDigestCacheStats *stats)
+{
+    pthread_mutex_lock(&CACHE_LOCK);
+    bool enabled = (CACHE != NULL);
+    if (enabled)
+    {
+        *stats = STATS;
+        stats->entries = MapSize(CACHE);
+    }
+    pthread_mutex_unlock(&CACHE_LOCK);
+
+    return enabled;
+}
+
+void ServerDigestCacheLogStats(LogLevel level)
+{
+    ServerDigestCacheStats stats;
+    if (!ServerDigestCacheGetStats(&stats))
+    {
+        return;
+    }
+
+    Log(level,
+        "Digest cache: %zu/%zu entries%s, %ju hits, %ju database hits, "
+        "%ju misses, %ju evictions",
+        stats.entries, stats.max_entries,
+        stats.persistent ? " (persistent)" : "",
+        (uintmax_t) stats.hits, (uintmax_t) stats.db_hits,
+        (uintmax_t) stats.misses, (uintmax_t) stats.evictions);
+}
@@ -0,0 +1,82 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_SERVER_DIGEST_CACHE_H
+#define CFENGINE_SERVER_DIGEST_CACHE_H
+
+
+#include <platform.h>
+#include <logging.h>                                          /* LogLevel */
+#include <hash_method.h>                                    /* HashMethod */
+#include <openssl/evp.h>                               /* EVP_MAX_MD_SIZE */
+
+
+/**
+ * Process-wide cache of file digests served to clients asking whether their
+ * copy of a file differs from ours. An entry is only reused while the file's
+ * inode, size, mtime and ctime are unchanged, so unchanged files are hashed
+ * once instead of once per request.
+ *
+ * All functions are thread-safe.
+ */
+
+typedef struct
+{
+    size_t entries;                        /* entries currently in memory */
+    size_t max_entries;                    /* capacity, 0 if disabled */
+    bool persistent;                       /* backed by an LMDB sub-database */
+    uint64_t hits;                         /* served from memory */
+    uint64_t db_hits;                      /* served from the database */
+    uint64_t misses;                       /* file had to be hashed */
+    uint64_t evictions;                    /* dropped to stay within capacity */
+} ServerDigestCacheStats;
+
+/**
+ * (Re)configure the cache, evicting entries if it shrinks.
+ *
+ * @param max_entries maximum number of digests kept in memory, 0 disables
+ *                    the cache altogether
+ * @param persistent also store digests in the "cf-serverd" sub-database of
+ *                   checksum_digests, so they survive a restart
+ */
+void ServerDigestCacheConfigure(size_t max_entries, bool persistent);
+
+/**
+ * Same as HashFile(), but reuse the digest computed earlier for #filename if
+ * the file hasn't changed since.
+ */
+void ServerDigestCacheHashFile(const char *filename,
+                               unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                               HashMethod type);
+
+/**
+ * Drop all entries and close the database, if open.
+ */
+void ServerDigestCacheClear(void);
+
+bool ServerDigestCacheGetStats(ServerDigestCacheStats *stats);
+void ServerDigestCacheLogStats(LogLevel level);
+
+#endif
@@ -41,6 +41,8 @@
 #include <regex.h>                                       /* StringMatchFull */
 #include <known_dirs.h>
 #include <file_lib.h>                                           /* IsDirReal */
+#include <file_delta.h>                                 /* DeltaTLSRead */
+#include <file_compress.h>                           /* CompressAvailable */
 
 #include "server_access.h"          /* access_CheckResource, acl_CheckExact */
 
@@ -730,8 +732,12 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
         int ret = sscanf(recvbuffer, "GET %d %[^\n]",
                          &(get_args.buf_size), filename);
 
+        const bool large_blocks = ProtocolSupportsLargeBlocks(
+            ConnectionInfoProtocolVersion(conn->conn_info));
+        const int max_buf_size = large_blocks ? CF_GET_MAX_BLOCKSIZE : CF_BUFSIZE;
+
         if (ret != 2 ||
-            get_args.buf_size <= 0 || get_args.buf_size > CF_BUFSIZE)
+            get_args.buf_size <= 0 || get_args.buf_size > max_buf_size)
         {
             goto protocol_error;
         }
@@ -775,7 +781,7 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
 
         memset(sendbuffer, 0, sizeof(sendbuffer));
 
-        if (get_args.buf_size >= CF_BUFSIZE)
+        if (!large_blocks && get_args.buf_size >= CF_BUFSIZE)
         {
             get_args.buf_size = 2048;
         }
@@ -839,6 +845,312 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
         CfOpenDirectory(conn, sendbuffer, filename);
         return true;
     }
+    case PROTOCOL_COMMAND_STATDIR:
+    {
+        if (!ProtocolSupportsStatDir(ConnectionInfoProtocolVersion(conn->conn_info)))
+        {
+            goto protocol_error;
+        }
+
+        long time_no_see = 0;
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "STATDIR %ld %[^\n]",
+                         &time_no_see, filename);
+        if (ret != 2 || filename[0] == '\0')
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Received:", "STATDIR", filename);
+
+        /* sizeof()-1 because we need one extra byte for
+           appending '/' afterwards. */
+        size_t zret = ShortcutsExpand(filename, sizeof(filename) - 1,
+                                      SERVER_ACCESS.path_shortcuts,
+                                      conn->ipaddr, conn->revdns,
+                                      KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename) - 1);
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* STATDIR *must* be directory. */
+        PathAppendTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Translated to:", "STATDIR", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to STATDIR: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* Still list the directory if the clocks are off, the client then
+         * gets the error from the STAT requests it falls back to. */
+        const char *no_stat_reason = NULL;
+        time_t tloc = time(NULL);
+        int drift = (int) (tloc - (time_t) time_no_see);
+        if (tloc == -1 ||
+            (DENYBADCLOCKS && (drift * drift > CLOCK_DRIFT * CLOCK_DRIFT)))
+        {
+            no_stat_reason = "clocks too far unsynchronized";
+        }
+
+        CfStatDirectory(conn, sendbuffer, filename, no_stat_reason);
+        return true;
+    }
+    case PROTOCOL_COMMAND_MANIFEST:
+    {
+        if (!ProtocolSupportsManifest(ConnectionInfoProtocolVersion(conn->conn_info)))
+        {
+            goto protocol_error;
+        }
+
+        long time_no_see = 0;
+        int max_depth = 0;
+        char what[16] = "";
+        size_t num_exclude = 0, num_include = 0;
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "MANIFEST %ld %d %15s %zu %zu %[^\n]",
+                         &time_no_see, &max_depth, what,
+                         &num_exclude, &num_include, filename);
+        if (ret != 6 || filename[0] == '\0' || max_depth < 1 ||
+            (strcmp(what, "digests") != 0 && strcmp(what, "stats") != 0) ||
+            num_exclude > CF_MANIFEST_MAX_PATTERNS ||
+            num_include > CF_MANIFEST_MAX_PATTERNS - num_exclude)
+        {
+            goto protocol_error;
+        }
+
+        /* Read the exclude_dirs and include_dirs patterns that follow
+         * before replying anything. */
+        ManifestFilter filter = {
+            .client_root = xstrdup(filename),
+            .exclude_dirs = SeqNew(8, free),
+            .include_dirs = SeqNew(8, free),
+        };
+        bool received = true;
+        for (size_t i = 0; received && i < num_exclude + num_include; i++)
+        {
+            char pattern[CF_BUFSIZE];
+            received = (ReceiveTransaction(conn->conn_info, pattern, NULL) > 0);
+            if (received)
+            {
+                SeqAppend((i < num_exclude) ? filter.exclude_dirs : filter.include_dirs,
+                          xstrdup(pattern));
+            }
+        }
+        if (!received)
+        {
+            ManifestFilterDestroy(&filter);
+            return false;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Received:", "MANIFEST", filename);
+
+        time_t tloc = time(NULL);
+        int drift = (int) (tloc - (time_t) time_no_see);
+        if (tloc == -1 ||
+            (DENYBADCLOCKS && (drift * drift > CLOCK_DRIFT * CLOCK_DRIFT)))
+        {
+            ManifestFilterDestroy(&filter);
+            SendTransaction(conn->conn_info, "BAD: clocks out of synch", 0, CF_DONE);
+            return true;
+        }
+
+        /* sizeof()-1 because we need one extra byte for
+           appending '/' afterwards. */
+        size_t zret = ShortcutsExpand(filename, sizeof(filename) - 1,
+                                      SERVER_ACCESS.path_shortcuts,
+                                      conn->ipaddr, conn->revdns,
+                                      KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            ManifestFilterDestroy(&filter);
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename) - 1);
+        if (zret == (size_t) -1)
+        {
+            ManifestFilterDestroy(&filter);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* MANIFEST *must* be directory. */
+        PathAppendTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Translated to:", "MANIFEST", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to MANIFEST: %s", filename);
+            ManifestFilterDestroy(&filter);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* Every entry below still goes through its own access check. */
+        CfManifest(conn, sendbuffer, filename, max_depth,
+                   strcmp(what, "digests") == 0, &filter);
+        ManifestFilterDestroy(&filter);
+        return true;
+    }
+    case PROTOCOL_COMMAND_DELTA:
+    {
+        if (!ProtocolSupportsDelta(ConnectionInfoProtocolVersion(conn->conn_info)))
+        {
+            goto protocol_error;
+        }
+
+        long block_size = 0;
+        long num_blocks = 0;
+        intmax_t basis_size = 0;
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "DELTA %ld %ld %jd %[^\n]",
+                         &block_size, &num_blocks, &basis_size, filename);
+        if (ret != 4 || filename[0] == '\0' ||
+            block_size < DELTA_MIN_BLOCKSIZE ||
+            block_size > DELTA_MAX_BLOCKSIZE ||
+            num_blocks < 0 || num_blocks > DELTA_MAX_BLOCKS ||
+            basis_size < 0 ||
+            (size_t) num_blocks != DeltaNumBlocks(basis_size, block_size))
+        {
+            goto protocol_error;
+        }
+
+        /* The signatures follow the request, read them before anything
+         * else so that the session stays in sync even if we refuse. */
+        const size_t signatures_size = num_blocks * DELTA_SIGNATURE_SIZE;
+        unsigned char *signatures = xmalloc(signatures_size + 1);
+        if (signatures_size > 0 &&
+            !DeltaTLSRead(ConnectionInfoSSL(conn->conn_info),
+                          signatures, signatures_size))
+        {
+            free(signatures);
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Received:", "DELTA", filename);
+
+        size_t zret = ShortcutsExpand(filename, sizeof(filename),
+                                      SERVER_ACCESS.path_shortcuts,
+                                      conn->ipaddr, conn->revdns,
+                                      KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            free(signatures);
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename));
+        if (zret == (size_t) -1)
+        {
+            free(signatures);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        PathRemoveTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Translated to:", "DELTA", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to DELTA: %s", filename);
+            free(signatures);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        CfDeltaFile(conn, filename, signatures, num_blocks,
+                    block_size, basis_size);
+        free(signatures);
+        return true;
+    }
+    case PROTOCOL_COMMAND_GETZ:
+    {
+        if (!ProtocolSupportsCompress(ConnectionInfoProtocolVersion(conn->conn_info)))
+        {
+            goto protocol_error;
+        }
+
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "GETZ %[^\n]", filename);
+        if (ret != 1 || filename[0] == '\0')
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Received:", "GETZ", filename);
+
+        /* Built without zlib, the client falls back to GET. */
+        if (!CompressAvailable())
+        {
+            SendTransaction(conn->conn_info, COMPRESS_UNSUPPORTED_REPLY,
+                            0, CF_DONE);
+            return true;
+        }
+
+        size_t zret = ShortcutsExpand(filename, sizeof(filename),
+                                      SERVER_ACCESS.path_shortcuts,
+                                      conn->ipaddr, conn->revdns,
+                                      KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename));
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        PathRemoveTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %7s %s",
+            "Translated to:", "GETZ", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to GETZ: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        CfGetFileCompressed(conn, filename);
+        return true;
+    }
     case PROTOCOL_COMMAND_SYNCH:
     {
         long time_no_see = 0;
@@ -46,6 +46,10 @@ typedef enum
     PROTOCOL_COMMAND_QUERY,
     PROTOCOL_COMMAND_CALL_ME_BACK,
     PROTOCOL_COMMAND_COOKIE,
+    PROTOCOL_COMMAND_STATDIR,
+    PROTOCOL_COMMAND_MANIFEST,
+    PROTOCOL_COMMAND_DELTA,
+    PROTOCOL_COMMAND_GETZ,
     PROTOCOL_COMMAND_BAD
 } ProtocolCommandNew;
 
@@ -62,6 +66,10 @@ static const char *const PROTOCOL_NEW[PROTOCOL_COMMAND_BAD + 1] =
     "QUERY",
     "SCALLBACK",
     "COOKIE",
+    "STATDIR",
+    "MANIFEST",
+    "DELTA",
+    "GETZ",
     NULL
 };
 
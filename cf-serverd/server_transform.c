@@ -319,6 +319,11 @@ static bool ValueHasUnresolvedVars(const void *value, DataType value_type)
 static void KeepControlPromises(EvalContext *ctx, const Policy *policy, GenericAgentConfig *config, bool *unresolved_vars)
 {
     CFD_MAXPROCESSES = 30;
+    SERVER_WORKER_POOL_SIZE = 0;
+    SERVER_DIGEST_CACHE_SIZE = SERVER_DIGEST_CACHE_DEFAULT_SIZE;
+    SERVER_DIGEST_CACHE_PERSISTENT = false;
+    SERVER_COMPRESS_CACHE_SIZE = SERVER_COMPRESS_CACHE_DEFAULT_SIZE;
+    SERVER_LASTSEEN_COMMIT_INTERVAL = 0;
     MAXTRIES = 5;
     DENYBADCLOCKS = true;
     CFRUNCOMMAND[0] = '\0';
@@ -407,6 +412,39 @@ static void KeepControlPromises(EvalContext *ctx, const Policy *policy, GenericA
                 /* Set RLIMIT_NOFILE to be enough for all threads. */
                 SetMaxOpenFiles(CFD_MAXPROCESSES * 5 + 10);
             }
+            else if (IsControlBody(SERVER_CONTROL_WORKER_POOL_SIZE))
+            {
+                SERVER_WORKER_POOL_SIZE = (int) IntFromString(value);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting worker_pool_size to %d", SERVER_WORKER_POOL_SIZE);
+            }
+            else if (IsControlBody(SERVER_CONTROL_DIGEST_CACHE_SIZE))
+            {
+                SERVER_DIGEST_CACHE_SIZE = (int) IntFromString(value);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting digest_cache_size to %d", SERVER_DIGEST_CACHE_SIZE);
+            }
+            else if (IsControlBody(SERVER_CONTROL_DIGEST_CACHE_PERSISTENT))
+            {
+                SERVER_DIGEST_CACHE_PERSISTENT = BooleanFromString(value);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting digest_cache_persistent to '%s'",
+                    SERVER_DIGEST_CACHE_PERSISTENT ? "true" : "false");
+            }
+            else if (IsControlBody(SERVER_CONTROL_COMPRESS_CACHE_SIZE))
+            {
+                SERVER_COMPRESS_CACHE_SIZE = (int) IntFromString(value);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting compress_cache_size to %d MB",
+                    SERVER_COMPRESS_CACHE_SIZE);
+            }
+            else if (IsControlBody(SERVER_CONTROL_LASTSEEN_COMMIT_INTERVAL))
+            {
+                SERVER_LASTSEEN_COMMIT_INTERVAL = (int) IntFromString(value);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting lastseen_commit_interval to %d ms",
+                    SERVER_LASTSEEN_COMMIT_INTERVAL);
+            }
             else if (IsControlBody(SERVER_CONTROL_CALL_COLLECT_INTERVAL))
             {
                 COLLECT_INTERVAL = (int) 60 * IntFromString(value);
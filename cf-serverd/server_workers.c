@@ -0,0 +1,300 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <server_workers.h>
+
+#include <alloc.h>
+#include <logging.h>
+
+#ifdef CLOCK_MONOTONIC
+# define WORKER_CLOCK CLOCK_MONOTONIC
+#else
+# define WORKER_CLOCK CLOCK_REALTIME
+#endif
+
+/* Same as the stack size we used to give every per-connection thread. */
+#define WORKER_STACK_SIZE (1024 * 1024)
+
+typedef struct
+{
+    void *job;
+    struct timespec enqueued;
+} QueuedJob;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* Ring buffer of queued jobs. */
+    QueuedJob *queue;
+    size_t queue_max;
+    size_t head;
+    size_t count;
+
+    ServerWorkerJobFn handler;
+    ServerWorkerJobFn discard;
+    bool stopping;
+
+    /* Last worker to exit a stopped pool frees it. */
+    size_t threads;
+
+    ServerWorkerPoolStats stats;
+} ServerWorkerPool;
+
+/* Only ever replaced from the main thread, workers hold their own pointer. */
+static ServerWorkerPool *POOL = NULL; /* GLOBAL_X */
+
+static uint64_t ElapsedMs(const struct timespec *since)
+{
+    struct timespec now;
+    if (clock_gettime(WORKER_CLOCK, &now) == -1)
+    {
+        return 0;
+    }
+    int64_t ms = (now.tv_sec - since->tv_sec) * 1000
+        + (now.tv_nsec - since->tv_nsec) / 1000000;
+    return (ms > 0) ? (uint64_t) ms : 0;
+}
+
+static void PoolDestroy(ServerWorkerPool *pool)
+{
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->queue);
+    free(pool);
+}
+
+static void *WorkerLoop(void *arg)
+{
+    ServerWorkerPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (pool->count == 0 && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->stopping)
+        {
+            break;
+        }
+
+        QueuedJob item = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->queue_max;
+        pool->count--;
+        pool->stats.busy++;
+        pool->stats.dispatched++;
+        pool->stats.total_wait_ms += ElapsedMs(&item.enqueued);
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->handler(item.job);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.busy--;
+    }
+
+    assert(pool->threads > 0);
+    pool->threads--;
+    bool last = (pool->threads == 0);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (last)
+    {
+        PoolDestroy(pool);
+    }
+    return NULL;
+}
+
+bool ServerWorkerPoolStart(size_t num_workers, size_t queue_max,
+                           ServerWorkerJobFn handler,
+                           ServerWorkerJobFn discard)
+{
+    assert(POOL == NULL);
+    assert(num_workers > 0);
+    assert(handler != NULL);
+
+    ServerWorkerPool *pool = xcalloc(1, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->queue_max = MAX(queue_max, 1);
+    pool->queue = xcalloc(pool->queue_max, sizeof(*pool->queue));
+    pool->handler = handler;
+    pool->discard = discard;
+    pool->stats.queue_max = pool->queue_max;
+
+    pthread_attr_t attrs;
+    pthread_attr_init(&attrs);
+    pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_attr_setstacksize(&attrs, WORKER_STACK_SIZE);
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Unable to set worker thread stack size (%s)", GetErrorStr());
+        /* Continue with default thread stack size. */
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < num_workers; i++)
+    {
+        pthread_t tid;
+        ret = pthread_create(&tid, &attrs, WorkerLoop, pool);
+        if (ret != 0)
+        {
+            errno = ret;
+            Log(LOG_LEVEL_ERR,
+                "Unable to spawn worker thread %zu/%zu (pthread_create: %s)",
+                i + 1, num_workers, GetErrorStr());
+            break;
+        }
+        pool->threads++;
+    }
+    pool->stats.workers = pool->threads;
+    size_t spawned = pool->threads;
+    pthread_mutex_unlock(&pool->lock);
+    pthread_attr_destroy(&attrs);
+
+    if (spawned == 0)
+    {
+        PoolDestroy(pool);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Started connection worker pool with %zu threads and queue of %zu",
+        spawned, pool->queue_max);
+    POOL = pool;
+    return true;
+}
+
+bool ServerWorkerPoolIsRunning(void)
+{
+    return (POOL != NULL);
+}
+
+bool ServerWorkerPoolSubmit(void *job)
+{
+    ServerWorkerPool *pool = POOL;
+    if (pool == NULL)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count >= pool->queue_max)
+    {
+        pool->stats.rejected++;
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+
+    QueuedJob *item = &pool->queue[(pool->head + pool->count) % pool->queue_max];
+    item->job = job;
+    if (clock_gettime(WORKER_CLOCK, &item->enqueued) == -1)
+    {
+        item->enqueued = (struct timespec) { 0 };
+    }
+    pool->count++;
+    pool->stats.queue_high_watermark = MAX(pool->stats.queue_high_watermark,
+                                           pool->count);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+void ServerWorkerPoolStop(void)
+{
+    ServerWorkerPool *pool = POOL;
+    if (pool == NULL)
+    {
+        return;
+    }
+    POOL = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+
+    size_t discarded = pool->count;
+    while (pool->count > 0)
+    {
+        void *job = pool->queue[pool->head].job;
+        pool->head = (pool->head + 1) % pool->queue_max;
+        pool->count--;
+        if (pool->discard != NULL)
+        {
+            pool->discard(job);
+        }
+    }
+
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    /* From now on the pool may be freed by its last worker at any time. */
+
+    if (discarded > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Discarded %zu queued connections while stopping worker pool",
+            discarded);
+    }
+}
+
+bool ServerWorkerPoolGetStats(ServerWorkerPoolStats *stats)
+{
+    assert(stats != NULL);
+
+    ServerWorkerPool *pool = POOL;
+    if (pool == NULL)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    stats->queued = pool->count;
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+void ServerWorkerPoolLogStats(LogLevel level)
+{
+    ServerWorkerPoolStats stats;
+    if (!ServerWorkerPoolGetStats(&stats))
+    {
+        return;
+    }
+
+    uint64_t avg_wait_ms = (stats.dispatched > 0) ?
+        stats.total_wait_ms / stats.dispatched : 0;
+
+    Log(level,
+        "Worker pool: %zu/%zu workers busy, queue depth %zu/%zu "
+        "(high watermark %zu), %ju connections dispatched, %ju rejected, "
+        "average queue wait %jums",
+        stats.busy, stats.workers, stats.queued, stats.queue_max,
+        stats.queue_high_watermark, (uintmax_t) stats.dispatched,
+        (uintmax_t) stats.rejected, (uintmax_t) avg_wait_ms);
+}
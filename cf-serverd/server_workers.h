@@ -0,0 +1,83 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_SERVER_WORKERS_H
+#define CFENGINE_SERVER_WORKERS_H
+
+
+#include <platform.h>
+#include <logging.h>                                          /* LogLevel */
+
+
+/**
+ * A fixed set of pre-spawned threads that pick accepted connections off a
+ * bounded queue, instead of spawning one thread per connection.
+ *
+ * The pool is a process-wide singleton, only to be started, resized and
+ * stopped from the main (accepting) thread.
+ */
+
+typedef void (*ServerWorkerJobFn)(void *job);
+
+typedef struct
+{
+    size_t workers;                        /* threads currently in the pool */
+    size_t busy;                           /* threads currently handling a job */
+    size_t queued;                         /* current queue depth */
+    size_t queue_max;                      /* queue capacity */
+    size_t queue_high_watermark;           /* deepest the queue has been */
+    uint64_t dispatched;                   /* jobs handed to a worker */
+    uint64_t rejected;                     /* jobs dropped because queue full */
+    uint64_t total_wait_ms;                /* sum of queue wait of dispatched jobs */
+} ServerWorkerPoolStats;
+
+/**
+ * @param num_workers number of threads to spawn, must be > 0
+ * @param queue_max maximum number of jobs waiting for a free worker
+ * @param handler called from a worker thread for every submitted job
+ * @param discard called for jobs still queued when the pool is stopped
+ */
+bool ServerWorkerPoolStart(size_t num_workers, size_t queue_max,
+                           ServerWorkerJobFn handler,
+                           ServerWorkerJobFn discard);
+bool ServerWorkerPoolIsRunning(void);
+
+/**
+ * @return false if the pool is not running or its queue is full, in which
+ *         case the caller still owns #job.
+ */
+bool ServerWorkerPoolSubmit(void *job);
+
+/**
+ * Stop accepting jobs, discard the queued ones and let the workers exit as
+ * soon as they finish their current job. Does not wait for busy workers,
+ * see ACTIVE_THREADS for that.
+ */
+void ServerWorkerPoolStop(void);
+
+bool ServerWorkerPoolGetStats(ServerWorkerPoolStats *stats);
+void ServerWorkerPoolLogStats(LogLevel level);
+
+#endif
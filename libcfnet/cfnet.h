@@ -51,13 +51,23 @@ extern int CFENGINE_PORT;                              /* GLOBAL_P GLOBAL_E */
 #define CF_INBAND_OFFSET 8
 #define CF_MSGSIZE (CF_BUFSIZE - CF_INBAND_OFFSET)
 
+/* Block sizes of file transfers (GET) with CF_PROTOCOL_LARGEBLOCKS: what the
+ * agent asks for, and the most the server accepts. Older protocols use
+ * 2048 byte blocks. */
+#define CF_GET_LARGE_BLOCKSIZE (64 * 1024)
+#define CF_GET_MAX_BLOCKSIZE   (256 * 1024)
+
+/* Most exclude_dirs and include_dirs patterns a MANIFEST request carries. */
+#define CF_MANIFEST_MAX_PATTERNS 128
+
 typedef struct
 {
-    ProtocolVersion protocol_version : 3;
+    ProtocolVersion protocol_version : 4;
     bool            cache_connection : 1;
     bool            force_ipv4       : 1;
     bool            trust_server     : 1;
     bool            off_the_record   : 1;
+    bool            compress         : 1;   /* ask for GETZ if supported */
 } ConnectionFlags;
 
 static inline bool ConnectionFlagsEqual(const ConnectionFlags *f1,
@@ -67,7 +77,8 @@ static inline bool ConnectionFlagsEqual(const ConnectionFlags *f1,
         f1->cache_connection == f2->cache_connection &&
         f1->force_ipv4 == f2->force_ipv4 &&
         f1->trust_server == f2->trust_server &&
-        f1->off_the_record == f2->off_the_record)
+        f1->off_the_record == f2->off_the_record &&
+        f1->compress == f2->compress)
     {
         return true;
     }
@@ -91,7 +102,7 @@ static inline bool ConnectionFlagsEqual(const ConnectionFlags *f1,
     x.tv_usec = DEFAULT_TLS_TIMEOUT_USECONDS
 #define DEFAULT_TLS_TRIES 5
 
-struct Stat_;              /* defined in stat_cache.h, typedef'ed to "Stat" */
+struct StatCache_;    /* defined in stat_cache.c, typedef'ed to "StatCache" */
 
 typedef struct
 {
@@ -104,13 +115,16 @@ typedef struct
     unsigned char *session_key;
     char encryption_type;
     short error;
-    struct Stat_ *cache;                          /* cache for remote STATs */
+    struct StatCache_ *cache;                     /* cache for remote STATs */
 
     /* The following consistutes the ID of a server host, mostly taken from
      * the copy_from connection attributes. */
     ConnectionFlags flags;
     char *this_server;
     char *this_port;
+
+    /* Server answered GETZ with BAD, use GET from now on. */
+    bool compress_refused;
 } AgentConnection;
 
 
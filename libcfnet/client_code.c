@@ -46,6 +46,10 @@
 #include <misc_lib.h>                                   /* ProgrammingError */
 #include <printsize.h>                                         /* PRINTSIZE */
 #include <lastseen.h>                                            /* LastSaw */
+#include <stat_cache.h>                                /* StatCachePrefetch */
+#include <sequence.h>                                  /* Seq */
+#include <file_delta.h>                                /* DeltaApply */
+#include <file_compress.h>                       /* CompressReceive */
 
 
 #define CFENGINE_SERVICE "cfengine"
@@ -341,6 +345,146 @@ void DisconnectServer(AgentConnection *conn)
 
 /*********************************************************************/
 
+/**
+ * RemoteDirList() using STATDIR: every name comes with the replies STAT would
+ * give for it, which go to the stat cache.
+ */
+static Item *RemoteDirListStat(const char *dirname, AgentConnection *conn)
+{
+    char sendbuffer[CF_BUFSIZE];
+    char recvbuffer[CF_BUFSIZE];
+
+    time_t tloc = time(NULL);
+    if (tloc == (time_t) -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't read system clock (time: %s)",
+            GetErrorStr());
+        tloc = 0;
+    }
+
+    int len = snprintf(sendbuffer, CF_BUFSIZE, "STATDIR %jd %s",
+                       (intmax_t) tloc, dirname);
+    if (len < 0 || len >= CF_BUFSIZE)
+    {
+        Log(LOG_LEVEL_ERR, "Directory name too long");
+        return NULL;
+    }
+    if (SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE) == -1)
+    {
+        return NULL;
+    }
+
+    Item *start = NULL, *end = NULL;                  /* NULL is empty list */
+    while (true)
+    {
+        int nbytes = ReceiveTransaction(conn->conn_info, recvbuffer, NULL);
+
+        /* If recv error or socket closed before receiving CFD_TERMINATOR. */
+        if (nbytes == -1)
+        {
+            goto err;
+        }
+
+        if (recvbuffer[0] == '\0')
+        {
+            Log(LOG_LEVEL_ERR,
+                "Empty%s server packet when listing directory '%s'!",
+                (start == NULL) ? " first" : "",
+                dirname);
+            goto err;
+        }
+
+        if (FailedProtoReply(recvbuffer))
+        {
+            Log(LOG_LEVEL_INFO, "Network access to '%s:%s' denied", conn->this_server, dirname);
+            goto err;
+        }
+
+        if (BadProtoReply(recvbuffer))
+        {
+            Log(LOG_LEVEL_INFO, "%s", recvbuffer + strlen("BAD: "));
+            goto err;
+        }
+
+        /* Entries are name, STAT reply and link reply, double '\0' means
+         * end of packet. */
+        const char *const packet_end = recvbuffer + nbytes;
+        for (char *sp = recvbuffer; sp < packet_end && *sp != '\0'; )
+        {
+            if (strcmp(sp, CFD_TERMINATOR) == 0)      /* end of all packets */
+            {
+                return start;
+            }
+
+            const char *name = sp;
+            const char *stat_reply = name + strlen(name) + 1;
+            const char *link_reply = stat_reply + strlen(stat_reply) + 1;
+            if (link_reply >= packet_end || *stat_reply == '\0' ||
+                *link_reply == '\0')
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Truncated STATDIR entry when listing directory '%s'",
+                    dirname);
+                goto err;
+            }
+            sp = (char *) link_reply + strlen(link_reply) + 1;
+
+            char path[CF_BUFSIZE];
+            if (StatCacheJoinPath(path, sizeof(path), dirname, name))
+            {
+                StatCachePrefetch(conn, path, stat_reply, link_reply, NULL);
+            }
+
+            Item *ip = xcalloc(1, sizeof(Item));
+            ip->name = (char *) AllocateDirentForFilename(name);
+
+            if (start == NULL)  /* First element */
+            {
+                start = ip;
+                end = ip;
+            }
+            else
+            {
+                end->next = ip;
+                end = ip;
+            }
+        }
+    }
+
+  err:                                                         /* free list */
+    for (Item *ip = start; ip != NULL; ip = start)
+    {
+        start = ip->next;
+        free(ip->name);
+        free(ip);
+    }
+
+    return NULL;
+}
+
+static Item *ItemListFromNames(const Seq *names)
+{
+    Item *start = NULL, *end = NULL;
+    const size_t length = SeqLength(names);
+    for (size_t i = 0; i < length; i++)
+    {
+        Item *ip = xcalloc(1, sizeof(Item));
+        ip->name = (char *) AllocateDirentForFilename(SeqAt(names, i));
+
+        if (start == NULL)  /* First element */
+        {
+            start = ip;
+            end = ip;
+        }
+        else
+        {
+            end->next = ip;
+            end = ip;
+        }
+    }
+    return start;
+}
+
 /* Returning NULL (an empty list) does not mean empty directory but ERROR,
  * since every directory has to contain at least . and .. */
 Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
@@ -361,6 +505,17 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
      * encrypted layer, so it does not support encrypted (S*) commands. */
     encrypt = encrypt && conn->conn_info->protocol == CF_PROTOCOL_CLASSIC;
 
+    const Seq *listing = StatCacheLookupListing(conn, dirname);
+    if (listing != NULL)
+    {
+        return ItemListFromNames(listing);
+    }
+
+    if (ProtocolSupportsStatDir(conn->conn_info->protocol))
+    {
+        return RemoteDirListStat(dirname, conn);
+    }
+
     if (encrypt)
     {
         if (conn->session_key == NULL)
@@ -478,6 +633,237 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
 
 /*********************************************************************/
 
+/* The #i-th pattern sent along a MANIFEST request, exclusions first. */
+static const char *ManifestPattern(const Seq *exclude_dirs,
+                                   const Seq *include_dirs, size_t i)
+{
+    const size_t num_exclude = (exclude_dirs != NULL) ? SeqLength(exclude_dirs) : 0;
+    return (i < num_exclude) ?
+        SeqAt(exclude_dirs, i) : SeqAt(include_dirs, i - num_exclude);
+}
+
+/**
+ * Ask the server for the MANIFEST of #dirname: the listing of it and of its
+ * subdirectories down to #max_depth levels, the STAT replies of all entries
+ * and, if #want_digests, the digests of all regular files. Everything goes
+ * to the stat cache of #conn, so that copying the tree afterwards needs no
+ * OPENDIR, STAT or MD5 round trips, only GETs. The caller drops it with
+ * StatCacheForgetManifest() once done with the tree.
+ *
+ * The server doesn't descend into the subdirectories the copy skips, those
+ * whose path or name fully matches one of #exclude_dirs, or none of
+ * #include_dirs if not empty. Both are regexes, and may be NULL.
+ *
+ * Only directories the server listed completely are cached, RemoteDirList()
+ * asks the server again for any other.
+ *
+ * @return false if the server didn't send a manifest, which is no error.
+ */
+bool RemoteManifest(AgentConnection *conn, const char *dirname,
+                    int max_depth, bool want_digests,
+                    const Seq *exclude_dirs, const Seq *include_dirs)
+{
+    assert(conn != NULL);
+    assert(dirname != NULL);
+
+    if (!ProtocolSupportsManifest(conn->conn_info->protocol) || max_depth < 1)
+    {
+        return false;
+    }
+
+    const size_t num_exclude = (exclude_dirs != NULL) ? SeqLength(exclude_dirs) : 0;
+    const size_t num_include = (include_dirs != NULL) ? SeqLength(include_dirs) : 0;
+    if (num_exclude + num_include > CF_MANIFEST_MAX_PATTERNS)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Too many exclude_dirs and include_dirs to ask for a manifest of '%s'",
+            dirname);
+        return false;
+    }
+    for (size_t i = 0; i < num_exclude + num_include; i++)
+    {
+        const char *pattern = ManifestPattern(exclude_dirs, include_dirs, i);
+        if (pattern[0] == '\0' || strlen(pattern) >= CF_BUFSIZE)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Directory pattern '%.64s' can't be sent in a manifest request",
+                pattern);
+            return false;
+        }
+    }
+
+    char sendbuffer[CF_BUFSIZE];
+    char recvbuffer[CF_BUFSIZE];
+
+    time_t tloc = time(NULL);
+    if (tloc == (time_t) -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't read system clock (time: %s)",
+            GetErrorStr());
+        tloc = 0;
+    }
+
+    int len = snprintf(sendbuffer, CF_BUFSIZE, "MANIFEST %jd %d %s %zu %zu %s",
+                       (intmax_t) tloc, max_depth,
+                       want_digests ? "digests" : "stats",
+                       num_exclude, num_include, dirname);
+    if (len < 0 || len >= CF_BUFSIZE)
+    {
+        Log(LOG_LEVEL_ERR, "Directory name too long");
+        return false;
+    }
+    if (SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE) == -1)
+    {
+        return false;
+    }
+
+    /* The patterns follow, one per transaction. */
+    for (size_t i = 0; i < num_exclude + num_include; i++)
+    {
+        const char *pattern = ManifestPattern(exclude_dirs, include_dirs, i);
+        strlcpy(sendbuffer, pattern, CF_BUFSIZE);
+        if (SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE) == -1)
+        {
+            return false;
+        }
+    }
+
+    /* Subdirectories are keyed the way SourceSearchAndCopy() names them. */
+    const char *dir_sep = (dirname[0] != '\0' &&
+                           dirname[strlen(dirname) - 1] == '/') ? "" : "/";
+
+    char dirkey[CF_BUFSIZE] = "";
+    Seq *names = NULL;                 /* listing of dirkey, until its "Z" */
+    size_t num_dirs = 0;
+    bool ok = false;
+    bool garbled = false;              /* rest of the reply can't be read */
+    while (true)
+    {
+        int nbytes = ReceiveTransaction(conn->conn_info, recvbuffer, NULL);
+
+        /* If recv error or socket closed before receiving CFD_TERMINATOR. */
+        if (nbytes == -1)
+        {
+            break;
+        }
+
+        if (recvbuffer[0] == '\0')
+        {
+            Log(LOG_LEVEL_ERR, "Empty server packet in manifest of '%s'",
+                dirname);
+            garbled = true;
+            break;
+        }
+
+        if (FailedProtoReply(recvbuffer) || BadProtoReply(recvbuffer))
+        {
+            Log(LOG_LEVEL_VERBOSE, "No manifest of '%s:%s', server said: %s",
+                conn->this_server, dirname, recvbuffer);
+            break;
+        }
+
+        /* Records are a tag and its fields, see CfManifest() in
+         * cf-serverd. Double '\0' means end of packet. */
+        const char *const packet_end = recvbuffer + nbytes;
+        const char *fields[5];
+        size_t num_fields = 0;
+        char *sp = recvbuffer;
+        while (sp < packet_end && *sp != '\0')
+        {
+            if (strcmp(sp, CFD_TERMINATOR) == 0)      /* end of all packets */
+            {
+                ok = true;
+                goto done;
+            }
+
+            size_t expected;
+            switch (sp[0])
+            {
+            case 'D':
+                expected = 2;
+                break;
+            case 'E':
+                expected = 5;
+                break;
+            case 'Z':
+                expected = 1;
+                break;
+            default:
+                Log(LOG_LEVEL_ERR, "Unknown record in manifest of '%s'",
+                    dirname);
+                garbled = true;
+                goto done;
+            }
+
+            for (num_fields = 0; num_fields < expected; num_fields++)
+            {
+                if (sp >= packet_end || *sp == '\0')
+                {
+                    Log(LOG_LEVEL_ERR, "Truncated record in manifest of '%s'",
+                        dirname);
+                    garbled = true;
+                    goto done;
+                }
+                fields[num_fields] = sp;
+                sp += strlen(sp) + 1;
+            }
+
+            if (fields[0][0] == 'D')
+            {
+                const char *reldir = fields[1];
+                int ret = (strcmp(reldir, ".") == 0) ?
+                    snprintf(dirkey, sizeof(dirkey), "%s", dirname) :
+                    snprintf(dirkey, sizeof(dirkey), "%s%s%s",
+                             dirname, dir_sep, reldir);
+                if (ret < 0 || (size_t) ret >= sizeof(dirkey))
+                {
+                    dirkey[0] = '\0';    /* ignore this directory's entries */
+                }
+
+                /* Previous directory wasn't complete, don't cache it. */
+                SeqDestroy(names);
+                names = (dirkey[0] != '\0') ? SeqNew(32, free) : NULL;
+            }
+            else if (fields[0][0] == 'E' && names != NULL)
+            {
+                const char *name = fields[1];
+                SeqAppend(names, xstrdup(name));
+
+                char path[CF_BUFSIZE];
+                if (StatCacheJoinPath(path, sizeof(path), dirkey, name))
+                {
+                    const char *digest = fields[4];
+                    StatCachePrefetch(conn, path, fields[2], fields[3],
+                                      (strcmp(digest, "-") == 0) ? NULL : digest);
+                }
+            }
+            else if (fields[0][0] == 'Z' && names != NULL)
+            {
+                StatCacheStoreListing(conn, dirkey, names);
+                names = NULL;
+                num_dirs++;
+            }
+        }
+    }
+
+  done:
+    SeqDestroy(names);
+
+    if (ok)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Received manifest of %zu directories in '%s:%s'",
+            num_dirs, conn->this_server, dirname);
+    }
+    if (garbled)
+    {
+        /* Don't read the rest of the reply as replies to what follows. */
+        conn->conn_info->status = CONNECTIONINFO_STATUS_BROKEN;
+    }
+    return ok;
+}
+
+/*********************************************************************/
+
 bool CompareHashNet(const char *file1, const char *file2, bool encrypt, AgentConnection *conn)
 {
     unsigned char d[EVP_MAX_MD_SIZE + 1];
@@ -488,6 +874,24 @@ bool CompareHashNet(const char *file1, const char *file2, bool encrypt, AgentCon
 
     HashFile(file2, d, CF_DEFAULT_DIGEST, false);
 
+    /* Digest of the remote file received in a MANIFEST, if any. */
+    const Stat *cached = StatCacheLookup(conn, file1, conn->this_server);
+    if (cached != NULL && cached->cf_digest != NULL)
+    {
+        char local_digest[CF_HOSTKEY_STRING_SIZE];
+        HashPrintSafe(local_digest, sizeof(local_digest), d,
+                      CF_DEFAULT_DIGEST, true);
+
+        /* Only comparable if both are "<same method>=..." */
+        const char *method_end = strchr(local_digest, '=');
+        if (method_end != NULL &&
+            strncmp(cached->cf_digest, local_digest,
+                    method_end - local_digest + 1) == 0)
+        {
+            return (strcmp(cached->cf_digest, local_digest) != 0);
+        }
+    }
+
     memset(recvbuffer, 0, CF_BUFSIZE);
 
     /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
@@ -749,13 +1153,104 @@ static void FlushFileStream(int sd, int toget)
     }
 }
 
+typedef enum
+{
+    COMPRESSED_COPY_OK,
+    COMPRESSED_COPY_FAILED,
+    COMPRESSED_COPY_UNSUPPORTED,          /* server can't compress, use GET */
+} CompressedCopyResult;
+
+static CompressedCopyResult CopyRegularFileNetCompressed(const char *source,
+                                                         const char *dest,
+                                                         AgentConnection *conn)
+{
+    char workbuf[CF_BUFSIZE];
+    int tosend = snprintf(workbuf, CF_BUFSIZE, "GETZ %s", source);
+    if (tosend <= 0 || tosend >= CF_BUFSIZE)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to compose GETZ command for file %s",
+            source);
+        return COMPRESSED_COPY_FAILED;
+    }
+
+    unlink(dest);                /* To avoid link attacks */
+
+    int dd = safe_open_create_perms(dest, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL | O_BINARY, CF_PERMS_DEFAULT);
+    if (dd == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Copy from server '%s' to destination '%s' failed (open: %s)",
+            conn->this_server, dest, GetErrorStr());
+        unlink(dest);
+        return COMPRESSED_COPY_FAILED;
+    }
+
+    char recvbuffer[CF_BUFSIZE] = "";
+    if (SendTransaction(conn->conn_info, workbuf, tosend, CF_DONE) == -1 ||
+        ReceiveTransaction(conn->conn_info, recvbuffer, NULL) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't send GETZ command");
+        conn->conn_info->status = CONNECTIONINFO_STATUS_BROKEN;
+        close(dd);
+        unlink(dest);
+        return COMPRESSED_COPY_FAILED;
+    }
+
+    intmax_t remote_size = 0;
+    if (strcmp(recvbuffer, COMPRESS_UNSUPPORTED_REPLY) == 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Server '%s' can't compress file transfers, using GET",
+            conn->this_server);
+        close(dd);
+        unlink(dest);
+        return COMPRESSED_COPY_UNSUPPORTED;
+    }
+    if (sscanf(recvbuffer, "OK %jd", &remote_size) != 1 || remote_size < 0)
+    {
+        Log(LOG_LEVEL_INFO, "Network access to '%s:%s' denied",
+            conn->this_server, source);
+        close(dd);
+        unlink(dest);
+        return COMPRESSED_COPY_FAILED;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Copying remote file '%s:%s' compressed, expecting %jd bytes",
+        conn->this_server, source, remote_size);
+
+    uint64_t wire_bytes = 0;
+    CompressResult result = CompressReceive(DeltaTLSRead, conn->conn_info->ssl,
+                                            dd, remote_size, &wire_bytes);
+    if (result == COMPRESS_RESULT_STREAM_ERROR)
+    {
+        Log(LOG_LEVEL_ERR, "Error in client-server stream copying '%s:%s'",
+            conn->this_server, source);
+        conn->conn_info->status = CONNECTIONINFO_STATUS_BROKEN;
+    }
+
+    const bool closed = (close(dd) == 0);
+    if (result != COMPRESS_RESULT_OK || !closed)
+    {
+        unlink(dest);
+        return COMPRESSED_COPY_FAILED;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Received '%s:%s' as %ju compressed bytes",
+        conn->this_server, source, (uintmax_t) wire_bytes);
+    return COMPRESSED_COPY_OK;
+}
+
 /* TODO finalise socket or TLS session in all cases that this function fails
  * and the transaction protocol is out of sync. */
 bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
                         bool encrypt, AgentConnection *conn)
 {
     char *buf, workbuf[CF_BUFSIZE], cfchangedstr[265];
-    const int buf_size = 2048;
+
+    /* With large blocks the server only sends CF_CHANGEDSTR at block
+     * boundaries, and we never receive across one. */
+    const bool large_blocks = ProtocolSupportsLargeBlocks(conn->conn_info->protocol);
+    const int buf_size = large_blocks ? CF_GET_LARGE_BLOCKSIZE : 2048;
 
     /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
      * encrypted layer, so it does not support encrypted (S*) commands. */
@@ -766,6 +1261,19 @@ bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
         return EncryptCopyRegularFileNet(source, dest, size, conn);
     }
 
+    if (conn->flags.compress && !conn->compress_refused &&
+        ProtocolSupportsCompress(conn->conn_info->protocol) &&
+        CompressAvailable())
+    {
+        CompressedCopyResult result =
+            CopyRegularFileNetCompressed(source, dest, conn);
+        if (result != COMPRESSED_COPY_UNSUPPORTED)
+        {
+            return (result == COMPRESSED_COPY_OK);
+        }
+        conn->compress_refused = true;
+    }
+
     snprintf(cfchangedstr, 255, "%s%s", CF_CHANGEDSTR1, CF_CHANGEDSTR2);
 
     if ((strlen(dest) > CF_BUFSIZE - 20))
@@ -805,7 +1313,8 @@ bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
         return false;
     }
 
-    buf = xmalloc(CF_BUFSIZE + sizeof(int));    /* Note CF_BUFSIZE not buf_size !! */
+    /* Note CF_BUFSIZE not buf_size !! */
+    buf = xmalloc(MAX(CF_BUFSIZE, buf_size) + sizeof(int));
 
     Log(LOG_LEVEL_VERBOSE, "Copying remote file '%s:%s', expecting %jd bytes",
           conn->this_server, source, (intmax_t)size);
@@ -814,7 +1323,9 @@ bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
     bool last_write_made_hole = false;
     while (n_wrote_total < size)
     {
-        int toget = MIN(size - n_wrote_total, buf_size);
+        /* Offset inside the server's current block */
+        const int block_offset = large_blocks ? (n_wrote_total % buf_size) : 0;
+        int toget = MIN(size - n_wrote_total, buf_size - block_offset);
 
         assert(toget > 0);
 
@@ -827,6 +1338,14 @@ bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
         {
             n_read = RecvSocketStream(conn->conn_info->sd, buf, toget);
         }
+        else if (large_blocks)
+        {
+            n_read = TLSRecvBlock(conn->conn_info->ssl, buf, toget);
+            if (n_read > 0)
+            {
+                buf[n_read] = '\0';
+            }
+        }
         else if (ProtocolIsTLS(version))
         {
             n_read = TLSRecv(conn->conn_info->ssl, buf, toget);
@@ -866,7 +1385,8 @@ bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
             return false;
         }
 
-        if (strncmp(buf, cfchangedstr, strlen(cfchangedstr)) == 0)
+        if (block_offset == 0
+            && strncmp(buf, cfchangedstr, strlen(cfchangedstr)) == 0)
         {
             Log(LOG_LEVEL_INFO, "Source '%s:%s' changed while copying",
                 conn->this_server, source);
@@ -922,3 +1442,136 @@ bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
     free(buf);
     return true;
 }
+
+/**
+ * Rebuild #dest from #basis, our outdated copy of the remote #source, by
+ * asking the server only for the data that is not in #basis already.
+ *
+ * @return false if the delta transfer was refused or failed, the caller can
+ *         still fall back to CopyRegularFileNet().
+ */
+bool CopyRegularFileNetDelta(const char *source, const char *basis,
+                             const char *dest, off_t size,
+                             AgentConnection *conn)
+{
+
+    if (!ProtocolSupportsDelta(conn->conn_info->protocol))
+    {
+        return false;
+    }
+
+    int bd = safe_open(basis, O_RDONLY | O_BINARY);
+    if (bd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Can't open '%s' as delta basis (open: %s)",
+            basis, GetErrorStr());
+        return false;
+    }
+
+    struct stat sb;
+    size_t block_size = 0;
+    if (fstat(bd, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+        (block_size = DeltaBlockSize(sb.st_size)) == 0)
+    {
+        close(bd);
+        return false;
+    }
+
+    const size_t num_blocks = DeltaNumBlocks(sb.st_size, block_size);
+    unsigned char *signatures = DeltaSignatures(bd, block_size, num_blocks);
+    if (signatures == NULL)
+    {
+        close(bd);
+        return false;
+    }
+
+    char workbuf[CF_BUFSIZE];
+    int tosend = snprintf(workbuf, CF_BUFSIZE, "DELTA %zu %zu %jd %s",
+                          block_size, num_blocks, (intmax_t) sb.st_size,
+                          source);
+    if (tosend <= 0 || tosend >= CF_BUFSIZE)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to compose DELTA command for file %s",
+            source);
+        free(signatures);
+        close(bd);
+        return false;
+    }
+
+    /* Open the destination before asking, once the server starts streaming
+     * we have to consume everything it sends. */
+    unlink(dest);                /* To avoid link attacks */
+    int dd = safe_open_create_perms(dest, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL | O_BINARY, CF_PERMS_DEFAULT);
+    if (dd == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Copy from server '%s' to destination '%s' failed (open: %s)",
+            conn->this_server, dest, GetErrorStr());
+        free(signatures);
+        close(bd);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Copying remote file '%s:%s' as a delta against '%s', expecting %jd bytes",
+        conn->this_server, source, basis, (intmax_t) size);
+
+    if (SendTransaction(conn->conn_info, workbuf, tosend, CF_DONE) == -1 ||
+        (num_blocks > 0 &&
+         !DeltaTLSWrite(conn->conn_info->ssl, signatures,
+                        num_blocks * DELTA_SIGNATURE_SIZE)))
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't send DELTA command");
+        conn->conn_info->status = CONNECTIONINFO_STATUS_BROKEN;
+        free(signatures);
+        close(bd);
+        close(dd);
+        unlink(dest);
+        return false;
+    }
+    free(signatures);
+
+    char recvbuffer[CF_BUFSIZE] = "";
+    if (ReceiveTransaction(conn->conn_info, recvbuffer, NULL) == -1)
+    {
+        conn->conn_info->status = CONNECTIONINFO_STATUS_BROKEN;
+        close(bd);
+        close(dd);
+        unlink(dest);
+        return false;
+    }
+    if (strcmp(recvbuffer, "OK") != 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Server refused delta transfer of '%s:%s' (%s)",
+            conn->this_server, source, recvbuffer);
+        close(bd);
+        close(dd);
+        unlink(dest);
+        return false;
+    }
+
+    DeltaStats stats;
+    DeltaResult result = DeltaApply(DeltaTLSRead, conn->conn_info->ssl,
+                                    bd, sb.st_size, block_size, dd, &stats);
+    close(bd);
+
+    if (result == DELTA_RESULT_STREAM_ERROR)
+    {
+        Log(LOG_LEVEL_ERR, "Error in client-server stream copying '%s:%s'",
+            conn->this_server, source);
+        conn->conn_info->status = CONNECTIONINFO_STATUS_BROKEN;
+    }
+
+    const bool closed = (close(dd) == 0);
+    if (result != DELTA_RESULT_OK || !closed)
+    {
+        unlink(dest);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Copied remote file '%s:%s' by delta: %ju bytes transferred, %ju bytes reused",
+        conn->this_server, source, (uintmax_t) stats.literal_bytes,
+        (uintmax_t) stats.copied_bytes);
+    return true;
+}
@@ -49,7 +49,13 @@ void DisconnectServer(AgentConnection *conn);
 bool CompareHashNet(const char *file1, const char *file2, bool encrypt, AgentConnection *conn);
 bool CopyRegularFileNet(const char *source, const char *dest, off_t size,
                         bool encrypt, AgentConnection *conn);
+bool CopyRegularFileNetDelta(const char *source, const char *basis,
+                             const char *dest, off_t size,
+                             AgentConnection *conn);
 Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn);
+bool RemoteManifest(AgentConnection *conn, const char *dirname,
+                    int max_depth, bool want_digests,
+                    const Seq *exclude_dirs, const Seq *include_dirs);
 
 int TLSConnectCallCollect(ConnectionInfo *conn_info, const char *username);
 
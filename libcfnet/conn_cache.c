@@ -29,19 +29,23 @@
 #include <cfnet.h>                                     /* AgentConnection */
 #include <client_code.h>                               /* DisconnectServer */
 #include <sequence.h>                                  /* Seq */
+#include <map.h>                                       /* Map */
 #include <mutex.h>                                     /* ThreadLock */
 #include <communication.h>                             /* Hostname2IPString */
 #include <misc_lib.h>                                  /* CF_ASSERT */
-#include <string_lib.h>                                /* StringEqual */
+#include <string_lib.h>                                /* StringFormat */
 
 
 /**
    Global cache for connections to servers, currently only used in cf-agent.
 
-   @note THREAD-SAFETY: yes this connection cache *is* thread-safe, but is
-         extremely slow if used intensely from multiple threads. It needs to
-         be redesigned from scratch for that, not a priority for
-         single-threaded cf-agent!
+   Idle connections are kept in one stack per (server, port, flags), and
+   every connection is indexed by its address, so finding an idle connection
+   or giving one back only holds the lock for a lookup and a push or pop. The
+   socket of a connection found idle is checked after the lock is released.
+
+   @note THREAD-SAFETY: yes, and cheap enough for several threads taking
+         connections to the same server, e.g. a parallel copy_from.
 */
 
 
@@ -54,8 +58,59 @@ typedef struct
 
 static pthread_mutex_t cft_conncache = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
 
-static Seq *conn_cache = NULL;
+/* All protected by cft_conncache. */
+static Seq *conn_cache = NULL;                 /* all entries, owns them */
+static Map *conn_cache_by_conn = NULL;         /* AgentConnection * -> entry */
+static Map *conn_cache_idle = NULL;            /* key -> Seq of idle entries */
+
+
+static unsigned int PointerHash(const void *p, unsigned int seed)
+{
+    uintptr_t x = (uintptr_t) p;
+    x ^= x >> 17;
+    x *= 0xed5ad4bbU;
+    x ^= x >> 11;
+    return (unsigned int) x ^ seed;
+}
+
+static bool PointerEqual(const void *p1, const void *p2)
+{
+    return p1 == p2;
+}
+
+static void SeqDestroy_untyped(void *p)
+{
+    SeqDestroy(p);
+}
+
+/* Connections are interchangeable if and only if their keys are equal. */
+static char *ConnCacheKey(const char *server, const char *port,
+                          ConnectionFlags flags)
+{
+    return StringFormat("%s %s %d %d %d %d %d %d", server, port,
+                        (int) flags.protocol_version,
+                        (int) flags.cache_connection, (int) flags.force_ipv4,
+                        (int) flags.trust_server, (int) flags.off_the_record,
+                        (int) flags.compress);
+}
 
+/* Call with cft_conncache held. */
+static void PushIdle(ConnCache_entry *svp)
+{
+    char *key = ConnCacheKey(svp->conn->this_server, svp->conn->this_port,
+                             svp->conn->flags);
+    Seq *idle = MapGet(conn_cache_idle, key);
+    if (idle == NULL)
+    {
+        idle = SeqNew(4, NULL);
+        MapInsert(conn_cache_idle, key, idle);
+    }
+    else
+    {
+        free(key);
+    }
+    SeqAppend(idle, svp);
+}
 
 void ConnCache_Init()
 {
@@ -63,6 +118,9 @@ void ConnCache_Init()
 
     assert(conn_cache == NULL);
     conn_cache = SeqNew(100, free);
+    conn_cache_by_conn = MapNew(PointerHash, PointerEqual, NULL, NULL);
+    conn_cache_idle = MapNew(StringHash_untyped, StringEqual_untyped,
+                             free, SeqDestroy_untyped);
 
     ThreadUnlock(&cft_conncache);
 }
@@ -83,100 +141,94 @@ void ConnCache_Destroy()
         DisconnectServer(svp->conn);
     }
 
+    MapDestroy(conn_cache_idle);
+    conn_cache_idle = NULL;
+    MapDestroy(conn_cache_by_conn);
+    conn_cache_by_conn = NULL;
     SeqDestroy(conn_cache);
     conn_cache = NULL;
 
     ThreadUnlock(&cft_conncache);
 }
 
-static bool ConnCacheEntryMatchesConnection(ConnCache_entry *entry,
-                                            const char *server,
-                                            const char *port,
-                                            ConnectionFlags flags)
+/* Pop an idle connection and mark it busy, or return NULL. */
+static ConnCache_entry *PopIdleMarkBusy(const char *key)
+{
+    ConnCache_entry *svp = NULL;
+
+    ThreadLock(&cft_conncache);
+
+    Seq *idle = MapGet(conn_cache_idle, key);
+    if (idle != NULL && SeqLength(idle) > 0)
+    {
+        /* Most recently used first, it's the least likely to have timed out. */
+        svp = SeqAt(idle, SeqLength(idle) - 1);
+        SeqRemove(idle, SeqLength(idle) - 1);
+
+        CF_ASSERT(svp->status == CONNCACHE_STATUS_IDLE,
+                  "FindIdle: connection in idle list has status %d!",
+                  svp->status);
+        svp->status = CONNCACHE_STATUS_BUSY;
+    }
+
+    ThreadUnlock(&cft_conncache);
+    return svp;
+}
+
+static void MarkBroken(ConnCache_entry *svp)
 {
-    return ConnectionFlagsEqual(&flags, &entry->conn->flags) &&
-           StringEqual(port, entry->conn->this_port)     &&
-           StringEqual(server, entry->conn->this_server);
+    ThreadLock(&cft_conncache);
+    svp->status = CONNCACHE_STATUS_BROKEN;
+    ThreadUnlock(&cft_conncache);
 }
 
 AgentConnection *ConnCache_FindIdleMarkBusy(const char *server,
                                             const char *port,
                                             ConnectionFlags flags)
 {
-    ThreadLock(&cft_conncache);
+    char *key = ConnCacheKey(server, port, flags);
 
     AgentConnection *ret_conn = NULL;
-    for (size_t i = 0; i < SeqLength(conn_cache); i++)
+    ConnCache_entry *svp;
+    while (ret_conn == NULL && (svp = PopIdleMarkBusy(key)) != NULL)
     {
-        ConnCache_entry *svp = SeqAt(conn_cache, i);
-
-        CF_ASSERT(svp != NULL,
-                  "FindIdle: NULL ConnCache_entry!");
-        CF_ASSERT(svp->conn != NULL,
-                  "FindIdle: NULL connection in ConnCache_entry!");
-
-
-        if (svp->status == CONNCACHE_STATUS_BUSY)
-        {
-            Log(LOG_LEVEL_DEBUG,
-                "FindIdle: connection %p seems to be busy.",
-                svp->conn);
-        }
-        else if (svp->status == CONNCACHE_STATUS_OFFLINE)
-        {
-            Log(LOG_LEVEL_DEBUG,
-                "FindIdle: connection %p is marked as offline.",
-                svp->conn);
-        }
-        else if (svp->status == CONNCACHE_STATUS_BROKEN)
-        {
-            Log(LOG_LEVEL_DEBUG,
-                "FindIdle: connection %p is marked as broken.",
-                svp->conn);
-        }
-        else if (ConnCacheEntryMatchesConnection(svp, server, port, flags))
+        /* It's ours now, no need for the lock until we mark it. */
+        if (svp->conn->conn_info->sd >= 0)
         {
-            if (svp->conn->conn_info->sd >= 0)
+            // Check connection state before returning it
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(svp->conn->conn_info->sd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
             {
-                assert(svp->status == CONNCACHE_STATUS_IDLE);
-
-                // Check connection state before returning it
-                int error = 0;
-                socklen_t len = sizeof(error);
-                if (getsockopt(svp->conn->conn_info->sd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
-                {
-                    Log(LOG_LEVEL_DEBUG, "FindIdle: found connection to '%s' but could not get socket status, skipping.",
-                        server);
-                    svp->status = CONNCACHE_STATUS_BROKEN;
-                    continue;
-                }
-                if (error != 0)
-                {
-                    Log(LOG_LEVEL_DEBUG, "FindIdle: found connection to '%s' but connection is broken, skipping.",
-                        server);
-                    svp->status = CONNCACHE_STATUS_BROKEN;
-                    continue;
-                }
-
-                Log(LOG_LEVEL_VERBOSE, "FindIdle:"
-                    " found connection to '%s' already open and ready.",
+                Log(LOG_LEVEL_DEBUG, "FindIdle: found connection to '%s' but could not get socket status, skipping.",
                     server);
-
-                svp->status = CONNCACHE_STATUS_BUSY;
-                ret_conn = svp->conn;
-                break;
+                MarkBroken(svp);
+                continue;
             }
-            else
+            if (error != 0)
             {
-                Log(LOG_LEVEL_VERBOSE, "FindIdle:"
-                    " connection to '%s' has invalid socket descriptor %d!",
-                    server, svp->conn->conn_info->sd);
-                svp->status = CONNCACHE_STATUS_BROKEN;
+                Log(LOG_LEVEL_DEBUG, "FindIdle: found connection to '%s' but connection is broken, skipping.",
+                    server);
+                MarkBroken(svp);
+                continue;
             }
+
+            Log(LOG_LEVEL_VERBOSE, "FindIdle:"
+                " found connection to '%s' already open and ready.",
+                server);
+
+            ret_conn = svp->conn;
+        }
+        else
+        {
+            Log(LOG_LEVEL_VERBOSE, "FindIdle:"
+                " connection to '%s' has invalid socket descriptor %d!",
+                server, svp->conn->conn_info->sd);
+            MarkBroken(svp);
         }
     }
 
-    ThreadUnlock(&cft_conncache);
+    free(key);
 
     if (ret_conn == NULL)
     {
@@ -194,34 +246,23 @@ void ConnCache_MarkNotBusy(AgentConnection *conn)
 
     ThreadLock(&cft_conncache);
 
-    bool found = false;
-    for (size_t i = 0; i < SeqLength(conn_cache); i++)
+    /* There might be many connections to the same server, some busy some
+     * not. But here we're searching by the address of the AgentConnection
+     * object. There can be only one. */
+    ConnCache_entry *svp = MapGet(conn_cache_by_conn, conn);
+    if (svp != NULL)
     {
-        ConnCache_entry *svp = SeqAt(conn_cache, i);
-
-        CF_ASSERT(svp != NULL,
-                  "MarkNotBusy: NULL ConnCache_entry!");
-        CF_ASSERT(svp->conn != NULL,
-                  "MarkNotBusy: NULL connection in ConnCache_entry!");
+        CF_ASSERT(svp->status == CONNCACHE_STATUS_BUSY,
+                  "MarkNotBusy: status is not busy, it is %d!",
+                  svp->status);
 
-        if (svp->conn == conn)
-        {
-            /* There might be many connections to the same server, some busy
-             * some not. But here we're searching by the address of the
-             * AgentConnection object. There can be only one. */
-            CF_ASSERT(svp->status == CONNCACHE_STATUS_BUSY,
-                      "MarkNotBusy: status is not busy, it is %d!",
-                      svp->status);
-
-            svp->status = CONNCACHE_STATUS_IDLE;
-            found = true;
-            break;
-        }
+        svp->status = CONNCACHE_STATUS_IDLE;
+        PushIdle(svp);
     }
 
     ThreadUnlock(&cft_conncache);
 
-    if (!found)
+    if (svp == NULL)
     {
         ProgrammingError("MarkNotBusy: No busy connection found!");
     }
@@ -238,5 +279,10 @@ void ConnCache_Add(AgentConnection *conn, enum ConnCacheStatus status)
 
     ThreadLock(&cft_conncache);
     SeqAppend(conn_cache, svp);
+    MapInsert(conn_cache_by_conn, conn, svp);
+    if (status == CONNCACHE_STATUS_IDLE)
+    {
+        PushIdle(svp);
+    }
     ThreadUnlock(&cft_conncache);
 }
@@ -0,0 +1,407 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <file_compress.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <files_lib.h>                                /* FullRead,FullWrite */
+
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+
+#ifdef HAVE_LIBZ
+
+/* Compression level used for files compressed on the fly: these are not
+ * cached, so favour speed. Cached files get Z_DEFAULT_COMPRESSION. */
+#define COMPRESS_STREAM_LEVEL 1
+
+#define COMPRESS_READ_SIZE (64 * 1024)
+
+static inline void PutU32(unsigned char *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static inline uint32_t GetU32(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8)  |  (uint32_t) p[3];
+}
+
+static bool SendFrame(const unsigned char *data, size_t len,
+                      CompressWriteFn write_fn, void *write_data)
+{
+    unsigned char header[4];
+    PutU32(header, len);
+    return write_fn(write_data, header, sizeof(header)) &&
+           (len == 0 || write_fn(write_data, data, len));
+}
+
+static bool SendEnd(bool changed, CompressWriteFn write_fn, void *write_data)
+{
+    const unsigned char status = changed ? COMPRESS_END_CHANGED : COMPRESS_END_OK;
+    return SendFrame(NULL, 0, write_fn, write_data) &&
+           write_fn(write_data, &status, 1);
+}
+
+/**
+ * Deflate the file open at #fd, calling #output_fn on every full output
+ * buffer and on the last, partial one.
+ *
+ * @return false if #output_fn failed, the file couldn't be read or had
+ *         other than #size bytes; #*read_error tells which.
+ */
+static bool DeflateFile(int fd, off_t size, int level,
+                        bool (*output_fn)(void *, const unsigned char *, size_t),
+                        void *output_data, bool *read_error)
+{
+    z_stream zs = { 0 };
+    if (deflateInit(&zs, level) != Z_OK)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to initialise zlib compression");
+        *read_error = true;
+        return false;
+    }
+
+    unsigned char *in = xmalloc(COMPRESS_READ_SIZE);
+    unsigned char *out = xmalloc(COMPRESS_FRAME_MAX);
+    off_t total = 0;
+    bool ok = true;
+    int flush = Z_NO_FLUSH;
+    *read_error = false;
+
+    zs.next_out = out;
+    zs.avail_out = COMPRESS_FRAME_MAX;
+
+    while (ok)
+    {
+        if (zs.avail_in == 0 && flush == Z_NO_FLUSH)
+        {
+            const ssize_t n = FullRead(fd, (char *) in, COMPRESS_READ_SIZE);
+            if (n < 0)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to read file to compress (read: %s)",
+                    GetErrorStr());
+                *read_error = true;
+                ok = false;
+                break;
+            }
+            total += n;
+            zs.next_in = in;
+            zs.avail_in = n;
+            if (n < COMPRESS_READ_SIZE)
+            {
+                flush = Z_FINISH;
+            }
+        }
+
+        const int ret = deflate(&zs, flush);
+        if (ret == Z_STREAM_ERROR)
+        {
+            *read_error = true;
+            ok = false;
+            break;
+        }
+
+        if (zs.avail_out == 0 || ret == Z_STREAM_END)
+        {
+            ok = output_fn(output_data, out, COMPRESS_FRAME_MAX - zs.avail_out);
+            zs.next_out = out;
+            zs.avail_out = COMPRESS_FRAME_MAX;
+        }
+        if (ret == Z_STREAM_END)
+        {
+            break;
+        }
+    }
+
+    deflateEnd(&zs);
+    free(in);
+    free(out);
+
+    if (ok && total != size)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "File changed size while compressing, %jd instead of %jd bytes",
+            (intmax_t) total, (intmax_t) size);
+        *read_error = true;
+        ok = false;
+    }
+    return ok;
+}
+
+typedef struct
+{
+    unsigned char *data;
+    size_t len;
+} CompressBuffer;
+
+static bool AppendToBuffer(void *data, const unsigned char *buf, size_t len)
+{
+    CompressBuffer *b = data;
+    b->data = xrealloc(b->data, b->len + len + 1);
+    memcpy(b->data + b->len, buf, len);
+    b->len += len;
+    return true;
+}
+
+typedef struct
+{
+    CompressWriteFn write_fn;
+    void *write_data;
+} FrameWriter;
+
+static bool WriteAsFrame(void *data, const unsigned char *buf, size_t len)
+{
+    FrameWriter *w = data;
+    return len == 0 || SendFrame(buf, len, w->write_fn, w->write_data);
+}
+
+bool CompressAvailable(void)
+{
+    return true;
+}
+
+bool CompressFileToBuffer(int fd, off_t size,
+                          unsigned char **out, size_t *out_len)
+{
+    CompressBuffer b = { 0 };
+    bool read_error;
+    if (!DeflateFile(fd, size, Z_DEFAULT_COMPRESSION,
+                     AppendToBuffer, &b, &read_error))
+    {
+        free(b.data);
+        return false;
+    }
+    *out = b.data;
+    *out_len = b.len;
+    return true;
+}
+
+bool CompressSendBuffer(const unsigned char *data, size_t len,
+                        CompressWriteFn write_fn, void *write_data)
+{
+    while (len > 0)
+    {
+        const size_t frame = MIN(len, COMPRESS_FRAME_MAX);
+        if (!SendFrame(data, frame, write_fn, write_data))
+        {
+            return false;
+        }
+        data += frame;
+        len -= frame;
+    }
+    return SendEnd(false, write_fn, write_data);
+}
+
+bool CompressSendFile(int fd, off_t size,
+                      CompressWriteFn write_fn, void *write_data)
+{
+    FrameWriter w = { write_fn, write_data };
+    bool read_error;
+    if (DeflateFile(fd, size, COMPRESS_STREAM_LEVEL,
+                    WriteAsFrame, &w, &read_error))
+    {
+        return SendEnd(false, write_fn, write_data);
+    }
+
+    /* The client is waiting for the end of the stream. */
+    if (read_error)
+    {
+        SendEnd(true, write_fn, write_data);
+    }
+    return false;
+}
+
+CompressResult CompressReceive(CompressReadFn read_fn, void *read_data,
+                               int dest_fd, off_t size,
+                               uint64_t *wire_bytes)
+{
+    z_stream zs = { 0 };
+    if (inflateInit(&zs) != Z_OK)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to initialise zlib decompression");
+        return COMPRESS_RESULT_STREAM_ERROR;
+    }
+
+    unsigned char *in = xmalloc(COMPRESS_FRAME_MAX);
+    unsigned char *out = xmalloc(COMPRESS_READ_SIZE);
+    CompressResult result = COMPRESS_RESULT_STREAM_ERROR;
+    bool local_error = false;                   /* keep reading, stay in sync */
+    bool stream_end = false;
+    off_t total = 0;
+    *wire_bytes = 0;
+
+    while (true)
+    {
+        unsigned char header[4];
+        if (!read_fn(read_data, header, sizeof(header)))
+        {
+            break;
+        }
+        const size_t len = GetU32(header);
+        if (len > COMPRESS_FRAME_MAX)
+        {
+            Log(LOG_LEVEL_ERR, "Invalid frame of %zu bytes in compressed stream",
+                len);
+            break;
+        }
+
+        if (len == 0)
+        {
+            unsigned char status;
+            if (!read_fn(read_data, &status, 1))
+            {
+                break;
+            }
+            *wire_bytes += sizeof(header) + 1;
+            if (status == COMPRESS_END_CHANGED)
+            {
+                Log(LOG_LEVEL_VERBOSE, "Source changed during compressed transfer");
+                local_error = true;
+            }
+            else if (!local_error && (!stream_end || total != size))
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Compressed transfer ended after %jd of %jd bytes",
+                    (intmax_t) total, (intmax_t) size);
+                local_error = true;
+            }
+            result = local_error ? COMPRESS_RESULT_FAILED : COMPRESS_RESULT_OK;
+            break;
+        }
+
+        if (!read_fn(read_data, in, len))
+        {
+            break;
+        }
+        *wire_bytes += len + sizeof(header);
+
+        if (local_error)
+        {
+            continue;
+        }
+        if (stream_end)
+        {
+            Log(LOG_LEVEL_ERR, "Trailing data after compressed stream");
+            local_error = true;
+            continue;
+        }
+
+        zs.next_in = in;
+        zs.avail_in = len;
+        do
+        {
+            zs.next_out = out;
+            zs.avail_out = COMPRESS_READ_SIZE;
+            const int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            {
+                Log(LOG_LEVEL_ERR, "Corrupt compressed stream (%s)",
+                    zs.msg != NULL ? zs.msg : "zlib error");
+                local_error = true;
+                break;
+            }
+
+            const size_t n = COMPRESS_READ_SIZE - zs.avail_out;
+            total += n;
+            if (total > size)
+            {
+                Log(LOG_LEVEL_VERBOSE, "Compressed transfer exceeds %jd bytes",
+                    (intmax_t) size);
+                local_error = true;
+                break;
+            }
+            if (n > 0 && FullWrite(dest_fd, (const char *) out, n) < 0)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to write decompressed data (%s)",
+                    GetErrorStr());
+                local_error = true;
+                break;
+            }
+
+            if (ret == Z_STREAM_END)
+            {
+                stream_end = true;
+                if (zs.avail_in > 0)
+                {
+                    Log(LOG_LEVEL_ERR, "Trailing data after compressed stream");
+                    local_error = true;
+                }
+                break;
+            }
+        } while (zs.avail_out == 0);
+    }
+
+    inflateEnd(&zs);
+    free(in);
+    free(out);
+    return result;
+}
+
+#else /* !HAVE_LIBZ */
+
+bool CompressAvailable(void)
+{
+    return false;
+}
+
+bool CompressFileToBuffer(ARG_UNUSED int fd, ARG_UNUSED off_t size,
+                          ARG_UNUSED unsigned char **out,
+                          ARG_UNUSED size_t *out_len)
+{
+    return false;
+}
+
+bool CompressSendBuffer(ARG_UNUSED const unsigned char *data,
+                        ARG_UNUSED size_t len,
+                        ARG_UNUSED CompressWriteFn write_fn,
+                        ARG_UNUSED void *write_data)
+{
+    return false;
+}
+
+bool CompressSendFile(ARG_UNUSED int fd, ARG_UNUSED off_t size,
+                      ARG_UNUSED CompressWriteFn write_fn,
+                      ARG_UNUSED void *write_data)
+{
+    return false;
+}
+
+CompressResult CompressReceive(ARG_UNUSED CompressReadFn read_fn,
+                               ARG_UNUSED void *read_data,
+                               ARG_UNUSED int dest_fd, ARG_UNUSED off_t size,
+                               ARG_UNUSED uint64_t *wire_bytes)
+{
+    return COMPRESS_RESULT_STREAM_ERROR;
+}
+
+#endif /* !HAVE_LIBZ */
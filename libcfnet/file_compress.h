@@ -0,0 +1,99 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_FILE_COMPRESS_H
+#define CFENGINE_FILE_COMPRESS_H
+
+
+#include <platform.h>
+
+
+/**
+ * zlib compressed file contents for GETZ (CF_PROTOCOL_COMPRESS).
+ *
+ * The compressed stream is sent in frames of a u32 length (network byte
+ * order) and at most COMPRESS_FRAME_MAX bytes of zlib data. A zero length
+ * frame ends the stream and is followed by one status byte: COMPRESS_END_OK,
+ * or COMPRESS_END_CHANGED if the file changed while it was being sent.
+ *
+ * Without zlib, CompressAvailable() is false and all the rest fails.
+ */
+
+#define COMPRESS_FRAME_MAX (64 * 1024)
+
+/* Server's reply to GETZ if it can't compress, the client then uses GET. */
+#define COMPRESS_UNSUPPORTED_REPLY "BAD: compression not supported"
+
+#define COMPRESS_END_OK      'E'
+#define COMPRESS_END_CHANGED 'X'
+
+typedef enum
+{
+    COMPRESS_RESULT_OK,
+    COMPRESS_RESULT_FAILED,     /* whole stream was consumed, but unusable */
+    COMPRESS_RESULT_STREAM_ERROR, /* stream is out of sync, drop connection */
+} CompressResult;
+
+/* Send or receive exactly #len bytes, e.g. DeltaTLSWrite(), DeltaTLSRead(). */
+typedef bool (*CompressWriteFn)(void *data, const void *buf, size_t len);
+typedef bool (*CompressReadFn)(void *data, void *buf, size_t len);
+
+bool CompressAvailable(void);
+
+/**
+ * Compress the #size bytes of the file open at #fd into a malloc'ed
+ * buffer, returned in #out and #out_len.
+ *
+ * @return false if the file couldn't be read or didn't have #size bytes.
+ */
+bool CompressFileToBuffer(int fd, off_t size,
+                          unsigned char **out, size_t *out_len);
+
+/**
+ * Send #len bytes compressed earlier by CompressFileToBuffer().
+ */
+bool CompressSendBuffer(const unsigned char *data, size_t len,
+                        CompressWriteFn write_fn, void *write_data);
+
+/**
+ * Compress and send the #size bytes of the file open at #fd on the fly.
+ *
+ * @return false if writing failed or the file didn't have #size bytes, in
+ *         which case COMPRESS_END_CHANGED was sent if possible.
+ */
+bool CompressSendFile(int fd, off_t size,
+                      CompressWriteFn write_fn, void *write_data);
+
+/**
+ * Receive a compressed stream and write the #size bytes it decompresses
+ * to into #dest_fd.
+ *
+ * @param wire_bytes set to the number of compressed bytes received
+ */
+CompressResult CompressReceive(CompressReadFn read_fn, void *read_data,
+                               int dest_fd, off_t size,
+                               uint64_t *wire_bytes);
+
+#endif
@@ -0,0 +1,678 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <file_delta.h>
+
+#include <openssl/evp.h>
+#include <libcrypto-compat.h>                            /* EVP_MD_CTX_new */
+
+#include <alloc.h>
+#include <logging.h>
+#include <files_lib.h>                                         /* FullWrite */
+#include <tls_generic.h>                              /* TLSSend,TLSRecvBlock */
+
+
+/* Largest chunk handed to TLSSend() at once. */
+#define DELTA_TLS_CHUNK (1024 * 1024)
+
+/* Instructions are buffered so that they go out in full TLS records. */
+#define DELTA_OUT_BUFSIZE (DELTA_MAX_LITERAL + 64)
+
+
+static inline void PutU32(unsigned char *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static inline uint32_t GetU32(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8)  |  (uint32_t) p[3];
+}
+
+static ssize_t ReadFully(int fd, void *buf, size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        ssize_t n = read(fd, (char *) buf + total, len - total);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+bool DeltaTLSWrite(void *ssl, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        const int chunk = MIN(len, DELTA_TLS_CHUNK);
+        if (TLSSend(ssl, p, chunk) != chunk)
+        {
+            return false;
+        }
+        p += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool DeltaTLSRead(void *ssl, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0)
+    {
+        const int n = TLSRecvBlock(ssl, p, MIN(len, DELTA_TLS_CHUNK));
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+size_t DeltaBlockSize(off_t basis_size)
+{
+    /* About the square root of the file size, like rsync: the signatures
+     * and the expected amount of literal data grow at the same pace. */
+    uint64_t block_size = DELTA_MIN_BLOCKSIZE;
+    while (block_size < DELTA_MAX_BLOCKSIZE &&
+           block_size * block_size < (uint64_t) basis_size)
+    {
+        block_size *= 2;
+    }
+    while (block_size < DELTA_MAX_BLOCKSIZE &&
+           DeltaNumBlocks(basis_size, block_size) > DELTA_MAX_BLOCKS)
+    {
+        block_size *= 2;
+    }
+
+    if (DeltaNumBlocks(basis_size, block_size) > DELTA_MAX_BLOCKS)
+    {
+        return 0;
+    }
+    return block_size;
+}
+
+size_t DeltaNumBlocks(off_t basis_size, size_t block_size)
+{
+    assert(block_size > 0);
+    return (basis_size + block_size - 1) / block_size;
+}
+
+uint32_t DeltaWeakChecksum(const unsigned char *data, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        a += data[i];
+        b += (uint32_t) (len - i) * data[i];
+    }
+    return (a & 0xFFFF) | ((b & 0xFFFF) << 16);
+}
+
+static void DeltaStrongChecksum(const unsigned char *data, size_t len,
+                                unsigned char strong[DELTA_STRONG_SIZE])
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_Digest(data, len, digest, &digest_len, EVP_md5(), NULL);
+    assert(digest_len == DELTA_STRONG_SIZE);
+    memcpy(strong, digest, DELTA_STRONG_SIZE);
+}
+
+unsigned char *DeltaSignatures(int fd, size_t block_size, size_t num_blocks)
+{
+    unsigned char *signatures = xmalloc(num_blocks * DELTA_SIGNATURE_SIZE + 1);
+    unsigned char *block = xmalloc(block_size);
+
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+        const ssize_t n = ReadFully(fd, block, block_size);
+        if (n <= 0 || ((size_t) n < block_size && i != num_blocks - 1))
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Could not read block %zu of the delta basis (%s)",
+                i, n < 0 ? GetErrorStr() : "file shrunk");
+            free(block);
+            free(signatures);
+            return NULL;
+        }
+
+        unsigned char *sig = signatures + i * DELTA_SIGNATURE_SIZE;
+        PutU32(sig, DeltaWeakChecksum(block, n));
+        DeltaStrongChecksum(block, n, sig + 4);
+    }
+
+    free(block);
+    return signatures;
+}
+
+/*******************************************************************/
+/* Signature index, hashed on the weak checksum                    */
+/*******************************************************************/
+
+typedef struct
+{
+    const unsigned char *signatures;
+    size_t num_blocks;
+    size_t block_size;
+    size_t last_block_size;
+    int shift;
+    int32_t *heads;                            /* -1 terminates the chains */
+    int32_t *next;
+} DeltaIndex;
+
+static inline uint32_t DeltaIndexBucket(const DeltaIndex *index, uint32_t weak)
+{
+    return (weak * 0x9E3779B1u) >> index->shift;
+}
+
+static inline size_t DeltaIndexBlockLength(const DeltaIndex *index, size_t block)
+{
+    return (block == index->num_blocks - 1) ?
+        index->last_block_size : index->block_size;
+}
+
+static void DeltaIndexInit(DeltaIndex *index,
+                           const unsigned char *signatures, size_t num_blocks,
+                           size_t block_size, off_t basis_size)
+{
+    assert(num_blocks <= DELTA_MAX_BLOCKS);
+
+    int bits = 4;
+    while (((size_t) 1 << bits) < 2 * num_blocks)
+    {
+        bits++;
+    }
+    const size_t num_buckets = (size_t) 1 << bits;
+
+    index->signatures = signatures;
+    index->num_blocks = num_blocks;
+    index->block_size = block_size;
+    index->last_block_size =
+        (num_blocks == 0) ? 0 : basis_size - (num_blocks - 1) * block_size;
+    index->shift = 32 - bits;
+    index->heads = xmalloc(num_buckets * sizeof(int32_t));
+    index->next = xmalloc((num_blocks + 1) * sizeof(int32_t));
+    memset(index->heads, 0xFF, num_buckets * sizeof(int32_t));
+
+    /* Insert backwards so that chains list blocks in file order. */
+    for (size_t i = num_blocks; i-- > 0; )
+    {
+        const uint32_t weak = GetU32(signatures + i * DELTA_SIGNATURE_SIZE);
+        const uint32_t bucket = DeltaIndexBucket(index, weak);
+        index->next[i] = index->heads[bucket];
+        index->heads[bucket] = i;
+    }
+}
+
+static void DeltaIndexDestroy(DeltaIndex *index)
+{
+    free(index->heads);
+    free(index->next);
+}
+
+/**
+ * @return a block of the basis identical to the #len bytes at #data, or -1.
+ *         #preferred is returned if it matches, to keep runs of blocks
+ *         contiguous.
+ */
+static long DeltaIndexFind(const DeltaIndex *index, uint32_t weak,
+                           const unsigned char *data, size_t len,
+                           long preferred)
+{
+    if (index->num_blocks == 0)
+    {
+        return -1;
+    }
+
+    unsigned char strong[DELTA_STRONG_SIZE];
+    bool have_strong = false;
+    long found = -1;
+
+    for (int32_t i = index->heads[DeltaIndexBucket(index, weak)];
+         i != -1; i = index->next[i])
+    {
+        const unsigned char *sig = index->signatures + i * DELTA_SIGNATURE_SIZE;
+        if (GetU32(sig) != weak || DeltaIndexBlockLength(index, i) != len)
+        {
+            continue;
+        }
+        if (!have_strong)
+        {
+            DeltaStrongChecksum(data, len, strong);
+            have_strong = true;
+        }
+        if (memcmp(sig + 4, strong, DELTA_STRONG_SIZE) == 0)
+        {
+            if (i == preferred)
+            {
+                return i;
+            }
+            if (found == -1)
+            {
+                found = i;
+            }
+        }
+    }
+    return found;
+}
+
+/*******************************************************************/
+/* Sending side                                                    */
+/*******************************************************************/
+
+typedef struct
+{
+    DeltaWriteFn write_fn;
+    void *write_data;
+    unsigned char *buf;
+    size_t len;
+    bool failed;
+
+    /* Pending copy instruction, extended while blocks come in order. */
+    size_t copy_first;
+    size_t copy_count;
+
+    DeltaStats *stats;
+} DeltaEncoder;
+
+static void EncoderFlush(DeltaEncoder *enc)
+{
+    if (!enc->failed && enc->len > 0)
+    {
+        enc->failed = !enc->write_fn(enc->write_data, enc->buf, enc->len);
+    }
+    enc->len = 0;
+}
+
+static void EncoderPut(DeltaEncoder *enc, const void *data, size_t len)
+{
+    if (enc->len + len > DELTA_OUT_BUFSIZE)
+    {
+        EncoderFlush(enc);
+    }
+    assert(len <= DELTA_OUT_BUFSIZE);
+    memcpy(enc->buf + enc->len, data, len);
+    enc->len += len;
+}
+
+static void EncoderFlushCopy(DeltaEncoder *enc)
+{
+    if (enc->copy_count > 0)
+    {
+        unsigned char op[9];
+        op[0] = DELTA_OP_COPY;
+        PutU32(op + 1, enc->copy_first);
+        PutU32(op + 5, enc->copy_count);
+        EncoderPut(enc, op, sizeof(op));
+        enc->copy_count = 0;
+    }
+}
+
+static void EncoderCopy(DeltaEncoder *enc, size_t block)
+{
+    if (enc->copy_count > 0 && block == enc->copy_first + enc->copy_count)
+    {
+        enc->copy_count++;
+        return;
+    }
+    EncoderFlushCopy(enc);
+    enc->copy_first = block;
+    enc->copy_count = 1;
+}
+
+static void EncoderData(DeltaEncoder *enc, const unsigned char *data, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    EncoderFlushCopy(enc);
+    enc->stats->literal_bytes += len;
+
+    while (len > 0)
+    {
+        const size_t chunk = MIN(len, DELTA_MAX_LITERAL);
+        unsigned char op[5];
+        op[0] = DELTA_OP_DATA;
+        PutU32(op + 1, chunk);
+        EncoderPut(enc, op, sizeof(op));
+        EncoderPut(enc, data, chunk);
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+bool DeltaGenerate(int fd, off_t size,
+                   const unsigned char *signatures, size_t num_blocks,
+                   size_t block_size, off_t basis_size,
+                   DeltaWriteFn write_fn, void *write_data,
+                   DeltaStats *stats)
+{
+    assert(block_size >= DELTA_MIN_BLOCKSIZE);
+    assert(block_size <= DELTA_MAX_BLOCKSIZE);
+
+    DeltaIndex index;
+    DeltaIndexInit(&index, signatures, num_blocks, block_size, basis_size);
+
+    DeltaEncoder enc = {
+        .write_fn = write_fn,
+        .write_data = write_data,
+        .buf = xmalloc(DELTA_OUT_BUFSIZE),
+        .stats = stats,
+    };
+    *stats = (DeltaStats) { 0 };
+
+    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(md_ctx, EVP_md5(), NULL);
+
+    /* The window [pos, pos + block_size) slides over buf, the bytes it has
+     * left behind since the last match, [lit, pos), are literal data. */
+    const size_t buf_size = DELTA_MAX_LITERAL + block_size;
+    unsigned char *buf = xmalloc(buf_size);
+    size_t lit = 0, pos = 0, end = 0;
+    off_t total_read = 0;
+    bool eof = false, read_error = false;
+
+    uint32_t weak = 0;
+    bool have_weak = false;
+    long last_block = -1;
+
+    while (!enc.failed)
+    {
+        if (end - pos < block_size && !eof)
+        {
+            EncoderData(&enc, buf + lit, pos - lit);
+            memmove(buf, buf + pos, end - pos);
+            end -= pos;
+            pos = 0;
+            lit = 0;
+
+            const ssize_t n = ReadFully(fd, buf + end, buf_size - end);
+            if (n < 0)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to read file for delta transfer (read: %s)",
+                    GetErrorStr());
+                read_error = true;
+                break;
+            }
+            eof = ((size_t) n < buf_size - end);
+            EVP_DigestUpdate(md_ctx, buf + end, n);
+            end += n;
+            total_read += n;
+            continue;
+        }
+
+        const size_t avail = end - pos;
+        if (avail == 0)
+        {
+            break;
+        }
+
+        const size_t window = MIN(block_size, avail);
+        if (!have_weak)
+        {
+            weak = DeltaWeakChecksum(buf + pos, window);
+            have_weak = true;
+        }
+
+        const long block = DeltaIndexFind(&index, weak, buf + pos, window,
+                                          last_block + 1);
+        if (block >= 0)
+        {
+            EncoderData(&enc, buf + lit, pos - lit);
+            EncoderCopy(&enc, block);
+            stats->copied_bytes += window;
+            pos += window;
+            lit = pos;
+            have_weak = false;
+            last_block = block;
+        }
+        else if (window < block_size)
+        {
+            /* A tail shorter than a block only matches as a whole. */
+            pos = end;
+        }
+        else
+        {
+            if (avail > block_size)
+            {
+                weak = DeltaWeakRoll(weak, block_size,
+                                     buf[pos], buf[pos + block_size]);
+            }
+            else
+            {
+                have_weak = false;
+            }
+            pos++;
+        }
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    EVP_DigestFinal_ex(md_ctx, digest, NULL);
+    EVP_MD_CTX_free(md_ctx);
+
+    bool changed = read_error;
+    if (!read_error)
+    {
+        EncoderData(&enc, buf + lit, pos - lit);
+        EncoderFlushCopy(&enc);
+
+        /* Same as GET, don't let a file that changed size under our feet
+         * pass for a consistent copy. */
+        if (total_read != size)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "File changed size during delta transfer, %jd instead of %jd bytes",
+                (intmax_t) total_read, (intmax_t) size);
+            changed = true;
+        }
+    }
+
+    if (changed)
+    {
+        const unsigned char op = DELTA_OP_CHANGED;
+        EncoderPut(&enc, &op, 1);
+    }
+    else
+    {
+        unsigned char op[1 + DELTA_STRONG_SIZE];
+        op[0] = DELTA_OP_END;
+        memcpy(op + 1, digest, DELTA_STRONG_SIZE);
+        EncoderPut(&enc, op, sizeof(op));
+    }
+    EncoderFlush(&enc);
+
+    const bool ok = !enc.failed && !changed;
+
+    free(buf);
+    free(enc.buf);
+    DeltaIndexDestroy(&index);
+    return ok;
+}
+
+/*******************************************************************/
+/* Receiving side                                                  */
+/*******************************************************************/
+
+static bool CopyFromBasis(int basis_fd, off_t offset, off_t len, int dest_fd,
+                          EVP_MD_CTX *md_ctx, unsigned char *buf, size_t buf_size)
+{
+    if (lseek(basis_fd, offset, SEEK_SET) == (off_t) -1)
+    {
+        return false;
+    }
+
+    while (len > 0)
+    {
+        const size_t chunk = MIN((off_t) buf_size, len);
+        if (ReadFully(basis_fd, buf, chunk) != (ssize_t) chunk ||
+            FullWrite(dest_fd, (const char *) buf, chunk) < 0)
+        {
+            return false;
+        }
+        EVP_DigestUpdate(md_ctx, buf, chunk);
+        len -= chunk;
+    }
+    return true;
+}
+
+DeltaResult DeltaApply(DeltaReadFn read_fn, void *read_data,
+                       int basis_fd, off_t basis_size, size_t block_size,
+                       int dest_fd, DeltaStats *stats)
+{
+    const size_t num_blocks = DeltaNumBlocks(basis_size, block_size);
+    unsigned char *buf = xmalloc(DELTA_MAX_LITERAL);
+    *stats = (DeltaStats) { 0 };
+
+    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(md_ctx, EVP_md5(), NULL);
+
+    /* On local errors keep reading, so that the stream stays in sync. */
+    bool local_error = false;
+    DeltaResult result = DELTA_RESULT_STREAM_ERROR;
+
+    while (true)
+    {
+        unsigned char op;
+        if (!read_fn(read_data, &op, 1))
+        {
+            break;
+        }
+
+        if (op == DELTA_OP_COPY)
+        {
+            unsigned char args[8];
+            if (!read_fn(read_data, args, sizeof(args)))
+            {
+                break;
+            }
+            const size_t first = GetU32(args);
+            const size_t count = GetU32(args + 4);
+            if (count == 0 || first >= num_blocks || count > num_blocks - first)
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Delta transfer refers to blocks %zu-%zu of a %zu block basis",
+                    first, first + count, num_blocks);
+                break;
+            }
+
+            const off_t offset = (off_t) first * block_size;
+            const off_t len = MIN((off_t) count * block_size,
+                                  basis_size - offset);
+            if (!local_error &&
+                !CopyFromBasis(basis_fd, offset, len, dest_fd,
+                               md_ctx, buf, DELTA_MAX_LITERAL))
+            {
+                Log(LOG_LEVEL_ERR, "Failed to copy block of delta basis (%s)",
+                    GetErrorStr());
+                local_error = true;
+            }
+            stats->copied_bytes += len;
+        }
+        else if (op == DELTA_OP_DATA)
+        {
+            unsigned char args[4];
+            if (!read_fn(read_data, args, sizeof(args)))
+            {
+                break;
+            }
+            const size_t len = GetU32(args);
+            if (len == 0 || len > DELTA_MAX_LITERAL)
+            {
+                Log(LOG_LEVEL_ERR, "Invalid literal of %zu bytes in delta transfer",
+                    len);
+                break;
+            }
+            if (!read_fn(read_data, buf, len))
+            {
+                break;
+            }
+            if (!local_error &&
+                FullWrite(dest_fd, (const char *) buf, len) < 0)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to write delta transfer data (%s)",
+                    GetErrorStr());
+                local_error = true;
+            }
+            EVP_DigestUpdate(md_ctx, buf, len);
+            stats->literal_bytes += len;
+        }
+        else if (op == DELTA_OP_END)
+        {
+            unsigned char expected[DELTA_STRONG_SIZE];
+            if (!read_fn(read_data, expected, sizeof(expected)))
+            {
+                break;
+            }
+
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            EVP_DigestFinal_ex(md_ctx, digest, NULL);
+            if (memcmp(digest, expected, DELTA_STRONG_SIZE) != 0)
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Digest mismatch after delta transfer, basis changed?");
+                local_error = true;
+            }
+            result = local_error ? DELTA_RESULT_FAILED : DELTA_RESULT_OK;
+            break;
+        }
+        else if (op == DELTA_OP_CHANGED)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Source changed during delta transfer");
+            result = DELTA_RESULT_FAILED;
+            break;
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Unknown instruction 0x%02x in delta transfer",
+                (unsigned int) op);
+            break;
+        }
+    }
+
+    EVP_MD_CTX_free(md_ctx);
+    free(buf);
+    return result;
+}
@@ -0,0 +1,145 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_FILE_DELTA_H
+#define CFENGINE_FILE_DELTA_H
+
+
+#include <platform.h>
+
+
+/**
+ * Delta transfer of files over CF_PROTOCOL_DELTA, in the spirit of rsync.
+ *
+ * The client cuts its current copy of a file (the basis) into blocks of
+ * DeltaBlockSize() bytes and sends one signature per block: a weak rolling
+ * checksum and a strong MD5 digest. The server slides a window over its
+ * version of the file and, wherever the window matches a signature, tells
+ * the client to copy that block from the basis instead of sending the data.
+ *
+ * The server's reply is a stream of instructions:
+ *
+ *   'C' <u32 first block> <u32 number of blocks>   copy blocks of the basis
+ *   'D' <u32 length> <length bytes>                literal data
+ *   'E' <16 bytes MD5 of the whole new file>       end of file
+ *   'X'                                            file changed, aborted
+ *
+ * with all integers in network byte order.
+ */
+
+#define DELTA_MIN_BLOCKSIZE 2048
+#define DELTA_MAX_BLOCKSIZE (1024 * 1024)
+#define DELTA_MAX_BLOCKS (1024 * 1024)
+#define DELTA_MAX_LITERAL (64 * 1024)
+
+#define DELTA_STRONG_SIZE 16                                          /* MD5 */
+#define DELTA_SIGNATURE_SIZE (4 + DELTA_STRONG_SIZE)
+
+#define DELTA_OP_COPY    'C'
+#define DELTA_OP_DATA    'D'
+#define DELTA_OP_END     'E'
+#define DELTA_OP_CHANGED 'X'
+
+typedef enum
+{
+    DELTA_RESULT_OK,
+    DELTA_RESULT_FAILED,        /* whole stream was consumed, but unusable */
+    DELTA_RESULT_STREAM_ERROR,  /* stream is out of sync, drop connection */
+} DeltaResult;
+
+typedef struct
+{
+    uint64_t literal_bytes;                     /* sent as 'D' instructions */
+    uint64_t copied_bytes;                      /* reused from the basis */
+} DeltaStats;
+
+/**
+ * Send or receive exactly #len bytes, return false on error. Used as the
+ * transport by DeltaGenerate() and DeltaApply().
+ */
+typedef bool (*DeltaWriteFn)(void *data, const void *buf, size_t len);
+typedef bool (*DeltaReadFn)(void *data, void *buf, size_t len);
+
+/* Transport over a TLS session, #data is the SSL *. */
+bool DeltaTLSWrite(void *ssl, const void *buf, size_t len);
+bool DeltaTLSRead(void *ssl, void *buf, size_t len);
+
+/**
+ * @return the block size to use for a basis of #basis_size bytes, or 0 if
+ *         the file is too large for a delta transfer.
+ */
+size_t DeltaBlockSize(off_t basis_size);
+
+/**
+ * @return the number of blocks, the last one possibly short, that a basis
+ *         of #basis_size bytes is cut into.
+ */
+size_t DeltaNumBlocks(off_t basis_size, size_t block_size);
+
+uint32_t DeltaWeakChecksum(const unsigned char *data, size_t len);
+
+/**
+ * Slide the window of #len bytes that #weak was computed on by one byte,
+ * dropping #out at its start and adding #in at its end.
+ */
+static inline uint32_t DeltaWeakRoll(uint32_t weak, size_t len,
+                                     unsigned char out, unsigned char in)
+{
+    uint32_t a = weak & 0xFFFF;
+    uint32_t b = weak >> 16;
+    a = (a - out + in) & 0xFFFF;
+    b = (b - (uint32_t) len * out + a) & 0xFFFF;
+    return a | (b << 16);
+}
+
+/**
+ * Compute the signatures of the #num_blocks blocks of the file open at #fd.
+ *
+ * @return a malloc'ed array of #num_blocks * DELTA_SIGNATURE_SIZE bytes, or
+ *         NULL if the file could not be read.
+ */
+unsigned char *DeltaSignatures(int fd, size_t block_size, size_t num_blocks);
+
+/**
+ * Send the instructions that rebuild the #size bytes of the file open at #fd
+ * from the basis described by #signatures.
+ *
+ * @return false if reading the file or writing to the transport failed.
+ */
+bool DeltaGenerate(int fd, off_t size,
+                   const unsigned char *signatures, size_t num_blocks,
+                   size_t block_size, off_t basis_size,
+                   DeltaWriteFn write_fn, void *write_data,
+                   DeltaStats *stats);
+
+/**
+ * Receive instructions and write the file they describe to #dest_fd, copying
+ * blocks from the basis open at #basis_fd.
+ */
+DeltaResult DeltaApply(DeltaReadFn read_fn, void *read_data,
+                       int basis_fd, off_t basis_size, size_t block_size,
+                       int dest_fd, DeltaStats *stats);
+
+#endif
@@ -33,6 +33,26 @@ ProtocolVersion ParseProtocolVersionPolicy(const char *const s)
     {
         return CF_PROTOCOL_COOKIE;
     }
+    else if (StringEqual(s, "4") || StringEqual(s, "largeblocks"))
+    {
+        return CF_PROTOCOL_LARGEBLOCKS;
+    }
+    else if (StringEqual(s, "5") || StringEqual(s, "statdir"))
+    {
+        return CF_PROTOCOL_STATDIR;
+    }
+    else if (StringEqual(s, "6") || StringEqual(s, "manifest"))
+    {
+        return CF_PROTOCOL_MANIFEST;
+    }
+    else if (StringEqual(s, "7") || StringEqual(s, "delta"))
+    {
+        return CF_PROTOCOL_DELTA;
+    }
+    else if (StringEqual(s, "8") || StringEqual(s, "compress"))
+    {
+        return CF_PROTOCOL_COMPRESS;
+    }
     else if (StringEqual(s, "latest"))
     {
         return CF_PROTOCOL_LATEST;
@@ -39,15 +39,35 @@ typedef enum
     /* --- Greater versions use TLS as secure communications layer --- */
     CF_PROTOCOL_TLS = 2,
     CF_PROTOCOL_COOKIE = 3,
+    /* GET may ask for blocks of up to CF_GET_MAX_BLOCKSIZE bytes */
+    CF_PROTOCOL_LARGEBLOCKS = 4,
+    /* STATDIR lists a directory along with the STAT replies of its entries */
+    CF_PROTOCOL_STATDIR = 5,
+    /* MANIFEST streams a whole tree's stats and digests in one reply */
+    CF_PROTOCOL_MANIFEST = 6,
+    /* DELTA rebuilds a changed file from the client's outdated copy */
+    CF_PROTOCOL_DELTA = 7,
+    /* GETZ sends file contents zlib compressed */
+    CF_PROTOCOL_COMPRESS = 8,
 } ProtocolVersion;
 
 /* We use CF_PROTOCOL_LATEST as the default for new connections. */
-#define CF_PROTOCOL_LATEST CF_PROTOCOL_COOKIE
+#define CF_PROTOCOL_LATEST CF_PROTOCOL_COMPRESS
 
 static inline const char *ProtocolVersionString(const ProtocolVersion p)
 {
     switch (p)
     {
+    case CF_PROTOCOL_COMPRESS:
+        return "compress";
+    case CF_PROTOCOL_DELTA:
+        return "delta";
+    case CF_PROTOCOL_MANIFEST:
+        return "manifest";
+    case CF_PROTOCOL_STATDIR:
+        return "statdir";
+    case CF_PROTOCOL_LARGEBLOCKS:
+        return "largeblocks";
     case CF_PROTOCOL_COOKIE:
         return "cookie";
     case CF_PROTOCOL_TLS:
@@ -89,6 +109,31 @@ static inline bool ProtocolTerminateCSV(const ProtocolVersion p)
     return (p < CF_PROTOCOL_COOKIE);
 }
 
+static inline bool ProtocolSupportsLargeBlocks(const ProtocolVersion p)
+{
+    return ((p >= CF_PROTOCOL_LARGEBLOCKS) && (p <= CF_PROTOCOL_LATEST));
+}
+
+static inline bool ProtocolSupportsStatDir(const ProtocolVersion p)
+{
+    return ((p >= CF_PROTOCOL_STATDIR) && (p <= CF_PROTOCOL_LATEST));
+}
+
+static inline bool ProtocolSupportsManifest(const ProtocolVersion p)
+{
+    return ((p >= CF_PROTOCOL_MANIFEST) && (p <= CF_PROTOCOL_LATEST));
+}
+
+static inline bool ProtocolSupportsDelta(const ProtocolVersion p)
+{
+    return ((p >= CF_PROTOCOL_DELTA) && (p <= CF_PROTOCOL_LATEST));
+}
+
+static inline bool ProtocolSupportsCompress(const ProtocolVersion p)
+{
+    return ((p >= CF_PROTOCOL_COMPRESS) && (p <= CF_PROTOCOL_LATEST));
+}
+
 /**
  * Returns CF_PROTOCOL_TLS or CF_PROTOCOL_CLASSIC (or CF_PROTOCOL_UNDEFINED)
  * Maps all versions using TLS to CF_PROTOCOL_TLS for convenience
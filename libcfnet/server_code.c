@@ -8,12 +8,117 @@
 #include <signals.h>                    // GetSignalPipe
 #include <cleanup.h>                    // DoCleanupAndExit
 #include <ctype.h>                      // isdigit
+#include <alloc.h>                      // xmalloc
 
 #if HAVE_SYSTEMD_SD_DAEMON_H
 #include <systemd/sd-daemon.h>          // sd_listen_fds
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>                  // epoll_create1, epoll_wait
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/* Every thread waiting for connections (cf-testd runs several) keeps its own
+ * epoll instance, so that the listening socket and the signal pipe are only
+ * registered once instead of being passed to the kernel on every wait. */
+typedef struct
+{
+    int epoll_fd;
+    int sd;                     /* listening socket registered, or -1 */
+} IncomingWaiter;
+
+static pthread_key_t WAITER_KEY;
+static pthread_once_t WAITER_KEY_ONCE = PTHREAD_ONCE_INIT;
+
+static void IncomingWaiterDestroy(void *arg)
+{
+    IncomingWaiter *waiter = arg;
+    close(waiter->epoll_fd);
+    free(waiter);
+}
+
+static void IncomingWaiterKeyCreate(void)
+{
+    pthread_key_create(&WAITER_KEY, IncomingWaiterDestroy);
+}
+
+static IncomingWaiter *IncomingWaiterGet(int signal_pipe)
+{
+    pthread_once(&WAITER_KEY_ONCE, IncomingWaiterKeyCreate);
+
+    IncomingWaiter *waiter = pthread_getspecific(WAITER_KEY);
+    if (waiter != NULL)
+    {
+        return waiter;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to create epoll instance (epoll_create1: %s)",
+            GetErrorStr());
+        return NULL;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = signal_pipe };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_pipe, &ev) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to watch signal pipe (epoll_ctl: %s)",
+            GetErrorStr());
+        close(epoll_fd);
+        return NULL;
+    }
+
+    waiter = xmalloc(sizeof(*waiter));
+    waiter->epoll_fd = epoll_fd;
+    waiter->sd = -1;
+    pthread_setspecific(WAITER_KEY, waiter);
+    return waiter;
+}
+
+static bool IncomingWaiterWatch(IncomingWaiter *waiter, int sd)
+{
+    if (waiter->sd != -1 && waiter->sd != sd)
+    {
+        /* Fails harmlessly if the old socket is already closed. */
+        epoll_ctl(waiter->epoll_fd, EPOLL_CTL_DEL, waiter->sd, NULL);
+        waiter->sd = -1;
+    }
+
+    /* Re-adding is cheap and catches a closed listening socket whose
+     * descriptor number got reused, which epoll would have forgotten. */
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sd };
+    if (epoll_ctl(waiter->epoll_fd, EPOLL_CTL_ADD, sd, &ev) == -1 &&
+        errno != EEXIST)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to watch listening socket (epoll_ctl: %s)",
+            GetErrorStr());
+        return false;
+    }
+    waiter->sd = sd;
+    return true;
+}
+
+#endif  /* HAVE_SYS_EPOLL_H */
+
+static void DrainSignalPipe(int signal_pipe)
+{
+    /* Empty the signal pipe, it is there to only detect missed
+     * signals in-between checking IsPendingTermination() and calling
+     * select()/epoll_wait(). */
+    unsigned char buf;
+    while (recv(signal_pipe, &buf, 1, 0) > 0)
+    {
+        /* skip */
+    }
+}
+
 /* Wait up to a minute for an in-coming connection.
+ *
+ * Uses epoll where available, which doesn't limit descriptor numbers to
+ * FD_SETSIZE like select() does.
  *
  * @param sd The listening socket or -1.
  * @param tm_sec timeout in seconds
@@ -24,9 +129,55 @@
  */
 int WaitForIncoming(int sd, time_t tm_sec)
 {
+    int signal_pipe = GetSignalPipe();
+
+#ifdef HAVE_SYS_EPOLL_H
+    IncomingWaiter *waiter = IncomingWaiterGet(signal_pipe);
+    if (waiter != NULL)
+    {
+        Log(LOG_LEVEL_DEBUG, "Waiting at incoming epoll_wait...");
+
+        /* sd might be -1 if "listen" attribute in body server control is
+         * set to off (enterprise feature for call-collected clients). */
+        if (sd != -1 && !IncomingWaiterWatch(waiter, sd))
+        {
+            return -1;
+        }
+
+        struct epoll_event events[2];
+        int result = epoll_wait(waiter->epoll_fd, events, 2, tm_sec * 1000);
+        if (result == -1)
+        {
+            return (errno == EINTR) ? -2 : -1;
+        }
+        assert(result >= 0);
+
+        DrainSignalPipe(signal_pipe);
+
+        for (int i = 0; i < result; i++)
+        {
+            if (sd != -1 && events[i].data.fd == sd)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    /* else: fall back to select() */
+#endif
+
+    /* FD_SET() on descriptors that don't fit would write past the fd_set. */
+    if (signal_pipe >= FD_SETSIZE || sd >= FD_SETSIZE)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Descriptor too large to wait on with select() (%d >= FD_SETSIZE %d)",
+            MAX(sd, signal_pipe), FD_SETSIZE);
+        errno = EBADF;
+        return -1;
+    }
+
     Log(LOG_LEVEL_DEBUG, "Waiting at incoming select...");
     struct timeval timeout = { .tv_sec = tm_sec };
-    int signal_pipe = GetSignalPipe();
     fd_set rset;
     FD_ZERO(&rset);
     FD_SET(signal_pipe, &rset);
@@ -46,14 +197,7 @@ int WaitForIncoming(int sd, time_t tm_sec)
     }
     assert(result >= 0);
 
-    /* Empty the signal pipe, it is there to only detect missed
-     * signals in-between checking IsPendingTermination() and calling
-     * select(). */
-    unsigned char buf;
-    while (recv(signal_pipe, &buf, 1, 0) > 0)
-    {
-        /* skip */
-    }
+    DrainSignalPipe(signal_pipe);
 
     /* We have an incoming connection if select() marked sd as ready: */
     if (sd != -1 && result > 0 && FD_ISSET(sd, &rset))
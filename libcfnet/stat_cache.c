@@ -33,23 +33,96 @@
 #include <logging.h>                          /* Log */
 #include <crypto.h>                           /* EncryptString */
 #include <misc_lib.h>                         /* ProgrammingError */
+#include <map.h>                              /* Map */
 
+struct StatCache_
+{
+    Map *entries;                      /* cf_filename -> Stat, owns values */
+    Map *listings;            /* directory -> Seq of names, from MANIFEST */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t prefetched;        /* entries from STATDIR/MANIFEST replies */
+    uint64_t listing_hits;            /* directories listed from MANIFEST */
+};
+
+static void StatDestroy(void *data)
+{
+    Stat *sp = data;
+    if (sp != NULL)
+    {
+        free(sp->cf_readlink);
+        free(sp->cf_digest);
+        free(sp->cf_filename);
+        free(sp->cf_server);
+        free(sp);
+    }
+}
+
+static void SeqDestroy_untyped(void *p)
+{
+    SeqDestroy(p);
+}
+
+static StatCache *ConnStatCache(AgentConnection *conn)
+{
+    if (conn->cache == NULL)
+    {
+        conn->cache = xcalloc(1, sizeof(StatCache));
+        /* Keys are owned by the values. */
+        conn->cache->entries = MapNew(StringHash_untyped, StringEqual_untyped,
+                                      NULL, StatDestroy);
+        conn->cache->listings = MapNew(StringHash_untyped, StringEqual_untyped,
+                                       free, SeqDestroy_untyped);
+    }
+    return conn->cache;
+}
+
+/* Takes ownership of the strings in #data. */
 static void NewStatCache(Stat *data, AgentConnection *conn)
 {
+    ConnStatCache(conn);
+
     Stat *sp = xmemdup(data, sizeof(Stat));
-    sp->next = conn->cache;
-    conn->cache = sp;
+
+    /* Never let MapInsert() replace a value whose key it still holds. */
+    MapRemove(conn->cache->entries, sp->cf_filename);
+    MapInsert(conn->cache->entries, sp->cf_filename, sp);
+}
+
+void StatCacheDestroy(AgentConnection *conn)
+{
+    StatCache *cache = conn->cache;
+    if (cache != NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Remote stat cache for '%s': %ju hits, %ju misses, "
+            "%ju entries from directory listings, "
+            "%ju directories listed from manifests",
+            conn->this_server, (uintmax_t) cache->hits,
+            (uintmax_t) cache->misses, (uintmax_t) cache->prefetched,
+            (uintmax_t) cache->listing_hits);
+
+        MapDestroy(cache->entries);
+        MapDestroy(cache->listings);
+        free(cache);
+        conn->cache = NULL;
+    }
 }
 
-void DestroyStatCache(Stat *data)
+static Stat *StatCacheGet(const AgentConnection *conn, const char *file,
+                          const char *server_name)
 {
-    if (data != NULL)
+    if (conn->cache == NULL)
+    {
+        return NULL;
+    }
+
+    Stat *sp = MapGet(conn->cache->entries, file);
+    if (sp != NULL && strcmp(server_name, sp->cf_server) == 0)
     {
-        free(data->cf_readlink);
-        free(data->cf_filename);
-        free(data->cf_server);
-        free(data);
+        return sp;
     }
+    return NULL;
 }
 
 /**
@@ -60,43 +133,200 @@ void DestroyStatCache(Stat *data)
 static int StatFromCache(AgentConnection *conn, const char *file,
                          struct stat *statbuf, const char *stattype)
 {
-    for (Stat *sp = conn->cache; sp != NULL; sp = sp->next)
+    StatCache *cache = ConnStatCache(conn);
+    const Stat *sp = StatCacheGet(conn, file, conn->this_server);
+    if (sp == NULL)
     {
-        /* TODO differentiate ports etc in this stat cache! */
+        cache->misses++;
+        return 1;                                              /* not found */
+    }
+    cache->hits++;
 
-        if (strcmp(conn->this_server, sp->cf_server) == 0 &&
-            strcmp(file, sp->cf_filename) == 0)
-        {
-            if (sp->cf_failed)  /* cached failure from cfopendir */
-            {
-                errno = EPERM;
-                return -1;
-            }
-
-            if ((strcmp(stattype, "link") == 0) && (sp->cf_lmode != 0))
-            {
-                statbuf->st_mode = sp->cf_lmode;
-            }
-            else
-            {
-                statbuf->st_mode = sp->cf_mode;
-            }
-
-            statbuf->st_uid = sp->cf_uid;
-            statbuf->st_gid = sp->cf_gid;
-            statbuf->st_size = sp->cf_size;
-            statbuf->st_atime = sp->cf_atime;
-            statbuf->st_mtime = sp->cf_mtime;
-            statbuf->st_ctime = sp->cf_ctime;
-            statbuf->st_ino = sp->cf_ino;
-            statbuf->st_dev = sp->cf_dev;
-            statbuf->st_nlink = sp->cf_nlink;
-
-            return 0;
-        }
+    if (sp->cf_failed)  /* cached failure from cfopendir */
+    {
+        errno = EPERM;
+        return -1;
+    }
+
+    if ((strcmp(stattype, "link") == 0) && (sp->cf_lmode != 0))
+    {
+        statbuf->st_mode = sp->cf_lmode;
+    }
+    else
+    {
+        statbuf->st_mode = sp->cf_mode;
+    }
+
+    statbuf->st_uid = sp->cf_uid;
+    statbuf->st_gid = sp->cf_gid;
+    statbuf->st_size = sp->cf_size;
+    statbuf->st_atime = sp->cf_atime;
+    statbuf->st_mtime = sp->cf_mtime;
+    statbuf->st_ctime = sp->cf_ctime;
+    statbuf->st_ino = sp->cf_ino;
+    statbuf->st_dev = sp->cf_dev;
+    statbuf->st_nlink = sp->cf_nlink;
+
+    return 0;
+}
+
+/**
+ * Build #cfst out of the two replies to "STAT #file": the stat fields and
+ * "OK:<link target>".
+ */
+static bool StatFromReplies(const AgentConnection *conn, const char *file,
+                            const char *stat_reply, const char *link_reply,
+                            Stat *cfst)
+{
+    if (!StatParseResponse(stat_reply, cfst))
+    {
+        Log(LOG_LEVEL_ERR, "Cannot read STAT reply from '%s'",
+            conn->this_server);
+        return false;
+    }
+
+    mode_t file_type = FileTypeToMode(cfst->cf_type);
+    if (file_type == 0)
+    {
+        Log(LOG_LEVEL_ERR, "Invalid file type identifier for file %s:%s, %u",
+            conn->this_server, file, cfst->cf_type);
+        return false;
+    }
+
+    cfst->cf_mode |= file_type;
+
+    /* Received a link destination from server */
+    const size_t ok_len = strlen("OK:");
+    if (strlen(link_reply) > ok_len)
+    {
+        // Read from after "OK:"
+        cfst->cf_readlink = xstrdup(link_reply + ok_len);
+    }
+    else
+    {
+        cfst->cf_readlink = NULL;
+    }
+
+    cfst->cf_filename = xstrdup(file);
+    cfst->cf_server = xstrdup(conn->this_server);
+    cfst->cf_digest = NULL;
+    cfst->cf_failed = false;
+
+    if (cfst->cf_lmode != 0)
+    {
+        cfst->cf_lmode |= (mode_t) S_IFLNK;
+    }
+
+    return true;
+}
+
+/**
+ * Cache the stat of #file received as part of a STATDIR or MANIFEST reply,
+ * so that the following cf_remote_stat() needs no round trip.
+ *
+ * @param #digest "MD5=..." as printed by HashPrintSafe(), or NULL
+ * @return false if #stat_reply is not a successful STAT reply.
+ */
+bool StatCachePrefetch(AgentConnection *conn, const char *file,
+                       const char *stat_reply, const char *link_reply,
+                       const char *digest)
+{
+    if (!OKProtoReply(stat_reply))
+    {
+        return false;
+    }
+
+    Stat cfst;
+    if (!StatFromReplies(conn, file, stat_reply, link_reply, &cfst))
+    {
+        return false;
+    }
+
+    cfst.cf_digest = (digest != NULL) ? xstrdup(digest) : NULL;
+
+    NewStatCache(&cfst, conn);
+    conn->cache->prefetched++;
+    return true;
+}
+
+/**
+ * Key under which #name in #dirname is cached, the way the agent names it
+ * when it looks it up: with a single '/' in between, also if #dirname is "/"
+ * or otherwise ends with one.
+ *
+ * @return false if the path doesn't fit in #key_size bytes.
+ */
+bool StatCacheJoinPath(char *key, size_t key_size,
+                       const char *dirname, const char *name)
+{
+    size_t len = strlen(dirname);
+    while (len > 0 && dirname[len - 1] == '/')
+    {
+        len--;
+    }
+
+    int ret = snprintf(key, key_size, "%.*s/%s", (int) len, dirname, name);
+    return (ret > 0 && (size_t) ret < key_size);
+}
+
+/**
+ * Remember the complete listing of #dirname received as part of a MANIFEST
+ * reply, so that RemoteDirList() needs no round trip.
+ *
+ * @param #names takes ownership
+ */
+void StatCacheStoreListing(AgentConnection *conn, const char *dirname,
+                           Seq *names)
+{
+    StatCache *cache = ConnStatCache(conn);
+
+    /* MapInsert() would keep the old key and leak the new one. */
+    MapRemove(cache->listings, dirname);
+    MapInsert(cache->listings, xstrdup(dirname), names);
+}
+
+/**
+ * @return the names in #dirname stored by StatCacheStoreListing(), or NULL.
+ */
+const Seq *StatCacheLookupListing(const AgentConnection *conn,
+                                  const char *dirname)
+{
+    if (conn->cache == NULL)
+    {
+        return NULL;
+    }
+
+    Seq *names = MapGet(conn->cache->listings, dirname);
+    if (names != NULL)
+    {
+        conn->cache->listing_hits++;
     }
+    return names;
+}
+
+/**
+ * Forget the listings and digests of MANIFEST replies, which may be outdated
+ * by the next copy, while the connection stays open for the rest of the run.
+ * STATs stay cached, as they always have been.
+ */
+void StatCacheForgetManifest(AgentConnection *conn)
+{
+    StatCache *cache = conn->cache;
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    MapClear(cache->listings);
 
-    return 1;                                                  /* not found */
+    MapIterator it = MapIteratorInit(cache->entries);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&it)) != NULL)
+    {
+        Stat *sp = item->value;
+        free(sp->cf_digest);
+        sp->cf_digest = NULL;
+    }
 }
 
 /**
@@ -224,15 +454,8 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
         return -1;
     }
 
-    Stat cfst;
-
-    ret = StatParseResponse(recvbuffer, &cfst);
-    if (!ret)
-    {
-        Log(LOG_LEVEL_ERR, "Cannot read STAT reply from '%s'",
-            conn->this_server);
-        return -1;
-    }
+    char stat_reply[CF_BUFSIZE];
+    strlcpy(stat_reply, recvbuffer, sizeof(stat_reply));
 
     // If remote path is symbolic link, receive actual path here
     int recv_len = ReceiveTransaction(conn->conn_info, recvbuffer, NULL);
@@ -242,38 +465,12 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
         return -1;
     }
 
-    int ok_len = sizeof("OK:");
-    /* Received a link destination from server
-       (recv_len greater than OK response + NUL-byte) */
-    if (recv_len > ok_len)
-    {
-        // Read from after "OK:"
-        cfst.cf_readlink = xstrdup(recvbuffer + (ok_len - 1));
-    }
-    else
-    {
-        cfst.cf_readlink = NULL;
-    }
-
-    mode_t file_type = FileTypeToMode(cfst.cf_type);
-    if (file_type == 0)
+    Stat cfst;
+    if (!StatFromReplies(conn, file, stat_reply, recvbuffer, &cfst))
     {
-        Log(LOG_LEVEL_ERR, "Invalid file type identifier for file %s:%s, %u",
-            conn->this_server, file, cfst.cf_type);
         return -1;
     }
 
-    cfst.cf_mode |= file_type;
-
-    cfst.cf_filename = xstrdup(file);
-    cfst.cf_server = xstrdup(conn->this_server);
-    cfst.cf_failed = false;
-
-    if (cfst.cf_lmode != 0)
-    {
-        cfst.cf_lmode |= (mode_t) S_IFLNK;
-    }
-
     NewStatCache(&cfst, conn);
 
     if ((cfst.cf_lmode != 0) && (strcmp(stattype, "link") == 0))
@@ -304,16 +501,7 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
 const Stat *StatCacheLookup(const AgentConnection *conn, const char *file_name,
                             const char *server_name)
 {
-    for (const Stat *sp = conn->cache; sp != NULL; sp = sp->next)
-    {
-        if (strcmp(server_name, sp->cf_server) == 0 &&
-            strcmp(file_name, sp->cf_filename) == 0)
-        {
-            return sp;
-        }
-    }
-
-    return NULL;
+    return StatCacheGet(conn, file_name, server_name);
 }
 
 /*********************************************************************/
@@ -26,6 +26,7 @@
 
 #include <platform.h>
 #include <cfnet.h>
+#include <sequence.h>
 
 
 typedef enum
@@ -59,14 +60,30 @@ struct Stat_
     int cf_nlink;               /* Number of hard links */
     int cf_ino;                 /* inode number on server */
     dev_t cf_dev;               /* device number */
-    Stat *next;
+    char *cf_digest;            /* "MD5=..." from a MANIFEST reply, or NULL */
 };
 
-void DestroyStatCache(Stat *data);
+/**
+ * Remote STATs of a connection, indexed by path. Lives as long as the
+ * connection, so it is only ever for one (server, port).
+ */
+typedef struct StatCache_ StatCache;
+
+void StatCacheDestroy(AgentConnection *conn);
 int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
                    struct stat *statbuf, const char *stattype);
 const Stat *StatCacheLookup(const AgentConnection *conn, const char *file_name,
                             const char *server_name);
+bool StatCachePrefetch(AgentConnection *conn, const char *file,
+                       const char *stat_reply, const char *link_reply,
+                       const char *digest);
+bool StatCacheJoinPath(char *key, size_t key_size,
+                       const char *dirname, const char *name);
+void StatCacheStoreListing(AgentConnection *conn, const char *dirname,
+                           Seq *names);
+const Seq *StatCacheLookupListing(const AgentConnection *conn,
+                                  const char *dirname);
+void StatCacheForgetManifest(AgentConnection *conn);
 mode_t FileTypeToMode(const FileType type);
 bool StatParseResponse(const char *const buf, Stat *statbuf);
 
@@ -717,27 +717,12 @@ int TLSSend(SSL *ssl, const char *buffer, int length)
 }
 
 /**
- * @brief Receives at most #length bytes of data from the SSL session
- *        and stores it in the buffer.
- * @param ssl SSL information.
- * @param buffer Buffer, of size at least #toget + 1 to store received data.
- * @param toget Length of the data to receive, must be < CF_BUFSIZE.
- *
- * @return The length of the received data, which should be equal or less
- *         than the requested amount.
- *         -1 in case of timeout or error - SSL session is unusable
- *         0  if connection was closed
- *
- * @note Use only for *blocking* sockets. Set
- *       SSL_CTX_set_mode(SSL_MODE_AUTO_RETRY) to make sure that either
- *       operation completed or an error occurred.
- * @note Still, it may happen for #retval to be less than #toget, if the
- *       opposite side completed a TLSSend() with number smaller than #toget.
+ * Common part of TLSRecv() and TLSRecvBlock(), without any limit on #toget
+ * and without '\0'-terminating the buffer.
  */
-int TLSRecv(SSL *ssl, char *buffer, int toget)
+static int TLSRecvRaw(SSL *ssl, char *buffer, int toget)
 {
     assert(toget > 0);
-    assert(toget < CF_BUFSIZE);
     assert_SSLIsBlocking(ssl);
 
     int received = -1;
@@ -803,12 +788,103 @@ int TLSRecv(SSL *ssl, char *buffer, int toget)
         }
     }
 
+    return received;
+}
+
+/**
+ * @brief Receives at most #length bytes of data from the SSL session
+ *        and stores it in the buffer.
+ * @param ssl SSL information.
+ * @param buffer Buffer, of size at least #toget + 1 to store received data.
+ * @param toget Length of the data to receive, must be < CF_BUFSIZE.
+ *
+ * @return The length of the received data, which should be equal or less
+ *         than the requested amount.
+ *         -1 in case of timeout or error - SSL session is unusable
+ *         0  if connection was closed
+ *
+ * @note Use only for *blocking* sockets. Set
+ *       SSL_CTX_set_mode(SSL_MODE_AUTO_RETRY) to make sure that either
+ *       operation completed or an error occurred.
+ * @note Still, it may happen for #retval to be less than #toget, if the
+ *       opposite side completed a TLSSend() with number smaller than #toget.
+ */
+int TLSRecv(SSL *ssl, char *buffer, int toget)
+{
+    assert(toget > 0);
+    assert(toget < CF_BUFSIZE);
+
+    int received = TLSRecvRaw(ssl, buffer, toget);
+    if (received < 0)
+    {
+        return -1;
+    }
+
     assert(received < CF_BUFSIZE);
     buffer[received] = '\0';
 
     return received;
 }
 
+/**
+ * @brief Like TLSRecv(), but for binary data of any size, e.g. the large
+ *        file blocks of CF_PROTOCOL_LARGEBLOCKS. #buffer is not
+ *        '\0'-terminated.
+ *
+ * @note A single call receives at most one TLS record (16KiB), so callers
+ *       must loop until they have all the data they expect.
+ */
+int TLSRecvBlock(SSL *ssl, char *buffer, int toget)
+{
+    return TLSRecvRaw(ssl, buffer, toget);
+}
+
+/**
+ * @return true if the kernel does the TLS record encryption for data we
+ *         send on #ssl (kTLS), so that TLSSendFile() can be used.
+ */
+bool TLSCanSendFile(SSL *ssl)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && defined(BIO_get_ktls_send)
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    UNUSED(ssl);
+    return false;
+#endif
+}
+
+/**
+ * @brief Sends #length bytes from #fd starting at #offset, without copying
+ *        them through userspace. Only works if TLSCanSendFile() is true.
+ *
+ * @return The number of bytes sent, which may be less than #length, or -1 in
+ *         case of error.
+ */
+ssize_t TLSSendFile(SSL *ssl, int fd, off_t offset, size_t length)
+{
+    assert(length > 0);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && defined(BIO_get_ktls_send)
+    assert_SSLIsBlocking(ssl);
+
+    EnforceBwLimit(length);
+
+    ossl_ssize_t sent = SSL_sendfile(ssl, fd, offset, length, 0);
+    if (sent < 0)
+    {
+        TLSLogError(ssl, LOG_LEVEL_VERBOSE, "SSL_sendfile", sent);
+        return -1;
+    }
+    return sent;
+#else
+    UNUSED(ssl);
+    UNUSED(fd);
+    UNUSED(offset);
+    UNUSED(length);
+    return -1;
+#endif
+}
+
 /**
  * @brief Repeat receiving until last byte received is '\n'.
  *
@@ -960,6 +1036,14 @@ void TLSSetDefaultOptions(SSL_CTX *ssl_ctx, const char *min_version)
     options |= SSL_OP_NO_TICKET;
 #endif
 
+#ifdef SSL_OP_ENABLE_KTLS
+    /* Let the kernel do the record encryption where it can, which allows
+     * sending file contents with SSL_sendfile(), see TLSSendFile(). OpenSSL
+     * silently falls back to userspace if kernel or cipher don't support
+     * it. */
+    options |= SSL_OP_ENABLE_KTLS;
+#endif
+
     SSL_CTX_set_options(ssl_ctx, options);
 
 
@@ -44,6 +44,9 @@ X509 *TLSGenerateCertFromPrivKey(RSA *privkey);
 int TLSLogError(SSL *ssl, LogLevel level, const char *prepend, int code);
 int TLSSend(SSL *ssl, const char *buffer, int length);
 int TLSRecv(SSL *ssl, char *buffer, int toget);
+int TLSRecvBlock(SSL *ssl, char *buffer, int toget);
+bool TLSCanSendFile(SSL *ssl);
+ssize_t TLSSendFile(SSL *ssl, int fd, off_t offset, size_t length);
 int TLSRecvLines(SSL *ssl, char *buf, size_t buf_size);
 void TLSSetDefaultOptions(SSL_CTX *ssl_ctx, const char *min_version);
 const char *TLSErrorString(intmax_t errcode);
@@ -1012,6 +1012,13 @@ FileCopy GetCopyConstraints(const EvalContext *ctx, const Promise *pp)
     f.verify = PromiseGetConstraintAsBoolean(ctx, "verify", pp);
     f.purge = PromiseGetConstraintAsBoolean(ctx, "purge", pp);
     f.missing_ok = PromiseGetConstraintAsBoolean(ctx, "missing_ok", pp);
+    f.parallel_connections = PromiseGetConstraintAsInt(ctx, "parallel_connections", pp);
+    if (f.parallel_connections == CF_NOINT)
+    {
+        f.parallel_connections = 1;
+    }
+    f.delta_transfer = PromiseGetConstraintAsBoolean(ctx, "delta_transfer", pp);
+    f.compress = PromiseGetConstraintAsBoolean(ctx, "compress", pp);
     f.destination = NULL;
 
     return f;
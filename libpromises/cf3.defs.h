@@ -489,6 +489,9 @@ typedef enum
     AGENT_CONTROL_REPORTCLASSLOG,
     AGENT_CONTROL_SELECT_END_MATCH_EOF,
     AGENT_CONTROL_COPYFROM_RESTRICT_KEYS,
+    AGENT_CONTROL_LOCK_CACHE,
+    AGENT_CONTROL_FILES_HASH_THREADS,
+    AGENT_CONTROL_DATA_FILE_CACHE,
     AGENT_CONTROL_NONE
 } AgentControl;
 
@@ -1512,6 +1515,9 @@ typedef struct
     short timeout;
     ProtocolVersion protocol_version;
     bool missing_ok;
+    int parallel_connections;
+    bool delta_transfer;
+    bool compress;
 } FileCopy;
 
 typedef struct
@@ -26,8 +26,9 @@
 #include <map.h>
 #include <alloc.h>
 #include <string_lib.h> /* String*() */
-#include <regex.h>      /* CompileRegex,StringMatchFullWithPrecompiledRegex */
+#include <regex_cache.h> /* RegexCacheGet,CachedRegexMatchFull */
 #include <files_names.h>
+#include <name_index.h>
 
 
 static void ClassDestroy(Class *cls);                /* forward declaration */
@@ -55,11 +56,15 @@ TYPED_MAP_DEFINE(Class, char *, Class *,
 struct ClassTable_
 {
     ClassMap *classes;
+    NameIndex *index;                  /* by ClassRefToString() and tags */
 };
 
 struct ClassTableIterator_
 {
+    const ClassTable *table;
     MapIterator iter;
+    Seq *candidates;                   /* NULL unless narrowed */
+    size_t next_candidate;
     char *ns;
     bool is_hard;
     bool is_soft;
@@ -120,6 +125,7 @@ ClassTable *ClassTableNew(void)
     ClassTable *table = xmalloc(sizeof(*table));
 
     table->classes = ClassMapNew();
+    table->index = NameIndexNew();
 
     return table;
 }
@@ -128,6 +134,7 @@ void ClassTableDestroy(ClassTable *table)
 {
     if (table)
     {
+        NameIndexDestroy(table->index);
         ClassMapDestroy(table->classes);
         free(table);
     }
@@ -156,7 +163,22 @@ bool ClassTablePut(ClassTable *table,
         is_soft ? "" : "hard ",
         fullname);
 
-    return ClassMapInsert(table->classes, fullname, cls);
+    if (NameIndexStarted(table->index))
+    {
+        /* Replaced and freed by the insertion. */
+        NameIndexRemove(table->index, ClassMapGet(table->classes, fullname));
+    }
+
+    bool ret = ClassMapInsert(table->classes, fullname, cls);
+
+    if (NameIndexStarted(table->index))
+    {
+        char *expr = ClassRefToString(cls->ns, cls->name);
+        NameIndexPut(table->index, expr, cls, cls->tags);
+        free(expr);
+    }
+
+    return ret;
 }
 
 Class *ClassTableGet(const ClassTable *table, const char *ns, const char *name)
@@ -172,12 +194,31 @@ Class *ClassTableGet(const ClassTable *table, const char *ns, const char *name)
     return ClassMapGet(table->classes, fullname);
 }
 
+bool ClassTableAddTag(ClassTable *table, const char *ns, const char *name, const char *tag)
+{
+    Class *cls = ClassTableGet(table, ns, name);
+    if (cls == NULL)
+    {
+        return false;
+    }
+
+    StringSetAdd(cls->tags, xstrdup(tag));
+
+    if (NameIndexStarted(table->index))
+    {
+        char *expr = ClassRefToString(cls->ns, cls->name);
+        NameIndexPut(table->index, expr, cls, cls->tags);
+        free(expr);
+    }
+    return true;
+}
+
 Class *ClassTableMatch(const ClassTable *table, const char *regex)
 {
     ClassTableIterator *it = ClassTableIteratorNew(table, NULL, true, true);
     Class *cls = NULL;
 
-    pcre *pattern = CompileRegex(regex);
+    CachedRegex *pattern = RegexCacheGet(regex);
     if (pattern == NULL)
     {
         // TODO: perhaps pcre has can give more info on this error?
@@ -191,12 +232,12 @@ Class *ClassTableMatch(const ClassTable *table, const char *regex)
         if (cls->ns)
         {
             char *class_expr = ClassRefToString(cls->ns, cls->name);
-            matched = StringMatchFullWithPrecompiledRegex(pattern, class_expr);
+            matched = CachedRegexMatchFull(pattern, class_expr);
             free(class_expr);
         }
         else
         {
-            matched = StringMatchFullWithPrecompiledRegex(pattern, cls->name);
+            matched = CachedRegexMatchFull(pattern, cls->name);
         }
 
         if (matched)
@@ -205,7 +246,7 @@ Class *ClassTableMatch(const ClassTable *table, const char *regex)
         }
     }
 
-    pcre_free(pattern);
+    RegexCacheRelease(pattern);
 
     ClassTableIteratorDestroy(it);
     return cls;
@@ -221,12 +262,18 @@ bool ClassTableRemove(ClassTable *table, const char *ns, const char *name)
     char fullname[ strlen(ns) + 1 + strlen(name) + 1 ];
     xsnprintf(fullname, sizeof(fullname), "%s:%s", ns, name);
 
+    if (NameIndexStarted(table->index))
+    {
+        NameIndexRemove(table->index, ClassMapGet(table->classes, fullname));
+    }
+
     return ClassMapRemove(table->classes, fullname);
 }
 
 bool ClassTableClear(ClassTable *table)
 {
     bool has_classes = (ClassMapSize(table->classes) > 0);
+    NameIndexClear(table->index);
     ClassMapClear(table->classes);
     return has_classes;
 }
@@ -237,21 +284,65 @@ ClassTableIterator *ClassTableIteratorNew(const ClassTable *table,
 {
     ClassTableIterator *iter = xmalloc(sizeof(*iter));
 
+    iter->table = table;
     iter->ns = ns ? xstrdup(ns) : NULL;
     iter->iter = MapIteratorInit(table->classes->impl);
+    iter->candidates = NULL;
+    iter->next_candidate = 0;
     iter->is_soft = is_soft;
     iter->is_hard = is_hard;
 
     return iter;
 }
 
+void ClassTableIteratorNarrow(ClassTableIterator *iter,
+                              const char *regex, const Rlist *tag_regexes)
+{
+    assert(iter != NULL);
+    assert(regex != NULL);
+
+    NameIndex *index = iter->table->index;
+    if (!NameIndexStarted(index))
+    {
+        NameIndexStart(index);
+
+        MapIterator it = MapIteratorInit(iter->table->classes->impl);
+        MapKeyValue *item;
+        while ((item = MapIteratorNext(&it)) != NULL)
+        {
+            Class *cls = item->value;
+            char *expr = ClassRefToString(cls->ns, cls->name);
+            NameIndexPut(index, expr, cls, cls->tags);
+            free(expr);
+        }
+    }
+
+    SeqDestroy(iter->candidates);
+    iter->candidates = NameIndexLookup(index, regex, tag_regexes);
+    iter->next_candidate = 0;
+}
+
+static Class *ClassTableIteratorNextCandidate(ClassTableIterator *iter)
+{
+    if (iter->candidates != NULL)
+    {
+        if (iter->next_candidate < SeqLength(iter->candidates))
+        {
+            return SeqAt(iter->candidates, iter->next_candidate++);
+        }
+        return NULL;
+    }
+
+    MapKeyValue *keyvalue = MapIteratorNext(&iter->iter);
+    return (keyvalue != NULL) ? keyvalue->value : NULL;
+}
+
 Class *ClassTableIteratorNext(ClassTableIterator *iter)
 {
-    MapKeyValue *keyvalue;
+    Class *cls;
 
-    while ((keyvalue = MapIteratorNext(&iter->iter)) != NULL)
+    while ((cls = ClassTableIteratorNextCandidate(iter)) != NULL)
     {
-        Class *cls = keyvalue->value;
 
         /* Make sure we never store "default" as namespace in the ClassTable,
          * instead we have always ns==NULL in that case. */
@@ -287,6 +378,7 @@ void ClassTableIteratorDestroy(ClassTableIterator *iter)
 {
     if (iter)
     {
+        SeqDestroy(iter->candidates);
         free(iter->ns);
         free(iter);
     }
@@ -48,12 +48,22 @@ void ClassTableDestroy(ClassTable *table);
 bool ClassTablePut(ClassTable *table, const char *ns, const char *name, bool is_soft, ContextScope scope,
                    StringSet *tags, const char *comment);
 Class *ClassTableGet(const ClassTable *table, const char *ns, const char *name);
+/* Tags of classes in the table must be added through this, not to cls->tags. */
+bool ClassTableAddTag(ClassTable *table, const char *ns, const char *name, const char *tag);
 Class *ClassTableMatch(const ClassTable *table, const char *regex);
 bool ClassTableRemove(ClassTable *table, const char *ns, const char *name);
 
 bool ClassTableClear(ClassTable *table);
 
 ClassTableIterator *ClassTableIteratorNew(const ClassTable *table, const char *ns, bool is_hard, bool is_soft);
+/**
+ * Restricts #iter to the classes whose expression #regex could match and,
+ * unless #tag_regexes is NULL, with a tag one of them could match. Those are
+ * still to be matched, but looked up in an index of the table instead of
+ * visiting all of them.
+ */
+void ClassTableIteratorNarrow(ClassTableIterator *iter,
+                              const char *regex, const Rlist *tag_regexes);
 Class *ClassTableIteratorNext(ClassTableIterator *iter);
 void ClassTableIteratorDestroy(ClassTableIterator *iter);
 
@@ -0,0 +1,881 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <data_file_cache.h>
+
+#include <map.h>
+#include <sequence.h>
+#include <alloc.h>
+#include <buffer.h>
+#include <logging.h>
+#include <file_lib.h>                       /* FullWrite, safe_open_create_perms */
+#include <dir.h>                                 /* DirOpen, DirRead, DirClose */
+#include <known_dirs.h>                                       /* GetStateDir */
+#include <string_lib.h>                              /* StringHash, StringFormat */
+#include <prototypes3.h>                                          /* Version */
+
+#include <utime.h>
+
+#ifndef __MINGW32__
+# include <sys/mman.h>
+#endif
+
+#define DATA_CACHE_DIR "data_cache"
+#define DATA_CACHE_MAGIC "CFDCACHE"
+/* Bump whenever the format changes. */
+#define DATA_CACHE_FORMAT 1
+/* Written in host byte order, tells us if the cache was not. */
+#define DATA_CACHE_BYTE_ORDER 0x01020304
+/* Cache files loaded are touched at most this often, their modification
+ * time tells DataFileCachePurge() when they were last used. */
+#define DATA_CACHE_TOUCH_INTERVAL SECONDS_PER_HOUR
+
+/* Rough memory use of a JsonElement and its Seq or value, on top of the
+ * strings it holds. */
+#define DATA_ELEMENT_OVERHEAD (8 * sizeof(void *))
+
+enum
+{
+    DATA_NODE_OBJECT,
+    DATA_NODE_ARRAY,
+    DATA_NODE_PRIMITIVE,
+};
+
+/* What a file has to still look like for its cached data to be used. */
+typedef struct
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t mtime;
+    uint64_t ctime;
+    uint64_t size;
+} DataFileStamp;
+
+typedef struct DataFileCacheEntry_ DataFileCacheEntry;
+struct DataFileCacheEntry_
+{
+    char *key;                          /* type, maximum size and path */
+    DataFileStamp stamp;
+    JsonElement *data;
+    size_t size;                        /* DataMemorySize() of #data */
+    DataFileCacheEntry *newer;
+    DataFileCacheEntry *older;
+};
+
+static Map *DATA_FILE_CACHE = NULL;     /* key -> DataFileCacheEntry */
+static DataFileCacheEntry *DATA_FILE_CACHE_NEWEST = NULL;
+static DataFileCacheEntry *DATA_FILE_CACHE_OLDEST = NULL;
+static size_t DATA_FILE_CACHE_SIZE = 0; /* sum of the sizes of the entries */
+static size_t DATA_FILE_CACHE_HITS = 0;
+static size_t DATA_FILE_CACHE_MISSES = 0;
+static size_t DATA_FILE_CACHE_DISK_HITS = 0;
+static bool DATA_FILE_CACHE_PERSISTENT = false;
+
+static void DataFileStampInit(DataFileStamp *stamp, const struct stat *sb)
+{
+    stamp->dev = sb->st_dev;
+    stamp->ino = sb->st_ino;
+    stamp->mtime = sb->st_mtime;
+    stamp->ctime = sb->st_ctime;
+    stamp->size = sb->st_size;
+}
+
+static bool DataFileStampEqual(const DataFileStamp *a, const DataFileStamp *b)
+{
+    return (a->dev == b->dev &&
+            a->ino == b->ino &&
+            a->mtime == b->mtime &&
+            a->ctime == b->ctime &&
+            a->size == b->size);
+}
+
+/*********************************************************************/
+/* Writing                                                           */
+/*********************************************************************/
+
+static void WriteU8(Buffer *out, uint8_t value)
+{
+    BufferAppend(out, (const char *) &value, sizeof(value));
+}
+
+static void WriteU32(Buffer *out, uint32_t value)
+{
+    BufferAppend(out, (const char *) &value, sizeof(value));
+}
+
+static void WriteU64(Buffer *out, uint64_t value)
+{
+    BufferAppend(out, (const char *) &value, sizeof(value));
+}
+
+static void WriteString(Buffer *out, const char *str)
+{
+    assert(str != NULL);
+
+    const size_t len = strlen(str);
+    WriteU32(out, len);
+    BufferAppend(out, str, len);
+}
+
+static void WriteElement(Buffer *out, const JsonElement *element)
+{
+    if (JsonGetElementType(element) == JSON_ELEMENT_TYPE_PRIMITIVE)
+    {
+        WriteU8(out, DATA_NODE_PRIMITIVE);
+        WriteU8(out, JsonGetPrimitiveType(element));
+        WriteString(out, JsonPrimitiveGetAsString(element));
+        return;
+    }
+
+    const bool is_object = (JsonGetContainerType(element) == JSON_CONTAINER_TYPE_OBJECT);
+    WriteU8(out, is_object ? DATA_NODE_OBJECT : DATA_NODE_ARRAY);
+    WriteU32(out, JsonLength(element));
+
+    JsonIterator it = JsonIteratorInit(element);
+    const JsonElement *child;
+    while ((child = JsonIteratorNextValue(&it)) != NULL)
+    {
+        if (is_object)
+        {
+            WriteString(out, JsonIteratorCurrentKey(&it));
+        }
+        WriteElement(out, child);
+    }
+}
+
+static void WriteHeader(Buffer *out, const char *key, const DataFileStamp *stamp)
+{
+    BufferAppend(out, DATA_CACHE_MAGIC, strlen(DATA_CACHE_MAGIC));
+    WriteU32(out, DATA_CACHE_FORMAT);
+    WriteU32(out, DATA_CACHE_BYTE_ORDER);
+    WriteString(out, Version());
+    WriteString(out, key);
+    WriteU64(out, stamp->dev);
+    WriteU64(out, stamp->ino);
+    WriteU64(out, stamp->mtime);
+    WriteU64(out, stamp->ctime);
+    WriteU64(out, stamp->size);
+}
+
+/*********************************************************************/
+/* Reading                                                           */
+/*********************************************************************/
+
+/* Reads never go past the end, the first read that would sets #error and
+ * every read after it returns zeroes and NULLs. */
+typedef struct
+{
+    const char *data;
+    size_t size;
+    size_t pos;
+    bool error;
+} CacheReader;
+
+static void ReadBytes(CacheReader *in, void *out, size_t len)
+{
+    if (in->error || len > in->size - in->pos)
+    {
+        in->error = true;
+        memset(out, 0, len);
+        return;
+    }
+
+    memcpy(out, in->data + in->pos, len);   /* the data may not be aligned */
+    in->pos += len;
+}
+
+static uint8_t ReadU8(CacheReader *in)
+{
+    uint8_t value;
+    ReadBytes(in, &value, sizeof(value));
+    return value;
+}
+
+static uint32_t ReadU32(CacheReader *in)
+{
+    uint32_t value;
+    ReadBytes(in, &value, sizeof(value));
+    return value;
+}
+
+static uint64_t ReadU64(CacheReader *in)
+{
+    uint64_t value;
+    ReadBytes(in, &value, sizeof(value));
+    return value;
+}
+
+/* Number of elements to follow, each takes at least one byte. */
+static uint32_t ReadCount(CacheReader *in)
+{
+    uint32_t count = ReadU32(in);
+    if (count > in->size - in->pos)
+    {
+        in->error = true;
+        return 0;
+    }
+    return count;
+}
+
+static char *ReadString(CacheReader *in)
+{
+    uint32_t len = ReadU32(in);
+    if (in->error)
+    {
+        return NULL;
+    }
+    if (len > in->size - in->pos)
+    {
+        in->error = true;
+        return NULL;
+    }
+
+    char *str = xstrndup(in->data + in->pos, len);
+    in->pos += len;
+    return str;
+}
+
+/* Numbers keep the text they were parsed from, parse it again. */
+static JsonElement *ParseNumber(const char *text)
+{
+    char *wrapped = StringConcatenate(3, "[", text, "]");
+    const char *data = wrapped;
+    JsonElement *array = NULL;
+
+    JsonElement *number = NULL;
+    if (JsonParse(&data, &array) == JSON_PARSE_OK &&
+        JsonGetElementType(array) == JSON_ELEMENT_TYPE_CONTAINER &&
+        JsonLength(array) == 1)
+    {
+        number = JsonCopy(JsonArrayGet(array, 0));
+    }
+
+    JsonDestroy(array);
+    free(wrapped);
+    return number;
+}
+
+static JsonElement *ReadPrimitive(CacheReader *in)
+{
+    const uint8_t type = ReadU8(in);
+    char *text = ReadString(in);
+    if (text == NULL)
+    {
+        return NULL;
+    }
+
+    JsonElement *primitive = NULL;
+    switch (type)
+    {
+    case JSON_PRIMITIVE_TYPE_STRING:
+        primitive = JsonStringCreate(text);
+        break;
+    case JSON_PRIMITIVE_TYPE_INTEGER:
+    case JSON_PRIMITIVE_TYPE_REAL:
+        primitive = ParseNumber(text);
+        break;
+    case JSON_PRIMITIVE_TYPE_BOOL:
+        primitive = JsonBoolCreate(StringEqual(text, "true"));
+        break;
+    case JSON_PRIMITIVE_TYPE_NULL:
+        primitive = JsonNullCreate();
+        break;
+    default:
+        break;
+    }
+    free(text);
+
+    if (primitive == NULL)
+    {
+        in->error = true;
+    }
+    return primitive;
+}
+
+static JsonElement *ReadElement(CacheReader *in)
+{
+    const uint8_t node = ReadU8(in);
+    if (node == DATA_NODE_PRIMITIVE)
+    {
+        return ReadPrimitive(in);
+    }
+    if (node != DATA_NODE_OBJECT && node != DATA_NODE_ARRAY)
+    {
+        in->error = true;
+        return NULL;
+    }
+
+    const uint32_t count = ReadCount(in);
+    JsonElement *container = (node == DATA_NODE_OBJECT) ?
+        JsonObjectCreate(count) : JsonArrayCreate(count);
+
+    for (uint32_t i = 0; i < count && !in->error; i++)
+    {
+        if (node == DATA_NODE_OBJECT)
+        {
+            char *key = ReadString(in);
+            JsonElement *child = ReadElement(in);
+            if (key != NULL && child != NULL)
+            {
+                JsonObjectAppendElement(container, key, child);
+            }
+            else
+            {
+                JsonDestroy(child);
+            }
+            free(key);
+        }
+        else
+        {
+            JsonElement *child = ReadElement(in);
+            if (child != NULL)
+            {
+                JsonArrayAppendElement(container, child);
+            }
+        }
+    }
+
+    if (in->error)
+    {
+        JsonDestroy(container);
+        return NULL;
+    }
+    return container;
+}
+
+static bool ReadHeader(CacheReader *in, const char *key, const DataFileStamp *stamp)
+{
+    const size_t magic_len = strlen(DATA_CACHE_MAGIC);
+    if (in->size < magic_len ||
+        memcmp(in->data, DATA_CACHE_MAGIC, magic_len) != 0)
+    {
+        return false;
+    }
+    in->pos = magic_len;
+
+    if (ReadU32(in) != DATA_CACHE_FORMAT ||
+        ReadU32(in) != DATA_CACHE_BYTE_ORDER)
+    {
+        return false;
+    }
+
+    char *version = ReadString(in);
+    char *cached_key = ReadString(in);
+    DataFileStamp cached_stamp;
+    cached_stamp.dev = ReadU64(in);
+    cached_stamp.ino = ReadU64(in);
+    cached_stamp.mtime = ReadU64(in);
+    cached_stamp.ctime = ReadU64(in);
+    cached_stamp.size = ReadU64(in);
+
+    bool matches = (!in->error &&
+                    StringEqual(version, Version()) &&
+                    StringEqual(cached_key, key) &&
+                    DataFileStampEqual(&cached_stamp, stamp));
+    free(version);
+    free(cached_key);
+
+    return matches;
+}
+
+static JsonElement *DeserializeData(const char *data, size_t size,
+                                    const char *key, const DataFileStamp *stamp)
+{
+    CacheReader in = { .data = data, .size = size, .pos = 0, .error = false };
+    if (!ReadHeader(&in, key, stamp))
+    {
+        return NULL;
+    }
+
+    JsonElement *element = ReadElement(&in);
+    if (in.error || in.pos != in.size)
+    {
+        JsonDestroy(element);
+        return NULL;
+    }
+    return element;
+}
+
+/*********************************************************************/
+/* Files                                                             */
+/*********************************************************************/
+
+static void CacheFilePath(char *out, size_t size, const char *key)
+{
+    /* Collisions just make the header not match. */
+    snprintf(out, size, "%s%c%s%c%08x.data", GetStateDir(), FILE_SEPARATOR,
+             DATA_CACHE_DIR, FILE_SEPARATOR, StringHash(key, 0));
+}
+
+static bool DataCacheStore(const char *key, const DataFileStamp *stamp,
+                           const JsonElement *data)
+{
+    char cache_path[PATH_MAX];
+    CacheFilePath(cache_path, sizeof(cache_path), key);
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s%c%s", GetStateDir(), FILE_SEPARATOR,
+             DATA_CACHE_DIR);
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create data cache directory '%s' (mkdir: %s)",
+            dir, GetErrorStr());
+        return false;
+    }
+
+    Buffer *serialized = BufferNew();
+    WriteHeader(serialized, key, stamp);
+    WriteElement(serialized, data);
+
+    /* Write it next to where it belongs and rename it into place, so that
+     * concurrent agents never see half of it. */
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ju", cache_path, (uintmax_t) getpid());
+
+    bool stored = false;
+    int fd = safe_open_create_perms(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                                    0600);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create data cache file '%s' (open: %s)",
+            tmp_path, GetErrorStr());
+    }
+    else
+    {
+        const bool written = (FullWrite(fd, BufferData(serialized),
+                                        BufferSize(serialized)) >= 0);
+        if (close(fd) == -1 || !written)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Could not write data cache file '%s' (write: %s)",
+                tmp_path, GetErrorStr());
+            unlink(tmp_path);
+        }
+        else if (rename(tmp_path, cache_path) == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Could not rename data cache file '%s' (rename: %s)",
+                tmp_path, GetErrorStr());
+            unlink(tmp_path);
+        }
+        else
+        {
+            stored = true;
+        }
+    }
+
+    BufferDestroy(serialized);
+    return stored;
+}
+
+static JsonElement *DataCacheLoad(const char *key, const DataFileStamp *stamp)
+{
+    char cache_path[PATH_MAX];
+    CacheFilePath(cache_path, sizeof(cache_path), key);
+
+    int fd = safe_open(cache_path, O_RDONLY | O_BINARY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    const size_t size = sb.st_size;
+    const time_t mtime = sb.st_mtime;
+
+    JsonElement *data = NULL;
+
+#ifndef __MINGW32__
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    data = DeserializeData(mapped, size, key, stamp);
+    munmap(mapped, size);
+#else
+    char *buffer = xmalloc(size);
+    const ssize_t n_read = FullRead(fd, buffer, size);
+    close(fd);
+    if (n_read == (ssize_t) size)
+    {
+        data = DeserializeData(buffer, size, key, stamp);
+    }
+    free(buffer);
+#endif
+
+    if (data == NULL)
+    {
+        Log(LOG_LEVEL_DEBUG, "Cached data '%s' is stale or corrupt", cache_path);
+    }
+    else if (time(NULL) - mtime >= DATA_CACHE_TOUCH_INTERVAL &&
+             utime(cache_path, NULL) == -1)
+    {
+        Log(LOG_LEVEL_DEBUG, "Could not touch data cache file '%s' (utime: %s)",
+            cache_path, GetErrorStr());
+    }
+    return data;
+}
+
+/* A file in the data cache directory, for DataFileCachePurge(). */
+typedef struct
+{
+    char *path;
+    time_t mtime;
+    size_t size;
+} DataCacheFile;
+
+static void DataCacheFileDestroy(void *file)
+{
+    if (file != NULL)
+    {
+        free(((DataCacheFile *) file)->path);
+        free(file);
+    }
+}
+
+static int DataCacheFileCompareMtime(const void *a, const void *b,
+                                     ARG_UNUSED void *user_data)
+{
+    const time_t a_mtime = ((const DataCacheFile *) a)->mtime;
+    const time_t b_mtime = ((const DataCacheFile *) b)->mtime;
+    return (a_mtime > b_mtime) - (a_mtime < b_mtime);
+}
+
+static void DataCacheUnlink(const DataCacheFile *file)
+{
+    if (unlink(file->path) == -1 && errno != ENOENT)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not remove data cache file '%s' (unlink: %s)",
+            file->path, GetErrorStr());
+    }
+    else
+    {
+        Log(LOG_LEVEL_DEBUG, "Removed data cache file '%s'", file->path);
+    }
+}
+
+void DataFileCachePurge(time_t now)
+{
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s%c%s", GetStateDir(), FILE_SEPARATOR,
+             DATA_CACHE_DIR);
+    Dir *dir = DirOpen(dir_path);
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    Seq *files = SeqNew(16, DataCacheFileDestroy);
+    size_t total_size = 0;
+
+    for (const struct dirent *entry = DirRead(dir); entry != NULL; entry = DirRead(dir))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        DataCacheFile file = {
+            .path = StringFormat("%s%c%s", dir_path, FILE_SEPARATOR, entry->d_name),
+        };
+        struct stat sb;
+        if (stat(file.path, &sb) == -1 || !S_ISREG(sb.st_mode))
+        {
+            free(file.path);
+            continue;
+        }
+        file.mtime = sb.st_mtime;
+        file.size = sb.st_size;
+
+        /* Files of data no longer read, stale ones are replaced when read,
+         * and temporary ones left behind by agents killed while writing. */
+        if (now - file.mtime > DATA_FILE_CACHE_HORIZON)
+        {
+            DataCacheUnlink(&file);
+            free(file.path);
+            continue;
+        }
+
+        DataCacheFile *kept = xmalloc(sizeof(DataCacheFile));
+        *kept = file;
+        SeqAppend(files, kept);
+        total_size += file.size;
+    }
+    DirClose(dir);
+
+    /* The least recently used first. */
+    SeqSort(files, DataCacheFileCompareMtime, NULL);
+    for (size_t i = 0; i < SeqLength(files) && total_size > DATA_FILE_CACHE_MAX_DISK_SIZE; i++)
+    {
+        const DataCacheFile *file = SeqAt(files, i);
+        DataCacheUnlink(file);
+        total_size -= file->size;
+    }
+
+    SeqDestroy(files);
+}
+
+/*********************************************************************/
+/* Memory                                                            */
+/*********************************************************************/
+
+/* Estimate of what #element takes in memory, which is what the limit is
+ * about, rather than the size of the file it was parsed from. */
+static size_t DataMemorySize(const JsonElement *element)
+{
+    if (JsonGetElementType(element) == JSON_ELEMENT_TYPE_PRIMITIVE)
+    {
+        return DATA_ELEMENT_OVERHEAD + strlen(JsonPrimitiveGetAsString(element)) + 1;
+    }
+
+    const bool is_object = (JsonGetContainerType(element) == JSON_CONTAINER_TYPE_OBJECT);
+    size_t size = DATA_ELEMENT_OVERHEAD;
+
+    JsonIterator it = JsonIteratorInit(element);
+    const JsonElement *child;
+    while ((child = JsonIteratorNextValue(&it)) != NULL)
+    {
+        size += sizeof(void *) + DataMemorySize(child);
+        if (is_object)
+        {
+            size += strlen(JsonIteratorCurrentKey(&it)) + 1;
+        }
+    }
+    return size;
+}
+
+static void DataFileCacheUnlink(DataFileCacheEntry *entry)
+{
+    if (entry->newer != NULL)
+    {
+        entry->newer->older = entry->older;
+    }
+    else
+    {
+        DATA_FILE_CACHE_NEWEST = entry->older;
+    }
+
+    if (entry->older != NULL)
+    {
+        entry->older->newer = entry->newer;
+    }
+    else
+    {
+        DATA_FILE_CACHE_OLDEST = entry->newer;
+    }
+
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+static void DataFileCacheLinkNewest(DataFileCacheEntry *entry)
+{
+    entry->older = DATA_FILE_CACHE_NEWEST;
+    if (DATA_FILE_CACHE_NEWEST != NULL)
+    {
+        DATA_FILE_CACHE_NEWEST->newer = entry;
+    }
+    DATA_FILE_CACHE_NEWEST = entry;
+    if (DATA_FILE_CACHE_OLDEST == NULL)
+    {
+        DATA_FILE_CACHE_OLDEST = entry;
+    }
+}
+
+static void DataFileCacheEvict(DataFileCacheEntry *entry)
+{
+    DataFileCacheUnlink(entry);
+    MapRemove(DATA_FILE_CACHE, entry->key);
+    DATA_FILE_CACHE_SIZE -= entry->size;
+
+    JsonDestroy(entry->data);
+    free(entry->key);
+    free(entry);
+}
+
+/* Takes #key and #data, which are freed right away if too big to cache. */
+static void DataFileCacheInsert(char *key, const DataFileStamp *stamp, JsonElement *data)
+{
+    const size_t size = DataMemorySize(data);
+    if (size > DATA_FILE_CACHE_MAX_SIZE)
+    {
+        free(key);
+        JsonDestroy(data);
+        return;
+    }
+
+    if (DATA_FILE_CACHE == NULL)
+    {
+        DATA_FILE_CACHE = MapNew(StringHash_untyped, StringEqual_untyped, NULL, NULL);
+    }
+
+    DataFileCacheEntry *entry = xcalloc(1, sizeof(DataFileCacheEntry));
+    entry->key = key;
+    entry->stamp = *stamp;
+    entry->data = data;
+    entry->size = size;
+
+    MapInsert(DATA_FILE_CACHE, entry->key, entry);
+    DataFileCacheLinkNewest(entry);
+    DATA_FILE_CACHE_SIZE += size;
+
+    while (DATA_FILE_CACHE_SIZE > DATA_FILE_CACHE_MAX_SIZE)
+    {
+        DataFileCacheEvict(DATA_FILE_CACHE_OLDEST);
+    }
+}
+
+static bool IsCacheable(const struct stat *sb)
+{
+    /* A file changed within the granularity of its timestamps could change
+     * again without them changing. */
+    return (S_ISREG(sb->st_mode) &&
+            sb->st_size <= DATA_FILE_CACHE_MAX_SIZE &&
+            time(NULL) - sb->st_mtime >= DATA_FILE_CACHE_MIN_AGE &&
+            time(NULL) - sb->st_ctime >= DATA_FILE_CACHE_MIN_AGE);
+}
+
+JsonElement *DataFileCacheRead(const char *log_identifier, const char *path,
+                               DataFileType requested_mode, size_t size_max)
+{
+    assert(path != NULL);
+
+    struct stat sb;
+    if (stat(path, &sb) == -1 || !IsCacheable(&sb))
+    {
+        return JsonReadDataFile(log_identifier, path, requested_mode, size_max);
+    }
+
+    DataFileStamp stamp;
+    DataFileStampInit(&stamp, &sb);
+    char *key = StringFormat("%d %zu %s", (int) requested_mode, size_max, path);
+
+    DataFileCacheEntry *entry = (DATA_FILE_CACHE != NULL) ?
+        MapGet(DATA_FILE_CACHE, key) : NULL;
+    if (entry != NULL)
+    {
+        if (DataFileStampEqual(&entry->stamp, &stamp))
+        {
+            DATA_FILE_CACHE_HITS++;
+            DataFileCacheUnlink(entry);
+            DataFileCacheLinkNewest(entry);
+            free(key);
+
+            Log(LOG_LEVEL_DEBUG, "%s: using cached data of '%s'", log_identifier, path);
+            return JsonCopy(entry->data);
+        }
+        DataFileCacheEvict(entry);
+    }
+    DATA_FILE_CACHE_MISSES++;
+
+    JsonElement *data = NULL;
+    if (DATA_FILE_CACHE_PERSISTENT)
+    {
+        data = DataCacheLoad(key, &stamp);
+        if (data != NULL)
+        {
+            DATA_FILE_CACHE_DISK_HITS++;
+            Log(LOG_LEVEL_DEBUG, "%s: loaded cached data of '%s' from disk",
+                log_identifier, path);
+        }
+    }
+
+    if (data == NULL)
+    {
+        data = JsonReadDataFile(log_identifier, path, requested_mode, size_max);
+        if (data == NULL)
+        {
+            free(key);
+            return NULL;
+        }
+
+        if (DATA_FILE_CACHE_PERSISTENT)
+        {
+            DataCacheStore(key, &stamp, data);
+        }
+    }
+
+    JsonElement *copy = JsonCopy(data);
+    DataFileCacheInsert(key, &stamp, data);
+    return copy;
+}
+
+void DataFileCacheSetPersistent(bool persistent)
+{
+    DATA_FILE_CACHE_PERSISTENT = persistent;
+}
+
+void DataFileCacheClear(void)
+{
+    while (DATA_FILE_CACHE_OLDEST != NULL)
+    {
+        DataFileCacheEvict(DATA_FILE_CACHE_OLDEST);
+    }
+    MapDestroy(DATA_FILE_CACHE);
+    DATA_FILE_CACHE = NULL;
+
+    DATA_FILE_CACHE_HITS = 0;
+    DATA_FILE_CACHE_MISSES = 0;
+    DATA_FILE_CACHE_DISK_HITS = 0;
+}
+
+void DataFileCacheStats(size_t *hits, size_t *misses, size_t *disk_hits, size_t *size)
+{
+    if (hits != NULL)
+    {
+        *hits = DATA_FILE_CACHE_HITS;
+    }
+    if (misses != NULL)
+    {
+        *misses = DATA_FILE_CACHE_MISSES;
+    }
+    if (disk_hits != NULL)
+    {
+        *disk_hits = DATA_FILE_CACHE_DISK_HITS;
+    }
+    if (size != NULL)
+    {
+        *size = DATA_FILE_CACHE_SIZE;
+    }
+}
+
+void DataFileCacheLogStats(void)
+{
+    if (DATA_FILE_CACHE_HITS == 0 && DATA_FILE_CACHE_MISSES == 0)
+    {
+        return;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Data file cache: %zu hits, %zu misses (%zu loaded from %s), about %zu bytes of data cached",
+        DATA_FILE_CACHE_HITS, DATA_FILE_CACHE_MISSES, DATA_FILE_CACHE_DISK_HITS,
+        DATA_CACHE_DIR, DATA_FILE_CACHE_SIZE);
+}
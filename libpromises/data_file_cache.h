@@ -0,0 +1,84 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_DATA_FILE_CACHE_H
+#define CFENGINE_DATA_FILE_CACHE_H
+
+#include <platform.h>
+#include <json.h>
+#include <json-utils.h>                                   /* DataFileType */
+#include <cf3.defs.h>                                 /* SECONDS_PER_WEEK */
+
+/**
+ * Cache of data files parsed by readjson(), readyaml(), readdata() and the
+ * like, so that a file read by several bundles, or on every pass, is only
+ * parsed once per run.
+ *
+ * Files are cached by path, type and maximum size, and only used while they
+ * still have the device, inode, modification and change times and size they
+ * had when read. Files changed in the last DATA_FILE_CACHE_MIN_AGE seconds,
+ * larger than DATA_FILE_CACHE_MAX_SIZE or not regular are always read.
+ * The least recently used files are forgotten once their parsed data takes
+ * more than about DATA_FILE_CACHE_MAX_SIZE bytes of memory.
+ *
+ * With DataFileCacheSetPersistent(), parsed files are also kept in a binary
+ * format in $(sys.statedir)/data_cache, to be mmap()ed by the next runs
+ * instead of parsing the files again. DataFileCachePurge() removes the ones
+ * not used for DATA_FILE_CACHE_HORIZON seconds, and the least recently used
+ * ones while they add up to more than DATA_FILE_CACHE_MAX_DISK_SIZE bytes.
+ *
+ * Not thread-safe, meant for policy evaluation.
+ */
+
+#define DATA_FILE_CACHE_MAX_SIZE (64 * 1024 * 1024)
+#define DATA_FILE_CACHE_MIN_AGE 2
+#define DATA_FILE_CACHE_HORIZON SECONDS_PER_WEEK
+#define DATA_FILE_CACHE_MAX_DISK_SIZE (4 * DATA_FILE_CACHE_MAX_SIZE)
+
+/**
+ * JsonReadDataFile() through the cache.
+ *
+ * @return a copy the caller owns, NULL on errors, logged by JsonReadDataFile()
+ */
+JsonElement *DataFileCacheRead(const char *log_identifier, const char *path,
+                               DataFileType requested_mode, size_t size_max);
+
+void DataFileCacheSetPersistent(bool persistent);
+
+/**
+ * Garbage-collect $(sys.statedir)/data_cache, whether or not this agent
+ * uses it.
+ */
+void DataFileCachePurge(time_t now);
+
+/**
+ * Forget all the cached files, not those in $(sys.statedir)/data_cache, and
+ * reset the statistics.
+ */
+void DataFileCacheClear(void);
+void DataFileCacheStats(size_t *hits, size_t *misses, size_t *disk_hits, size_t *size);
+void DataFileCacheLogStats(void);
+
+#endif
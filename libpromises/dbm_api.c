@@ -35,6 +35,7 @@
 #include <known_dirs.h>
 #include <string_lib.h>
 #include <time.h>          /* time() */
+#include <profiling.h>
 
 
 static bool DBPathLock(FileLock *lock, const char *filename);
@@ -65,8 +66,37 @@ struct DBHandle_
      * @see FreezeDB()
      */
     bool frozen;
+
+    /* Writes kept in memory to be committed together, see DBBeginBatch()
+     * and DBSetGroupCommit(). Set while either is in effect, cleared once the
+     * last of them ends and pending is committed, see DBStopBuffering(). */
+    bool buffered;
+
+    /* Protects the members below, never held across a DB write. */
+    pthread_mutex_t pending_lock;
+    pthread_cond_t pending_cond;         /* pending filled up or flusher stopping */
+    Map *pending;                        /* DBPendingWrite -> itself, or NULL */
+    Map *flushing;                       /* the ones being committed, or NULL */
+    struct timespec pending_since;       /* CLOCK_REALTIME, of the oldest pending */
+    int batches;                         /* DBBeginBatch() without DBEndBatch() */
+    bool group_commit;                   /* DBSetGroupCommit() holds a reference */
+    size_t max_pending;
+    unsigned int max_latency_ms;
+    bool flusher_running;
+    pthread_t flusher;
+
+    /* Serializes the commits of pending writes, taken before pending_lock. */
+    pthread_mutex_t flush_lock;
 };
 
+typedef struct
+{
+    void *key;
+    int key_size;
+    void *value;                         /* NULL if deleted */
+    int value_size;
+} DBPendingWrite;
+
 struct DBCursor_
 {
     DBCursorPriv *cursor;
@@ -208,6 +238,20 @@ bool IsSubHandle(DBHandle *handle, dbid id, const char *name)
     return result;
 }
 
+static void DBHandleInitLocks(DBHandle *handle)
+{
+    /* Initialize mutexes as error-checking ones. */
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+    pthread_mutex_init(&handle->lock, &attr);
+    pthread_mutex_init(&handle->pending_lock, &attr);
+    pthread_mutex_init(&handle->flush_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    pthread_cond_init(&handle->pending_cond, NULL);
+}
+
 static DBHandle *DBHandleGetSubDB(dbid id, const char *name)
 {
     ThreadLock(&db_handles_lock);
@@ -227,13 +271,7 @@ static DBHandle *DBHandleGetSubDB(dbid id, const char *name)
     DBHandle *handle = xcalloc(1, sizeof(DBHandle));
     handle->filename = DBIdToSubPath(id, name);
     handle->subname = SafeStringDuplicate(name);
-
-    /* Initialize mutexes as error-checking ones. */
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
-    pthread_mutex_init(&handle->lock, &attr);
-    pthread_mutexattr_destroy(&attr);
+    DBHandleInitLocks(handle);
 
     /* Prepend handle to global list. */
     handles_list = xcalloc(1, sizeof(DynamicDBHandles));
@@ -254,13 +292,7 @@ static DBHandle *DBHandleGet(int id)
     if (db_handles[id].filename == NULL)
     {
         db_handles[id].filename = DBIdToPath(id);
-
-        /* Initialize mutexes as error-checking ones. */
-        pthread_mutexattr_t attr;
-        pthread_mutexattr_init(&attr);
-        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
-        pthread_mutex_init(&db_handles[id].lock, &attr);
-        pthread_mutexattr_destroy(&attr);
+        DBHandleInitLocks(&db_handles[id]);
     }
 
     ThreadUnlock(&db_handles_lock);
@@ -268,6 +300,348 @@ static DBHandle *DBHandleGet(int id)
     return &db_handles[id];
 }
 
+/******************************************************************************/
+
+static unsigned int DBPendingWriteHash(const void *data, unsigned int seed)
+{
+    const DBPendingWrite *write = data;
+    const unsigned char *key = write->key;
+
+    /* FNV-1a, keys are binary. */
+    unsigned int hash = 2166136261U ^ seed;
+    for (int i = 0; i < write->key_size; i++)
+    {
+        hash ^= key[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static bool DBPendingWriteEqual(const void *a, const void *b)
+{
+    const DBPendingWrite *write_a = a, *write_b = b;
+    return (write_a->key_size == write_b->key_size &&
+            memcmp(write_a->key, write_b->key, write_a->key_size) == 0);
+}
+
+static void DBPendingWriteDestroy(void *data)
+{
+    DBPendingWrite *write = data;
+    free(write->key);
+    free(write->value);
+    free(write);
+}
+
+/* Call with handle->pending_lock held. */
+static const DBPendingWrite *DBPendingLookup(const DBHandle *handle,
+                                             const void *key, int key_size)
+{
+    const DBPendingWrite probe = { .key = (void *) key, .key_size = key_size };
+
+    /* The newer ones first. */
+    const DBPendingWrite *write = NULL;
+    if (handle->pending != NULL)
+    {
+        write = MapGet(handle->pending, &probe);
+    }
+    if (write == NULL && handle->flushing != NULL)
+    {
+        write = MapGet(handle->flushing, &probe);
+    }
+    return write;
+}
+
+/**
+ * Reads #key from the writes not committed yet.
+ *
+ * @param dest where to copy the value to, may be NULL
+ * @param value_size where to store the size of the value, may be NULL
+ * @param exists where to store whether the write left a value or deleted it
+ * @return false if #key has no write pending, the DB has to be asked then
+ */
+static bool DBPendingRead(DBHandle *handle, const void *key, int key_size,
+                          void *dest, int dest_size, int *value_size,
+                          bool *exists)
+{
+    if (!handle->buffered)
+    {
+        return false;
+    }
+
+    ThreadLock(&handle->pending_lock);
+    const DBPendingWrite *write = DBPendingLookup(handle, key, key_size);
+    const bool found = (write != NULL);
+    if (found)
+    {
+        *exists = (write->value != NULL);
+        if (*exists && dest != NULL)
+        {
+            memcpy(dest, write->value, MIN(dest_size, write->value_size));
+        }
+        if (value_size != NULL)
+        {
+            *value_size = *exists ? write->value_size : 0;
+        }
+    }
+    ThreadUnlock(&handle->pending_lock);
+
+    return found;
+}
+
+/**
+ * Replaces the pending write of #key, if any, a NULL #value deletes #key.
+ * Call with handle->pending_lock held.
+ */
+static void DBPendingPut(DBHandle *handle, const void *key, int key_size,
+                         const void *value, int value_size)
+{
+    if (handle->pending == NULL)
+    {
+        handle->pending = MapNew(DBPendingWriteHash, DBPendingWriteEqual,
+                                 DBPendingWriteDestroy, NULL);
+    }
+
+    const DBPendingWrite probe = { .key = (void *) key, .key_size = key_size };
+    DBPendingWrite *write = MapGet(handle->pending, &probe);
+    if (write == NULL)
+    {
+        if (MapSize(handle->pending) == 0)
+        {
+            clock_gettime(CLOCK_REALTIME, &handle->pending_since);
+        }
+
+        write = xcalloc(1, sizeof(DBPendingWrite));
+        write->key = xmemdup(key, key_size);
+        write->key_size = key_size;
+        MapInsert(handle->pending, write, write);
+    }
+    else
+    {
+        free(write->value);
+    }
+
+    write->value = (value != NULL) ? xmemdup(value, value_size) : NULL;
+    write->value_size = (value != NULL) ? value_size : 0;
+
+    if (handle->group_commit && handle->max_pending > 0 &&
+        MapSize(handle->pending) >= handle->max_pending)
+    {
+        pthread_cond_signal(&handle->pending_cond);
+    }
+}
+
+static bool DBBufferWrite(DBHandle *handle, const void *key, int key_size,
+                          const void *value, int value_size)
+{
+    ThreadLock(&handle->pending_lock);
+    if (!handle->buffered)
+    {
+        /* Buffering stopped since the caller checked. */
+        ThreadUnlock(&handle->pending_lock);
+        if (value == NULL)
+        {
+            return DBPrivDelete(handle->priv, key, key_size);
+        }
+        return DBPrivWrite(handle->priv, key, key_size, value, value_size);
+    }
+    DBPendingPut(handle, key, key_size, value, value_size);
+    ThreadUnlock(&handle->pending_lock);
+    return true;
+}
+
+/**
+ * Commits the pending writes of #handle in a single transaction.
+ *
+ * Writes made meanwhile are kept for the next commit, and reads keep seeing
+ * the writes being committed until they are.
+ */
+static bool DBFlushPending(DBHandle *handle)
+{
+    if (!handle->buffered)
+    {
+        return true;
+    }
+
+    /* Our own write transaction would hold off another thread's commit for
+     * good while we wait for it below. */
+    DBPrivCommit(handle->priv);
+
+    ThreadLock(&handle->flush_lock);
+
+    ThreadLock(&handle->pending_lock);
+    Map *writes = handle->pending;
+    handle->pending = NULL;
+    handle->flushing = writes;
+    ThreadUnlock(&handle->pending_lock);
+
+    bool success = true;
+    if (writes != NULL && MapSize(writes) > 0)
+    {
+        MapIterator it = MapIteratorInit(writes);
+        MapKeyValue *item;
+        while ((item = MapIteratorNext(&it)) != NULL)
+        {
+            const DBPendingWrite *write = item->key;
+            if (write->value != NULL)
+            {
+                success = DBPrivWrite(handle->priv, write->key, write->key_size,
+                                      write->value, write->value_size) && success;
+            }
+            else
+            {
+                /* Deleting what isn't there is not an error here. */
+                DBPrivDelete(handle->priv, write->key, write->key_size);
+            }
+        }
+        DBPrivCommit(handle->priv);
+
+        Log(LOG_LEVEL_DEBUG, "Committed %zu writes to '%s' at once",
+            MapSize(writes), handle->filename);
+    }
+
+    ThreadLock(&handle->pending_lock);
+    handle->flushing = NULL;
+    ThreadUnlock(&handle->pending_lock);
+
+    if (writes != NULL)
+    {
+        MapDestroy(writes);
+    }
+
+    ThreadUnlock(&handle->flush_lock);
+    return success;
+}
+
+/**
+ * @return whether a batch or group commit is keeping writes of #handle
+ */
+static bool DBIsGrouping(DBHandle *handle)
+{
+    if (!handle->buffered)
+    {
+        return false;
+    }
+
+    ThreadLock(&handle->pending_lock);
+    const bool grouping = (handle->batches > 0 || handle->group_commit);
+    ThreadUnlock(&handle->pending_lock);
+    return grouping;
+}
+
+/**
+ * Commits the pending writes of #handle and has further writes go straight
+ * to the DB, unless a batch or group commit still keeps them.
+ */
+static bool DBStopBuffering(DBHandle *handle)
+{
+    bool success = true;
+    while (handle->buffered)
+    {
+        success = DBFlushPending(handle) && success;
+
+        ThreadLock(&handle->pending_lock);
+        const bool grouping = (handle->batches > 0 || handle->group_commit);
+        const bool done = ((handle->pending == NULL || MapSize(handle->pending) == 0) &&
+                           handle->flushing == NULL);
+        if (!grouping && done)
+        {
+            handle->buffered = false;
+        }
+        ThreadUnlock(&handle->pending_lock);
+
+        if (grouping)
+        {
+            break;
+        }
+        /* Otherwise written meanwhile, commit those too. */
+    }
+    return success;
+}
+
+static void *DBFlusherMain(void *arg)
+{
+    DBHandle *handle = arg;
+
+    ThreadLock(&handle->pending_lock);
+    while (handle->flusher_running)
+    {
+        const size_t count = (handle->pending != NULL) ? MapSize(handle->pending) : 0;
+        if (count == 0)
+        {
+            pthread_cond_wait(&handle->pending_cond, &handle->pending_lock);
+            continue;
+        }
+
+        if (handle->max_pending == 0 || count < handle->max_pending)
+        {
+            if (handle->max_latency_ms == 0)
+            {
+                /* Only a full buffer is committed. */
+                pthread_cond_wait(&handle->pending_cond, &handle->pending_lock);
+                continue;
+            }
+
+            struct timespec deadline = handle->pending_since;
+            deadline.tv_sec += handle->max_latency_ms / 1000;
+            deadline.tv_nsec += (long) (handle->max_latency_ms % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            if (now.tv_sec < deadline.tv_sec ||
+                (now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec))
+            {
+                pthread_cond_timedwait(&handle->pending_cond, &handle->pending_lock,
+                                       &deadline);
+                continue;
+            }
+        }
+
+        ThreadUnlock(&handle->pending_lock);
+        DBFlushPending(handle);
+        ThreadLock(&handle->pending_lock);
+    }
+    ThreadUnlock(&handle->pending_lock);
+
+    return NULL;
+}
+
+/**
+ * Stops the flusher of #handle, commits what it left and drops the reference
+ * DBSetGroupCommit() held.
+ */
+static void DBStopGroupCommit(DBHandle *handle)
+{
+    ThreadLock(&handle->pending_lock);
+    const bool group_commit = handle->group_commit;
+    const bool flusher_running = handle->flusher_running;
+    handle->flusher_running = false;
+    pthread_cond_broadcast(&handle->pending_cond);
+    ThreadUnlock(&handle->pending_lock);
+
+    if (flusher_running)
+    {
+        pthread_join(handle->flusher, NULL);
+    }
+
+    if (group_commit)
+    {
+        ThreadLock(&handle->pending_lock);
+        handle->group_commit = false;
+        handle->max_pending = 0;
+        handle->max_latency_ms = 0;
+        ThreadUnlock(&handle->pending_lock);
+
+        DBStopBuffering(handle);
+
+        CloseDB(handle);
+    }
+}
+
 static inline
 void CloseDBInstance(DBHandle *handle)
 {
@@ -303,6 +677,7 @@ void CloseDBInstance(DBHandle *handle)
         Log(LOG_LEVEL_ERR,
                 "Database %s refcount is still not zero (%d), forcing CloseDB()!",
                 handle->filename, handle->refcount);
+        DBFlushPending(handle);
         DBPrivCloseDB(handle->priv);
     }
     else /* TODO: can we clean this up unconditionally ? */
@@ -327,6 +702,14 @@ void CloseAllDBExit()
 {
     ThreadLock(&db_handles_lock);
 
+    for (int i = 0; i < dbid_max; i++)
+    {
+        if (db_handles[i].filename && !db_handles[i].frozen)
+        {
+            DBStopGroupCommit(&db_handles[i]);
+        }
+    }
+
     for (int i = 0; i < dbid_max; i++)
     {
         if (db_handles[i].filename)
@@ -469,6 +852,12 @@ time_t GetDBOpenTimestamp(const DBHandle *handle)
     return handle->open_tstamp;
 }
 
+bool GetDBGeneration(DBHandle *handle, size_t *generation)
+{
+    assert(handle != NULL);
+    return DBPrivGetGeneration(handle->priv, generation);
+}
+
 void CloseDB(DBHandle *handle)
 {
     assert(handle != NULL);
@@ -485,6 +874,10 @@ void CloseDB(DBHandle *handle)
         return;
     }
     DBPrivCommit(handle->priv);
+    if (!DBIsGrouping(handle))
+    {
+        DBFlushPending(handle);
+    }
 
     if (handle->refcount < 1)
     {
@@ -497,6 +890,7 @@ void CloseDB(DBHandle *handle)
         handle->refcount--;
         if (handle->refcount == 0)
         {
+            DBFlushPending(handle);
             DBPrivCloseDB(handle->priv);
             handle->open_tstamp = -1;
         }
@@ -514,7 +908,19 @@ bool CleanDB(DBHandle *handle)
         ThreadUnlock(&handle->lock);
         return false;
     }
+
+    /* Nothing pending may survive, not even what is being committed. */
+    ThreadLock(&handle->flush_lock);
+    ThreadLock(&handle->pending_lock);
+    if (handle->pending != NULL)
+    {
+        MapDestroy(handle->pending);
+        handle->pending = NULL;
+    }
+    ThreadUnlock(&handle->pending_lock);
+
     bool ret = DBPrivClean(handle->priv);
+    ThreadUnlock(&handle->flush_lock);
     ThreadUnlock(&handle->lock);
 
     return ret;
@@ -536,57 +942,251 @@ void FreezeDB(DBHandle *handle)
 
 /*****************************************************************************/
 
+void DBBeginBatch(DBHandle *handle)
+{
+    assert(handle != NULL);
+
+    ThreadLock(&handle->pending_lock);
+    handle->buffered = true;
+    handle->batches++;
+    ThreadUnlock(&handle->pending_lock);
+}
+
+bool DBEndBatch(DBHandle *handle)
+{
+    assert(handle != NULL);
+
+    ThreadLock(&handle->pending_lock);
+    if (handle->batches < 1)
+    {
+        ThreadUnlock(&handle->pending_lock);
+        ProgrammingError("DBEndBatch() without DBBeginBatch() on '%s'",
+                         handle->filename);
+    }
+    handle->batches--;
+    const bool outermost = (handle->batches == 0);
+    ThreadUnlock(&handle->pending_lock);
+
+    return outermost ? DBStopBuffering(handle) : true;
+}
+
+bool DBSetGroupCommit(dbid id, size_t max_pending, unsigned int max_latency_ms)
+{
+    DBHandle *handle = DBHandleGet(id);
+    if (handle->frozen)
+    {
+        return false;
+    }
+
+    DBStopGroupCommit(handle);
+    if (max_pending == 0 && max_latency_ms == 0)
+    {
+        return true;
+    }
+
+    /* Keeps the DB open for the flusher. */
+    DBHandle *db;
+    if (!OpenDB(&db, id))
+    {
+        return false;
+    }
+
+    ThreadLock(&handle->pending_lock);
+    handle->buffered = true;
+    handle->group_commit = true;
+    handle->max_pending = max_pending;
+    handle->max_latency_ms = max_latency_ms;
+    handle->flusher_running = true;
+    int ret = pthread_create(&handle->flusher, NULL, DBFlusherMain, handle);
+    if (ret != 0)
+    {
+        handle->flusher_running = false;
+    }
+    ThreadUnlock(&handle->pending_lock);
+
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to start the commit thread of '%s' (pthread_create: %s)",
+            handle->filename, GetErrorStrFromCode(ret));
+        DBStopGroupCommit(handle);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Committing writes to '%s' in groups of up to %zu, at most %u ms late",
+        handle->filename, max_pending, max_latency_ms);
+    return true;
+}
+
+/*****************************************************************************/
+
+static bool DBRead(DBHandle *handle, const void *key, int key_size,
+                   void *dest, int dest_size)
+{
+    bool exists;
+    if (DBPendingRead(handle, key, key_size, dest, dest_size, NULL, &exists))
+    {
+        return exists;
+    }
+    return DBPrivRead(handle->priv, key, key_size, dest, dest_size);
+}
+
+static bool DBWrite(DBHandle *handle, const void *key, int key_size,
+                    const void *value, int value_size)
+{
+    if (handle->buffered)
+    {
+        return DBBufferWrite(handle, key, key_size, value, value_size);
+    }
+    return DBPrivWrite(handle->priv, key, key_size, value, value_size);
+}
+
+static bool DBDelete(DBHandle *handle, const void *key, int key_size)
+{
+    if (handle->buffered)
+    {
+        return DBBufferWrite(handle, key, key_size, NULL, 0);
+    }
+    return DBPrivDelete(handle->priv, key, key_size);
+}
+
 bool ReadComplexKeyDB(DBHandle *handle, const char *key, int key_size,
                       void *dest, int dest_size)
 {
-    return DBPrivRead(handle->priv, key, key_size, dest, dest_size);
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    return DBRead(handle, key, key_size, dest, dest_size);
 }
 
 bool WriteComplexKeyDB(DBHandle *handle, const char *key, int key_size,
                        const void *value, int value_size)
 {
-    return DBPrivWrite(handle->priv, key, key_size, value, value_size);
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    return DBWrite(handle, key, key_size, value, value_size);
 }
 
 bool DeleteComplexKeyDB(DBHandle *handle, const char *key, int key_size)
 {
-    return DBPrivDelete(handle->priv, key, key_size);
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    return DBDelete(handle, key, key_size);
 }
 
 bool ReadDB(DBHandle *handle, const char *key, void *dest, int destSz)
 {
-    return DBPrivRead(handle->priv, key, strlen(key) + 1, dest, destSz);
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    return DBRead(handle, key, strlen(key) + 1, dest, destSz);
 }
 
 bool WriteDB(DBHandle *handle, const char *key, const void *src, int srcSz)
 {
-    return DBPrivWrite(handle->priv, key, strlen(key) + 1, src, srcSz);
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    return DBWrite(handle, key, strlen(key) + 1, src, srcSz);
+}
+
+/* The same as DBPrivOverwrite(), on top of the pending writes. */
+static bool DBBufferOverwrite(DBHandle *handle, const char *key, int key_size,
+                              const void *value, size_t value_size,
+                              OverwriteCondition Condition, void *data)
+{
+    bool ret = true;
+
+    /* Held throughout so that no other write of ours gets in between. */
+    ThreadLock(&handle->pending_lock);
+    if (!handle->buffered)
+    {
+        /* Buffering stopped since the caller checked. */
+        ThreadUnlock(&handle->pending_lock);
+        return DBPrivOverwrite(handle->priv, key, key_size, value, value_size,
+                               Condition, data);
+    }
+    if (Condition != NULL)
+    {
+        void *cur_val = NULL;
+        size_t cur_size = 0;
+
+        const DBPendingWrite *write = DBPendingLookup(handle, key, key_size);
+        if (write != NULL)
+        {
+            if (write->value != NULL)
+            {
+                cur_val = xmemdup(write->value, write->value_size);
+                cur_size = write->value_size;
+            }
+        }
+        else
+        {
+            const int size = DBPrivGetValueSize(handle->priv, key, key_size);
+            if (size > 0)
+            {
+                cur_val = xmalloc(size);
+                if (DBPrivRead(handle->priv, key, key_size, cur_val, size))
+                {
+                    cur_size = size;
+                }
+                else
+                {
+                    FREE_AND_NULL(cur_val);
+                }
+            }
+        }
+
+        ret = Condition(cur_val, cur_size, data);
+        free(cur_val);
+    }
+
+    if (ret)
+    {
+        DBPendingPut(handle, key, key_size, value, value_size);
+    }
+    ThreadUnlock(&handle->pending_lock);
+
+    return ret;
 }
 
 bool OverwriteDB(DBHandle *handle, const char *key, const void *value, size_t value_size,
                  OverwriteCondition Condition, void *data)
 {
     assert(handle != NULL);
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    if (handle->buffered)
+    {
+        return DBBufferOverwrite(handle, key, strlen(key) + 1, value, value_size,
+                                 Condition, data);
+    }
     return DBPrivOverwrite(handle->priv, key, strlen(key) + 1, value, value_size, Condition, data);
 }
 
 bool HasKeyDB(DBHandle *handle, const char *key, int key_size)
 {
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    bool exists;
+    if (DBPendingRead(handle, key, key_size, NULL, 0, NULL, &exists))
+    {
+        return exists;
+    }
     return DBPrivHasKey(handle->priv, key, key_size);
 }
 
 int ValueSizeDB(DBHandle *handle, const char *key, int key_size)
 {
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    int size;
+    bool exists;
+    if (DBPendingRead(handle, key, key_size, NULL, 0, &size, &exists))
+    {
+        return size;
+    }
     return DBPrivGetValueSize(handle->priv, key, key_size);
 }
 
 bool DeleteDB(DBHandle *handle, const char *key)
 {
-    return DBPrivDelete(handle->priv, key, strlen(key) + 1);
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    return DBDelete(handle, key, strlen(key) + 1);
 }
 
 bool NewDBCursor(DBHandle *handle, DBCursor **cursor)
 {
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
     DBCursorPriv *priv = DBPrivOpenCursor(handle->priv);
     if (!priv)
     {
@@ -77,6 +77,8 @@ void CloseDB(CF_DB *dbp);
 
 DBHandle *GetDBHandleFromFilename(const char *db_file_name);
 time_t GetDBOpenTimestamp(const DBHandle *handle);
+/* Changes with every commit, false if the implementation can't tell. */
+bool GetDBGeneration(DBHandle *handle, size_t *generation);
 
 bool HasKeyDB(CF_DB *dbp, const char *key, int key_size);
 int ValueSizeDB(CF_DB *dbp, const char *key, int key_size);
@@ -90,6 +92,25 @@ bool OverwriteDB(DBHandle *handle, const char *key, const void *value, size_t va
 bool DeleteDB(CF_DB *dbp, const char *key);
 void FreezeDB(DBHandle *handle);
 
+/*
+ * Write-behind for databases updated often, like lastseen, where a commit per
+ * update is what costs. Writes and deletions are then kept in memory and
+ * committed together in a single transaction. Reads through this API see
+ * them right away, cursors and other processes only once they are committed.
+ * Outside of both, CloseDB() commits as usual.
+ *
+ * DBBeginBatch() and DBEndBatch() bracket a batch of updates, they nest, the
+ * outermost DBEndBatch() commits.
+ *
+ * DBSetGroupCommit() keeps #id open and commits its writes from a background
+ * thread, once #max_pending of them are waiting or the oldest one waited for
+ * #max_latency_ms, 0 meaning no limit. Both 0 commits what is left and stops
+ * it. CloseAllDBExit() stops it too.
+ */
+void DBBeginBatch(DBHandle *handle);
+bool DBEndBatch(DBHandle *handle);
+bool DBSetGroupCommit(dbid id, size_t max_pending, unsigned int max_latency_ms);
+
 /*
  * Creating cursor locks the whole database, so keep the amount of work here to
  * minimum.
@@ -720,6 +720,25 @@ void DBPrivCommit(DBPriv *db)
     free(db_txn);
 }
 
+bool DBPrivGetGeneration(DBPriv *db, size_t *generation)
+{
+    assert(db != NULL);
+    assert(generation != NULL);
+
+    MDB_envinfo info;
+    const int rc = mdb_env_info(db->env, &info);
+    if (rc != MDB_SUCCESS)
+    {
+        Log(LOG_LEVEL_ERR, "Could not get database info of '%s': %s",
+            (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
+        return false;
+    }
+
+    /* Read from the meta page, so it includes commits of other processes. */
+    *generation = info.me_last_txnid;
+    return true;
+}
+
 bool DBPrivHasKey(DBPriv *db, const void *key, int key_size)
 {
     assert(db != NULL);
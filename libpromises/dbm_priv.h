@@ -54,6 +54,13 @@ void DBPrivCloseDB(DBPriv *hdbp);
 void DBPrivCommit(DBPriv *hdbp);
 bool DBPrivClean(DBPriv *hdbp);
 
+/*
+ * Should set #generation to a number that changes with every commit to the
+ * database, by any process, and return true. Or return false if the
+ * implementation can't tell.
+ */
+bool DBPrivGetGeneration(DBPriv *db, size_t *generation);
+
 bool DBPrivHasKey(DBPriv *db, const void *key, int key_size);
 int DBPrivGetValueSize(DBPriv *db, const void *key, int key_size);
 
@@ -221,6 +221,11 @@ void DBPrivCommit(ARG_UNUSED DBPriv *db)
 {
 }
 
+bool DBPrivGetGeneration(ARG_UNUSED DBPriv *db, ARG_UNUSED size_t *generation)
+{
+    return false;
+}
+
 bool DBPrivClean(DBPriv *db)
 {
     DBCursorPriv *cursor = DBPrivOpenCursor(db);
@@ -48,9 +48,11 @@
 #include <known_dirs.h>
 #include <printsize.h>
 #include <regex.h>
+#include <regex_cache.h>
 #include <map.h>
 #include <conversion.h>                               /* DataTypeIsIterable */
 #include <cleanup.h>
+#include <profiling.h>
 
 /* If we need to put a scoped variable into a special scope, use the string
  * below to replace the original scope separator.
@@ -109,6 +111,64 @@ TYPED_MAP_DEFINE(RemoteVarPromises, char *, Seq *,
                  free,
                  SeqDestroy_untyped)
 
+/**
+   Define ClassExpressionCacheMap.
+   Key:   a class expression with its whitespace removed (char *)
+   Value: the parsed expression and its memoised value
+ */
+
+typedef struct
+{
+    Expression *expr;            /* NULL if the expression doesn't parse */
+    ExpressionValue value;
+    uint64_t class_generation;   /* value is valid for, 0 if not evaluated */
+} ClassExpressionCacheEntry;
+
+static void ClassExpressionCacheEntryDestroy(void *p)
+{
+    ClassExpressionCacheEntry *entry = p;
+    FreeExpression(entry->expr);
+    free(entry);
+}
+
+TYPED_MAP_DECLARE(ClassExpressionCache, char *, ClassExpressionCacheEntry *)
+
+TYPED_MAP_DEFINE(ClassExpressionCache, char *, ClassExpressionCacheEntry *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 ClassExpressionCacheEntryDestroy)
+
+/* Expressions containing variables expand to ever new strings, keep the
+ * cache from growing without bounds. */
+#define CLASS_EXPRESSION_CACHE_MAX 10000
+
+/**
+   Promise input tracking: the classes and variables a promise reads and
+   writes while it is evaluated, so that cf-agent can tell whether evaluating
+   it again in a later pass could make any difference. Names are recorded
+   without namespace or scope, which can only make a promise look changed
+   when it isn't, never the opposite.
+ */
+
+struct PromiseInputs_
+{
+    StringSet *read;             /* "c:<class>" and "v:<lval>" names */
+    StringSet *written;
+    uint64_t begin;              /* tracker clock when recording began */
+    uint64_t end;                /* tracker clock when recording ended */
+    bool untracked;              /* depends on more than the names above */
+};
+
+typedef struct
+{
+    uint64_t clock;              /* ticks on every change */
+    uint64_t epoch;              /* clock of the last change to everything */
+    Map *changes;                /* name -> clock of its last change, NULL
+                                  * until the first recording */
+    PromiseInputs *recording;    /* NULL unless recording a promise */
+} PromiseInputTracker;
+
 
 static pcre *context_expression_whitespace_rx = NULL;
 
@@ -127,6 +187,25 @@ static bool EvalContextClassPut(EvalContext *ctx, const char *ns, const char *na
 static const char *EvalContextCurrentNamespace(const EvalContext *ctx);
 static ClassRef IDRefQualify(const EvalContext *ctx, const char *id);
 
+static inline void ClassesChanged(EvalContext *ctx)
+{
+    ctx->class_generation++;
+}
+
+static void InputChanged(const EvalContext *ctx, char kind, const char *name);
+static void InputRead(const EvalContext *ctx, char kind, const char *name);
+static void InputUntracked(const EvalContext *ctx);
+static void InputAllChanged(const EvalContext *ctx);
+static void InputVariableTableCleared(const EvalContext *ctx, VariableTable *table,
+                                      const char *ns, const char *scope);
+
+/* A class was defined or undefined. */
+static inline void ClassChanged(EvalContext *ctx, const char *name)
+{
+    ClassesChanged(ctx);
+    InputChanged(ctx, 'c', name);
+}
+
 /**
  * Every agent has only one EvalContext from process start to finish.
  */
@@ -160,6 +239,14 @@ struct EvalContext_
     StringSet *dependency_handles;
     FuncCacheMap *function_cache;
 
+    /* Incremented whenever a class is defined or undefined, or the set of
+     * classes visible from the top of the stack changes. */
+    uint64_t class_generation;
+    ClassExpressionCacheMap *class_expression_cache;
+
+    /* Pointer so that lookups through a const EvalContext can record. */
+    PromiseInputTracker *input_tracker;
+
     uid_t uid;
     uid_t gid;
     pid_t pid;
@@ -492,6 +579,7 @@ static void EvalContextStackFrameAddSoft(EvalContext *ctx, const char *context,
                   CONTEXT_SCOPE_BUNDLE,
                   NULL_OR_EMPTY(tags) ? NULL : StringSetFromString(tags, ','),
                   NULL);
+    ClassChanged(ctx, context);
 
     if (!BundleAborted(ctx))
     {
@@ -511,6 +599,7 @@ static ExpressionValue EvalTokenAsClass(const char *classname, void *param)
 {
     const EvalContext *ctx = param;
     ClassRef ref = ClassRefParse(classname);
+    InputRead(ctx, 'c', ref.name);
     if (ClassRefIsQualified(ref))
     {
         if (strcmp(ref.ns, NamespaceDefault()) == 0)
@@ -569,10 +658,33 @@ bool ClassCharIsWhitespace(char ch)
     return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
 }
 
+/* Look up #condensed in the cache, parsing it if it's not there yet. */
+static ClassExpressionCacheEntry *ClassExpressionCacheGet(const EvalContext *ctx,
+                                                          const char *condensed,
+                                                          size_t len)
+{
+    ClassExpressionCacheEntry *entry =
+        ClassExpressionCacheMapGet(ctx->class_expression_cache, condensed);
+    if (entry != NULL)
+    {
+        return entry;
+    }
+
+    if (ClassExpressionCacheMapSize(ctx->class_expression_cache) >= CLASS_EXPRESSION_CACHE_MAX)
+    {
+        ClassExpressionCacheMapClear(ctx->class_expression_cache);
+    }
+
+    entry = xcalloc(1, sizeof(*entry));
+    entry->expr = ParseExpression(condensed, 0, len).result;
+    ClassExpressionCacheMapInsert(ctx->class_expression_cache,
+                                  xstrndup(condensed, len), entry);
+    return entry;
+}
+
 ExpressionValue CheckClassExpression(const EvalContext *ctx, const char *context)
 {
     assert(context != NULL);
-    ParseResult res;
 
     if (!context)
     {
@@ -580,44 +692,273 @@ ExpressionValue CheckClassExpression(const EvalContext *ctx, const char *context
         return EXPRESSION_VALUE_TRUE;
     }
 
-    if (context_expression_whitespace_rx == NULL)
+    ProfileCount(PROFILE_COUNTER_CLASS_EVALUATIONS);
+
+    ClassExpressionCacheEntry *entry;
+
+    /* Most expressions contain no whitespace at all, so they are already
+     * condensed and the whitespace regex can't match them. */
+    if (strpbrk(context, " \t\n\r") == NULL)
     {
-        context_expression_whitespace_rx = CompileRegex(CFENGINE_REGEX_WHITESPACE_IN_CONTEXTS);
+        entry = ClassExpressionCacheGet(ctx, context, strlen(context));
+    }
+    else
+    {
+        if (context_expression_whitespace_rx == NULL)
+        {
+            context_expression_whitespace_rx = CompileRegex(CFENGINE_REGEX_WHITESPACE_IN_CONTEXTS);
+        }
+
+        if (context_expression_whitespace_rx == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "The context expression whitespace regular expression could not be compiled, aborting.");
+            InputUntracked(ctx);
+            return EXPRESSION_VALUE_ERROR;
+        }
+
+        if (StringMatchFullWithPrecompiledRegex(context_expression_whitespace_rx, context))
+        {
+            Log(LOG_LEVEL_ERR, "class expressions can't be separated by whitespace without an intervening operator in expression '%s'", context);
+            InputUntracked(ctx);
+            return EXPRESSION_VALUE_ERROR;
+        }
+
+        Buffer *condensed = BufferNewFrom(context, strlen(context));
+        BufferRewrite(condensed, &ClassCharIsWhitespace, true);
+        entry = ClassExpressionCacheGet(ctx, BufferData(condensed),
+                                        BufferSize(condensed));
+        BufferDestroy(condensed);
     }
 
-    if (context_expression_whitespace_rx == NULL)
+    if (entry->expr == NULL)
     {
-        Log(LOG_LEVEL_ERR, "The context expression whitespace regular expression could not be compiled, aborting.");
+        Log(LOG_LEVEL_ERR, "Unable to parse class expression '%s'", context);
+        InputUntracked(ctx);
         return EXPRESSION_VALUE_ERROR;
     }
 
-    if (StringMatchFullWithPrecompiledRegex(context_expression_whitespace_rx, context))
+    /* The value only depends on the classes, reuse it until they change.
+     * Unless we are recording which classes a promise reads. */
+    if (entry->class_generation != ctx->class_generation ||
+        ctx->input_tracker->recording != NULL)
     {
-        Log(LOG_LEVEL_ERR, "class expressions can't be separated by whitespace without an intervening operator in expression '%s'", context);
-        return EXPRESSION_VALUE_ERROR;
+        entry->value = EvalExpression(entry->expr,
+                                      &EvalTokenAsClass, &EvalVarRef,
+                                      (void *)ctx); // controlled cast. None of these should modify EvalContext
+        entry->class_generation = ctx->class_generation;
+    }
+    if (entry->value == EXPRESSION_VALUE_ERROR)
+    {
+        InputUntracked(ctx);
     }
+    return entry->value;
+}
 
-    Buffer *condensed = BufferNewFrom(context, strlen(context));
-    BufferRewrite(condensed, &ClassCharIsWhitespace, true);
-    res = ParseExpression(BufferData(condensed), 0, BufferSize(condensed));
-    BufferDestroy(condensed);
+uint64_t EvalContextClassGeneration(const EvalContext *ctx)
+{
+    assert(ctx != NULL);
+    return ctx->class_generation;
+}
 
-    if (!res.result)
+/**********************************************************************/
+
+static bool IsPromiseLocalScope(const VarRef *ref)
+{
+    return ref->scope != NULL &&
+        (strcmp(ref->scope, "this") == 0 || strcmp(ref->scope, "body") == 0);
+}
+
+static void InputKey(char *key, size_t size, char kind, const char *name)
+{
+    /* Namespaces are not tracked, see above. */
+    const char *colon = strchr(name, ':');
+    if (kind == 'c' && colon != NULL)
     {
-        Log(LOG_LEVEL_ERR, "Unable to parse class expression '%s'", context);
-        return EXPRESSION_VALUE_ERROR;
+        name = colon + 1;
     }
-    else
+    /* Truncation can only make different names look the same, which makes
+     * promises look changed when they are not. */
+    snprintf(key, size, "%c:%s", kind, name);
+}
+
+static void InputAdd(StringSet *set, const char *key)
+{
+    if (!StringSetContains(set, key))
     {
-        ExpressionValue r = EvalExpression(res.result,
-                                           &EvalTokenAsClass, &EvalVarRef,
-                                           (void *)ctx); // controlled cast. None of these should modify EvalContext
+        StringSetAdd(set, xstrdup(key));
+    }
+}
 
-        FreeExpression(res.result);
-        return r;
+static void InputChanged(const EvalContext *ctx, char kind, const char *name)
+{
+    PromiseInputTracker *tracker = ctx->input_tracker;
+    if (tracker->changes == NULL)
+    {
+        return;                        /* nothing has been recorded yet */
+    }
+
+    char key[CF_MAXVARSIZE];
+    InputKey(key, sizeof(key), kind, name);
+
+    uint64_t *stamp = MapGet(tracker->changes, key);
+    if (stamp == NULL)
+    {
+        stamp = xmalloc(sizeof(*stamp));
+        MapInsert(tracker->changes, xstrdup(key), stamp);
+    }
+    *stamp = ++tracker->clock;
+
+    if (tracker->recording != NULL)
+    {
+        InputAdd(tracker->recording->written, key);
     }
 }
 
+static void InputRead(const EvalContext *ctx, char kind, const char *name)
+{
+    PromiseInputs *recording = ctx->input_tracker->recording;
+    if (recording != NULL)
+    {
+        char key[CF_MAXVARSIZE];
+        InputKey(key, sizeof(key), kind, name);
+        InputAdd(recording->read, key);
+    }
+}
+
+static void InputUntracked(const EvalContext *ctx)
+{
+    PromiseInputs *recording = ctx->input_tracker->recording;
+    if (recording != NULL)
+    {
+        recording->untracked = true;
+    }
+}
+
+static void InputAllChanged(const EvalContext *ctx)
+{
+    PromiseInputTracker *tracker = ctx->input_tracker;
+    tracker->epoch = ++tracker->clock;
+    InputUntracked(ctx);
+}
+
+static void InputVariableTableCleared(const EvalContext *ctx, VariableTable *table,
+                                      const char *ns, const char *scope)
+{
+    if (ctx->input_tracker->changes == NULL)
+    {
+        return;
+    }
+
+    VariableTableIterator *iter = VariableTableIteratorNew(table, ns, scope, NULL);
+    Variable *var = NULL;
+    while ((var = VariableTableIteratorNext(iter)))
+    {
+        InputChanged(ctx, 'v', VariableGetRef(var)->lval);
+    }
+    VariableTableIteratorDestroy(iter);
+}
+
+PromiseInputs *PromiseInputsNew(void)
+{
+    PromiseInputs *inputs = xcalloc(1, sizeof(PromiseInputs));
+    inputs->read = StringSetNew();
+    inputs->written = StringSetNew();
+    return inputs;
+}
+
+void PromiseInputsDestroy(PromiseInputs *inputs)
+{
+    if (inputs != NULL)
+    {
+        StringSetDestroy(inputs->read);
+        StringSetDestroy(inputs->written);
+        free(inputs);
+    }
+}
+
+PromiseInputs *EvalContextPromiseInputsBegin(EvalContext *ctx, PromiseInputs *inputs)
+{
+    assert(inputs != NULL);
+    PromiseInputTracker *tracker = ctx->input_tracker;
+
+    if (tracker->changes == NULL)
+    {
+        tracker->changes = MapNew(StringHash_untyped, StringEqual_untyped,
+                                  free, free);
+    }
+
+    /* Whatever encloses this promise depends on more than we record for it. */
+    InputUntracked(ctx);
+
+    StringSetClear(inputs->read);
+    StringSetClear(inputs->written);
+    inputs->untracked = false;
+    inputs->begin = tracker->clock;
+    inputs->end = tracker->clock;
+
+    PromiseInputs *previous = tracker->recording;
+    tracker->recording = inputs;
+    return previous;
+}
+
+void EvalContextPromiseInputsEnd(EvalContext *ctx, PromiseInputs *previous)
+{
+    PromiseInputTracker *tracker = ctx->input_tracker;
+    assert(tracker->recording != NULL);
+
+    tracker->recording->end = tracker->clock;
+    tracker->recording = previous;
+}
+
+bool EvalContextPromiseInputsRecording(const EvalContext *ctx)
+{
+    return ctx->input_tracker->recording != NULL;
+}
+
+void EvalContextPromiseInputsUntracked(const EvalContext *ctx)
+{
+    InputUntracked(ctx);
+}
+
+bool EvalContextPromiseInputsChanged(const EvalContext *ctx, const PromiseInputs *inputs)
+{
+    const PromiseInputTracker *tracker = ctx->input_tracker;
+    if (inputs->untracked || tracker->changes == NULL ||
+        tracker->epoch > inputs->begin)
+    {
+        return true;
+    }
+
+    StringSetIterator it = StringSetIteratorInit(inputs->read);
+    const char *key;
+    while ((key = StringSetIteratorNext(&it)))
+    {
+        /* A name the promise wrote itself after reading it only counts as
+         * changed if something else changed it since. */
+        const uint64_t *stamp = MapGet(tracker->changes, key);
+        const uint64_t since = StringSetContains(inputs->written, key) ?
+            inputs->end : inputs->begin;
+        if (stamp != NULL && *stamp > since)
+        {
+            return true;
+        }
+    }
+
+    /* Someone else changed what the promise defined, it may need to put it
+     * back. */
+    it = StringSetIteratorInit(inputs->written);
+    while ((key = StringSetIteratorNext(&it)))
+    {
+        const uint64_t *stamp = MapGet(tracker->changes, key);
+        if (stamp != NULL && *stamp > inputs->end)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**********************************************************************/
 
 static ExpressionValue EvalTokenFromList(const char *token, void *param)
@@ -834,10 +1175,9 @@ void EvalContextHeapPersistentLoadAll(EvalContext *ctx)
                 ClassRef ref = ClassRefParse(key);
                 EvalContextClassPut(ctx, ref.ns, ref.name, true, CONTEXT_SCOPE_NAMESPACE, tags, NULL);
 
-                StringSet *tag_set = EvalContextClassTags(ctx, ref.ns, ref.name);
-                assert(tag_set);
-
-                StringSetAdd(tag_set, xstrdup("source=persistent"));
+                NDEBUG_UNUSED bool tagged = ClassTableAddTag(ctx->global_classes, ref.ns, ref.name,
+                                                             "source=persistent");
+                assert(tagged);
 
                 ClassRefDestroy(ref);
             }
@@ -1080,6 +1420,10 @@ EvalContext *EvalContextNew(void)
     ctx->promise_lock_cache = StringSetNew();
     ctx->function_cache = FuncCacheMapNew();
 
+    ctx->class_generation = 1;
+    ctx->class_expression_cache = ClassExpressionCacheMapNew();
+    ctx->input_tracker = xcalloc(1, sizeof(PromiseInputTracker));
+
     EvalContextSetupMissionPortalLogHook(ctx);
 
     ctx->package_promise_context = PackagePromiseConfigNew();
@@ -1128,6 +1472,12 @@ void EvalContextDestroy(EvalContext *ctx)
         StringSetDestroy(ctx->promise_lock_cache);
 
         FuncCacheMapDestroy(ctx->function_cache);
+        ClassExpressionCacheMapDestroy(ctx->class_expression_cache);
+        if (ctx->input_tracker->changes != NULL)
+        {
+            MapDestroy(ctx->input_tracker->changes);
+        }
+        free(ctx->input_tracker);
 
         FreePackagePromiseContext(ctx->package_promise_context);
 
@@ -1186,17 +1536,21 @@ static bool EvalContextStackFrameContainsSoft(const EvalContext *ctx, const char
 
 bool EvalContextHeapRemoveSoft(EvalContext *ctx, const char *ns, const char *name)
 {
+    ClassChanged(ctx, name);
     return ClassTableRemove(ctx->global_classes, ns, name);
 }
 
 bool EvalContextHeapRemoveHard(EvalContext *ctx, const char *name)
 {
+    ClassChanged(ctx, name);
     return ClassTableRemove(ctx->global_classes, NULL, name);
 }
 
 void EvalContextClear(EvalContext *ctx)
 {
     ClassTableClear(ctx->global_classes);
+    ClassesChanged(ctx);
+    InputAllChanged(ctx);
     EvalContextDeleteIpAddresses(ctx);
     VariableTableClear(ctx->global_variables, NULL, NULL, NULL);
     VariableTableClear(ctx->match_variables, NULL, NULL, NULL);
@@ -1383,6 +1737,7 @@ void EvalContextStackFrameRemoveSoft(EvalContext *ctx, const char *context)
     assert(frame);
 
     ClassTableRemove(frame->data.bundle.classes, frame->data.bundle.owner->ns, context);
+    ClassChanged(ctx, context);
 }
 
 static void EvalContextStackPushFrame(EvalContext *ctx, StackFrame *frame)
@@ -1401,6 +1756,13 @@ static void EvalContextStackPushFrame(EvalContext *ctx, StackFrame *frame)
 
     SeqAppend(ctx->stack, frame);
 
+    /* Bundle and body frames change the current namespace and hide the
+     * classes of the frames below; the others inherit them. */
+    if (!frame->inherits_previous || frame->type == STACK_FRAME_TYPE_BUNDLE)
+    {
+        ClassesChanged(ctx);
+    }
+
     assert(!frame->path);
     frame->path = EvalContextStackPath(ctx);
 
@@ -1420,6 +1782,7 @@ void EvalContextStackPushBundleFrame(EvalContext *ctx, const Bundle *owner, cons
         if (caller)
         {
             VariableTable *table = LastStackFrameByType(ctx, STACK_FRAME_TYPE_BUNDLE)->data.bundle.vars;
+            InputVariableTableCleared(ctx, table, NULL, NULL);
             VariableTableClear(table, NULL, NULL, NULL);
         }
 
@@ -1434,6 +1797,7 @@ void EvalContextStackPushBundleFrame(EvalContext *ctx, const Bundle *owner, cons
             Rval var_rval = VariableGetRval(var, true);
             Rval retval = ExpandPrivateRval(ctx, owner->ns, owner->name, var_rval.item, var_rval.type);
             VariableSetRval(var, retval);
+            InputChanged(ctx, 'v', VariableGetRef(var)->lval);
         }
         VariableTableIteratorDestroy(iter);
     }
@@ -1590,6 +1954,7 @@ void EvalContextStackPopFrame(EvalContext *ctx)
             const Bundle *bp = last_frame->data.bundle.owner;
             if (strcmp(bp->type, "edit_line") == 0 || strcmp(bp->type, "edit_xml") == 0)
             {
+                InputVariableTableCleared(ctx, last_frame->data.bundle.vars, "default", "edit");
                 VariableTableClear(last_frame->data.bundle.vars, "default", "edit", NULL);
             }
         }
@@ -1608,7 +1973,13 @@ void EvalContextStackPopFrame(EvalContext *ctx)
         break;
     }
 
+    const bool classes_changed = (!last_frame->inherits_previous ||
+                                  last_frame_type == STACK_FRAME_TYPE_BUNDLE);
     SeqRemove(ctx->stack, SeqLength(ctx->stack) - 1);
+    if (classes_changed)
+    {
+        ClassesChanged(ctx);
+    }
 
     last_frame = LastStackFrame(ctx, 0);
     if (last_frame)
@@ -1637,11 +2008,14 @@ bool EvalContextClassRemove(EvalContext *ctx, const char *ns, const char *name)
         ClassTableRemove(frame->data.bundle.classes, ns, name);
     }
 
+    ClassChanged(ctx, name);
     return ClassTableRemove(ctx->global_classes, ns, name);
 }
 
 Class *EvalContextClassGet(const EvalContext *ctx, const char *ns, const char *name)
 {
+    InputRead(ctx, 'c', name);
+
     StackFrame *frame = LastStackFrameByType(ctx, STACK_FRAME_TYPE_BUNDLE);
     if (frame)
     {
@@ -1737,6 +2111,7 @@ static bool EvalContextClassPutTagsSet(EvalContext *ctx, const char *ns, const c
     }
 
     Nova_ClassHistoryAddContextName(ctx->all_classes, name);
+    ClassChanged(ctx, name);
 
     switch (scope)
     {
@@ -2271,6 +2646,11 @@ static VariableTable *GetVariableTableForScope(const EvalContext *ctx,
 
 bool EvalContextVariableRemove(const EvalContext *ctx, const VarRef *ref)
 {
+    if (!IsPromiseLocalScope(ref))
+    {
+        InputChanged(ctx, 'v', ref->lval);
+    }
+
     VariableTable *table = GetVariableTableForScope(ctx, ref->ns, ref->scope);
     return VariableTableRemove(table, ref);
 }
@@ -2415,6 +2795,10 @@ bool EvalContextVariablePutTagsSetWithComment(EvalContext *ctx,
     VariableTable *table = GetVariableTableForScope(ctx, ref->ns, ref->scope);
     const Promise *pp = EvalContextStackCurrentPromise(ctx);
     VariableTablePut(table, ref, &rval, type, tags, SafeStringDuplicate(comment), pp ? pp->org_pp : pp);
+    if (!IsPromiseLocalScope(ref))
+    {
+        InputChanged(ctx, 'v', ref->lval);
+    }
     return true;
 }
 
@@ -2587,6 +2971,8 @@ static Variable *VariableResolve(const EvalContext *ctx, const VarRef *ref)
  */
 const void *EvalContextVariableGet(const EvalContext *ctx, const VarRef *ref, DataType *type_out)
 {
+    InputRead(ctx, 'v', ref->lval);
+
     Variable *var = VariableResolve(ctx, ref);
     if (var)
     {
@@ -2619,6 +3005,9 @@ const void *EvalContextVariableGet(const EvalContext *ctx, const VarRef *ref, Da
         }
     }
 
+    /* Unresolved, the promise must be evaluated again in the next pass. */
+    InputUntracked(ctx);
+
     if (type_out)
     {
         *type_out = CF_DATA_TYPE_NONE;
@@ -2628,6 +3017,7 @@ const void *EvalContextVariableGet(const EvalContext *ctx, const VarRef *ref, Da
 
 const Promise *EvalContextVariablePromiseGet(const EvalContext *ctx, const VarRef *ref)
 {
+    InputRead(ctx, 'v', ref->lval);
     Variable *var = VariableResolve(ctx, ref);
     return var ? VariableGetPromise(var) : NULL;
 }
@@ -2646,6 +3036,7 @@ StringSet *EvalContextClassTags(const EvalContext *ctx, const char *ns, const ch
 
 StringSet *EvalContextVariableTags(const EvalContext *ctx, const VarRef *ref)
 {
+    InputRead(ctx, 'v', ref->lval);
     Variable *var = VariableResolve(ctx, ref);
     if (!var)
     {
@@ -2658,11 +3049,21 @@ StringSet *EvalContextVariableTags(const EvalContext *ctx, const VarRef *ref)
 
 bool EvalContextVariableClearMatch(EvalContext *ctx)
 {
+    InputVariableTableCleared(ctx, ctx->match_variables, NULL, NULL);
     return VariableTableClear(ctx->match_variables, NULL, NULL, NULL);
 }
 
 VariableTableIterator *EvalContextVariableTableIteratorNew(const EvalContext *ctx, const char *ns, const char *scope, const char *lval)
 {
+    if (lval != NULL)
+    {
+        InputRead(ctx, 'v', lval);
+    }
+    else
+    {
+        InputUntracked(ctx);
+    }
+
     VariableTable *table = scope ? GetVariableTableForScope(ctx, ns, scope) : ctx->global_variables;
     return table ? VariableTableIteratorNew(table, ns, scope, lval) : NULL;
 }
@@ -2671,6 +3072,7 @@ VariableTableIterator *EvalContextVariableTableIteratorNew(const EvalContext *ct
 VariableTableIterator *EvalContextVariableTableFromRefIteratorNew(const EvalContext *ctx, const VarRef *ref)
 {
     assert(ref);
+    InputRead(ctx, 'v', ref->lval);
     VariableTable *table = ref->scope ? GetVariableTableForScope(ctx, ref->ns, ref->scope) : ctx->global_variables;
     return table ? VariableTableIteratorNewFromVarRef(table, ref) : NULL;
 }
@@ -3488,7 +3890,11 @@ StringSet *ClassesMatching(const EvalContext *ctx, ClassTableIterator *iter, con
 {
     StringSet *matching = StringSetNew();
 
-    pcre *rx = CompileRegex(regex);
+    CachedRegex *rx = RegexCacheGet(regex);
+
+    /* Only visit the classes the literal prefix of the regex and the tags
+     * allow for. */
+    ClassTableIteratorNarrow(iter, regex, tags);
 
     Class *cls;
     while ((cls = ClassTableIteratorNext(iter)))
@@ -3497,7 +3903,7 @@ StringSet *ClassesMatching(const EvalContext *ctx, ClassTableIterator *iter, con
 
         /* FIXME: review this strcmp. Moved out from StringMatch */
         if (!strcmp(regex, expr) ||
-            (rx && StringMatchFullWithPrecompiledRegex(rx, expr)))
+            (rx && CachedRegexMatchFull(rx, expr)))
         {
             bool pass = false;
             StringSet *tagset = EvalContextClassTags(ctx, cls->ns, cls->name);
@@ -3513,7 +3919,7 @@ StringSet *ClassesMatching(const EvalContext *ctx, ClassTableIterator *iter, con
                     {
                         /* FIXME: review this strcmp. Moved out from StringMatch */
                         if (strcmp(tag_regex, element) == 0 ||
-                            StringMatchFull(tag_regex, element))
+                            RegexCacheMatchFull(tag_regex, element))
                         {
                             pass = true;
                             break;
@@ -3546,10 +3952,7 @@ StringSet *ClassesMatching(const EvalContext *ctx, ClassTableIterator *iter, con
         }
     }
 
-    if (rx)
-    {
-        pcre_free(rx);
-    }
+    RegexCacheRelease(rx);
 
     return matching;
 }
@@ -244,6 +244,12 @@ Seq *EvalContextResolveBodyExpression(const EvalContext *ctx, const Policy *poli
 /* - Parsing/evaluating expressions - */
 void ValidateClassSyntax(const char *str);
 ExpressionValue CheckClassExpression(const EvalContext *ctx, const char *context);
+/**
+ * Changes whenever a class is defined or undefined, or entering or leaving a
+ * bundle changes which classes are visible. Anything computed only from the
+ * classes stays valid while the generation is the same.
+ */
+uint64_t EvalContextClassGeneration(const EvalContext *ctx);
 static inline bool IsDefinedClass(const EvalContext *ctx, const char *context)
 {
     return (CheckClassExpression(ctx, context) == EXPRESSION_VALUE_TRUE);
@@ -253,6 +259,35 @@ StringSet *ClassesMatching(const EvalContext *ctx, ClassTableIterator *iter, con
 bool EvalProcessResult(const char *process_result, StringSet *proc_attr);
 bool EvalFileResult(const char *file_result, StringSet *leaf_attr);
 
+/* - Promise input tracking - */
+/**
+ * The classes and variables a promise read and wrote while it was evaluated,
+ * so that a later pass can skip evaluating it again if none of them changed.
+ */
+typedef struct PromiseInputs_ PromiseInputs;
+
+PromiseInputs *PromiseInputsNew(void);
+void PromiseInputsDestroy(PromiseInputs *inputs);
+
+/**
+ * Start recording into #inputs, discarding what it held before.
+ * @return the recording in progress, to be passed to
+ *         EvalContextPromiseInputsEnd()
+ */
+PromiseInputs *EvalContextPromiseInputsBegin(EvalContext *ctx, PromiseInputs *inputs);
+void EvalContextPromiseInputsEnd(EvalContext *ctx, PromiseInputs *previous);
+bool EvalContextPromiseInputsRecording(const EvalContext *ctx);
+/**
+ * The promise being recorded depends on something other than classes and
+ * variables (e.g. the system, or a failed lookup), always evaluate it again.
+ */
+void EvalContextPromiseInputsUntracked(const EvalContext *ctx);
+/**
+ * @return false only if evaluating the promise again would see the same
+ *         classes and variables as when #inputs was recorded
+ */
+bool EvalContextPromiseInputsChanged(const EvalContext *ctx, const PromiseInputs *inputs);
+
 /* Various global options */
 void SetChecksumUpdatesDefault(EvalContext *ctx, bool enabled);
 bool GetChecksumUpdatesDefault(const EvalContext *ctx);
@@ -45,6 +45,7 @@
 #include <unix.h>           /* GetUserName(), GetGroupName() */
 #include <string_lib.h>
 #include <regex.h>          /* CompileRegex,StringMatchWithPrecompiledRegex */
+#include <regex_cache.h>    /* RegexCacheMatchFull */
 #include <net.h>                                           /* SocketConnect */
 #include <communication.h>
 #include <classic.h>                                    /* SendSocketStream */
@@ -65,6 +66,7 @@
 #include <json.h>
 #include <json-yaml.h>
 #include <json-utils.h>
+#include <data_file_cache.h>                            /* DataFileCacheRead */
 #include <known_dirs.h>
 #include <mustache.h>
 #include <processes_select.h>
@@ -509,31 +511,6 @@ static JsonElement* VarNameOrInlineToJson(EvalContext *ctx, const FnCall *fp, co
     return vardata;
 }
 
-typedef struct {
-    char *address;
-    char *hostkey;
-    time_t lastseen;
-} HostData;
-
-static HostData *HostDataNew(const char *address, const char *hostkey, time_t lastseen)
-{
-    HostData *data = xmalloc(sizeof(HostData));
-    data->address = SafeStringDuplicate(address);
-    data->hostkey = SafeStringDuplicate(hostkey);
-    data->lastseen = lastseen;
-    return data;
-}
-
-static void HostDataFree(HostData *hd)
-{
-    if (hd != NULL)
-    {
-        free(hd->address);
-        free(hd->hostkey);
-        free(hd);
-    }
-}
-
 typedef enum {
     NAME,
     ADDRESS,
@@ -561,93 +538,54 @@ static HostsSeenFieldOption ParseHostsSeenFieldOption(const char *field)
     }
 }
 
-static Rlist *GetHostsFromLastseenDB(Seq *host_data, time_t horizon, HostsSeenFieldOption return_what, bool return_recent)
+/* The hostsseen() value of a host, false if it has none. */
+static bool HostsSeenValue(char *dst, size_t dst_size,
+                           const char *hostkey, const char *address,
+                           HostsSeenFieldOption return_what)
 {
-    Rlist *recent = NULL, *aged = NULL;
-    time_t now = time(NULL);
-    time_t entrytime;
-    char ret_host_data[CF_MAXVARSIZE]; // TODO: Could this be 1025 / NI_MAXHOST ?
-
-    const size_t length = SeqLength(host_data);
-    for (size_t i = 0; i < length; ++i)
+    if ((return_what == NAME || return_what == ADDRESS)
+         && HostKeyAddressUnknown(hostkey))
     {
-        HostData *hd = SeqAt(host_data, i);
-        entrytime = hd->lastseen;
-
-        if ((return_what == NAME || return_what == ADDRESS)
-             && HostKeyAddressUnknown(hd->hostkey))
-        {
-            continue;
-        }
-
-        switch (return_what)
-        {
-            case NAME:
-            {
-                char hostname[NI_MAXHOST];
-                if (IPString2Hostname(hostname, hd->address, sizeof(hostname)) != -1)
-                {
-                    StringCopy(hostname, ret_host_data, sizeof(ret_host_data));
-                }
-                else
-                {
-                    /* Not numeric address was requested, but IP was unresolvable. */
-                    StringCopy(hd->address, ret_host_data, sizeof(ret_host_data));
-                }
-                break;
-            }
-            case ADDRESS:
-                StringCopy(hd->address, ret_host_data, sizeof(ret_host_data));
-                break;
-            case HOSTKEY:
-                StringCopy(hd->hostkey, ret_host_data, sizeof(ret_host_data));
-                break;
-            default:
-                ProgrammingError("Parser allowed invalid hostsseen() field argument");
-        }
+        return false;
+    }
 
-        if (entrytime < now - horizon)
+    switch (return_what)
+    {
+        case NAME:
         {
-            Log(LOG_LEVEL_DEBUG, "Old entry");
-
-            if (RlistKeyIn(recent, ret_host_data))
+            char hostname[NI_MAXHOST];
+            if (IPString2Hostname(hostname, address, sizeof(hostname)) != -1)
             {
-                Log(LOG_LEVEL_DEBUG, "There is recent entry for this ret_host_data. Do nothing.");
+                StringCopy(hostname, dst, dst_size);
             }
             else
             {
-                Log(LOG_LEVEL_DEBUG, "Adding to list of aged hosts.");
-                RlistPrependScalarIdemp(&aged, ret_host_data);
-            }
-        }
-        else
-        {
-            Log(LOG_LEVEL_DEBUG, "Recent entry");
-
-            Rlist *r = RlistKeyIn(aged, ret_host_data);
-            if (r)
-            {
-                Log(LOG_LEVEL_DEBUG, "Purging from list of aged hosts.");
-                RlistDestroyEntry(&aged, r);
+                /* Not numeric address was requested, but IP was unresolvable. */
+                StringCopy(address, dst, dst_size);
             }
-
-            Log(LOG_LEVEL_DEBUG, "Adding to list of recent hosts.");
-            RlistPrependScalarIdemp(&recent, ret_host_data);
+            break;
         }
+        case ADDRESS:
+            StringCopy(address, dst, dst_size);
+            break;
+        case HOSTKEY:
+            StringCopy(hostkey, dst, dst_size);
+            break;
+        default:
+            ProgrammingError("Parser allowed invalid hostsseen() field argument");
     }
 
-    if (return_recent)
-    {
-        RlistDestroy(aged);
-        return recent;
-    }
-    else
-    {
-        RlistDestroy(recent);
-        return aged;
-    }
+    return true;
 }
 
+typedef struct
+{
+    HostsSeenFieldOption return_what;
+    time_t horizon;             /* Seen at this time or later is recent */
+    StringSet *recent;
+    StringSet *aged;            /* Seen before the horizon only */
+} HostsSeenData;
+
 /*********************************************************************/
 
 static FnCallResult FnCallAnd(EvalContext *ctx,
@@ -678,11 +616,41 @@ static FnCallResult FnCallAnd(EvalContext *ctx,
 
 /*******************************************************************/
 
-static bool CallHostsSeenCallback(const char *hostkey, const char *address,
-                                  ARG_UNUSED bool incoming, const KeyHostSeen *quality,
-                                  void *ctx)
+static bool CallHostsSeenRecentCallback(const char *hostkey, const char *address,
+                                        ARG_UNUSED bool incoming,
+                                        ARG_UNUSED const KeyHostSeen *quality,
+                                        void *ctx)
 {
-    SeqAppend(ctx, HostDataNew(address, hostkey, quality->lastseen));
+    HostsSeenData *data = ctx;
+
+    char value[CF_MAXVARSIZE]; // TODO: Could this be 1025 / NI_MAXHOST ?
+    if (HostsSeenValue(value, sizeof(value), hostkey, address, data->return_what) &&
+        !StringSetContains(data->recent, value))
+    {
+        StringSetAdd(data->recent, xstrdup(value));
+    }
+    return true;
+}
+
+static bool CallHostsSeenAgedCallback(const char *hostkey, const char *address,
+                                      ARG_UNUSED bool incoming, const KeyHostSeen *quality,
+                                      void *ctx)
+{
+    HostsSeenData *data = ctx;
+
+    if (quality->lastseen >= data->horizon)
+    {
+        /* Oldest first, only recent ones from here on. */
+        return false;
+    }
+
+    char value[CF_MAXVARSIZE];
+    if (HostsSeenValue(value, sizeof(value), hostkey, address, data->return_what) &&
+        !StringSetContains(data->recent, value) &&
+        !StringSetContains(data->aged, value))
+    {
+        StringSetAdd(data->aged, xstrdup(value));
+    }
     return true;
 }
 
@@ -690,8 +658,6 @@ static bool CallHostsSeenCallback(const char *hostkey, const char *address,
 
 static FnCallResult FnCallHostsSeen(ARG_UNUSED EvalContext *ctx, ARG_UNUSED const Policy *policy, ARG_UNUSED const FnCall *fp, const Rlist *finalargs)
 {
-    Seq *host_data = SeqNew(1, HostDataFree);
-
     int horizon = IntFromString(RlistScalarValue(finalargs)) * 3600;
     char *hostseen_policy = RlistScalarValue(finalargs->next);
     char *field_str = RlistScalarValue(finalargs->next->next);
@@ -700,17 +666,48 @@ static FnCallResult FnCallHostsSeen(ARG_UNUSED EvalContext *ctx, ARG_UNUSED cons
     Log(LOG_LEVEL_DEBUG, "Calling hostsseen(%d,%s,%s)",
         horizon, hostseen_policy, field_str);
 
-    if (!ScanLastSeenQuality(&CallHostsSeenCallback, host_data))
+    LastSeenSnapshot *snapshot = LastSeenSnapshotAcquire();
+    if (snapshot == NULL)
     {
-        SeqDestroy(host_data);
         return FnFailure();
     }
 
-    Rlist *returnlist = GetHostsFromLastseenDB(host_data, horizon,
-                                               field,
-                                               StringEqual(hostseen_policy, "lastseen"));
+    HostsSeenData data = {
+        .return_what = field,
+        .horizon = time(NULL) - horizon,
+        .recent = StringSetNew(),
+        .aged = StringSetNew(),
+    };
+
+    /* Hosts seen since the horizon are recent, the others aged, so both need
+     * the recent ones but only aged ones need those seen before. */
+    LastSeenSnapshotScan(snapshot, data.horizon, CallHostsSeenRecentCallback, &data);
+    const bool return_recent = StringEqual(hostseen_policy, "lastseen");
+    if (!return_recent)
+    {
+        LastSeenSnapshotScan(snapshot, 0, CallHostsSeenAgedCallback, &data);
+    }
+    LastSeenSnapshotRelease(snapshot);
+
+    /* Sorted, not in the order of the set. */
+    StringSet *values = return_recent ? data.recent : data.aged;
+    Seq *sorted = SeqNew(StringSetSize(values), NULL);
+    StringSetIterator it = StringSetIteratorInit(values);
+    const char *value;
+    while ((value = StringSetIteratorNext(&it)))
+    {
+        SeqAppend(sorted, (void *) value);
+    }
+    SeqSort(sorted, StrCmpWrapper, NULL);
 
-    SeqDestroy(host_data);
+    Rlist *returnlist = NULL;
+    for (size_t i = SeqLength(sorted); i > 0; i--)
+    {
+        RlistPrepend(&returnlist, SeqAt(sorted, i - 1), RVAL_TYPE_SCALAR);
+    }
+    SeqDestroy(sorted);
+    StringSetDestroy(data.recent);
+    StringSetDestroy(data.aged);
 
     {
         Writer *w = StringWriter();
@@ -1434,7 +1431,11 @@ static JsonElement *VariablesMatching(const EvalContext *ctx, const FnCall *fp,
     JsonElement *matching = JsonObjectCreate(10);
 
     const char *regex = RlistScalarValue(args);
-    pcre *rx = CompileRegex(regex);
+    CachedRegex *rx = RegexCacheGet(regex);
+
+    /* Only visit the variables the literal prefix of the regex and the tags
+     * allow for. */
+    VariableTableIteratorNarrow(iter, regex, args->next);
 
     Variable *v = NULL;
     while ((v = VariableTableIteratorNext(iter)))
@@ -1442,7 +1443,7 @@ static JsonElement *VariablesMatching(const EvalContext *ctx, const FnCall *fp,
         const VarRef *var_ref = VariableGetRef(v);
         char *expr = VarRefToString(var_ref, true);
 
-        if (rx != NULL && StringMatchFullWithPrecompiledRegex(rx, expr))
+        if (rx != NULL && CachedRegexMatchFull(rx, expr))
         {
             StringSet *tagset = EvalContextVariableTags(ctx, var_ref);
             bool pass = false;
@@ -1456,7 +1457,7 @@ static JsonElement *VariablesMatching(const EvalContext *ctx, const FnCall *fp,
                     StringSetIterator it = StringSetIteratorInit(tagset);
                     while ((element = SetIteratorNext(&it)))
                     {
-                        if (StringMatchFull(tag_regex, element))
+                        if (RegexCacheMatchFull(tag_regex, element))
                         {
                             pass = true;
                             break;
@@ -1506,10 +1507,7 @@ static JsonElement *VariablesMatching(const EvalContext *ctx, const FnCall *fp,
         free(expr);
     }
 
-    if (rx)
-    {
-        pcre_free(rx);
-    }
+    RegexCacheRelease(rx);
 
     return matching;
 }
@@ -3368,7 +3366,7 @@ static FnCallResult FnCallLsDir(ARG_UNUSED EvalContext *ctx, ARG_UNUSED const Po
     const struct dirent *dirp;
     for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
     {
-        if (strlen(regex) == 0 || StringMatchFull(regex, dirp->d_name))
+        if (strlen(regex) == 0 || RegexCacheMatchFull(regex, dirp->d_name))
         {
             if (includepath)
             {
@@ -4206,7 +4204,7 @@ static FnCallResult FnCallSelectServers(EvalContext *ctx,
                     assert((size_t) n_read < sizeof(recvbuf));
                     recvbuf[n_read] = '\0';
 
-                    if (strlen(regex) == 0 || StringMatchFull(regex, recvbuf))
+                    if (strlen(regex) == 0 || RegexCacheMatchFull(regex, recvbuf))
                     {
                         Log(LOG_LEVEL_VERBOSE,
                             "selectservers: Got matching reply from host %s address %s",
@@ -6241,7 +6239,7 @@ static FnCallResult FnCallRegCmp(ARG_UNUSED EvalContext *ctx, ARG_UNUSED const P
     char *argv0 = RlistScalarValue(finalargs);
     char *argv1 = RlistScalarValue(finalargs->next);
 
-    return FnReturnContext(StringMatchFull(argv0, argv1));
+    return FnReturnContext(RegexCacheMatchFull(argv0, argv1));
 }
 
 /*********************************************************************/
@@ -6984,7 +6982,7 @@ static FnCallResult ReadDataGeneric(const char *const fname,
     assert(fname != NULL);
     assert(input_path != NULL);
 
-    JsonElement *json = JsonReadDataFile(fname, input_path, requested_mode, size_max);
+    JsonElement *json = DataFileCacheRead(fname, input_path, requested_mode, size_max);
     if (json == NULL)
     {
         return FnFailure();
@@ -42,6 +42,7 @@
 #include <string_lib.h>
 #include <conversion.h>
 #include <verify_classes.h>
+#include <profiling.h>
 
 /**
  * VARIABLES AND PROMISE EXPANSION
@@ -220,6 +221,8 @@ static PromiseResult ExpandPromiseAndDo(EvalContext *ctx, PromiseIterator *iterc
             continue;
         }
 
+        ProfileCount(PROFILE_COUNTER_ITERATIONS);
+
         /* ACTUAL WORK PART 2: run the actuator */
         PromiseResult iteration_result = act_on_promise(ctx, pexp, param);
 
@@ -270,6 +273,8 @@ PromiseResult ExpandPromise(EvalContext *ctx, const Promise *pp,
         return PROMISE_RESULT_SKIPPED;
     }
 
+    ProfileEnter(PROFILE_FRAME_PROMISE, PromiseGetPromiseType(pp), pp->promiser);
+
     /* 1. Copy the promise while expanding '@' slists and body arguments
      *    (including body inheritance). */
     Promise *pcopy = DeRefCopyPromise(ctx, pp);
@@ -311,6 +316,7 @@ PromiseResult ExpandPromise(EvalContext *ctx, const Promise *pp,
     PromiseIteratorDestroy(iterctx);
     PromiseDestroy(pcopy);
 
+    ProfileLeave();
     return result;
 }
 
@@ -526,6 +532,8 @@ char *ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope,
 {
     bool out_belongs_to_us = false;
 
+    ProfileCount(PROFILE_COUNTER_EXPANSIONS);
+
     if (out == NULL)
     {
         out               = BufferNew();
@@ -35,6 +35,7 @@
 #include <syntax.h>
 #include <audit.h>
 #include <cleanup.h>
+#include <profiling.h>
 
 #define SIMULATE_SAFE_META_TAG "simulate_safe"
 
@@ -305,7 +306,66 @@ static FnCallResult CallFunction(EvalContext *ctx, const Policy *policy, const F
     return (*fncall_type->impl) (ctx, policy, fp, expargs);
 }
 
+/* Functions whose result only depends on their arguments and the variables
+ * they name, sorted for bsearch(). */
+static const char *const PURE_FUNCTIONS[] =
+{
+    "and", "basename", "canonify", "canonifyuniquely", "cf_version_after",
+    "cf_version_at", "cf_version_before", "cf_version_between",
+    "cf_version_maximum", "cf_version_minimum", "concat", "data_expand",
+    "data_regextract", "difference", "dirname", "escape", "eval", "every",
+    "expandrange", "filter", "format", "getindices", "getvalues", "grep",
+    "hash", "hash_to_int", "ifelse", "int", "intersection", "irange",
+    "isgreaterthan", "islessthan", "isvariable", "join", "lastnode", "length",
+    "maparray", "maplist", "max", "mean", "mergedata", "min", "none", "not",
+    "nth", "or", "parsejson", "parseyaml", "product", "regcmp",
+    "regex_replace", "reverse", "rrange", "shuffle", "some", "sort",
+    "splitstring", "storejson", "strcmp", "string", "string_downcase",
+    "string_head", "string_length", "string_replace", "string_reverse",
+    "string_split", "string_tail", "string_trim", "string_upcase", "sublist",
+    "sum", "type", "unique", "validdata", "validjson", "variance",
+};
+
+static int CompareFunctionName(const void *name, const void *entry)
+{
+    return strcmp(name, *(const char *const *) entry);
+}
+
+/* Could the function return something else in a later pass even though the
+ * variables and classes it reads are the same? */
+static bool FnCallIsTracked(const FnCall *fp)
+{
+    const FnCallType *fp_type = FnCallTypeGet(fp->name);
+    if (fp_type == NULL)
+    {
+        return false;
+    }
+
+    /* Cached results don't change for the rest of the run. */
+    return (fp_type->options & FNCALL_OPTION_CACHED) ||
+        bsearch(fp->name, PURE_FUNCTIONS,
+                sizeof(PURE_FUNCTIONS) / sizeof(PURE_FUNCTIONS[0]),
+                sizeof(PURE_FUNCTIONS[0]), CompareFunctionName) != NULL;
+}
+
+static FnCallResult EvaluateFunctionCall(EvalContext *ctx, const Policy *policy, FnCall *fp, const Promise *caller);
+
 FnCallResult FnCallEvaluate(EvalContext *ctx, const Policy *policy, FnCall *fp, const Promise *caller)
+{
+    ProfileEnter(PROFILE_FRAME_FUNCTION, NULL, fp->name);
+    FnCallResult result = EvaluateFunctionCall(ctx, policy, fp, caller);
+    ProfileLeave();
+
+    if (EvalContextPromiseInputsRecording(ctx) &&
+        (result.status == FNCALL_FAILURE || !FnCallIsTracked(fp)))
+    {
+        EvalContextPromiseInputsUntracked(ctx);
+    }
+
+    return result;
+}
+
+static FnCallResult EvaluateFunctionCall(EvalContext *ctx, const Policy *policy, FnCall *fp, const Promise *caller)
 {
     assert(ctx != NULL);
     assert(policy != NULL);
@@ -73,6 +73,7 @@
 #include <libgen.h>
 #include <cleanup.h>
 #include <cmdb.h>               /* LoadCMDBData() */
+#include <data_file_cache.h>    /* DataFileCacheLogStats(), DataFileCachePurge() */
 
 #define AUGMENTS_VARIABLES_TAGS "tags"
 #define AUGMENTS_VARIABLES_DATA "value"
@@ -1706,6 +1707,10 @@ static void DeleteChangesChroot()
 void GenericAgentFinalize(EvalContext *ctx, GenericAgentConfig *config)
 {
     /* TODO, FIXME: what else from the above do we need to undo here ? */
+    DataFileCacheLogStats();
+    DataFileCachePurge(time(NULL));
+    DataFileCacheClear();
+
     if (config->agent_type != AGENT_TYPE_KEYGEN)
     {
         cfnet_shut();
@@ -2497,6 +2502,7 @@ GenericAgentConfig *GenericAgentConfigNewDefault(AgentType agent_type, bool tty_
     config->ignore_missing_bundles = false;
     config->ignore_missing_inputs = false;
     config->ignore_preferred_augments = false;
+    config->parse_jobs = 0;
 
     config->heap_soft = NULL;
     config->heap_negated = NULL;
@@ -28,7 +28,8 @@
 #include <addr_lib.h>
 #include <matching.h>
 #include <misc_lib.h>
-#include <regex.h> /* StringMatchFull,CompileRegex,StringMatchWithPrecompiledRegex */
+#include <regex.h> /* CompileRegex,StringMatchWithPrecompiledRegex */
+#include <regex_cache.h> /* RegexCacheMatchFull */
 #include <file_lib.h>
 #include <files_interfaces.h>
 
@@ -791,7 +792,7 @@ bool IsMatchItemIn(const Item *list, const char *item)
     {
         if (FuzzySetMatch(ptr->name, item) == 0 ||
             (IsRegex(ptr->name) &&
-             StringMatchFull(ptr->name, item)))
+             RegexCacheMatchFull(ptr->name, item)))
         {
             return true;
         }
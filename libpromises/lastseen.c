@@ -30,6 +30,8 @@
 #include <locks.h>
 #include <item_lib.h>
 #include <known_dirs.h>
+#include <sequence.h>
+#include <mutex.h>
 #ifdef LMDB
 #include <lmdb.h>
 #endif
@@ -106,6 +108,8 @@ void LastSaw(const char *ipaddress, const unsigned char *digest, LastSeenRole ro
 
 /*****************************************************************************/
 
+static void LastSeenSnapshotInvalidate(void);
+
 void UpdateLastSawHost(const char *hostkey, const char *address,
                        bool incoming, time_t timestamp)
 {
@@ -150,6 +154,7 @@ void UpdateLastSawHost(const char *hostkey, const char *address,
     WriteDB(db, address_key, hostkey, strlen(hostkey) + 1);
 
     CloseDB(db);
+    LastSeenSnapshotInvalidate();
 }
 /*****************************************************************************/
 
@@ -531,6 +536,10 @@ bool DeleteIpFromLastSeen(const char *ip, char *digest, size_t digest_size)
 
 clean:
     CloseDB(db);
+    if (res)
+    {
+        LastSeenSnapshotInvalidate();
+    }
     return res;
 }
 
@@ -600,116 +609,467 @@ bool DeleteDigestFromLastSeen(const char *key, char *ip, size_t ip_size, bool a_
 
 clean:
     CloseDB(db);
+    if (res)
+    {
+        LastSeenSnapshotInvalidate();
+    }
     return res;
 }
 
 /*****************************************************************************/
-bool ScanLastSeenQuality(LastSeenQualityCallback callback, void *ctx)
+
+/*
+ * Snapshot of the lastseen database.
+ *
+ * hostsseen() and friends read all of it, which means a cursor over the whole
+ * database and parsing every key, on hubs with tens of thousands of hosts for
+ * each call. Instead they share one copy, sorted for lookups by hostkey, by
+ * address and by time. It is loaded in a single read transaction.
+ *
+ * On a hub cf-serverd commits to the database with every connection, so the
+ * snapshot is reused for LASTSEEN_SNAPSHOT_MAX_AGE before the database
+ * generation is compared, and only loaded again if some process committed
+ * since. Changes made by this process are seen right away.
+ */
+
+#define LASTSEEN_SNAPSHOT_MAX_AGE SECONDS_PER_MINUTE
+
+typedef struct
+{
+    char *hostkey;
+    char *address;
+    bool has_incoming;
+    bool has_outgoing;
+    KeyHostSeen incoming;
+    KeyHostSeen outgoing;
+} LastSeenHost;
+
+typedef struct
+{
+    char *address;
+    char *hostkey;
+} LastSeenAddress;
+
+typedef struct
+{
+    const LastSeenHost *host;
+    bool incoming;
+} LastSeenConnection;
+
+typedef struct
 {
-    StringMap *lastseen_db = LoadDatabaseToStringMap(dbid_lastseen);
-    if (!lastseen_db)
+    char *hostkey;
+    bool incoming;
+    KeyHostSeen quality;
+} LastSeenQuality;
+
+struct LastSeenSnapshot_
+{
+    Seq *hosts;                 /* LastSeenHost, by hostkey */
+    Seq *addresses;             /* LastSeenAddress, by address */
+    Seq *connections;           /* LastSeenConnection, by last seen time */
+    size_t generation;
+    time_t checked;             /* when #generation was last compared */
+    int refcount;
+};
+
+static pthread_mutex_t LASTSEEN_SNAPSHOT_LOCK = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+static LastSeenSnapshot *LASTSEEN_SNAPSHOT = NULL; /* GLOBAL_X */
+
+static void LastSeenHostDestroy(void *data)
+{
+    LastSeenHost *host = data;
+    free(host->hostkey);
+    free(host->address);
+    free(host);
+}
+
+static void LastSeenAddressDestroy(void *data)
+{
+    LastSeenAddress *address = data;
+    free(address->address);
+    free(address->hostkey);
+    free(address);
+}
+
+static void LastSeenQualityDestroy(void *data)
+{
+    LastSeenQuality *quality = data;
+    free(quality->hostkey);
+    free(quality);
+}
+
+static int LastSeenHostCompare(const void *a, const void *b,
+                               ARG_UNUSED void *user_data)
+{
+    const LastSeenHost *host_a = a;
+    const LastSeenHost *host_b = b;
+    return strcmp(host_a->hostkey, host_b->hostkey);
+}
+
+static int LastSeenAddressCompare(const void *a, const void *b,
+                                  ARG_UNUSED void *user_data)
+{
+    const LastSeenAddress *address_a = a;
+    const LastSeenAddress *address_b = b;
+    return strcmp(address_a->address, address_b->address);
+}
+
+static const KeyHostSeen *LastSeenConnectionQuality(const LastSeenConnection *connection)
+{
+    return connection->incoming ?
+        &connection->host->incoming : &connection->host->outgoing;
+}
+
+static int LastSeenConnectionCompare(const void *a, const void *b,
+                                     ARG_UNUSED void *user_data)
+{
+    const LastSeenConnection *connection_a = a;
+    const LastSeenConnection *connection_b = b;
+    const time_t time_a = LastSeenConnectionQuality(connection_a)->lastseen;
+    const time_t time_b = LastSeenConnectionQuality(connection_b)->lastseen;
+    if (time_a != time_b)
     {
-        return false;
+        return (time_a > time_b) - (time_a < time_b);
+    }
+    const int ret = strcmp(connection_a->host->hostkey, connection_b->host->hostkey);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return connection_a->incoming - connection_b->incoming;
+}
+
+static void LastSeenSnapshotDestroy(LastSeenSnapshot *snapshot)
+{
+    if (snapshot != NULL)
+    {
+        SeqDestroy(snapshot->connections);
+        SeqDestroy(snapshot->addresses);
+        SeqDestroy(snapshot->hosts);
+        free(snapshot);
     }
-    MapIterator it = MapIteratorInit(lastseen_db->impl);
-    MapKeyValue *item;
+}
+
+static bool IsStringKey(const char *key, int key_size)
+{
+    return (key_size > 1 && key[key_size - 1] == '\0');
+}
 
-    Seq *hostkeys = SeqNew(100, free);
-    while ((item = MapIteratorNext(&it)) != NULL)
+static LastSeenSnapshot *LastSeenSnapshotLoad(DBHandle *db)
+{
+    DBCursor *cursor;
+    if (!NewDBCursor(db, &cursor))
     {
-        char *key = item->key;
-        /* Only look for "keyhost" entries */
-        if (key[0] != 'k')
+        Log(LOG_LEVEL_ERR, "Unable to create lastseen database cursor");
+        return NULL;
+    }
+
+    LastSeenSnapshot *snapshot = xcalloc(1, sizeof(LastSeenSnapshot));
+    snapshot->hosts = SeqNew(100, LastSeenHostDestroy);
+    snapshot->addresses = SeqNew(100, LastSeenAddressDestroy);
+    snapshot->connections = SeqNew(200, free);
+
+    /* Quality entries are matched with their hosts once all are read. */
+    Seq *qualities = SeqNew(200, LastSeenQualityDestroy);
+
+    char *key;
+    void *value;
+    int ksize, vsize;
+    while (NextDB(cursor, &key, &ksize, &value, &vsize))
+    {
+        if (!IsStringKey(key, ksize) || value == NULL)
         {
             continue;
         }
 
-        SeqAppend(hostkeys, xstrdup(key + 1));
+        if (key[0] == 'k')
+        {
+            LastSeenHost *host = xcalloc(1, sizeof(LastSeenHost));
+            host->hostkey = xstrdup(key + 1);
+            host->address = xstrndup(value, vsize);
+            SeqAppend(snapshot->hosts, host);
+        }
+        else if (key[0] == 'a')
+        {
+            LastSeenAddress *address = xmalloc(sizeof(LastSeenAddress));
+            address->address = xstrdup(key + 1);
+            address->hostkey = xstrndup(value, vsize);
+            SeqAppend(snapshot->addresses, address);
+        }
+        else if ((strncmp(key, "qi", 2) == 0 || strncmp(key, "qo", 2) == 0) &&
+                 vsize == sizeof(KeyHostSeen))
+        {
+            LastSeenQuality *quality = xmalloc(sizeof(LastSeenQuality));
+            quality->hostkey = xstrdup(key + 2);
+            quality->incoming = (key[1] == 'i');
+            memcpy(&quality->quality, value, sizeof(KeyHostSeen));
+            SeqAppend(qualities, quality);
+        }
     }
-    for (size_t i = 0; i < SeqLength(hostkeys); ++i)
-    {
-        const char *hostkey = SeqAt(hostkeys, i);
 
-        char keyhost_key[CF_BUFSIZE];
-        snprintf(keyhost_key, CF_BUFSIZE, "k%s", hostkey);
-        char *address = NULL;
-        address = (char*)StringMapGet(lastseen_db, keyhost_key);
-        if (!address)
+    DeleteDBCursor(cursor);
+
+    SeqSort(snapshot->hosts, LastSeenHostCompare, NULL);
+    SeqSort(snapshot->addresses, LastSeenAddressCompare, NULL);
+
+    const size_t n_qualities = SeqLength(qualities);
+    for (size_t i = 0; i < n_qualities; i++)
+    {
+        const LastSeenQuality *quality = SeqAt(qualities, i);
+        const LastSeenHost key_host = { .hostkey = quality->hostkey };
+        LastSeenHost *host = SeqBinaryLookup(snapshot->hosts, &key_host,
+                                             LastSeenHostCompare);
+        if (host == NULL)
         {
-            Log(LOG_LEVEL_ERR, "Failed to read address for key '%s'.", hostkey);
+            /* No address for it, not reported by ScanLastSeenQuality(). */
             continue;
         }
 
-        char incoming_key[CF_BUFSIZE];
-        snprintf(incoming_key, CF_BUFSIZE, "qi%s", hostkey);
-        KeyHostSeen *incoming = NULL;
-        incoming = (KeyHostSeen*)StringMapGet(lastseen_db, incoming_key);
-        if (incoming)
+        if (quality->incoming)
         {
-            if (!(*callback)(hostkey, address, true, incoming, ctx))
-            {
-                break;
-            }
+            host->has_incoming = true;
+            host->incoming = quality->quality;
+        }
+        else
+        {
+            host->has_outgoing = true;
+            host->outgoing = quality->quality;
         }
+    }
+    SeqDestroy(qualities);
 
-        char outgoing_key[CF_BUFSIZE];
-        snprintf(outgoing_key, CF_BUFSIZE, "qo%s", hostkey);
-        KeyHostSeen *outgoing = NULL;
-        outgoing = (KeyHostSeen*)StringMapGet(lastseen_db, outgoing_key);
-        if (outgoing)
+    const size_t n_hosts = SeqLength(snapshot->hosts);
+    for (size_t i = 0; i < n_hosts; i++)
+    {
+        const LastSeenHost *host = SeqAt(snapshot->hosts, i);
+        if (host->has_incoming)
+        {
+            LastSeenConnection *connection = xmalloc(sizeof(LastSeenConnection));
+            *connection = (LastSeenConnection) { .host = host, .incoming = true };
+            SeqAppend(snapshot->connections, connection);
+        }
+        if (host->has_outgoing)
         {
-            if (!(*callback)(hostkey, address, false, outgoing, ctx))
+            LastSeenConnection *connection = xmalloc(sizeof(LastSeenConnection));
+            *connection = (LastSeenConnection) { .host = host, .incoming = false };
+            SeqAppend(snapshot->connections, connection);
+        }
+    }
+    SeqSort(snapshot->connections, LastSeenConnectionCompare, NULL);
+
+    Log(LOG_LEVEL_DEBUG, "Loaded lastseen snapshot of %zu hosts, %zu addresses",
+        n_hosts, SeqLength(snapshot->addresses));
+
+    return snapshot;
+}
+
+/* Drops the snapshot once this process changed the database. */
+static void LastSeenSnapshotInvalidate(void)
+{
+    ThreadLock(&LASTSEEN_SNAPSHOT_LOCK);
+    LastSeenSnapshot *old = LASTSEEN_SNAPSHOT;
+    LASTSEEN_SNAPSHOT = NULL;
+    const bool last = (old != NULL && --old->refcount == 0);
+    ThreadUnlock(&LASTSEEN_SNAPSHOT_LOCK);
+
+    if (last)
+    {
+        LastSeenSnapshotDestroy(old);
+    }
+}
+
+LastSeenSnapshot *LastSeenSnapshotAcquire(void)
+{
+    const time_t now = time(NULL);
+
+    ThreadLock(&LASTSEEN_SNAPSHOT_LOCK);
+    LastSeenSnapshot *recent = LASTSEEN_SNAPSHOT;
+    if (recent != NULL && recent->checked <= now &&
+        now - recent->checked < LASTSEEN_SNAPSHOT_MAX_AGE)
+    {
+        recent->refcount++;
+        ThreadUnlock(&LASTSEEN_SNAPSHOT_LOCK);
+        return recent;
+    }
+    ThreadUnlock(&LASTSEEN_SNAPSHOT_LOCK);
+
+    DBHandle *db;
+    if (!OpenDB(&db, dbid_lastseen))
+    {
+        char *db_path = DBIdToPath(dbid_lastseen);
+        Log(LOG_LEVEL_ERR, "Unable to open lastseen database '%s'", db_path);
+        free(db_path);
+        return NULL;
+    }
+
+    /* Before reading, so that commits in between make it look outdated. */
+    size_t generation;
+    const bool has_generation = GetDBGeneration(db, &generation);
+
+    /* Held while loading, so that concurrent callers wait for the one load. */
+    ThreadLock(&LASTSEEN_SNAPSHOT_LOCK);
+    LastSeenSnapshot *snapshot = LASTSEEN_SNAPSHOT;
+    if (snapshot == NULL || !has_generation || snapshot->generation != generation)
+    {
+        snapshot = LastSeenSnapshotLoad(db);
+        if (snapshot != NULL)
+        {
+            snapshot->generation = generation;
+            snapshot->checked = has_generation ? now : 0;
+            snapshot->refcount = 1;     /* LASTSEEN_SNAPSHOT's */
+
+            LastSeenSnapshot *old = LASTSEEN_SNAPSHOT;
+            if (old != NULL && --old->refcount == 0)
             {
-                break;
+                LastSeenSnapshotDestroy(old);
             }
+            LASTSEEN_SNAPSHOT = snapshot;
         }
     }
+    else
+    {
+        snapshot->checked = now;
+    }
+    if (snapshot != NULL)
+    {
+        snapshot->refcount++;
+    }
+    ThreadUnlock(&LASTSEEN_SNAPSHOT_LOCK);
 
-    StringMapDestroy(lastseen_db);
-    SeqDestroy(hostkeys);
+    CloseDB(db);
+    return snapshot;
+}
 
-    return true;
+void LastSeenSnapshotRelease(LastSeenSnapshot *snapshot)
+{
+    if (snapshot == NULL)
+    {
+        return;
+    }
+
+    ThreadLock(&LASTSEEN_SNAPSHOT_LOCK);
+    assert(snapshot->refcount > 0);
+    const bool last = (--snapshot->refcount == 0);
+    ThreadUnlock(&LASTSEEN_SNAPSHOT_LOCK);
+
+    if (last)
+    {
+        LastSeenSnapshotDestroy(snapshot);
+    }
 }
 
-/*****************************************************************************/
+size_t LastSeenSnapshotHostCount(const LastSeenSnapshot *snapshot)
+{
+    assert(snapshot != NULL);
+    return SeqLength(snapshot->hosts);
+}
 
-int LastSeenHostKeyCount(void)
+const char *LastSeenSnapshotAddress(const LastSeenSnapshot *snapshot,
+                                    const char *hostkey)
 {
-    CF_DB *dbp;
-    CF_DBC *dbcp;
-    QPoint entry;
-    char *key;
-    void *value;
-    int ksize, vsize;
+    assert(snapshot != NULL);
+    assert(hostkey != NULL);
 
-    int count = 0;
+    const LastSeenHost key = { .hostkey = (char *) hostkey };
+    const LastSeenHost *host = SeqBinaryLookup(snapshot->hosts, &key,
+                                               LastSeenHostCompare);
+    return (host != NULL) ? host->address : NULL;
+}
+
+const char *LastSeenSnapshotHostkey(const LastSeenSnapshot *snapshot,
+                                    const char *address)
+{
+    assert(snapshot != NULL);
+    assert(address != NULL);
 
-    if (OpenDB(&dbp, dbid_lastseen))
+    const LastSeenAddress key = { .address = (char *) address };
+    const LastSeenAddress *entry = SeqBinaryLookup(snapshot->addresses, &key,
+                                                   LastSeenAddressCompare);
+    return (entry != NULL) ? entry->hostkey : NULL;
+}
+
+void LastSeenSnapshotScan(const LastSeenSnapshot *snapshot, time_t since,
+                          LastSeenQualityCallback callback, void *ctx)
+{
+    assert(snapshot != NULL);
+    assert(callback != NULL);
+
+    /* The first connection seen at #since or later. */
+    size_t low = 0;
+    size_t high = SeqLength(snapshot->connections);
+    while (low < high)
     {
-        memset(&entry, 0, sizeof(entry));
+        const size_t mid = low + (high - low) / 2;
+        const LastSeenConnection *connection = SeqAt(snapshot->connections, mid);
+        if (LastSeenConnectionQuality(connection)->lastseen < since)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
 
-        if (NewDBCursor(dbp, &dbcp))
+    const size_t length = SeqLength(snapshot->connections);
+    for (size_t i = low; i < length; i++)
+    {
+        const LastSeenConnection *connection = SeqAt(snapshot->connections, i);
+        if (!(*callback)(connection->host->hostkey, connection->host->address,
+                         connection->incoming,
+                         LastSeenConnectionQuality(connection), ctx))
         {
-            while (NextDB(dbcp, &key, &ksize, &value, &vsize))
-            {
-                /* Only look for valid "hostkey" entries */
+            break;
+        }
+    }
+}
 
-                if ((key[0] != 'k') || (value == NULL))
-                {
-                    continue;
-                }
+/*****************************************************************************/
 
-                count++;
-            }
+bool ScanLastSeenQuality(LastSeenQualityCallback callback, void *ctx)
+{
+    LastSeenSnapshot *snapshot = LastSeenSnapshotAcquire();
+    if (snapshot == NULL)
+    {
+        return false;
+    }
 
-            DeleteDBCursor(dbcp);
+    const size_t length = SeqLength(snapshot->hosts);
+    for (size_t i = 0; i < length; i++)
+    {
+        const LastSeenHost *host = SeqAt(snapshot->hosts, i);
+        if (host->has_incoming &&
+            !(*callback)(host->hostkey, host->address, true, &host->incoming, ctx))
+        {
+            break;
+        }
+        if (host->has_outgoing &&
+            !(*callback)(host->hostkey, host->address, false, &host->outgoing, ctx))
+        {
+            break;
         }
+    }
+
+    LastSeenSnapshotRelease(snapshot);
+    return true;
+}
 
-        CloseDB(dbp);
+/*****************************************************************************/
+
+int LastSeenHostKeyCount(void)
+{
+    LastSeenSnapshot *snapshot = LastSeenSnapshotAcquire();
+    if (snapshot == NULL)
+    {
+        return 0;
     }
 
+    const int count = LastSeenSnapshotHostCount(snapshot);
+    LastSeenSnapshotRelease(snapshot);
     return count;
 }
+
 /**
  * @brief removes all traces of entry 'input' from lastseen DB
  *
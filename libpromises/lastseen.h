@@ -50,13 +50,36 @@ bool DeleteIpFromLastSeen(const char *ip, char *digest, size_t digest_size);
 bool DeleteDigestFromLastSeen(const char *key, char *ip, size_t ip_size, bool a_entry_required);
 
 /*
- * Return false in order to stop iteration
+ * Return false in order to stop iteration. ScanLastSeenQuality() reports the
+ * hosts sorted by hostkey, incoming before outgoing.
  */
 typedef bool (*LastSeenQualityCallback)(const char *hostkey, const char *address,
                                         bool incoming, const KeyHostSeen *quality,
                                         void *ctx);
 
 bool ScanLastSeenQuality(LastSeenQualityCallback callback, void *ctx);
+
+/*
+ * Read-only copy of the lastseen database, indexed by hostkey, address and
+ * time, for queries that would otherwise scan all of it. Shared between
+ * callers and threads, loaded again once this process changed the database,
+ * or at most once a minute once other processes did. Release each snapshot
+ * acquired, NULL means the database couldn't be read.
+ */
+typedef struct LastSeenSnapshot_ LastSeenSnapshot;
+
+LastSeenSnapshot *LastSeenSnapshotAcquire(void);
+void LastSeenSnapshotRelease(LastSeenSnapshot *snapshot);
+
+size_t LastSeenSnapshotHostCount(const LastSeenSnapshot *snapshot);
+const char *LastSeenSnapshotAddress(const LastSeenSnapshot *snapshot,
+                                    const char *hostkey);
+const char *LastSeenSnapshotHostkey(const LastSeenSnapshot *snapshot,
+                                    const char *address);
+/* Connections last seen at #since or later, oldest first. */
+void LastSeenSnapshotScan(const LastSeenSnapshot *snapshot, time_t since,
+                          LastSeenQualityCallback callback, void *ctx);
+
 int LastSeenHostKeyCount(void);
 bool IsLastSeenCoherent(void);
 int RemoveKeysFromLastSeen(const char *input, bool must_be_coherent,
@@ -38,6 +38,7 @@
 #include <known_dirs.h>
 #include <ornaments.h>
 #include <policy.h>
+#include <policy_cache.h>
 #include <cleanup.h>
 
 // TODO: remove
@@ -46,18 +47,23 @@
 
 
 static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, const char *policy_file,
+                              const char *policy_file_hash,
                               StringMap *policy_files_hashes, StringSet *parsed_files_checksums,
                               StringSet *failed_files);
 
 
 
 
-/*
- * The difference between filename and input_input file is that the latter is the file specified by -f or
- * equivalently the file containing body common control. This will hopefully be squashed in later refactoring.
+/**
+ * @param cache_hash if not NULL, try loading the policy from the policy cache
+ *                   first, expecting the file to hash to it
+ * @param cached set to whether it was loaded from the cache
  */
-Policy *Cf3ParseFile(const GenericAgentConfig *config, const char *input_path)
+static Policy *ParsePolicyFile(const GenericAgentConfig *config, const char *input_path,
+                               const char *cache_hash, bool *cached)
 {
+    *cached = false;
+
     struct stat statbuf;
 
     if (stat(input_path, &statbuf) == -1)
@@ -129,6 +135,12 @@ Policy *Cf3ParseFile(const GenericAgentConfig *config, const char *input_path)
         JsonDestroy(json_policy);
         WriterClose(contents);
     }
+    else if (cache_hash != NULL &&
+             (policy = PolicyCacheLoad(input_path, cache_hash)) != NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Loaded file '%s' from the policy cache", input_path);
+        *cached = true;
+    }
     else
     {
         if (config->agent_type == AGENT_TYPE_COMMON)
@@ -145,12 +157,157 @@ Policy *Cf3ParseFile(const GenericAgentConfig *config, const char *input_path)
     return policy;
 }
 
+/*
+ * The difference between filename and input_input file is that the latter is the file specified by -f or
+ * equivalently the file containing body common control. This will hopefully be squashed in later refactoring.
+ */
+Policy *Cf3ParseFile(const GenericAgentConfig *config, const char *input_path)
+{
+    bool cached;
+    return ParsePolicyFile(config, input_path, NULL, &cached);
+}
+
+static void HashPolicyFile(const char *policy_file, char *hashbuffer, size_t hashbuffer_size)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+
+    HashFile(policy_file, digest, CF_DEFAULT_DIGEST, false);
+    HashPrintSafe(hashbuffer, hashbuffer_size, digest,
+                  CF_DEFAULT_DIGEST, true);
+}
+
+#ifndef __MINGW32__
+static void PrecachePolicyFilesJob(const GenericAgentConfig *config, const Seq *paths,
+                                   const Seq *hashes, size_t first, size_t step)
+{
+    for (size_t i = first; i < SeqLength(paths); i += step)
+    {
+        const char *path = SeqAt(paths, i);
+        const char *hashbuffer = SeqAt(hashes, i);
+
+        Policy *policy = ParserParseFile(config->agent_type, path, 0, 0);
+        if (policy == NULL)
+        {
+            continue;
+        }
+
+        Seq *errors = SeqNew(10, free);
+        if (PolicyCheckPartial(policy, errors))
+        {
+            Buffer *serialized = PolicyCacheSerialize(policy, path, hashbuffer);
+            PolicyCacheStore(path, serialized);
+            BufferDestroy(serialized);
+        }
+        SeqDestroy(errors);
+        PolicyDestroy(policy);
+    }
+}
+#endif
+
+/**
+ * Parse the files in #inputs that need no expansion and are not in the
+ * policy cache yet in config->parse_jobs parallel processes, so that loading
+ * them one by one afterwards only needs to read them from the policy cache.
+ * The parser is not reentrant, hence processes and not threads. Errors are left for the sequential loading to
+ * report.
+ *
+ * @param hashes where to add the hashes of the files, by path, for the
+ *               sequential loading not to hash them again
+ */
+static void PrecachePolicyFiles(const GenericAgentConfig *config, const Rlist *inputs,
+                                StringMap *policy_files_hashes, StringMap *hashes)
+{
+#ifdef __MINGW32__
+    UNUSED(config);
+    UNUSED(inputs);
+    UNUSED(policy_files_hashes);
+    UNUSED(hashes);
+#else
+    if (config->parse_jobs < 2 || config->agent_type == AGENT_TYPE_COMMON)
+    {
+        return;
+    }
+
+    /* Only fork for the files that are not cached yet, usually none. */
+    Seq *paths = SeqNew(100, free);
+    Seq *path_hashes = SeqNew(100, free);
+    for (const Rlist *rp = inputs; rp != NULL; rp = rp->next)
+    {
+        if (rp->val.type != RVAL_TYPE_SCALAR || IsExpandable(RlistScalarValue(rp)))
+        {
+            continue;
+        }
+
+        const char *path = GenericAgentResolveInputPath(config, RlistScalarValue(rp));
+        if (StringEndsWith(path, ".json") ||
+            StringMapHasKey(policy_files_hashes, path) ||
+            !FileCanOpen(path, "r"))
+        {
+            continue;
+        }
+
+        char hashbuffer[CF_HOSTKEY_STRING_SIZE] = { 0 };
+        HashPolicyFile(path, hashbuffer, sizeof(hashbuffer));
+        StringMapInsert(hashes, xstrdup(path), xstrdup(hashbuffer));
+        if (!PolicyCacheIsFresh(path, hashbuffer))
+        {
+            SeqAppend(paths, xstrdup(path));
+            SeqAppend(path_hashes, xstrdup(hashbuffer));
+        }
+    }
+
+    const size_t n_jobs = MIN(config->parse_jobs, SeqLength(paths));
+    if (n_jobs < 2)
+    {
+        SeqDestroy(paths);
+        SeqDestroy(path_hashes);
+        return;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Parsing %zu policy files in %zu parallel jobs",
+        SeqLength(paths), n_jobs);
+
+    pid_t *pids = xcalloc(n_jobs, sizeof(pid_t));
+    for (size_t i = 0; i < n_jobs; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+        {
+            LogSetGlobalLevel(LOG_LEVEL_CRIT);
+            PrecachePolicyFilesJob(config, paths, path_hashes, i, n_jobs);
+            _exit(EXIT_SUCCESS);
+        }
+        else if (pids[i] == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Failed to start a policy parsing job (fork: %s)", GetErrorStr());
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < n_jobs && pids[i] > 0; i++)
+    {
+        int status;
+        while (waitpid(pids[i], &status, 0) == -1 && errno == EINTR)
+        {
+        }
+    }
+
+    free(pids);
+    SeqDestroy(paths);
+    SeqDestroy(path_hashes);
+#endif
+}
+
 static Policy *LoadPolicyInputFiles(EvalContext *ctx, GenericAgentConfig *config, const Rlist *inputs,
                                     StringMap *policy_files_hashes, StringSet *parsed_files_checksums,
                                     StringSet *failed_files)
 {
     Policy *policy = PolicyNew();
 
+    StringMap *hashes = StringMapNew();
+    PrecachePolicyFiles(config, inputs, policy_files_hashes, hashes);
+
     for (const Rlist *rp = inputs; rp; rp = rp->next)
     {
         if (rp->val.type != RVAL_TYPE_SCALAR)
@@ -171,16 +328,19 @@ static Policy *LoadPolicyInputFiles(EvalContext *ctx, GenericAgentConfig *config
         switch (resolved_input.type)
         {
         case RVAL_TYPE_SCALAR:
+        {
             if (IsCf3VarString(RvalScalarValue(resolved_input)))
             {
                 Log(LOG_LEVEL_ERR, "Unresolved variable '%s' in input list, cannot parse", RvalScalarValue(resolved_input));
                 break;
             }
 
-            aux_policy = LoadPolicyFile(ctx, config,
-                                        GenericAgentResolveInputPath(config, RvalScalarValue(resolved_input)),
+            const char *input_path = GenericAgentResolveInputPath(config, RvalScalarValue(resolved_input));
+            aux_policy = LoadPolicyFile(ctx, config, input_path,
+                                        StringMapGet(hashes, input_path),
                                         policy_files_hashes, parsed_files_checksums, failed_files);
             break;
+        }
 
         case RVAL_TYPE_LIST:
             aux_policy = LoadPolicyInputFiles(ctx, config,
@@ -201,6 +361,7 @@ static Policy *LoadPolicyInputFiles(EvalContext *ctx, GenericAgentConfig *config
         RvalDestroy(resolved_input);
     }
 
+    StringMapDestroy(hashes);
     return policy;
 }
 
@@ -277,6 +438,7 @@ static void RenameMainBundle(EvalContext *ctx, Policy *policy)
     }
     Seq *bundles = policy->bundles;
     int length = SeqLength(bundles);
+    bool renamed = false;
     bool removed = false;
     for (int i = 0; i < length; ++i)
     {
@@ -291,6 +453,7 @@ static void RenameMainBundle(EvalContext *ctx, Policy *policy)
                     abspath);
                 strncpy(bundle->name, "main", 4+1);
                 // "__main__" is always big enough for "main"
+                renamed = true;
             }
             else
             {
@@ -308,21 +471,28 @@ static void RenameMainBundle(EvalContext *ctx, Policy *policy)
     {
         SeqRemoveNulls(bundles);
     }
+    if (renamed || removed)
+    {
+        PolicyRebuildIndexes(policy);
+    }
     free(entry_point);
 }
 
 static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, const char *policy_file,
+                              const char *policy_file_hash,
                               StringMap *policy_files_hashes, StringSet *parsed_files_checksums,
                               StringSet *failed_files)
 {
-    unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
     char hashbuffer[CF_HOSTKEY_STRING_SIZE] = { 0 };
-
-    HashFile(policy_file, digest, CF_DEFAULT_DIGEST, false);
-    HashPrintSafe(hashbuffer, sizeof(hashbuffer), digest,
-                  CF_DEFAULT_DIGEST, true);
-
-    Log(LOG_LEVEL_DEBUG, "Hashed policy file %s to %s", policy_file, hashbuffer);
+    if (policy_file_hash != NULL)
+    {
+        strlcpy(hashbuffer, policy_file_hash, sizeof(hashbuffer));
+    }
+    else
+    {
+        HashPolicyFile(policy_file, hashbuffer, sizeof(hashbuffer));
+        Log(LOG_LEVEL_DEBUG, "Hashed policy file %s to %s", policy_file, hashbuffer);
+    }
 
     if (StringMapHasKey(policy_files_hashes, policy_file))
     {
@@ -340,13 +510,24 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
         Log(LOG_LEVEL_DEBUG, "Loading policy file %s", policy_file);
     }
 
-    Policy *policy = Cf3ParseFile(config, policy_file);
+    /* cf-promises parses everything, it has to warn about what it finds. */
+    const char *cache_hash = (config->agent_type != AGENT_TYPE_COMMON) ? hashbuffer : NULL;
+    bool cached = false;
+    Policy *policy = ParsePolicyFile(config, policy_file, cache_hash, &cached);
 
     StringMapInsert(policy_files_hashes, xstrdup(policy_file), xstrdup(hashbuffer));
     StringSetAdd(parsed_files_checksums, xstrdup(hashbuffer));
 
     if (policy)
     {
+        /* Serialize before RenameMainBundle(), which depends on the entry
+         * point, but only cache it if it passes the checks. */
+        Buffer *serialized = NULL;
+        if (cache_hash != NULL && !cached)
+        {
+            serialized = PolicyCacheSerialize(policy, policy_file, cache_hash);
+        }
+
         RenameMainBundle(ctx, policy);
         Seq *errors = SeqNew(10, free);
         if (!PolicyCheckPartial(policy, errors))
@@ -359,12 +540,22 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
             WriterClose(writer);
             SeqDestroy(errors);
 
+            if (serialized != NULL)
+            {
+                BufferDestroy(serialized);
+            }
             StringSetAdd(failed_files, xstrdup(policy_file));
             PolicyDestroy(policy);
             return NULL;
         }
 
         SeqDestroy(errors);
+
+        if (serialized != NULL)
+        {
+            PolicyCacheStore(policy_file, serialized);
+            BufferDestroy(serialized);
+        }
     }
     else
     {
@@ -377,6 +568,10 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
     Body *body_common_control = PolicyGetBody(policy, NULL, "common", "control");
     Body *body_file_control = PolicyGetBody(policy, NULL, "file", "control");
 
+    /* This file first, then its inputs, merged in one go. */
+    Seq *parts = SeqNew(3, NULL);
+    SeqAppend(parts, policy);
+
     if (body_common_control)
     {
         Seq *potential_inputs = BodyGetConstraint(body_common_control, "inputs");
@@ -390,7 +585,7 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
                                                       failed_files);
             if (aux_policy)
             {
-                policy = PolicyMerge(policy, aux_policy);
+                SeqAppend(parts, aux_policy);
             }
         }
     }
@@ -408,11 +603,14 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
                                                       failed_files);
             if (aux_policy)
             {
-                policy = PolicyMerge(policy, aux_policy);
+                SeqAppend(parts, aux_policy);
             }
         }
     }
 
+    policy = PolicyMergeAll(parts);
+    SeqDestroy(parts);
+
     return policy;
 }
 
@@ -500,7 +698,7 @@ Policy *LoadPolicy(EvalContext *ctx, GenericAgentConfig *config)
 
     Banner("Loading policy");
 
-    Policy *policy = LoadPolicyFile(ctx, config, config->input_file,
+    Policy *policy = LoadPolicyFile(ctx, config, config->input_file, NULL,
                                     policy_files_hashes, parsed_files_checksums,
                                     failed_files);
 
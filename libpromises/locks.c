@@ -42,6 +42,9 @@
 #include <sysinfo.h>
 #include <openssl/evp.h>
 #include <libcrypto-compat.h>
+#include <map.h>
+#include <sequence.h>
+#include <dir.h>
 
 #ifdef LMDB
 // Be careful if you want to change this,
@@ -91,6 +94,18 @@ static CfLockStack *PopLock()
     return lock;
 }
 
+/* See SetLockCaching(), all protected by cft_lock. */
+typedef struct
+{
+    LockData data;
+    bool removed;
+    bool dirty;                                 /* not in the database yet */
+} LockCacheEntry;
+
+static Map *LOCK_CACHE = NULL;   /* lock database key -> LockCacheEntry */
+static Seq *LOCK_CACHE_DIRTY = NULL;     /* keys of the dirty entries */
+static time_t LOCK_CACHE_START_TIME = PROCESS_START_TIME_UNKNOWN;
+
 static void CopyLockDatabaseAtomically(const char *from, const char *to,
                                        const char *from_pretty_name,
                                        const char *to_pretty_name);
@@ -190,6 +205,185 @@ static void HashLockKeyIfNecessary(const char *const istring, char *const ohash)
 }
 #endif
 
+/* The key of lock #name in the lock database. */
+static void LockDBKey(const char *name, char key[CF_BUFSIZE])
+{
+#ifdef LMDB
+    HashLockKeyIfNecessary(name, key);
+#else
+    strlcpy(key, name, CF_BUFSIZE);
+#endif
+}
+
+static void LockCacheLoad(void)
+{
+    LOCK_CACHE = MapNew(StringHash_untyped, StringEqual_untyped, free, free);
+    LOCK_CACHE_DIRTY = SeqNew(128, free);
+    LOCK_CACHE_START_TIME = GetProcessStartTime(getpid());
+
+    CF_DB *dbp = OpenLock();
+    if (dbp == NULL)
+    {
+        return;
+    }
+
+    CF_DBC *dbcp;
+    if (!NewDBCursor(dbp, &dbcp))
+    {
+        Log(LOG_LEVEL_ERR, "Unable to scan the lock database, starting with no locks");
+        CloseLock(dbp);
+        return;
+    }
+
+    char *key;
+    void *value;
+    int ksize, vsize;
+    while (NextDB(dbcp, &key, &ksize, &value, &vsize))
+    {
+        if (ksize < 1 || key[ksize - 1] != '\0' ||
+            value == NULL || vsize != sizeof(LockData))
+        {
+            continue;
+        }
+
+        LockCacheEntry *entry = xcalloc(1, sizeof(LockCacheEntry));
+        memcpy(&entry->data, value, sizeof(LockData));
+        MapInsert(LOCK_CACHE, xstrdup(key), entry);
+    }
+    DeleteDBCursor(dbcp);
+    CloseLock(dbp);
+
+    Log(LOG_LEVEL_VERBOSE, "Read %zu locks into memory", MapSize(LOCK_CACHE));
+}
+
+/* Call with cft_lock held. */
+static const LockData *LockCacheGet(const char *name)
+{
+    char key[CF_BUFSIZE];
+    LockDBKey(name, key);
+
+    const LockCacheEntry *entry = MapGet(LOCK_CACHE, key);
+    return (entry != NULL && !entry->removed) ? &entry->data : NULL;
+}
+
+/* Call with cft_lock held, a NULL #data removes the lock. */
+static void LockCacheSet(const char *name, const LockData *data)
+{
+    char key[CF_BUFSIZE];
+    LockDBKey(name, key);
+
+    LockCacheEntry *entry = MapGet(LOCK_CACHE, key);
+    if (entry == NULL)
+    {
+        if (data == NULL)
+        {
+            return;
+        }
+        entry = xcalloc(1, sizeof(LockCacheEntry));
+        MapInsert(LOCK_CACHE, xstrdup(key), entry);
+    }
+
+    if (data != NULL)
+    {
+        entry->data = *data;
+    }
+    entry->removed = (data == NULL);
+
+    if (!entry->dirty)
+    {
+        entry->dirty = true;
+        SeqAppend(LOCK_CACHE_DIRTY, xstrdup(key));
+    }
+}
+
+bool FlushLockCache(void)
+{
+    ThreadLock(cft_lock);
+    const size_t count = (LOCK_CACHE_DIRTY != NULL) ? SeqLength(LOCK_CACHE_DIRTY) : 0;
+    if (count == 0)
+    {
+        ThreadUnlock(cft_lock);
+        return true;
+    }
+
+    CF_DB *dbp = OpenLock();
+    if (dbp == NULL)
+    {
+        ThreadUnlock(cft_lock);
+        return false;
+    }
+
+    /* All in one transaction. */
+    DBBeginBatch(dbp);
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *key = SeqAt(LOCK_CACHE_DIRTY, i);
+        LockCacheEntry *entry = MapGet(LOCK_CACHE, key);
+        if (entry->removed)
+        {
+            DeleteDB(dbp, key);
+        }
+        else
+        {
+            WriteDB(dbp, key, &entry->data, sizeof(LockData));
+        }
+        entry->dirty = false;
+    }
+    const bool success = DBEndBatch(dbp);
+    CloseLock(dbp);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *key = SeqAt(LOCK_CACHE_DIRTY, i);
+        const LockCacheEntry *entry = MapGet(LOCK_CACHE, key);
+        if (entry->removed)
+        {
+            MapRemove(LOCK_CACHE, key);
+        }
+    }
+    SeqClear(LOCK_CACHE_DIRTY);
+    ThreadUnlock(cft_lock);
+
+    Log(LOG_LEVEL_DEBUG, "Wrote %zu lock updates to the lock database", count);
+    return success;
+}
+
+static void FlushLockCacheAtExit(void)
+{
+    FlushLockCache();
+}
+
+static void RegisterFlushLockCacheAtExit(void)
+{
+    RegisterCleanupFunction(&FlushLockCacheAtExit);
+}
+
+void SetLockCaching(bool enabled)
+{
+    static pthread_once_t flush_at_exit_once = PTHREAD_ONCE_INIT;
+
+    if (enabled && LOCK_CACHE == NULL)
+    {
+        ThreadLock(cft_lock);
+        LockCacheLoad();
+        ThreadUnlock(cft_lock);
+
+        /* After opening the DB, so that this runs before CloseAllDBExit(). */
+        pthread_once(&flush_at_exit_once, RegisterFlushLockCacheAtExit);
+    }
+    else if (!enabled && LOCK_CACHE != NULL)
+    {
+        FlushLockCache();
+
+        ThreadLock(cft_lock);
+        MapDestroy(LOCK_CACHE);
+        LOCK_CACHE = NULL;
+        SeqDestroy(LOCK_CACHE_DIRTY);
+        LOCK_CACHE_DIRTY = NULL;
+        ThreadUnlock(cft_lock);
+    }
+}
+
 static bool WriteLockData(CF_DB *dbp, const char *lock_id, LockData *lock_data)
 {
     bool ret;
@@ -221,6 +415,20 @@ static bool WriteLockDataCurrent(CF_DB *dbp, const char *lock_id)
 
 static int WriteLock(const char *name)
 {
+    if (LOCK_CACHE != NULL)
+    {
+        const LockData lock_data = {
+            .pid = getpid(),
+            .time = time(NULL),
+            .process_start_time = LOCK_CACHE_START_TIME,
+        };
+
+        ThreadLock(cft_lock);
+        LockCacheSet(name, &lock_data);
+        ThreadUnlock(cft_lock);
+        return 0;
+    }
+
     CF_DB *dbp = OpenLock();
 
     if (dbp == NULL)
@@ -239,6 +447,15 @@ static int WriteLock(const char *name)
 
 static time_t FindLockTime(const char *name)
 {
+    if (LOCK_CACHE != NULL)
+    {
+        ThreadLock(cft_lock);
+        const LockData *lock_data = LockCacheGet(name);
+        const time_t lock_time = (lock_data != NULL) ? lock_data->time : -1;
+        ThreadUnlock(cft_lock);
+        return lock_time;
+    }
+
     bool ret;
     CF_DB *dbp = OpenLock();
     if (dbp == NULL)
@@ -339,7 +556,7 @@ static void RemoveDates(char *s)
     }
 }
 
-static int RemoveLock(const char *name)
+static int RemoveLockFromDB(const char *name)
 {
     CF_DB *dbp = OpenLock();
     if (dbp == NULL)
@@ -365,6 +582,18 @@ static int RemoveLock(const char *name)
     return 0;
 }
 
+static int RemoveLock(const char *name)
+{
+    if (LOCK_CACHE != NULL)
+    {
+        ThreadLock(cft_lock);
+        LockCacheSet(name, NULL);
+        ThreadUnlock(cft_lock);
+        return 0;
+    }
+    return RemoveLockFromDB(name);
+}
+
 static bool NoOrObsoleteLock(LockData *entry, ARG_UNUSED size_t entry_size, size_t *max_old)
 {
     assert((entry == NULL) || (entry_size == sizeof(LockData)));
@@ -447,7 +676,8 @@ void WaitForCriticalSection(const char *section_id)
 void ReleaseCriticalSection(const char *section_id)
 {
     Log(LOG_LEVEL_DEBUG, "Releasing critical section lock '%s'", section_id);
-    if (RemoveLock(section_id) == 0)
+    /* Taken in the database itself by WaitForCriticalSection(). */
+    if (RemoveLockFromDB(section_id) == 0)
     {
         Log(LOG_LEVEL_DEBUG, "Released critical section lock '%s'", section_id);
     }
@@ -554,9 +784,59 @@ static void PromiseTypeString(char *dst, size_t dst_size, const Promise *pp)
     }
 }
 
+static bool KillProcessHoldingLock(const LockData *lock_data)
+{
+    if (GracefulTerminate(lock_data->pid, lock_data->process_start_time))
+    {
+        Log(LOG_LEVEL_INFO,
+            "Process with PID %jd successfully killed",
+            (intmax_t) lock_data->pid);
+        return true;
+    }
+    else
+    {
+        if (errno == ESRCH)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Process with PID %jd has already been killed",
+                (intmax_t) lock_data->pid);
+            return true;
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR,
+                "Failed to kill process with PID: %jd (kill: %s)",
+                (intmax_t) lock_data->pid, GetErrorStr());
+            return false;
+        }
+    }
+}
+
 static bool KillLockHolder(const char *lock)
 {
     bool ret;
+    LockData lock_data = { 0 };
+    lock_data.process_start_time = PROCESS_START_TIME_UNKNOWN;
+
+    if (LOCK_CACHE != NULL)
+    {
+        ThreadLock(cft_lock);
+        const LockData *cached = LockCacheGet(lock);
+        const bool found = (cached != NULL);
+        if (found)
+        {
+            lock_data = *cached;
+        }
+        ThreadUnlock(cft_lock);
+
+        if (!found)
+        {
+            /* No lock found */
+            return true;
+        }
+        return KillProcessHoldingLock(&lock_data);
+    }
+
     CF_DB *dbp = OpenLock();
     if (dbp == NULL)
     {
@@ -564,9 +844,6 @@ static bool KillLockHolder(const char *lock)
         return false;
     }
 
-    LockData lock_data = { 0 };
-    lock_data.process_start_time = PROCESS_START_TIME_UNKNOWN;
-
 #ifdef LMDB
     unsigned char ohash[LMDB_MAX_KEY_SIZE];
     HashLockKeyIfNecessary(lock, ohash);
@@ -587,30 +864,7 @@ static bool KillLockHolder(const char *lock)
 
     CloseLock(dbp);
 
-    if (GracefulTerminate(lock_data.pid, lock_data.process_start_time))
-    {
-        Log(LOG_LEVEL_INFO,
-            "Process with PID %jd successfully killed",
-            (intmax_t) lock_data.pid);
-        return true;
-    }
-    else
-    {
-        if (errno == ESRCH)
-        {
-            Log(LOG_LEVEL_VERBOSE,
-                "Process with PID %jd has already been killed",
-                (intmax_t) lock_data.pid);
-            return true;
-        }
-        else
-        {
-            Log(LOG_LEVEL_ERR,
-                "Failed to kill process with PID: %jd (kill: %s)",
-                (intmax_t) lock_data.pid, GetErrorStr());
-            return false;
-        }
-    }
+    return KillProcessHoldingLock(&lock_data);
 }
 
 static void RvalDigestUpdate(EVP_MD_CTX *context, Rlist *rp)
@@ -796,6 +1050,327 @@ static CfLock CfLockNull(void)
     };
 }
 
+#ifndef __MINGW32__
+/*
+ * With lock_cache, a promise lock is also held as an fcntl() lock on a file
+ * of its own in this directory, named after a digest of the lock name and
+ * holding the LockData of the holder. Unlike the lock entries kept in
+ * memory, other agents see it right away, and it goes away with the process
+ * holding it. The file is removed when the lock is released, so only the
+ * locks being held and those of agents that died holding them have one.
+ */
+#define RUNNING_LOCKS_DIR "running_locks"
+
+/* fcntl() locks belong to the process, not to an acquisition, so holding a
+ * lock again is only counted and the last release drops it. */
+typedef struct
+{
+    int fd;
+    int count;
+} RunningLock;
+
+/* Protected by cft_lock, and only valid in RUNNING_LOCKS_PID, a forked
+ * child doesn't inherit the fcntl() locks. */
+static Map *RUNNING_LOCKS = NULL; /* path -> RunningLock */     /* GLOBAL_X */
+static pid_t RUNNING_LOCKS_PID = -1;                            /* GLOBAL_X */
+static time_t RUNNING_LOCKS_START_TIME = PROCESS_START_TIME_UNKNOWN; /* GLOBAL_X */
+
+static void RunningLockPath(const char *lock, char path[CF_BUFSIZE])
+{
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    HashString(lock, strlen(lock), digest, HASH_METHOD_SHA256);
+
+    char str_digest[CF_HOSTKEY_STRING_SIZE];
+    HashPrintSafe(str_digest, sizeof(str_digest), digest,
+                  HASH_METHOD_SHA256, false);
+
+    snprintf(path, CF_BUFSIZE, "%s%c%s%c%s", GetStateDir(), FILE_SEPARATOR,
+             RUNNING_LOCKS_DIR, FILE_SEPARATOR, str_digest);
+}
+
+static void RunningLocksInit(void)
+{
+    if (RUNNING_LOCKS != NULL)
+    {
+        /* Inherited, closing these doesn't release the parent's locks. */
+        MapIterator it = MapIteratorInit(RUNNING_LOCKS);
+        MapKeyValue *item;
+        while ((item = MapIteratorNext(&it)) != NULL)
+        {
+            close(((RunningLock *) item->value)->fd);
+        }
+        MapDestroy(RUNNING_LOCKS);
+    }
+
+    RUNNING_LOCKS = MapNew(StringHash_untyped, StringEqual_untyped, free, free);
+    RUNNING_LOCKS_PID = getpid();
+    RUNNING_LOCKS_START_TIME = GetProcessStartTime(RUNNING_LOCKS_PID);
+
+    char *dir = StringFormat("%s%c%s", GetStateDir(), FILE_SEPARATOR,
+                             RUNNING_LOCKS_DIR);
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create '%s' (mkdir: %s)",
+            dir, GetErrorStr());
+    }
+    free(dir);
+}
+
+/* Whether #fd still is the file at #path, its holder or PurgeRunningLocks()
+ * may have removed it before we locked it. */
+static bool IsRunningLockFile(int fd, const char *path)
+{
+    struct stat fd_sb, path_sb;
+    return (fstat(fd, &fd_sb) == 0 && stat(path, &path_sb) == 0 &&
+            fd_sb.st_dev == path_sb.st_dev && fd_sb.st_ino == path_sb.st_ino);
+}
+
+/**
+ * @param holder where to store the LockData of the other process holding
+ *               #lock, with its time when it took it
+ * @return 0 if we hold #lock now, the pid of the process holding it, or -1
+ *         if that can't be told
+ */
+static pid_t TakeRunningLock(const char *lock, time_t now, LockData *holder)
+{
+    char path[CF_BUFSIZE];
+    RunningLockPath(lock, path);
+
+    ThreadLock(cft_lock);
+    if (RUNNING_LOCKS == NULL || RUNNING_LOCKS_PID != getpid())
+    {
+        RunningLocksInit();
+    }
+
+    RunningLock *held = MapGet(RUNNING_LOCKS, path);
+    if (held != NULL)
+    {
+        held->count++;
+        ThreadUnlock(cft_lock);
+        return 0;
+    }
+
+    pid_t ret = -1;
+    /* Once more if it was removed or released in between. */
+    for (int attempt = 0; attempt < 2 && ret == -1; attempt++)
+    {
+        int fd = safe_open(path, O_CREAT | O_RDWR);
+        if (fd == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Could not open '%s' (open: %s)",
+                path, GetErrorStr());
+            break;
+        }
+
+        struct flock fl = {
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+            .l_start = 0,
+            .l_len = 0,
+        };
+        if (fcntl(fd, F_SETLK, &fl) == 0)
+        {
+            if (!IsRunningLockFile(fd, path))
+            {
+                close(fd);
+                continue;
+            }
+
+            /* Compared to #now by others, like the time in lock entries. */
+            const LockData lock_data = {
+                .pid = getpid(),
+                .time = time(NULL),
+                .process_start_time = RUNNING_LOCKS_START_TIME,
+            };
+            if (pwrite(fd, &lock_data, sizeof(lock_data), 0) != sizeof(lock_data))
+            {
+                Log(LOG_LEVEL_VERBOSE, "Could not write '%s' (pwrite: %s)",
+                    path, GetErrorStr());
+            }
+
+            held = xcalloc(1, sizeof(RunningLock));
+            held->fd = fd;
+            held->count = 1;
+            MapInsert(RUNNING_LOCKS, xstrdup(path), held);
+            ret = 0;
+        }
+        else if ((errno == EACCES || errno == EAGAIN) &&
+                 fcntl(fd, F_GETLK, &fl) == 0 && fl.l_type != F_UNLCK)
+        {
+            /* Only trust the time if it was written by the holder, it may
+             * not have got to that yet. */
+            if (pread(fd, holder, sizeof(*holder), 0) != sizeof(*holder) ||
+                holder->pid != fl.l_pid)
+            {
+                holder->pid = fl.l_pid;
+                holder->time = now;
+                holder->process_start_time = PROCESS_START_TIME_UNKNOWN;
+            }
+            ret = fl.l_pid;
+            close(fd);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+    ThreadUnlock(cft_lock);
+
+    return ret;
+}
+
+static void ReleaseRunningLock(const char *lock)
+{
+    if (RUNNING_LOCKS == NULL)
+    {
+        /* Never took one, lock_cache is off. */
+        return;
+    }
+
+    char path[CF_BUFSIZE];
+    RunningLockPath(lock, path);
+
+    ThreadLock(cft_lock);
+    RunningLock *held = (RUNNING_LOCKS != NULL && RUNNING_LOCKS_PID == getpid()) ?
+        MapGet(RUNNING_LOCKS, path) : NULL;
+    if (held != NULL && --held->count == 0)
+    {
+        /* Still holding it, so nobody else is using the file. Whoever
+         * opened it meanwhile sees it is gone, see IsRunningLockFile(). */
+        if (unlink(path) == -1 && errno != ENOENT)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Could not remove '%s' (unlink: %s)",
+                path, GetErrorStr());
+        }
+
+        /* Closing drops the fcntl() lock. */
+        close(held->fd);
+        MapRemove(RUNNING_LOCKS, path);
+    }
+    ThreadUnlock(cft_lock);
+}
+
+/**
+ * Takes #lock, unless another agent took it less than #expireafter minutes
+ * ago. Holders for longer than that are killed.
+ */
+static bool TakeRunningLockOrExpire(const char *lock, time_t now, int expireafter)
+{
+    LockData holder;
+    const pid_t holder_pid = TakeRunningLock(lock, now, &holder);
+    if (holder_pid <= 0)
+    {
+        /* If it can't be told, the lock entries still are. */
+        return true;
+    }
+
+    if ((now - holder.time) / 60 < expireafter)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Couldn't obtain lock for %s (already running in process %jd)",
+            lock, (intmax_t) holder_pid);
+        return false;
+    }
+
+    Log(LOG_LEVEL_INFO, "Lock expired after %jd/%u minutes: %s",
+        (intmax_t) (now - holder.time) / 60, expireafter, lock);
+    if (!KillProcessHoldingLock(&holder))
+    {
+        Log(LOG_LEVEL_ERR, "Failed to expire lock: %s", lock);
+        return false;
+    }
+    return (TakeRunningLock(lock, now, &holder) <= 0);
+}
+
+/* Removes the files nobody holds, left by agents that died holding them. */
+static void PurgeRunningLocks(time_t now)
+{
+    char *dir_path = StringFormat("%s%c%s", GetStateDir(), FILE_SEPARATOR,
+                                  RUNNING_LOCKS_DIR);
+    Dir *dir = DirOpen(dir_path);
+    if (dir == NULL)
+    {
+        free(dir_path);
+        return;
+    }
+
+    for (const struct dirent *entry = DirRead(dir); entry != NULL; entry = DirRead(dir))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        char path[CF_BUFSIZE];
+        snprintf(path, sizeof(path), "%s%c%s", dir_path, FILE_SEPARATOR,
+                 entry->d_name);
+
+        /* Leave the ones just created a chance to be locked, taking the
+         * lock here would look like holding it to their creator. */
+        struct stat sb;
+        if (stat(path, &sb) == -1 || now - sb.st_mtime < SECONDS_PER_MINUTE)
+        {
+            continue;
+        }
+
+        /* Closing another descriptor of ours would drop our lock. */
+        ThreadLock(cft_lock);
+        const bool ours = (RUNNING_LOCKS != NULL && RUNNING_LOCKS_PID == getpid() &&
+                       MapHasKey(RUNNING_LOCKS, path));
+        ThreadUnlock(cft_lock);
+        if (ours)
+        {
+            continue;
+        }
+
+        /* Only while nobody holds it, see IsRunningLockFile(). */
+        int fd = safe_open(path, O_RDWR);
+        if (fd == -1)
+        {
+            continue;
+        }
+        struct flock fl = {
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+            .l_start = 0,
+            .l_len = 0,
+        };
+        if (fcntl(fd, F_SETLK, &fl) == 0)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Purging running lock file '%s'", path);
+            unlink(path);
+        }
+        close(fd);
+    }
+
+    DirClose(dir);
+    free(dir_path);
+}
+#else  /* __MINGW32__ */
+static bool TakeRunningLockOrExpire(ARG_UNUSED const char *lock,
+                                    ARG_UNUSED time_t now,
+                                    ARG_UNUSED int expireafter)
+{
+    return true;
+}
+
+static void ReleaseRunningLock(ARG_UNUSED const char *lock)
+{
+}
+
+static void PurgeRunningLocks(ARG_UNUSED time_t now)
+{
+}
+#endif  /* __MINGW32__ */
+
+static void LeaveCriticalSection(bool entered)
+{
+    if (entered)
+    {
+        ReleaseCriticalSection(CF_CRITIAL_SECTION);
+    }
+}
+
 CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
                    time_t now, int ifelapsed, int expireafter, const Promise *pp,
                    bool ignoreProcesses)
@@ -868,8 +1443,13 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
     Log(LOG_LEVEL_DEBUG, "Locking bundle '%s' with lock '%s'",
         bundle_name, cflock);
 
-    // Now see if we can get exclusivity to edit the locks
-    WaitForCriticalSection(CF_CRITIAL_SECTION);
+    // Now see if we can get exclusivity to edit the locks. With lock_cache,
+    // they are in our memory and the running lock keeps other agents out.
+    const bool critical_section = (LOCK_CACHE == NULL);
+    if (critical_section)
+    {
+        WaitForCriticalSection(CF_CRITIAL_SECTION);
+    }
 
     // Look for non-existent (old) processes
     time_t lastcompleted = FindLock(cflast);
@@ -885,7 +1465,7 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
                 "Another cf-agent seems to have done this since I started "
                 "(elapsed=%jd)",
                 (intmax_t) elapsedtime);
-            ReleaseCriticalSection(CF_CRITIAL_SECTION);
+            LeaveCriticalSection(critical_section);
             return CfLockNull();
         }
 
@@ -894,7 +1474,7 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
             Log(LOG_LEVEL_VERBOSE,
                 "Nothing promised here [%.40s] (%jd/%u minutes elapsed)",
                 cflast, (intmax_t) elapsedtime, ifelapsed);
-            ReleaseCriticalSection(CF_CRITIAL_SECTION);
+            LeaveCriticalSection(critical_section);
             return CfLockNull();
         }
     }
@@ -926,7 +1506,7 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
             }
             else
             {
-                ReleaseCriticalSection(CF_CRITIAL_SECTION);
+                LeaveCriticalSection(critical_section);
                 Log(LOG_LEVEL_VERBOSE,
                     "Couldn't obtain lock for %s (already running!)",
                     cflock);
@@ -934,6 +1514,12 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
             }
         }
 
+        if (LOCK_CACHE != NULL && !TakeRunningLockOrExpire(cflock, now, expireafter))
+        {
+            LeaveCriticalSection(critical_section);
+            return CfLockNull();
+        }
+
         int ret = WriteLock(cflock);
         if (ret != -1)
         {
@@ -947,7 +1533,7 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
         }
     }
 
-    ReleaseCriticalSection(CF_CRITIAL_SECTION);
+    LeaveCriticalSection(critical_section);
 
     // Keep this as a global for signal handling
     PushLock(cflock, cflast);
@@ -970,6 +1556,7 @@ void YieldCurrentLock(CfLock lock)
 
     Log(LOG_LEVEL_DEBUG, "Yielding lock '%s'", lock.lock);
 
+    ReleaseRunningLock(lock.lock);
     if (RemoveLock(lock.lock) == -1)
     {
         Log(LOG_LEVEL_VERBOSE, "Unable to remove lock %s", lock.lock);
@@ -1177,6 +1764,9 @@ void PurgeLocks(void)
     LockData *entry = NULL;
     time_t now = time(NULL);
 
+    /* Every time, there are only a few and they hold nothing. */
+    PurgeRunningLocks(now);
+
     CF_DB *dbp = OpenLock();
     if (dbp == NULL)
     {
@@ -39,6 +39,18 @@ void GetLockName(char *lockname, const char *locktype,
 void PurgeLocks(void);
 void BackupLockDatabase(void);
 
+/**
+ * Keeps the lock database in memory, read in once, instead of reading and
+ * writing it for every promise. Changes are written in one transaction by
+ * FlushLockCache(), and at exit. Agents running at the same time still
+ * exclude each other from running the same promise, but only see what the
+ * other one completed once it is flushed.
+ *
+ * Disabling flushes the changes.
+ */
+void SetLockCaching(bool enabled);
+bool FlushLockCache(void);
+
 // Used in enterprise/nova code:
 CF_DB *OpenLock();
 void CloseLock(CF_DB *dbp);
@@ -28,15 +28,16 @@
 #include <eval_context.h>
 #include <string_lib.h>                                   /* StringFromLong */
 #include <regex.h>                                        /* CompileRegex */
+#include <regex_cache.h>
 
 
 /* Sets variables */
-static bool RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststring, int *start, int *end)
+static bool RegExMatchSubString(EvalContext *ctx, const CachedRegex *rx, const char *teststring, int *start, int *end)
 {
     int ovector[OVECCOUNT];
     int rc = 0;
 
-    if ((rc = pcre_exec(rx, NULL, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
+    if ((rc = CachedRegexExec(rx, teststring, ovector, OVECCOUNT)) >= 0)
     {
         *start = ovector[0];
         *end = ovector[1];
@@ -64,12 +65,11 @@ static bool RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststri
         *end = 0;
     }
 
-    pcre_free(rx);
     return rc >= 0;
 }
 
 /* Sets variables */
-static bool RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststring)
+static bool RegExMatchFullString(EvalContext *ctx, const CachedRegex *rx, const char *teststring)
 {
     int match_start;
     int match_len;
@@ -86,27 +86,20 @@ static bool RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststr
 
 bool FullTextMatch(EvalContext *ctx, const char *regexp, const char *teststring)
 {
-    pcre *rx;
-
     if (strcmp(regexp, teststring) == 0)
     {
         return true;
     }
 
-    rx = CompileRegex(regexp);
+    CachedRegex *rx = RegexCacheGet(regexp);
     if (rx == NULL)
     {
         return false;
     }
 
-    if (RegExMatchFullString(ctx, rx, teststring))
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    const bool matched = RegExMatchFullString(ctx, rx, teststring);
+    RegexCacheRelease(rx);
+    return matched;
 }
 
 bool ValidateRegEx(const char *regex)
@@ -120,19 +113,14 @@ bool ValidateRegEx(const char *regex)
 
 bool BlockTextMatch(EvalContext *ctx, const char *regexp, const char *teststring, int *start, int *end)
 {
-    pcre *rx = CompileRegex(regexp);
+    CachedRegex *rx = RegexCacheGet(regexp);
 
     if (rx == NULL)
     {
         return false;
     }
 
-    if (RegExMatchSubString(ctx, rx, teststring, start, end))
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    const bool matched = RegExMatchSubString(ctx, rx, teststring, start, end);
+    RegexCacheRelease(rx);
+    return matched;
 }
@@ -32,7 +32,8 @@
 #include <scope.h>
 #include <misc_lib.h>
 #include <rlist.h>
-#include <regex.h>                          /* CompileRegex,StringMatchFull */
+#include <regex.h>                          /* CompileRegex */
+#include <regex_cache.h>                    /* RegexCacheMatchFull */
 #include <string_lib.h>
 
 
@@ -230,6 +231,65 @@ bool IsPathRegex(const char *str)
     return result;
 }
 
+char *RegexLiteralPrefix(const char *regex)
+{
+    assert(regex != NULL);
+
+    char *prefix = xcalloc(1, strlen(regex) + 1);
+
+    /* Alternatives could start with anything. */
+    if (strchr(regex, '|') != NULL)
+    {
+        return prefix;
+    }
+
+    size_t len = 0;
+    const char *sp = regex;
+    if (*sp == '^')
+    {
+        sp++;
+    }
+
+    while (*sp != '\0')
+    {
+        char c = *sp;
+        size_t width = 1;
+        if (c == '\\')
+        {
+            /* Escaped punctuation is literal, letters and digits are
+             * character classes, back references,... */
+            if (sp[1] == '\0' || isalnum((unsigned char) sp[1]))
+            {
+                break;
+            }
+            c = sp[1];
+            width = 2;
+        }
+        else if (strchr(".[]()*+?{}^$", c) != NULL)
+        {
+            break;
+        }
+
+        const char next = sp[width];
+        if (next == '*' || next == '?' || next == '{')
+        {
+            /* Not necessarily there. */
+            break;
+        }
+
+        prefix[len] = c;
+        len++;
+        sp += width;
+
+        if (next == '+')
+        {
+            break;
+        }
+    }
+
+    return prefix;
+}
+
 /* Checks whether item matches a list of wildcards */
 
 bool IsRegexItemIn(const EvalContext *ctx, const Item *list, const char *regex)
@@ -250,7 +310,7 @@ bool IsRegexItemIn(const EvalContext *ctx, const Item *list, const char *regex)
 
         /* Make it commutative */
 
-        if (StringMatchFull(regex, ptr->name) || StringMatchFull(ptr->name, regex))
+        if (RegexCacheMatchFull(regex, ptr->name) || RegexCacheMatchFull(ptr->name, regex))
         {
             return true;
         }
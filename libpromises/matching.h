@@ -28,6 +28,12 @@
 #include <cf3.defs.h>
 
 bool IsRegex(const char *str); /* Pure */
+
+/**
+ * The text all the strings matched in full by #regex start with, empty if
+ * it can't tell. Malloced.
+ */
+char *RegexLiteralPrefix(const char *regex); /* Pure */
 bool IsRegexItemIn(const EvalContext *ctx, const Item *list, const char *regex); /* Uses context */
 
 char *ExtractFirstReference(const char *regexp, const char *teststring); /* Pure, not thread-safe */
@@ -263,7 +263,7 @@ const ConstraintSyntax CFG_CONTROLBODY[COMMON_CONTROL_MAX + 1] =
     ConstraintSyntaxNewBool("fips_mode", "Activate full FIPS mode restrictions. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewReal("bwlimit", CF_VALRANGE, "Limit outgoing protocol bandwidth in Bytes per second", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("cache_system_functions", "Cache the result of system functions. Default value: true", SYNTAX_STATUS_NORMAL),
-    ConstraintSyntaxNewOption("protocol_version", "1,classic,2,tls,3,cookie,latest", "CFEngine protocol version to use when connecting to the server. Default: \"latest\"", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewOption("protocol_version", "1,classic,2,tls,3,cookie,4,largeblocks,5,statdir,6,manifest,7,delta,8,compress,latest", "CFEngine protocol version to use when connecting to the server. Default: \"latest\"", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("tls_ciphers", "", "List of acceptable ciphers in outgoing TLS connections, defaults to OpenSSL's default. For syntax help see man page for \"openssl ciphers\"", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("tls_min_version", "", "Minimum acceptable TLS version for outgoing connections, defaults to OpenSSL's default", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewStringList("package_inventory", ".*", "Name of the package manager used for software inventory management", SYNTAX_STATUS_NORMAL),
@@ -319,6 +319,9 @@ const ConstraintSyntax CFA_CONTROLBODY[] =
     ConstraintSyntaxNewBool("report_class_log", "true/false enables logging classes at the end of agent execution. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("select_end_match_eof", "Set the default behavior of select_end_match_eof in edit_line promises. Default: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewStringList("copyfrom_restrict_keys", ".*", "A list of key hashes to restrict copy_from to", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("lock_cache", "true/false keep promise locks in memory and write them to the lock database once per bundle. Default value: false", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("files_hash_threads", "0,64", "Number of threads hashing files ahead of depth searches with content change detection and local copies comparing digests. Default value: 0 (no threads)", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("data_file_cache", "true/false keep data files parsed by readjson(), readyaml(), readdata() and the like in $(sys.statedir)/data_cache for the next runs. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
@@ -348,6 +351,11 @@ const ConstraintSyntax CFS_CONTROLBODY[SERVER_CONTROL_MAX + 1] =
     ConstraintSyntaxNewString("allowciphers", "", "List of ciphers the server accepts. For Syntax help see man page for \"openssl ciphers\". Default is \"AES256-GCM-SHA384:AES256-SHA\"", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewStringList("allowlegacyconnects", "", "List of IPs from whom we accept legacy protocol connections", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("allowtlsversion", "", "Minimum TLS version allowed for incoming connections", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("worker_pool_size", "0,99999", "Number of pre-spawned threads serving connections, 0 spawns a thread per connection. Default value: 0", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("digest_cache_size", "0,99999999", "Maximum number of file digests cached for hash comparison requests, 0 disables the cache. Default value: 10000", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("digest_cache_persistent", "true/false keep cached file digests in a database across restarts. Default value: false", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("compress_cache_size", "0,99999", "Megabytes of compressed file contents cached for compressed copy requests, 0 disables the cache. Default value: 64", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("lastseen_commit_interval", "0,60000", "Milliseconds lastseen updates may wait to be committed together, 0 commits each one right away. Default value: 0", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
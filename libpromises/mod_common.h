@@ -54,6 +54,11 @@ typedef enum
     SERVER_CONTROL_ALLOWCIPHERS,
     SERVER_CONTROL_ALLOWLEGACYCONNECTS,
     SERVER_CONTROL_ALLOWTLSVERSION,
+    SERVER_CONTROL_WORKER_POOL_SIZE,
+    SERVER_CONTROL_DIGEST_CACHE_SIZE,
+    SERVER_CONTROL_DIGEST_CACHE_PERSISTENT,
+    SERVER_CONTROL_COMPRESS_CACHE_SIZE,
+    SERVER_CONTROL_LASTSEEN_COMMIT_INTERVAL,
     SERVER_CONTROL_MAX
 } ServerControl;
 
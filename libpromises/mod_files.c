@@ -325,8 +325,11 @@ static const ConstraintSyntax copy_from_constraints[] =
     ConstraintSyntaxNewBool("trustkey", "true/false trust public keys from remote server if previously unknown. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("type_check", "true/false compare file types before copying and require match", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("verify", "true/false verify transferred file by hashing after copy (resource penalty). Default value: false", SYNTAX_STATUS_NORMAL),
-    ConstraintSyntaxNewOption("protocol_version", "1,classic,2,tls,3,cookie,latest", "CFEngine protocol version to use when connecting to the server. Default: undefined", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewOption("protocol_version", "1,classic,2,tls,3,cookie,4,largeblocks,5,statdir,6,manifest,7,delta,8,compress,latest", "CFEngine protocol version to use when connecting to the server. Default: undefined", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("missing_ok", "true/false Do not treat missing file as an error. Default value: false", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("parallel_connections", "1,64", "Number of connections over which to fetch files of a recursive copy in parallel. Default value: 1", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("compress", "true/false ask the server to send file contents zlib compressed, if it supports that. Default value: false", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("delta_transfer", "true/false update changed files by fetching only the blocks that differ from the existing copy. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
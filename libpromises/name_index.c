@@ -0,0 +1,408 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <name_index.h>
+
+#include <map.h>
+#include <alloc.h>
+#include <rlist.h>
+#include <string_lib.h>                                 /* StringStartsWith */
+#include <matching.h>                                   /* RegexLiteralPrefix */
+#include <regex_cache.h>                                /* RegexCacheMatchFull */
+
+typedef struct
+{
+    char *name;
+    void *value;
+    Seq *tags;                          /* char *, NULL if none were given */
+    bool removed;
+} NameIndexEntry;
+
+/*
+ * Removing an entry only marks it removed and moves it to #removed, finding
+ * it in #sorted or #unsorted would cost a scan and moving all that follow
+ * it. NameIndexSort() drops the removed entries from both.
+ */
+struct NameIndex_
+{
+    bool started;
+    Map *entries;                       /* value -> NameIndexEntry */
+    Seq *sorted;                        /* NameIndexEntry, by name */
+    Seq *unsorted;                      /* NameIndexEntry, put since the last lookup */
+    Seq *removed;                       /* NameIndexEntry, still in the above */
+    Map *tags;                          /* tag -> set of NameIndexEntry */
+    Map *untagged;                      /* set of NameIndexEntry */
+};
+
+static void NameIndexSort(NameIndex *index);
+
+static unsigned int PointerHash(const void *p, unsigned int seed)
+{
+    uint64_t x = (uintptr_t) p;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned int) x ^ seed;
+}
+
+static bool PointerEqual(const void *a, const void *b)
+{
+    return (a == b);
+}
+
+static Map *PointerSetNew(void)
+{
+    return MapNew(PointerHash, PointerEqual, NULL, NULL);
+}
+
+static void PointerSetDestroy(void *set)
+{
+    MapDestroy(set);
+}
+
+static void NameIndexEntryDestroy(void *data)
+{
+    NameIndexEntry *entry = data;
+    if (entry != NULL)
+    {
+        free(entry->name);
+        SeqDestroy(entry->tags);
+        free(entry);
+    }
+}
+
+/* The entries of #index->entries, which doesn't own them for
+ * NameIndexRemove() to move them to #index->removed. */
+static void NameIndexDestroyEntries(NameIndex *index)
+{
+    MapIterator it = MapIteratorInit(index->entries);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&it)) != NULL)
+    {
+        NameIndexEntryDestroy(item->value);
+    }
+    MapClear(index->entries);
+}
+
+static int NameIndexEntryCompare(const void *a, const void *b,
+                                 ARG_UNUSED void *user_data)
+{
+    const NameIndexEntry *entry_a = a, *entry_b = b;
+    return strcmp(entry_a->name, entry_b->name);
+}
+
+NameIndex *NameIndexNew(void)
+{
+    NameIndex *index = xcalloc(1, sizeof(NameIndex));
+    index->entries = MapNew(PointerHash, PointerEqual, NULL, NULL);
+    index->sorted = SeqNew(100, NULL);
+    index->unsorted = SeqNew(100, NULL);
+    index->removed = SeqNew(100, NameIndexEntryDestroy);
+    index->tags = MapNew(StringHash_untyped, StringEqual_untyped, free, PointerSetDestroy);
+    index->untagged = PointerSetNew();
+    return index;
+}
+
+void NameIndexDestroy(NameIndex *index)
+{
+    if (index != NULL)
+    {
+        MapDestroy(index->untagged);
+        MapDestroy(index->tags);
+        SeqDestroy(index->removed);
+        SeqDestroy(index->unsorted);
+        SeqDestroy(index->sorted);
+        NameIndexDestroyEntries(index);
+        MapDestroy(index->entries);
+        free(index);
+    }
+}
+
+bool NameIndexStarted(const NameIndex *index)
+{
+    assert(index != NULL);
+    return index->started;
+}
+
+void NameIndexStart(NameIndex *index)
+{
+    assert(index != NULL);
+    index->started = true;
+}
+
+void NameIndexPut(NameIndex *index, const char *name, void *value, const StringSet *tags)
+{
+    assert(index != NULL);
+    assert(name != NULL);
+
+    if (!index->started)
+    {
+        return;
+    }
+
+    NameIndexRemove(index, value);
+
+    NameIndexEntry *entry = xcalloc(1, sizeof(NameIndexEntry));
+    entry->name = xstrdup(name);
+    entry->value = value;
+    MapInsert(index->entries, value, entry);
+    SeqAppend(index->unsorted, entry);
+
+    if (tags == NULL)
+    {
+        MapInsert(index->untagged, entry, entry);
+        return;
+    }
+
+    entry->tags = SeqNew(StringSetSize(tags), free);
+    StringSetIterator it = StringSetIteratorInit((StringSet *) tags);
+    const char *tag;
+    while ((tag = StringSetIteratorNext(&it)) != NULL)
+    {
+        Map *set = MapGet(index->tags, tag);
+        if (set == NULL)
+        {
+            set = PointerSetNew();
+            MapInsert(index->tags, xstrdup(tag), set);
+        }
+        MapInsert(set, entry, entry);
+        SeqAppend(entry->tags, xstrdup(tag));
+    }
+}
+
+/* The first position in #sorted whose name is not less than #name. */
+static size_t LowerBound(const Seq *sorted, const char *name)
+{
+    size_t low = 0;
+    size_t high = SeqLength(sorted);
+    while (low < high)
+    {
+        const size_t mid = low + (high - low) / 2;
+        const NameIndexEntry *entry = SeqAt(sorted, mid);
+        if (strcmp(entry->name, name) < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void NameIndexRemove(NameIndex *index, void *value)
+{
+    assert(index != NULL);
+
+    if (!index->started)
+    {
+        return;
+    }
+
+    NameIndexEntry *entry = MapGet(index->entries, value);
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    if (entry->tags == NULL)
+    {
+        MapRemove(index->untagged, entry);
+    }
+    else
+    {
+        const size_t n_tags = SeqLength(entry->tags);
+        for (size_t i = 0; i < n_tags; i++)
+        {
+            const char *tag = SeqAt(entry->tags, i);
+            Map *set = MapGet(index->tags, tag);
+            if (set != NULL)
+            {
+                MapRemove(set, entry);
+                if (MapSize(set) == 0)
+                {
+                    MapRemove(index->tags, tag);
+                }
+            }
+        }
+    }
+
+    /* Now owned by #removed, the value may be put again meanwhile. */
+    MapRemove(index->entries, value);
+    entry->removed = true;
+    SeqAppend(index->removed, entry);
+
+    /* Only tag lookups, which don't sort, would let them pile up. */
+    if (SeqLength(index->removed) > MapSize(index->entries))
+    {
+        NameIndexSort(index);
+    }
+}
+
+void NameIndexClear(NameIndex *index)
+{
+    assert(index != NULL);
+
+    MapClear(index->untagged);
+    MapClear(index->tags);
+    SeqClear(index->unsorted);
+    SeqClear(index->sorted);
+    SeqClear(index->removed);
+    NameIndexDestroyEntries(index);
+}
+
+static void NameIndexSort(NameIndex *index)
+{
+    const size_t n_new = SeqLength(index->unsorted);
+    const size_t n_removed = SeqLength(index->removed);
+    if (n_new == 0 && n_removed == 0)
+    {
+        return;
+    }
+
+    SeqSort(index->unsorted, NameIndexEntryCompare, NULL);
+
+    const size_t n_old = SeqLength(index->sorted);
+    Seq *merged = SeqNew(n_old + n_new, NULL);
+    size_t i = 0, j = 0;
+    while (i < n_old || j < n_new)
+    {
+        NameIndexEntry *entry;
+        if (j == n_new ||
+            (i < n_old && NameIndexEntryCompare(SeqAt(index->sorted, i),
+                                                SeqAt(index->unsorted, j), NULL) <= 0))
+        {
+            entry = SeqAt(index->sorted, i);
+            i++;
+        }
+        else
+        {
+            entry = SeqAt(index->unsorted, j);
+            j++;
+        }
+
+        if (!entry->removed)
+        {
+            SeqAppend(merged, entry);
+        }
+    }
+
+    SeqDestroy(index->sorted);
+    index->sorted = merged;
+    SeqClear(index->unsorted);
+    SeqClear(index->removed);
+}
+
+static bool TagMatches(const char *tag, const Rlist *tag_regexes)
+{
+    for (const Rlist *rp = tag_regexes; rp != NULL; rp = rp->next)
+    {
+        const char *tag_regex = RlistScalarValue(rp);
+        if (StringEqual(tag_regex, tag) || RegexCacheMatchFull(tag_regex, tag))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void AddWithPrefix(Seq *entries, Map *set, const char *prefix)
+{
+    MapIterator it = MapIteratorInit(set);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&it)) != NULL)
+    {
+        NameIndexEntry *entry = item->value;
+        if (StringStartsWith(entry->name, prefix))
+        {
+            SeqAppend(entries, entry);
+        }
+    }
+}
+
+Seq *NameIndexLookup(NameIndex *index, const char *name_regex, const Rlist *tag_regexes)
+{
+    assert(index != NULL);
+    assert(index->started);
+    assert(name_regex != NULL);
+
+    char *prefix = RegexLiteralPrefix(name_regex);
+    Seq *entries = SeqNew(16, NULL);
+
+    if (tag_regexes == NULL)
+    {
+        NameIndexSort(index);
+
+        const size_t length = SeqLength(index->sorted);
+        for (size_t i = LowerBound(index->sorted, prefix); i < length; i++)
+        {
+            NameIndexEntry *entry = SeqAt(index->sorted, i);
+            if (!StringStartsWith(entry->name, prefix))
+            {
+                break;
+            }
+            SeqAppend(entries, entry);
+        }
+    }
+    else
+    {
+        /* There are much fewer different tags than names, match them
+         * instead of those of every value. */
+        Map *matched = PointerSetNew();
+        MapIterator it = MapIteratorInit(index->tags);
+        MapKeyValue *item;
+        while ((item = MapIteratorNext(&it)) != NULL)
+        {
+            if (TagMatches(item->key, tag_regexes))
+            {
+                MapIterator set_it = MapIteratorInit(item->value);
+                MapKeyValue *member;
+                while ((member = MapIteratorNext(&set_it)) != NULL)
+                {
+                    MapInsert(matched, member->key, member->key);
+                }
+            }
+        }
+
+        AddWithPrefix(entries, matched, prefix);
+        AddWithPrefix(entries, index->untagged, prefix);
+        MapDestroy(matched);
+
+        SeqSort(entries, NameIndexEntryCompare, NULL);
+    }
+    free(prefix);
+
+    const size_t length = SeqLength(entries);
+    Seq *values = SeqNew(length + 1, NULL);
+    for (size_t i = 0; i < length; i++)
+    {
+        const NameIndexEntry *entry = SeqAt(entries, i);
+        SeqAppend(values, entry->value);
+    }
+    SeqDestroy(entries);
+
+    return values;
+}
@@ -0,0 +1,69 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_NAME_INDEX_H
+#define CFENGINE_NAME_INDEX_H
+
+#include <cf3.defs.h>
+#include <set.h>
+#include <sequence.h>
+
+/**
+ * An index of the classes or variables of a table by their names and tags,
+ * to find those a name regex and tag regexes can match without matching all
+ * of them, like classesmatching() and variablesmatching() do.
+ *
+ * Values are indexed by identity, a name can have several. The names of
+ * those added since the last lookup are sorted by the next one.
+ *
+ * Tables start the index with their first lookup, until then changes are
+ * no-ops, so that it costs nothing unless used.
+ */
+
+typedef struct NameIndex_ NameIndex;
+
+NameIndex *NameIndexNew(void);
+void NameIndexDestroy(NameIndex *index);
+
+bool NameIndexStarted(const NameIndex *index);
+void NameIndexStart(NameIndex *index);
+
+/**
+ * @param tags copied, NULL for values matched by any tag regexes
+ */
+void NameIndexPut(NameIndex *index, const char *name, void *value, const StringSet *tags);
+void NameIndexRemove(NameIndex *index, void *value);
+void NameIndexClear(NameIndex *index);
+
+/**
+ * The values whose name starts with the literal prefix of #name_regex and,
+ * unless #tag_regexes is NULL, with a tag equal to or matched by one of
+ * them, in the order of their names. Callers still have to match them.
+ *
+ * @return a Seq not owning its values
+ */
+Seq *NameIndexLookup(NameIndex *index, const char *name_regex, const Rlist *tag_regexes);
+
+#endif
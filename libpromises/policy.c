@@ -80,6 +80,9 @@ static void BundleDestroy(Bundle *bundle);
 static void BodyDestroy(Body *body);
 static SyntaxTypeMatch ConstraintCheckType(const Constraint *cp);
 static bool PromiseCheck(const Promise *pp, Seq *errors);
+static Map *PolicyIndexNew(void);
+static void PolicyIndexAdd(Map *index, const char *name, void *element);
+static const char *StripNamespace(const char *full_symbol);
 
 /*************************************************************************/
 
@@ -111,6 +114,8 @@ Policy *PolicyNew(void)
     policy->bodies = SeqNew(100, BodyDestroy);
     policy->custom_promise_types = SeqNew(20, BodyDestroy);
     policy->policy_files_hashes = NULL;
+    policy->bundle_index = PolicyIndexNew();
+    policy->body_index = PolicyIndexNew();
 
     return policy;
 }
@@ -136,6 +141,8 @@ void PolicyDestroy(Policy *policy)
         {
             StringMapDestroy(policy->policy_files_hashes);
         }
+        MapDestroy(policy->bundle_index);
+        MapDestroy(policy->body_index);
 
         free(policy);
     }
@@ -312,13 +319,15 @@ static const char *StripNamespace(const char *full_symbol)
  */
 Body *PolicyGetBody(const Policy *policy, const char *ns, const char *type, const char *name)
 {
-    for (size_t i = 0; i < SeqLength(policy->bodies); i++)
+    // bodies with this name (without namespace), in policy order
+    const Seq *bodies = MapGet(policy->body_index, name);
+    const size_t length = (bodies != NULL) ? SeqLength(bodies) : 0;
+
+    for (size_t i = 0; i < length; i++)
     {
-        Body *bp = SeqAt(policy->bodies, i);
-        const char *body_symbol = StripNamespace(bp->name);
+        Body *bp = SeqAt(bodies, i);
 
-        if (strcmp(bp->type, type)    == 0 &&
-            strcmp(body_symbol, name) == 0)
+        if (strcmp(bp->type, type) == 0)
         {
             // allow namespace to be optionally matched
             if (ns && strcmp(bp->ns, ns) != 0)
@@ -335,6 +344,83 @@ Body *PolicyGetBody(const Policy *policy, const char *ns, const char *type, cons
 
 /*************************************************************************/
 
+static void PolicyIndexEntryDestroy(void *entries)
+{
+    SeqDestroy(entries);
+}
+
+static Map *PolicyIndexNew(void)
+{
+    return MapNew(StringHash_untyped, StringEqual_untyped,
+                  free, PolicyIndexEntryDestroy);
+}
+
+static void PolicyIndexAdd(Map *index, const char *name, void *element)
+{
+    Seq *entries = MapGet(index, name);
+    if (entries == NULL)
+    {
+        entries = SeqNew(1, NULL);
+        MapInsert(index, xstrdup(name), entries);
+    }
+    SeqAppend(entries, element);
+}
+
+static void PolicyIndexBundles(Policy *policy, const Seq *bundles)
+{
+    for (size_t i = 0; i < SeqLength(bundles); i++)
+    {
+        Bundle *bp = SeqAt(bundles, i);
+        PolicyIndexAdd(policy->bundle_index, bp->name, bp);
+    }
+}
+
+static void PolicyIndexBodies(Policy *policy, const Seq *bodies)
+{
+    for (size_t i = 0; i < SeqLength(bodies); i++)
+    {
+        Body *bp = SeqAt(bodies, i);
+        PolicyIndexAdd(policy->body_index, StripNamespace(bp->name), bp);
+    }
+}
+
+void PolicyRebuildIndexes(Policy *policy)
+{
+    assert(policy != NULL);
+
+    MapClear(policy->bundle_index);
+    MapClear(policy->body_index);
+    PolicyIndexBundles(policy, policy->bundles);
+    PolicyIndexBodies(policy, policy->bodies);
+}
+
+/*************************************************************************/
+
+static Bundle *BundleIndexLookup(Map *index, const char *ns, const char *type, const char *name)
+{
+    // bundles with this name, in policy order
+    const Seq *bundles = MapGet(index, name);
+    const size_t length = (bundles != NULL) ? SeqLength(bundles) : 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        Bundle *bp = SeqAt(bundles, i);
+
+        if (type == NULL || strcmp(bp->type, type) == 0)
+        {
+            // allow namespace to be optionally matched
+            if (ns && strcmp(bp->ns, ns) != 0)
+            {
+                continue;
+            }
+
+            return bp;
+        }
+    }
+
+    return NULL;
+}
+
 /**
  * @brief Query a policy for a bundle
  * @param policy The policy to query
@@ -347,6 +433,14 @@ Bundle *PolicyGetBundle(const Policy *policy, const char *ns, const char *type,
 {
     const char *bundle_symbol = StripNamespace(name);
 
+    if (bundle_symbol == name || MapGet(policy->bundle_index, name) == NULL)
+    {
+        return BundleIndexLookup(policy->bundle_index, ns, type, bundle_symbol);
+    }
+
+    // Both a bundle named name and one named bundle_symbol may match, the
+    // first one in the policy wins. Bundles with a namespace in their name
+    // are rare, just search.
     for (size_t i = 0; i < SeqLength(policy->bundles); i++)
     {
         Bundle *bp = SeqAt(policy->bundles, i);
@@ -384,90 +478,99 @@ bool PolicyIsRunnable(const Policy *policy)
 /*************************************************************************/
 
 /**
- * @brief Merge two partial policy objects. The memory for the child objects of the original policies are transferred to the new parent.
+ * @brief Merge two partial policy objects. The child objects of #b are moved
+ *        to the end of #a and #b is freed.
+ *
+ * Only #b's elements are touched, so merging many policies one by one into
+ * the same one takes time linear in their total size.
  * @param a
  * @param b
- * @return Merged policy
+ * @return Merged policy, which is #a
  */
 Policy *PolicyMerge(Policy *a, Policy *b)
 {
     assert(a != NULL);
     assert(b != NULL);
 
-    Policy *result = PolicyNew();
+    // a's indexes are up to date, only add b's elements to them
+    PolicyIndexBundles(a, b->bundles);
+    PolicyIndexBodies(a, b->bodies);
+    MapDestroy(b->bundle_index);
+    MapDestroy(b->body_index);
 
-    SeqAppendSeq(result->bundles, a->bundles);
-    SeqSoftDestroy(a->bundles);
-    SeqAppendSeq(result->bundles, b->bundles);
+    for (size_t i = 0; i < SeqLength(b->bundles); i++)
+    {
+        Bundle *bp = SeqAt(b->bundles, i);
+        bp->parent_policy = a;
+    }
+    SeqAppendSeq(a->bundles, b->bundles);
     SeqSoftDestroy(b->bundles);
 
-    for (size_t i = 0; i < SeqLength(result->bundles); i++)
+    for (size_t i = 0; i < SeqLength(b->bodies); i++)
     {
-        Bundle *bp = SeqAt(result->bundles, i);
-        bp->parent_policy = result;
+        Body *bdp = SeqAt(b->bodies, i);
+        bdp->parent_policy = a;
     }
-
-    SeqAppendSeq(result->bodies, a->bodies);
-    SeqSoftDestroy(a->bodies);
-    SeqAppendSeq(result->bodies, b->bodies);
+    SeqAppendSeq(a->bodies, b->bodies);
     SeqSoftDestroy(b->bodies);
 
-    for (size_t i = 0; i < SeqLength(result->bodies); i++)
+    for (size_t i = 0; i < SeqLength(b->custom_promise_types); i++)
     {
-        Body *bdp = SeqAt(result->bodies, i);
-        bdp->parent_policy = result;
+        Body *bdp = SeqAt(b->custom_promise_types, i);
+        bdp->parent_policy = a;
     }
-
-    SeqAppendSeq(result->custom_promise_types, a->custom_promise_types);
-    SeqSoftDestroy(a->custom_promise_types);
-    SeqAppendSeq(result->custom_promise_types, b->custom_promise_types);
+    SeqAppendSeq(a->custom_promise_types, b->custom_promise_types);
     SeqSoftDestroy(b->custom_promise_types);
 
-    for (size_t i = 0; i < SeqLength(result->custom_promise_types); i++)
-    {
-        Body *bdp = SeqAt(result->custom_promise_types, i);
-        bdp->parent_policy = result;
-    }
-
-    StringMap *extra_hashes = NULL;
-    if (a->policy_files_hashes != NULL)
+    if (a->policy_files_hashes == NULL)
     {
-        result->policy_files_hashes = a->policy_files_hashes;
-        a->policy_files_hashes = NULL;
-        extra_hashes = b->policy_files_hashes;
-        b->policy_files_hashes = NULL;
+        a->policy_files_hashes = b->policy_files_hashes;
     }
     else if (b->policy_files_hashes != NULL)
     {
-        result->policy_files_hashes = b->policy_files_hashes;
-        b->policy_files_hashes = NULL;
-    }
-    else
-    {
-        result->policy_files_hashes = NULL;
-    }
-
-    if (extra_hashes != NULL)
-    {
-        MapIterator it = MapIteratorInit(extra_hashes->impl);
+        MapIterator it = MapIteratorInit(b->policy_files_hashes->impl);
         MapKeyValue *item;
         while ((item = MapIteratorNext(&it)) != NULL)
         {
             /* Move data and duplicate just the keys (which are always owned by
                the map). */
-            StringMapInsert(result->policy_files_hashes,
+            StringMapInsert(a->policy_files_hashes,
                             xstrdup((char*) item->key), (char*) item->value);
         }
         /* Destroy only the map and the keys, data was moved. */
-        StringMapSoftDestroy(extra_hashes);
+        StringMapSoftDestroy(b->policy_files_hashes);
     }
 
-    /* Should result take over a release_id ? */
+    /* The merged policy doesn't come from a single release. */
     free(a->release_id);
+    a->release_id = NULL;
     free(b->release_id);
-    free(a);
     free(b);
 
+    return a;
+}
+
+/**
+ * @brief Merge all the partial policies in #policies, in order, into the first
+ *        one. The others are freed, #policies itself is left to the caller.
+ * @return Merged policy, a new empty one if #policies is empty
+ */
+Policy *PolicyMergeAll(Seq *policies)
+{
+    assert(policies != NULL);
+
+    const size_t length = SeqLength(policies);
+    if (length == 0)
+    {
+        return PolicyNew();
+    }
+
+    Policy *result = SeqAt(policies, 0);
+    for (size_t i = 1; i < length; i++)
+    {
+        result = PolicyMerge(result, SeqAt(policies, i));
+    }
+
     return result;
 }
 
@@ -1300,6 +1403,8 @@ Bundle *PolicyAppendBundle(Policy *policy,
     bundle->sections = SeqNew(10, BundleSectionDestroy);
     bundle->custom_sections = SeqNew(10, BundleSectionDestroy);
 
+    PolicyIndexAdd(policy->bundle_index, bundle->name, bundle);
+
     return bundle;
 }
 
@@ -1322,6 +1427,8 @@ Body *PolicyAppendBody(Policy *policy, const char *ns, const char *name,
     body->conlist = SeqNew(10, ConstraintDestroy);
     body->is_custom = is_custom;
 
+    PolicyIndexAdd(policy->body_index, StripNamespace(body->name), body);
+
     // TODO: move to standard callback
     if (strcmp("service_method", body->name) == 0)
     {
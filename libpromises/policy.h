@@ -57,6 +57,11 @@ struct Policy_
     Seq *bodies;
     Seq *custom_promise_types;
     StringMap *policy_files_hashes;
+
+    /* Indexes for PolicyGetBundle() and PolicyGetBody(), see
+     * PolicyRebuildIndexes(). */
+    Map *bundle_index;
+    Map *body_index;
 };
 
 typedef struct
@@ -152,6 +157,13 @@ StringSet *PolicySourceFiles(const Policy *policy);
 const char *PolicyGetPolicyFileHash(const Policy *policy, const char *policy_file_path);
 
 Policy *PolicyMerge(Policy *a, Policy *b);
+Policy *PolicyMergeAll(Seq *policies);
+/**
+ * PolicyAppendBundle(), PolicyAppendBody() and PolicyMerge() keep the
+ * bundle and body indexes up to date. Call this after adding, removing or
+ * renaming bundles or bodies in any other way.
+ */
+void PolicyRebuildIndexes(Policy *policy);
 Body *PolicyGetBody(const Policy *policy, const char *ns, const char *type, const char *name);
 Bundle *PolicyGetBundle(const Policy *policy, const char *ns, const char *type, const char *name);
 bool PolicyIsRunnable(const Policy *policy);
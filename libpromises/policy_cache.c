@@ -0,0 +1,684 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <policy_cache.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <file_lib.h>                       /* FullWrite, safe_open_create_perms */
+#include <known_dirs.h>                                       /* GetStateDir */
+#include <rlist.h>
+#include <fncall.h>
+#include <string_lib.h>                                   /* StringHash */
+#include <prototypes3.h>                                          /* Version */
+
+#ifndef __MINGW32__
+# include <sys/mman.h>
+#endif
+
+#define POLICY_CACHE_DIR "policy_cache"
+#define POLICY_CACHE_MAGIC "CFPCACHE"
+/* Bump whenever the format, or the policy structures, change. */
+#define POLICY_CACHE_FORMAT 1
+/* Written in host byte order, tells us if the cache was not. */
+#define POLICY_CACHE_BYTE_ORDER 0x01020304
+#define NULL_STRING UINT32_MAX
+
+/*********************************************************************/
+/* Writing                                                           */
+/*********************************************************************/
+
+static void WriteU8(Buffer *out, uint8_t value)
+{
+    BufferAppend(out, (const char *) &value, sizeof(value));
+}
+
+static void WriteU32(Buffer *out, uint32_t value)
+{
+    BufferAppend(out, (const char *) &value, sizeof(value));
+}
+
+static void WriteU64(Buffer *out, uint64_t value)
+{
+    BufferAppend(out, (const char *) &value, sizeof(value));
+}
+
+static void WriteString(Buffer *out, const char *str)
+{
+    if (str == NULL)
+    {
+        WriteU32(out, NULL_STRING);
+        return;
+    }
+
+    const size_t len = strlen(str);
+    WriteU32(out, len);
+    BufferAppend(out, str, len);
+}
+
+static void WriteOffset(Buffer *out, const SourceOffset *offset)
+{
+    WriteU64(out, offset->start);
+    WriteU64(out, offset->end);
+    WriteU64(out, offset->line);
+    WriteU64(out, offset->context);
+}
+
+static void WriteRlist(Buffer *out, const Rlist *list);
+
+static void WriteRval(Buffer *out, Rval rval)
+{
+    WriteU8(out, rval.type);
+
+    switch (rval.type)
+    {
+    case RVAL_TYPE_SCALAR:
+        WriteString(out, RvalScalarValue(rval));
+        break;
+
+    case RVAL_TYPE_LIST:
+        WriteRlist(out, RvalRlistValue(rval));
+        break;
+
+    case RVAL_TYPE_FNCALL:
+    {
+        const FnCall *fp = RvalFnCallValue(rval);
+        WriteString(out, fp->name);
+        WriteRlist(out, fp->args);
+        break;
+    }
+
+    case RVAL_TYPE_CONTAINER:
+    {
+        Writer *w = StringWriter();
+        JsonWrite(w, RvalContainerValue(rval), 0);
+        WriteString(out, StringWriterData(w));
+        WriterClose(w);
+        break;
+    }
+
+    case RVAL_TYPE_NOPROMISEE:
+        break;
+    }
+}
+
+static void WriteRlist(Buffer *out, const Rlist *list)
+{
+    WriteU32(out, RlistLen(list));
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        WriteRval(out, rp->val);
+    }
+}
+
+static void WriteConstraints(Buffer *out, const Seq *conlist)
+{
+    WriteU32(out, SeqLength(conlist));
+    for (size_t i = 0; i < SeqLength(conlist); i++)
+    {
+        const Constraint *cp = SeqAt(conlist, i);
+        WriteString(out, cp->lval);
+        WriteRval(out, cp->rval);
+        WriteString(out, cp->classes);
+        WriteU8(out, cp->references_body);
+        WriteOffset(out, &cp->offset);
+    }
+}
+
+static void WriteSections(Buffer *out, const Seq *sections)
+{
+    WriteU32(out, SeqLength(sections));
+    for (size_t i = 0; i < SeqLength(sections); i++)
+    {
+        const BundleSection *section = SeqAt(sections, i);
+        WriteString(out, section->promise_type);
+        WriteOffset(out, &section->offset);
+
+        WriteU32(out, SeqLength(section->promises));
+        for (size_t j = 0; j < SeqLength(section->promises); j++)
+        {
+            const Promise *pp = SeqAt(section->promises, j);
+            WriteString(out, pp->promiser);
+            WriteRval(out, pp->promisee);
+            WriteString(out, pp->classes);
+            WriteString(out, pp->comment);
+            WriteOffset(out, &pp->offset);
+            WriteConstraints(out, pp->conlist);
+        }
+    }
+}
+
+static void WriteBodies(Buffer *out, const Seq *bodies)
+{
+    WriteU32(out, SeqLength(bodies));
+    for (size_t i = 0; i < SeqLength(bodies); i++)
+    {
+        const Body *body = SeqAt(bodies, i);
+        WriteString(out, body->type);
+        WriteString(out, body->name);
+        WriteString(out, body->ns);
+        WriteRlist(out, body->args);
+        WriteString(out, body->source_path);
+        WriteU8(out, body->is_custom);
+        WriteOffset(out, &body->offset);
+        WriteConstraints(out, body->conlist);
+    }
+}
+
+static void WriteHeader(Buffer *out, const char *path, const char *hash)
+{
+    BufferAppend(out, POLICY_CACHE_MAGIC, strlen(POLICY_CACHE_MAGIC));
+    WriteU32(out, POLICY_CACHE_FORMAT);
+    WriteU32(out, POLICY_CACHE_BYTE_ORDER);
+    WriteString(out, Version());
+    WriteString(out, path);
+    WriteString(out, hash);
+}
+
+Buffer *PolicyCacheSerialize(const Policy *policy, const char *path, const char *hash)
+{
+    assert(policy != NULL);
+
+    Buffer *out = BufferNew();
+    WriteHeader(out, path, hash);
+
+    WriteU32(out, SeqLength(policy->bundles));
+    for (size_t i = 0; i < SeqLength(policy->bundles); i++)
+    {
+        const Bundle *bundle = SeqAt(policy->bundles, i);
+        WriteString(out, bundle->type);
+        WriteString(out, bundle->name);
+        WriteString(out, bundle->ns);
+        WriteRlist(out, bundle->args);
+        WriteString(out, bundle->source_path);
+        WriteOffset(out, &bundle->offset);
+        WriteSections(out, bundle->sections);
+        WriteSections(out, bundle->custom_sections);
+    }
+
+    WriteBodies(out, policy->bodies);
+    WriteBodies(out, policy->custom_promise_types);
+
+    return out;
+}
+
+/*********************************************************************/
+/* Reading                                                           */
+/*********************************************************************/
+
+/* Reads never go past the end, the first read that would sets #error and
+ * every read after it returns zeroes and NULLs. */
+typedef struct
+{
+    const char *data;
+    size_t size;
+    size_t pos;
+    bool error;
+} CacheReader;
+
+static void ReadBytes(CacheReader *in, void *out, size_t len)
+{
+    if (in->error || len > in->size - in->pos)
+    {
+        in->error = true;
+        memset(out, 0, len);
+        return;
+    }
+
+    memcpy(out, in->data + in->pos, len);   /* the data may not be aligned */
+    in->pos += len;
+}
+
+static uint8_t ReadU8(CacheReader *in)
+{
+    uint8_t value;
+    ReadBytes(in, &value, sizeof(value));
+    return value;
+}
+
+static uint32_t ReadU32(CacheReader *in)
+{
+    uint32_t value;
+    ReadBytes(in, &value, sizeof(value));
+    return value;
+}
+
+static uint64_t ReadU64(CacheReader *in)
+{
+    uint64_t value;
+    ReadBytes(in, &value, sizeof(value));
+    return value;
+}
+
+/* Number of elements to follow, each takes at least one byte. */
+static uint32_t ReadCount(CacheReader *in)
+{
+    uint32_t count = ReadU32(in);
+    if (count > in->size - in->pos)
+    {
+        in->error = true;
+        return 0;
+    }
+    return count;
+}
+
+static char *ReadString(CacheReader *in)
+{
+    uint32_t len = ReadU32(in);
+    if (in->error || len == NULL_STRING)
+    {
+        return NULL;
+    }
+    if (len > in->size - in->pos)
+    {
+        in->error = true;
+        return NULL;
+    }
+
+    char *str = xstrndup(in->data + in->pos, len);
+    in->pos += len;
+    return str;
+}
+
+/* Like ReadString(), for strings that must not be NULL. */
+static char *ReadNonNullString(CacheReader *in)
+{
+    char *str = ReadString(in);
+    if (str == NULL)
+    {
+        in->error = true;
+    }
+    return str;
+}
+
+static void ReadOffset(CacheReader *in, SourceOffset *offset)
+{
+    offset->start = ReadU64(in);
+    offset->end = ReadU64(in);
+    offset->line = ReadU64(in);
+    offset->context = ReadU64(in);
+}
+
+static Rlist *ReadRlist(CacheReader *in);
+
+static Rval ReadRval(CacheReader *in)
+{
+    const char type = ReadU8(in);
+
+    switch (type)
+    {
+    case RVAL_TYPE_SCALAR:
+        return (Rval) { ReadNonNullString(in), RVAL_TYPE_SCALAR };
+
+    case RVAL_TYPE_LIST:
+        return (Rval) { ReadRlist(in), RVAL_TYPE_LIST };
+
+    case RVAL_TYPE_FNCALL:
+    {
+        char *name = ReadNonNullString(in);
+        Rlist *args = ReadRlist(in);
+        FnCall *fp = FnCallNew(NULL_TO_EMPTY_STRING(name), args);
+        fp->caller = NULL;
+        free(name);
+        return (Rval) { fp, RVAL_TYPE_FNCALL };
+    }
+
+    case RVAL_TYPE_CONTAINER:
+    {
+        char *json_str = ReadNonNullString(in);
+        JsonElement *json = NULL;
+        const char *data = json_str;
+        if (json_str != NULL && JsonParse(&data, &json) != JSON_PARSE_OK)
+        {
+            in->error = true;
+        }
+        free(json_str);
+        if (json == NULL)
+        {
+            in->error = true;
+            return (Rval) { NULL, RVAL_TYPE_NOPROMISEE };
+        }
+        return (Rval) { json, RVAL_TYPE_CONTAINER };
+    }
+
+    case RVAL_TYPE_NOPROMISEE:
+        return (Rval) { NULL, RVAL_TYPE_NOPROMISEE };
+
+    default:
+        in->error = true;
+        return (Rval) { NULL, RVAL_TYPE_NOPROMISEE };
+    }
+}
+
+static Rlist *ReadRlist(CacheReader *in)
+{
+    Rlist *list = NULL;
+    Rlist **next = &list;
+
+    const uint32_t len = ReadCount(in);
+    for (uint32_t i = 0; i < len && !in->error; i++)
+    {
+        Rlist *rp = xmalloc(sizeof(Rlist));
+        rp->val = ReadRval(in);
+        rp->next = NULL;
+        *next = rp;
+        next = &rp->next;
+    }
+
+    return list;
+}
+
+static void ReadConstraints(CacheReader *in, Seq *conlist,
+                            PolicyElementType parent_type, void *parent)
+{
+    const uint32_t count = ReadCount(in);
+    for (uint32_t i = 0; i < count && !in->error; i++)
+    {
+        Constraint *cp = xcalloc(1, sizeof(Constraint));
+        SeqAppend(conlist, cp);
+
+        cp->type = parent_type;
+        if (parent_type == POLICY_ELEMENT_TYPE_PROMISE)
+        {
+            cp->parent.promise = parent;
+        }
+        else
+        {
+            cp->parent.body = parent;
+        }
+
+        cp->lval = ReadNonNullString(in);
+        cp->rval = ReadRval(in);
+        cp->classes = ReadString(in);
+        cp->references_body = ReadU8(in);
+        ReadOffset(in, &cp->offset);
+    }
+}
+
+static void ReadSections(CacheReader *in, Bundle *bundle, Seq *sections)
+{
+    const uint32_t count = ReadCount(in);
+    for (uint32_t i = 0; i < count && !in->error; i++)
+    {
+        BundleSection *section = xcalloc(1, sizeof(BundleSection));
+        SeqAppend(sections, section);
+
+        section->parent_bundle = bundle;
+        section->promise_type = ReadNonNullString(in);
+        ReadOffset(in, &section->offset);
+        section->promises = SeqNew(10, PromiseDestroy);
+
+        const uint32_t n_promises = ReadCount(in);
+        for (uint32_t j = 0; j < n_promises && !in->error; j++)
+        {
+            Promise *pp = xcalloc(1, sizeof(Promise));
+            SeqAppend(section->promises, pp);
+
+            pp->parent_section = section;
+            pp->org_pp = pp;
+            pp->promiser = ReadNonNullString(in);
+            pp->promisee = ReadRval(in);
+            pp->classes = ReadNonNullString(in);
+            pp->comment = ReadString(in);
+            ReadOffset(in, &pp->offset);
+            pp->conlist = SeqNew(10, ConstraintDestroy);
+            ReadConstraints(in, pp->conlist, POLICY_ELEMENT_TYPE_PROMISE, pp);
+        }
+    }
+}
+
+static void ReadBodies(CacheReader *in, Policy *policy, Seq *bodies)
+{
+    const uint32_t count = ReadCount(in);
+    for (uint32_t i = 0; i < count && !in->error; i++)
+    {
+        Body *body = xcalloc(1, sizeof(Body));
+        SeqAppend(bodies, body);
+
+        body->parent_policy = policy;
+        body->type = ReadNonNullString(in);
+        body->name = ReadNonNullString(in);
+        body->ns = ReadNonNullString(in);
+        body->args = ReadRlist(in);
+        body->source_path = ReadString(in);
+        body->is_custom = ReadU8(in);
+        ReadOffset(in, &body->offset);
+        body->conlist = SeqNew(10, ConstraintDestroy);
+        ReadConstraints(in, body->conlist, POLICY_ELEMENT_TYPE_BODY, body);
+    }
+}
+
+static bool ReadHeader(CacheReader *in, const char *path, const char *hash)
+{
+    const size_t magic_len = strlen(POLICY_CACHE_MAGIC);
+    if (in->size < magic_len ||
+        memcmp(in->data, POLICY_CACHE_MAGIC, magic_len) != 0)
+    {
+        return false;
+    }
+    in->pos = magic_len;
+
+    if (ReadU32(in) != POLICY_CACHE_FORMAT ||
+        ReadU32(in) != POLICY_CACHE_BYTE_ORDER)
+    {
+        return false;
+    }
+
+    char *version = ReadString(in);
+    char *cached_path = ReadString(in);
+    char *cached_hash = ReadString(in);
+    bool matches = (!in->error &&
+                    StringEqual(version, Version()) &&
+                    StringEqual(cached_path, path) &&
+                    StringEqual(cached_hash, hash));
+    free(version);
+    free(cached_path);
+    free(cached_hash);
+
+    return matches;
+}
+
+Policy *PolicyCacheDeserialize(const char *data, size_t size,
+                               const char *path, const char *hash)
+{
+    CacheReader in = { .data = data, .size = size, .pos = 0, .error = false };
+    if (!ReadHeader(&in, path, hash))
+    {
+        return NULL;
+    }
+
+    Policy *policy = PolicyNew();
+
+    const uint32_t n_bundles = ReadCount(&in);
+    for (uint32_t i = 0; i < n_bundles && !in.error; i++)
+    {
+        Bundle *bundle = xcalloc(1, sizeof(Bundle));
+        SeqAppend(policy->bundles, bundle);
+
+        bundle->parent_policy = policy;
+        bundle->type = ReadNonNullString(&in);
+        bundle->name = ReadNonNullString(&in);
+        bundle->ns = ReadNonNullString(&in);
+        bundle->args = ReadRlist(&in);
+        bundle->source_path = ReadString(&in);
+        ReadOffset(&in, &bundle->offset);
+        bundle->sections = SeqNew(10, BundleSectionDestroy);
+        bundle->custom_sections = SeqNew(10, BundleSectionDestroy);
+        ReadSections(&in, bundle, bundle->sections);
+        ReadSections(&in, bundle, bundle->custom_sections);
+    }
+
+    ReadBodies(&in, policy, policy->bodies);
+    ReadBodies(&in, policy, policy->custom_promise_types);
+
+    if (in.error || in.pos != in.size)
+    {
+        PolicyDestroy(policy);
+        return NULL;
+    }
+
+    PolicyRebuildIndexes(policy);
+    return policy;
+}
+
+/*********************************************************************/
+/* Files                                                             */
+/*********************************************************************/
+
+static void CacheFilePath(char *out, size_t size, const char *path)
+{
+    /* Collisions just make the header not match. */
+    snprintf(out, size, "%s%c%s%c%08x.policy", GetStateDir(), FILE_SEPARATOR,
+             POLICY_CACHE_DIR, FILE_SEPARATOR, StringHash(path, 0));
+}
+
+bool PolicyCacheStore(const char *path, const Buffer *serialized)
+{
+    char cache_path[PATH_MAX];
+    CacheFilePath(cache_path, sizeof(cache_path), path);
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s%c%s", GetStateDir(), FILE_SEPARATOR,
+             POLICY_CACHE_DIR);
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create policy cache directory '%s' (mkdir: %s)",
+            dir, GetErrorStr());
+        return false;
+    }
+
+    /* Write it next to where it belongs and rename it into place, so that
+     * concurrent agents never see half of it. */
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ju", cache_path, (uintmax_t) getpid());
+
+    int fd = safe_open_create_perms(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                                    0600);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create policy cache file '%s' (open: %s)",
+            tmp_path, GetErrorStr());
+        return false;
+    }
+
+    const bool written = (FullWrite(fd, BufferData(serialized),
+                                    BufferSize(serialized)) >= 0);
+    if (close(fd) == -1 || !written)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not write policy cache file '%s' (write: %s)",
+            tmp_path, GetErrorStr());
+        unlink(tmp_path);
+        return false;
+    }
+
+    if (rename(tmp_path, cache_path) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not rename policy cache file '%s' (rename: %s)",
+            tmp_path, GetErrorStr());
+        unlink(tmp_path);
+        return false;
+    }
+
+    Log(LOG_LEVEL_DEBUG, "Cached policy file '%s' in '%s'", path, cache_path);
+    return true;
+}
+
+Policy *PolicyCacheLoad(const char *path, const char *hash)
+{
+    char cache_path[PATH_MAX];
+    CacheFilePath(cache_path, sizeof(cache_path), path);
+
+    int fd = safe_open(cache_path, O_RDONLY | O_BINARY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    const size_t size = sb.st_size;
+
+    Policy *policy = NULL;
+
+#ifndef __MINGW32__
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    policy = PolicyCacheDeserialize(data, size, path, hash);
+    munmap(data, size);
+#else
+    char *data = xmalloc(size);
+    const ssize_t n_read = FullRead(fd, data, size);
+    close(fd);
+    if (n_read == (ssize_t) size)
+    {
+        policy = PolicyCacheDeserialize(data, size, path, hash);
+    }
+    free(data);
+#endif
+
+    if (policy == NULL)
+    {
+        Log(LOG_LEVEL_DEBUG, "Cached policy '%s' for '%s' is stale or corrupt",
+            cache_path, path);
+    }
+    return policy;
+}
+
+bool PolicyCacheIsFresh(const char *path, const char *hash)
+{
+    char cache_path[PATH_MAX];
+    CacheFilePath(cache_path, sizeof(cache_path), path);
+
+    int fd = safe_open(cache_path, O_RDONLY | O_BINARY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    /* The header is the magic, two numbers and three strings, one of them a
+     * path. */
+    const size_t max_header_size = 2 * PATH_MAX + CF_BUFSIZE;
+    char *data = xmalloc(max_header_size);
+    const ssize_t n_read = FullRead(fd, data, max_header_size);
+    close(fd);
+
+    bool fresh = false;
+    if (n_read > 0)
+    {
+        CacheReader in = { .data = data, .size = n_read, .pos = 0, .error = false };
+        fresh = ReadHeader(&in, path, hash);
+    }
+
+    free(data);
+    return fresh;
+}
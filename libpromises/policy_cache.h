@@ -0,0 +1,71 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_POLICY_CACHE_H
+#define CFENGINE_POLICY_CACHE_H
+
+#include <policy.h>
+#include <buffer.h>
+
+/**
+ * Cache of parsed and checked policy files, so that agents don't have to
+ * parse every input again on every run.
+ *
+ * Each policy file gets one cache file in $(sys.statedir)/policy_cache,
+ * holding a binary serialization of its Policy (bundles, bodies, promises,
+ * constraints and their source offsets). It is only used while the policy
+ * file hashes to the same digest it had when it was cached, and it was cached
+ * by the same version of CFEngine.
+ */
+
+/**
+ * Serialize #policy, as parsed from #path whose contents hash to #hash.
+ */
+Buffer *PolicyCacheSerialize(const Policy *policy, const char *path, const char *hash);
+
+/**
+ * @return the policy serialized in #data, NULL if it is corrupt or was
+ *         serialized for a different #path or #hash
+ */
+Policy *PolicyCacheDeserialize(const char *data, size_t size,
+                               const char *path, const char *hash);
+
+/**
+ * Store the output of PolicyCacheSerialize() for #path.
+ */
+bool PolicyCacheStore(const char *path, const Buffer *serialized);
+
+/**
+ * @return the policy cached for #path, or NULL if there is none or the file
+ *         no longer hashes to #hash
+ */
+Policy *PolicyCacheLoad(const char *path, const char *hash);
+
+/**
+ * @return whether PolicyCacheLoad() would find #path cached, only looking at
+ *         the header of the cache file
+ */
+bool PolicyCacheIsFresh(const char *path, const char *hash);
+
+#endif
@@ -0,0 +1,569 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <process_table.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <item_lib.h>
+#include <string_lib.h>                          /* StringFormat, StringMap */
+#include <file_lib.h>                                          /* FullRead */
+#include <unix.h>                                           /* GetUserName */
+#include <printsize.h>
+
+struct ProcessTable_
+{
+    Seq *processes;             /* ProcessInfo, sorted by pid */
+    time_t time;
+    StringMap *user_names;      /* uid -> user name */
+    struct stat passwd_sb;      /* /etc/passwd when #user_names was emptied */
+};
+
+static void ProcessInfoDestroy(void *ptr)
+{
+    ProcessInfo *info = ptr;
+    if (info != NULL)
+    {
+        free(info->user);
+        free(info->tty);
+        free(info->comm);
+        free(info->command);
+        free(info);
+    }
+}
+
+static int ProcessInfoComparePid(const void *a, const void *b,
+                                 ARG_UNUSED void *user_data)
+{
+    const ProcessInfo *info_a = a;
+    const ProcessInfo *info_b = b;
+    return (info_a->pid > info_b->pid) - (info_a->pid < info_b->pid);
+}
+
+ProcessTable *ProcessTableNew(void)
+{
+    ProcessTable *table = xmalloc(sizeof(ProcessTable));
+    table->processes = SeqNew(100, ProcessInfoDestroy);
+    table->time = 0;
+    table->user_names = StringMapNew();
+    memset(&table->passwd_sb, 0, sizeof(table->passwd_sb));
+    return table;
+}
+
+void ProcessTableDestroy(ProcessTable *table)
+{
+    if (table != NULL)
+    {
+        SeqDestroy(table->processes);
+        StringMapDestroy(table->user_names);
+        free(table);
+    }
+}
+
+size_t ProcessTableLength(const ProcessTable *table)
+{
+    assert(table != NULL);
+    return SeqLength(table->processes);
+}
+
+const ProcessInfo *ProcessTableAt(const ProcessTable *table, size_t index)
+{
+    assert(table != NULL);
+    return SeqAt(table->processes, index);
+}
+
+const ProcessInfo *ProcessTableGet(const ProcessTable *table, pid_t pid)
+{
+    assert(table != NULL);
+    ProcessInfo key = { .pid = pid };
+    return SeqBinaryLookup(table->processes, &key, ProcessInfoComparePid);
+}
+
+time_t ProcessTableTime(const ProcessTable *table)
+{
+    assert(table != NULL);
+    return table->time;
+}
+
+/*******************************************************************/
+
+/* [dd-]hh:mm:ss, as ps prints TIME and ELAPSED. */
+static void FormatTimeCounter(char *buf, size_t size, time_t seconds)
+{
+    if (seconds < 0)
+    {
+        seconds = 0;
+    }
+
+    const long days = seconds / 86400;
+    const int hours = (seconds / 3600) % 24;
+    const int minutes = (seconds / 60) % 60;
+    const int secs = seconds % 60;
+
+    if (days > 0)
+    {
+        snprintf(buf, size, "%ld-%02d:%02d:%02d", days, hours, minutes, secs);
+    }
+    else
+    {
+        snprintf(buf, size, "%02d:%02d:%02d", hours, minutes, secs);
+    }
+}
+
+/* hh:mm today, MmmDD this year, the year before that, as ps prints STIME. */
+static void FormatStartTime(char *buf, size_t size, time_t start, time_t now)
+{
+    struct tm tm;
+    localtime_r(&start, &tm);
+
+    const char *format;
+    if (now - start < 24 * 3600)
+    {
+        format = "%H:%M";
+    }
+    else if (now - start < 365 * 24 * 3600)
+    {
+        format = "%b%d";
+    }
+    else
+    {
+        format = "%Y";
+    }
+
+    if (strftime(buf, size, format, &tm) == 0)
+    {
+        strlcpy(buf, "-", size);
+    }
+}
+
+Item *ProcessTableToPsOutput(const ProcessTable *table)
+{
+    assert(table != NULL);
+
+    const size_t length = SeqLength(table->processes);
+
+    /* Line up the columns, ps pads USER to 30 characters. */
+    int user_width = 4;
+    for (size_t i = 0; i < length; i++)
+    {
+        const ProcessInfo *info = SeqAt(table->processes, i);
+        const int len = strlen(info->user);
+        user_width = MAX(user_width, len);
+    }
+
+    Item *lines = NULL;
+    Item *last = NULL;
+
+    char *header = StringFormat(
+        "%-*s %7s %7s %7s %5s %5s %9s %3s %9s %-8s %4s %5s %11s %11s %s",
+        user_width, "USER", "PID", "PPID", "PGID", "%CPU", "%MEM", "VSZ", "NI",
+        "RSS", "TT", "NLWP", "STIME", "ELAPSED", "TIME", "COMMAND");
+    AppendItem(&lines, header, NULL);
+    last = lines;
+    free(header);
+
+    for (size_t i = 0; i < length; i++)
+    {
+        const ProcessInfo *info = SeqAt(table->processes, i);
+
+        char stime[16], elapsed[32], cpu_time[32];
+        FormatStartTime(stime, sizeof(stime), info->start_time, table->time);
+        FormatTimeCounter(elapsed, sizeof(elapsed), table->time - info->start_time);
+        FormatTimeCounter(cpu_time, sizeof(cpu_time), info->cpu_time);
+
+        char *line = StringFormat(
+            "%-*s %7jd %7jd %7jd %5.1f %5.1f %9ju %3d %9ju %-8s %4ld %5s %11s %11s %s",
+            user_width, info->user, (intmax_t) info->pid,
+            (intmax_t) info->ppid, (intmax_t) info->pgid, info->pcpu,
+            info->pmem, info->vsize, info->nice, info->rss, info->tty,
+            info->threads, stime, elapsed, cpu_time, info->command);
+
+        /* Appending to the end directly, AppendItem() walks the list. */
+        Item *ip = xcalloc(1, sizeof(Item));
+        ip->name = line;
+        ip->counter = info->pid;
+        last->next = ip;
+        last = ip;
+    }
+
+    return lines;
+}
+
+/*******************************************************************/
+
+#ifdef __linux__
+
+typedef struct
+{
+    long ticks;                 /* clock ticks per second */
+    long page_size;             /* KiB */
+    time_t boot_time;
+    double uptime;              /* seconds */
+    uintmax_t mem_total;        /* KiB */
+} ProcSystemInfo;
+
+/* Reads a small file in one go, NUL-terminated. */
+static bool ReadProcFile(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    const ssize_t n_read = FullRead(fd, buf, size - 1);
+    close(fd);
+
+    if (n_read < 0)
+    {
+        return false;
+    }
+    buf[n_read] = '\0';
+    return true;
+}
+
+static bool ReadProcSystemInfo(const char *proc_dir, ProcSystemInfo *sys)
+{
+    char path[PATH_MAX];
+    char buf[CF_BUFSIZE];
+
+    sys->ticks = sysconf(_SC_CLK_TCK);
+    sys->page_size = sysconf(_SC_PAGESIZE) / 1024;
+
+    /* The intr line before btime can be very long. */
+    xsnprintf(path, sizeof(path), "%s/stat", proc_dir);
+    FILE *fp = safe_fopen(path, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    size_t line_size = CF_BUFSIZE;
+    char *line = xmalloc(line_size);
+    long long boot_time = -1;
+    while (boot_time == -1 && CfReadLine(&line, &line_size, fp) != -1)
+    {
+        sscanf(line, "btime %lld", &boot_time);
+    }
+    free(line);
+    fclose(fp);
+    if (boot_time == -1)
+    {
+        return false;
+    }
+    sys->boot_time = boot_time;
+
+    xsnprintf(path, sizeof(path), "%s/uptime", proc_dir);
+    if (!ReadProcFile(path, buf, sizeof(buf)) ||
+        sscanf(buf, "%lf", &sys->uptime) != 1)
+    {
+        return false;
+    }
+
+    xsnprintf(path, sizeof(path), "%s/meminfo", proc_dir);
+    sys->mem_total = 0;
+    if (ReadProcFile(path, buf, sizeof(buf)))
+    {
+        const char *mem_total = strstr(buf, "MemTotal:");
+        if (mem_total != NULL)
+        {
+            sscanf(mem_total, "MemTotal: %ju", &sys->mem_total);
+        }
+    }
+
+    return true;
+}
+
+static char *TtyName(unsigned int tty_nr)
+{
+    const unsigned int major = (tty_nr >> 8) & 0xfff;
+    const unsigned int minor = (tty_nr & 0xff) | ((tty_nr >> 12) & 0xfff00);
+
+    if (major == 4 && minor < 64)
+    {
+        return StringFormat("tty%u", minor);
+    }
+    else if (major == 4)
+    {
+        return StringFormat("ttyS%u", minor - 64);
+    }
+    else if (major >= 136 && major <= 143)
+    {
+        return StringFormat("pts/%u", (major - 136) * 256 + minor);
+    }
+
+    return xstrdup("?");
+}
+
+/* Forgets the user names if /etc/passwd changed since they were looked
+ * up, as useradd or usermod may have given a uid another name. */
+static void ForgetChangedUserNames(ProcessTable *table)
+{
+    struct stat sb;
+    if (stat("/etc/passwd", &sb) == -1)
+    {
+        memset(&sb, 0, sizeof(sb));
+    }
+
+    if (sb.st_dev != table->passwd_sb.st_dev ||
+        sb.st_ino != table->passwd_sb.st_ino ||
+        sb.st_mtime != table->passwd_sb.st_mtime ||
+        sb.st_ctime != table->passwd_sb.st_ctime ||
+        sb.st_size != table->passwd_sb.st_size)
+    {
+        StringMapClear(table->user_names);
+        table->passwd_sb = sb;
+    }
+}
+
+static char *UserName(ProcessTable *table, uid_t uid)
+{
+    char key[PRINTSIZE(uintmax_t)];
+    xsnprintf(key, sizeof(key), "%ju", (uintmax_t) uid);
+
+    const char *cached = StringMapGet(table->user_names, key);
+    if (cached == NULL)
+    {
+        char name[CF_BUFSIZE];
+        if (!GetUserName(uid, name, sizeof(name), LOG_LEVEL_DEBUG))
+        {
+            strlcpy(name, key, sizeof(name));
+        }
+        cached = xstrdup(name);
+        StringMapInsert(table->user_names, xstrdup(key), (char *) cached);
+    }
+
+    return xstrdup(cached);
+}
+
+static bool ReadProcessUid(const char *proc_dir, pid_t pid, uid_t *uid)
+{
+    char path[PATH_MAX];
+    char buf[CF_BUFSIZE];
+    xsnprintf(path, sizeof(path), "%s/%jd/status", proc_dir, (intmax_t) pid);
+    if (!ReadProcFile(path, buf, sizeof(buf)))
+    {
+        return false;
+    }
+
+    /* Uid: real effective saved filesystem */
+    const char *line = strstr(buf, "\nUid:");
+    uintmax_t real, effective;
+    if (line == NULL || sscanf(line, " Uid: %ju %ju", &real, &effective) != 2)
+    {
+        return false;
+    }
+
+    *uid = effective;
+    return true;
+}
+
+/* The arguments separated by spaces, or the name in brackets if there are
+ * none (kernel threads, zombies), like ps does. */
+static char *ReadProcessCommand(const char *proc_dir, pid_t pid,
+                                const char *comm, char state)
+{
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/%jd/cmdline", proc_dir, (intmax_t) pid);
+
+    size_t size = 256;
+    size_t length = 0;
+    char *command = xmalloc(size);
+
+    int fd = open(path, O_RDONLY);
+    if (fd != -1)
+    {
+        ssize_t n_read;
+        while ((n_read = FullRead(fd, command + length, size - length - 1)) > 0)
+        {
+            length += n_read;
+            if (length < size - 1)
+            {
+                break;
+            }
+            size *= 2;
+            command = xrealloc(command, size);
+        }
+        close(fd);
+    }
+
+    while (length > 0 && command[length - 1] == '\0')
+    {
+        length--;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if (command[i] == '\0' || command[i] == '\n')
+        {
+            command[i] = ' ';
+        }
+    }
+    command[length] = '\0';
+
+    if (length == 0)
+    {
+        free(command);
+        command = StringFormat((state == 'Z') ? "[%s] <defunct>" : "[%s]", comm);
+    }
+
+    return command;
+}
+
+/**
+ * @return NULL if the process is gone
+ */
+static ProcessInfo *ReadProcess(ProcessTable *table, const char *proc_dir,
+                                pid_t pid, const ProcSystemInfo *sys)
+{
+    char path[PATH_MAX];
+    char buf[CF_BUFSIZE];
+    xsnprintf(path, sizeof(path), "%s/%jd/stat", proc_dir, (intmax_t) pid);
+    if (!ReadProcFile(path, buf, sizeof(buf)))
+    {
+        return NULL;
+    }
+
+    /* <pid> (<comm>) <state> ..., and comm can have anything in it. */
+    char *comm_start = strchr(buf, '(');
+    char *comm_end = strrchr(buf, ')');
+    if (comm_start == NULL || comm_end == NULL || comm_end < comm_start)
+    {
+        return NULL;
+    }
+
+    char state;
+    long long ppid, pgid;
+    int tty_nr, nice;
+    unsigned long long utime, stime, start_ticks, vsize;
+    long threads, rss;
+    if (sscanf(comm_end + 1,
+               " %c"            /* state */
+               " %lld"          /* ppid */
+               " %lld"          /* pgrp */
+               " %*d"           /* session */
+               " %d"            /* tty_nr */
+               " %*d"           /* tpgid */
+               " %*u"           /* flags */
+               " %*u %*u %*u %*u" /* minflt cminflt majflt cmajflt */
+               " %llu %llu"     /* utime stime */
+               " %*d %*d"       /* cutime cstime */
+               " %*d"           /* priority */
+               " %d"            /* nice */
+               " %ld"           /* num_threads */
+               " %*d"           /* itrealvalue */
+               " %llu"          /* starttime */
+               " %llu"          /* vsize */
+               " %ld",          /* rss */
+               &state, &ppid, &pgid, &tty_nr, &utime, &stime, &nice,
+               &threads, &start_ticks, &vsize, &rss) != 11)
+    {
+        return NULL;
+    }
+    *comm_end = '\0';
+    const char *comm = comm_start + 1;
+
+    ProcessInfo *info = xcalloc(1, sizeof(ProcessInfo));
+    info->pid = pid;
+    info->ppid = ppid;
+    info->pgid = pgid;
+    info->state = state;
+    info->nice = nice;
+    info->threads = threads;
+    info->vsize = vsize / 1024;
+    info->rss = (rss > 0) ? (uintmax_t) rss * sys->page_size : 0;
+    info->tty = TtyName(tty_nr);
+    info->start_time = sys->boot_time + start_ticks / sys->ticks;
+    info->cpu_time = (utime + stime) / sys->ticks;
+
+    const double seconds = sys->uptime - (double) start_ticks / sys->ticks;
+    info->pcpu = (seconds > 0) ?
+        (double) (utime + stime) / sys->ticks * 100 / seconds : 0;
+    info->pmem = (sys->mem_total > 0) ?
+        (double) info->rss * 100 / sys->mem_total : 0;
+
+    /* Read every time, see ProcessTableLoadProc(). */
+    if (!ReadProcessUid(proc_dir, pid, &info->uid))
+    {
+        ProcessInfoDestroy(info);
+        return NULL;
+    }
+    info->user = UserName(table, info->uid);
+    info->comm = xstrdup(comm);
+    info->command = ReadProcessCommand(proc_dir, pid, comm, state);
+
+    return info;
+}
+
+bool ProcessTableLoadProc(ProcessTable *table, const char *proc_dir)
+{
+    assert(table != NULL);
+    assert(proc_dir != NULL);
+
+    ProcSystemInfo sys;
+    if (!ReadProcSystemInfo(proc_dir, &sys))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not read system information from '%s'",
+            proc_dir);
+        return false;
+    }
+
+    DIR *dir = opendir(proc_dir);
+    if (dir == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not open '%s' (opendir: %s)",
+            proc_dir, GetErrorStr());
+        return false;
+    }
+
+    ForgetChangedUserNames(table);
+
+    Seq *processes = SeqNew(SeqLength(table->processes) + 100,
+                            ProcessInfoDestroy);
+
+    const struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char *end;
+        const long pid = strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0 || end == entry->d_name)
+        {
+            continue;
+        }
+
+        ProcessInfo *info = ReadProcess(table, proc_dir, pid, &sys);
+        if (info != NULL)
+        {
+            SeqAppend(processes, info);
+        }
+    }
+    closedir(dir);
+
+    SeqSort(processes, ProcessInfoComparePid, NULL);
+    SeqDestroy(table->processes);
+    table->processes = processes;
+    table->time = sys.boot_time + (time_t) sys.uptime;
+
+    return true;
+}
+
+#endif /* __linux__ */
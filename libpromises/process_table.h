@@ -0,0 +1,96 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_PROCESS_TABLE_H
+#define CFENGINE_PROCESS_TABLE_H
+
+#include <cf3.defs.h>
+
+/**
+ * A process table read directly from the system, without running ps.
+ */
+
+typedef struct
+{
+    pid_t pid;
+    pid_t ppid;
+    pid_t pgid;
+    uid_t uid;                  /* effective */
+    char *user;                 /* name of #uid, or #uid if it has none */
+    char state;                 /* R, S, D, Z, T, ... */
+    int nice;
+    long threads;
+    uintmax_t vsize;            /* KiB */
+    uintmax_t rss;              /* KiB */
+    double pcpu;                /* CPU usage over its lifetime, in % */
+    double pmem;                /* rss in % of the physical memory */
+    char *tty;                  /* "?" if none */
+    time_t start_time;
+    time_t cpu_time;            /* user and system, in seconds */
+    char *comm;                 /* name of the executable */
+    char *command;              /* command line, like ps shows it */
+} ProcessInfo;
+
+typedef struct ProcessTable_ ProcessTable;
+
+ProcessTable *ProcessTableNew(void);
+void ProcessTableDestroy(ProcessTable *table);
+
+/**
+ * @return the number of processes, which are in the order of their pids
+ */
+size_t ProcessTableLength(const ProcessTable *table);
+const ProcessInfo *ProcessTableAt(const ProcessTable *table, size_t index);
+const ProcessInfo *ProcessTableGet(const ProcessTable *table, pid_t pid);
+
+/**
+ * @return when the table was last loaded
+ */
+time_t ProcessTableTime(const ProcessTable *table);
+
+/**
+ * The table in the format of
+ * `ps -eo user,pid,ppid,pgid,pcpu,pmem,vsz,ni,rss,tname,nlwp,stime,etime,time,args`,
+ * a header line followed by a line for each process, with the pid in its
+ * counter.
+ */
+Item *ProcessTableToPsOutput(const ProcessTable *table);
+
+#ifdef __linux__
+/**
+ * Load the processes from #proc_dir, normally "/proc".
+ *
+ * Loading a table again reads every process again. Nothing tells when a
+ * process changed its owner or its command line: setuid() and
+ * setproctitle() do so without an exec, keeping the pid and the start
+ * time, and the owner of /proc/<pid> is root for any process that is not
+ * dumpable. So only the names of the users are kept from one load to the
+ * next, until /etc/passwd changes.
+ *
+ * @return false if #proc_dir could not be read, the table is unchanged then
+ */
+bool ProcessTableLoadProc(ProcessTable *table, const char *proc_dir);
+#endif
+
+#endif
@@ -32,7 +32,7 @@
 #include <matching.h>
 #include <systype.h>
 #include <string_lib.h>                                         /* Chop */
-#include <regex.h> /* CompileRegex,StringMatchWithPrecompiledRegex,StringMatchFull */
+#include <regex_cache.h> /* RegexCacheGet,CachedRegexMatch,CachedRegexMatchFull */
 #include <item_lib.h>
 #include <file_lib.h>   // SetUmask(), RestoreUmask()
 #include <pipes.h>
@@ -42,9 +42,11 @@
 #include <zones.h>
 #include <printsize.h>
 #include <known_dirs.h>
+#include <process_table.h>
+#include <sequence.h>
+#include <map.h>
 
 # ifdef HAVE_GETZONEID
-#include <sequence.h>
 #define MAX_ZONENAME_SIZE 64
 # endif
 
@@ -55,6 +57,13 @@
 #endif
 TABLE_STORAGE Item *PROCESSTABLE = NULL;
 
+#ifdef __linux__
+/* Kept across ClearProcessTable(), loading it again is cheaper. */
+static ProcessTable *PROC_TABLE = NULL;
+/* PROCESSTABLE if it is the ps view of PROC_TABLE, NULL otherwise. */
+static const Item *PROC_TABLE_LINES = NULL;
+#endif
+
 typedef enum
 {
     /*
@@ -116,8 +125,6 @@ static const char *UCB_STYLE_PS_ARGS = "axwww";
 static const PsColumnAlgorithm UCB_STYLE_PS_COLUMN_ALGORITHM = PCA_ZombieSkipEmptyColumns;
 #endif
 
-static bool SelectProcRangeMatch(char *name1, char *name2, int min, int max, char **names, char **line);
-static bool SelectProcRegexMatch(const char *name1, const char *name2, const char *regex, bool anchored, char **colNames, char **line);
 static bool SplitProcLine(const char *proc,
                           time_t pstime,
                           char **names,
@@ -125,8 +132,6 @@ static bool SplitProcLine(const char *proc,
                           int *end,
                           PsColumnAlgorithm pca,
                           char **line);
-static bool SelectProcTimeCounterRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line);
-static bool SelectProcTimeAbsRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line);
 static int GetProcColumnIndex(const char *name1, const char *name2, char **names);
 static void GetProcessColumnNames(const char *proc, char **names, int *start, int *end);
 static int ExtractPid(char *psentry, char **names, int *end);
@@ -134,474 +139,784 @@ static void ApplyPlatformExtraTable(char **names, char **columns);
 
 /***************************************************************************/
 
-static bool SelectProcess(const char *procentry,
-                          time_t pstime,
-                          char **names,
-                          int *start,
-                          int *end,
-                          const char *process_regex,
-                          const ProcessSelect *a,
-                          bool attrselect)
+static long TimeCounter2Int(const char *s)
 {
-    bool result = true;
-    char *column[CF_PROCCOLS];
-    Rlist *rp;
-
-    assert(process_regex);
-    assert(a != NULL);
-
-    StringSet *process_select_attributes = StringSetNew();
-
-    memset(column, 0, sizeof(column));
+    long days, hours, minutes, seconds;
 
-    if (!SplitProcLine(procentry, pstime, names, start, end,
-                       PS_COLUMN_ALGORITHM[VPSHARDCLASS], column))
+    if (s == NULL)
     {
-        result = false;
-        goto cleanup;
+        return CF_NOINT;
     }
 
-    ApplyPlatformExtraTable(names, column);
-
-    for (int i = 0; names[i] != NULL; i++)
+    /* If we match dd-hh:mm[:ss], believe it: */
+    int got = sscanf(s, "%ld-%ld:%ld:%ld", &days, &hours, &minutes, &seconds);
+    if (got > 2)
     {
-        LogDebug(LOG_MOD_PS, "In SelectProcess, COL[%s] = '%s'",
-                 names[i], column[i]);
+        /* All but perhaps seconds set */
     }
-
-    if (!SelectProcRegexMatch("CMD", "COMMAND", process_regex, false, names, column))
+    /* Failing that, try matching hh:mm[:ss] */
+    else if (1 < (got = sscanf(s, "%ld:%ld:%ld", &hours, &minutes, &seconds)))
+    {
+        /* All but days and perhaps seconds set */
+        days = 0;
+        got++;
+    }
+    else
     {
-        result = false;
-        goto cleanup;
+        Log(LOG_LEVEL_ERR,
+            "Unable to parse 'ps' time field as [dd-]hh:mm[:ss], got '%s'",
+            s);
+        return CF_NOINT;
     }
+    assert(got > 2); /* i.e. all but maybe seconds have been set */
+    /* Clear seconds if unset: */
+    if (got < 4)
+    {
+        seconds = 0;
+    }
+
+    LogDebug(LOG_MOD_PS, "TimeCounter2Int:"
+             " Parsed '%s' as elapsed time '%ld-%02ld:%02ld:%02ld'",
+             s, days, hours, minutes, seconds);
 
-    if (!attrselect)
+    /* Convert to seconds: */
+    return ((days * 24 + hours) * 60 + minutes) * 60 + seconds;
+}
+
+static time_t TimeAbs2Int(const char *s)
+{
+    if (s == NULL)
     {
-        // If we are not considering attributes, then the matching is done.
-        goto cleanup;
+        return CF_NOINT;
     }
 
-    for (rp = a->owner; rp != NULL; rp = rp->next)
+    struct tm tm;
+    localtime_r(&CFSTARTTIME, &tm);
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+
+    /* Try various ways to parse s: */
+    char word[4]; /* Abbreviated month name */
+    long ns[3]; /* Miscellaneous numbers, diverse readings */
+    int got = sscanf(s, "%2ld:%2ld:%2ld", ns, ns + 1, ns + 2);
+    if (1 < got) /* Hr:Min[:Sec] */
     {
-        if (rp->val.type == RVAL_TYPE_FNCALL)
+        tm.tm_hour = ns[0];
+        tm.tm_min = ns[1];
+        if (got == 3)
         {
-            Log(LOG_LEVEL_VERBOSE,
-                "Function call '%s' in process_select body was not resolved, skipping",
-                RlistFnCallValue(rp)->name);
+            tm.tm_sec = ns[2];
         }
-        else if (SelectProcRegexMatch("USER", "UID", RlistScalarValue(rp), true, names, column))
+    }
+    /* or MMM dd (the %ld shall ignore any leading space) */
+    else if (sscanf(s, "%3[a-zA-Z]%ld", word, ns) == 2 &&
+             /* Only match if word is a valid month text: */
+             0 < (ns[1] = Month2Int(word)))
+    {
+        int month = ns[1] - 1;
+        if (tm.tm_mon < month)
         {
-            StringSetAdd(process_select_attributes, xstrdup("process_owner"));
-            break;
+            /* Wrapped around */
+            tm.tm_year--;
         }
+        tm.tm_mon = month;
+        tm.tm_mday = ns[0];
+        tm.tm_hour = 0;
+        tm.tm_min = 0;
     }
-
-    if (SelectProcRangeMatch("PID", "PID", a->min_pid, a->max_pid, names, column))
+    /* or just year, or seconds since 1970 */
+    else if (sscanf(s, "%ld", ns) == 1)
     {
-        StringSetAdd(process_select_attributes, xstrdup("pid"));
-    }
+        if (ns[0] > 9999)
+        {
+            /* Seconds since 1970.
+             *
+             * This is the amended value SplitProcLine() replaces
+             * start time with if it's imprecise and a better value
+             * can be calculated from elapsed time.
+             */
+            return (time_t)ns[0];
+        }
+        /* else year, at most four digits; either 4-digit CE or
+         * already relative to 1900. */
 
-    if (SelectProcRangeMatch("PPID", "PPID", a->min_ppid, a->max_ppid, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("ppid"));
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = ns[0] < 999 ? ns[0] : ns[0] - 1900;
+        tm.tm_isdst = -1;
     }
-
-    if (SelectProcRangeMatch("PGID", "PGID", a->min_pgid, a->max_pgid, names, column))
+    else
     {
-        StringSetAdd(process_select_attributes, xstrdup("pgid"));
+        return CF_NOINT;
     }
 
-    if (SelectProcRangeMatch("VSZ", "SZ", a->min_vsize, a->max_vsize, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("vsize"));
-    }
+    return mktime(&tm);
+}
 
-    if (SelectProcRangeMatch("RSS", "RSS", a->min_rsize, a->max_rsize, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("rsize"));
-    }
+/***************************************************************************/
 
-    if (SelectProcTimeCounterRangeMatch("TIME", "TIME", a->min_ttime, a->max_ttime, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("ttime"));
-    }
+/* The columns selection looks at, each by the names ps may give it. */
+typedef enum
+{
+    PROC_COLUMN_USER,
+    PROC_COLUMN_PID,
+    PROC_COLUMN_PPID,
+    PROC_COLUMN_PGID,
+    PROC_COLUMN_VSIZE,
+    PROC_COLUMN_RSIZE,
+    PROC_COLUMN_TTIME,
+    PROC_COLUMN_STIME,
+    PROC_COLUMN_PRIORITY,
+    PROC_COLUMN_THREADS,
+    PROC_COLUMN_STATUS,
+    PROC_COLUMN_COMMAND,
+    PROC_COLUMN_TTY,
+    PROC_COLUMN_MAX
+} ProcColumn;
+
+static const char *const PROC_COLUMN_NAMES[PROC_COLUMN_MAX][2] =
+{
+    [PROC_COLUMN_USER] = { "USER", "UID" },
+    [PROC_COLUMN_PID] = { "PID", "PID" },
+    [PROC_COLUMN_PPID] = { "PPID", "PPID" },
+    [PROC_COLUMN_PGID] = { "PGID", "PGID" },
+    [PROC_COLUMN_VSIZE] = { "VSZ", "SZ" },
+    [PROC_COLUMN_RSIZE] = { "RSS", "RSS" },
+    [PROC_COLUMN_TTIME] = { "TIME", "TIME" },
+    [PROC_COLUMN_STIME] = { "STIME", "START" },
+    [PROC_COLUMN_PRIORITY] = { "NI", "PRI" },
+    [PROC_COLUMN_THREADS] = { "NLWP", "NLWP" },
+    [PROC_COLUMN_STATUS] = { "S", "STAT" },
+    [PROC_COLUMN_COMMAND] = { "CMD", "COMMAND" },
+    [PROC_COLUMN_TTY] = { "TTY", "TTY" },
+};
 
-    if (SelectProcTimeAbsRangeMatch
-        ("STIME", "START", a->min_stime, a->max_stime, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("stime"));
-    }
+/* A line of PROCESSTABLE, split into its columns, or the process it shows
+ * if it was read from /proc. */
+typedef struct
+{
+    const char *line;
+    const ProcessInfo *info;            /* NULL if the line was split */
+    char *fields[CF_PROCCOLS];
+    size_t user;                        /* index in ProcessRecords.users */
+    long values[PROC_COLUMN_MAX];       /* parsed when first needed */
+    unsigned int parsed;                /* bit per column in values */
+} ProcessRecord;
+
+/* PROCESSTABLE split once, for all the selections against it. */
+typedef struct
+{
+    const Item *source;
+    char *names[CF_PROCCOLS];
+    int start[CF_PROCCOLS];
+    int end[CF_PROCCOLS];
+    int columns[PROC_COLUMN_MAX];       /* index in names, -1 if missing */
+    Seq *records;
+    Seq *users;                         /* distinct owners of the records */
+} ProcessRecords;
+
+static ProcessRecords *PROCESS_RECORDS = NULL;
 
-    if (SelectProcRangeMatch("NI", "PRI", a->min_pri, a->max_pri, names, column))
+static void ProcessRecordDestroy(void *data)
+{
+    ProcessRecord *record = data;
+    if (record != NULL)
     {
-        StringSetAdd(process_select_attributes, xstrdup("priority"));
+        for (int i = 0; i < CF_PROCCOLS; i++)
+        {
+            free(record->fields[i]);
+        }
+        free(record);
     }
+}
 
-    if (SelectProcRangeMatch("NLWP", "NLWP", a->min_thread, a->max_thread, names, column))
+static void ProcessRecordsDestroy(ProcessRecords *records)
+{
+    if (records != NULL)
     {
-        StringSetAdd(process_select_attributes, xstrdup("threads"));
+        SeqDestroy(records->users);
+        SeqDestroy(records->records);
+        for (int i = 0; i < CF_PROCCOLS; i++)
+        {
+            free(records->names[i]);
+        }
+        free(records);
     }
+}
 
-    if (SelectProcRegexMatch("S", "STAT", a->status, true, names, column))
+/* Owner name -> index in users + 1, the records own the names. */
+static void ProcessRecordsAddUser(ProcessRecords *records, Map *user_index,
+                                  ProcessRecord *record, char *user)
+{
+    uintptr_t index = (uintptr_t) MapGet(user_index, user);
+    if (index == 0)
     {
-        StringSetAdd(process_select_attributes, xstrdup("status"));
+        SeqAppend(records->users, user);
+        index = SeqLength(records->users);
+        MapInsert(user_index, user, (void *) index);
     }
+    record->user = index - 1;
+}
 
-    if (SelectProcRegexMatch("CMD", "COMMAND", a->command, true, names, column))
+/**
+ * @param table the processes #processes shows, selections then look at
+ *              them rather than at the lines, NULL to split the lines
+ */
+static ProcessRecords *ProcessRecordsNew(const Item *processes, const ProcessTable *table)
+{
+    assert(processes != NULL);
+
+    ProcessRecords *records = xcalloc(1, sizeof(ProcessRecords));
+    records->source = processes;
+    records->records = SeqNew(1000, ProcessRecordDestroy);
+    records->users = SeqNew(100, NULL);
+
+    GetProcessColumnNames(processes->name, records->names, records->start, records->end);
+    for (int c = 0; c < PROC_COLUMN_MAX; c++)
     {
-        StringSetAdd(process_select_attributes, xstrdup("command"));
+        records->columns[c] = GetProcColumnIndex(PROC_COLUMN_NAMES[c][0],
+                                                 PROC_COLUMN_NAMES[c][1],
+                                                 records->names);
     }
 
-    if (SelectProcRegexMatch("TTY", "TTY", a->tty, true, names, column))
+    const int user_column = records->columns[PROC_COLUMN_USER];
+    Map *user_index = MapNew(StringHash_untyped, StringEqual_untyped, NULL, NULL);
+
+    if (table != NULL)
     {
-        StringSetAdd(process_select_attributes, xstrdup("tty"));
+        /* The lines have the pids in their counters. */
+        for (const Item *ip = processes->next; ip != NULL; ip = ip->next)
+        {
+            const ProcessInfo *info = ProcessTableGet(table, ip->counter);
+            if (info == NULL)
+            {
+                continue;
+            }
+
+            ProcessRecord *record = xcalloc(1, sizeof(ProcessRecord));
+            record->line = ip->name;
+            record->info = info;
+            if (user_column != -1)
+            {
+                ProcessRecordsAddUser(records, user_index, record, info->user);
+            }
+            SeqAppend(records->records, record);
+        }
+
+        MapDestroy(user_index);
+        return records;
     }
 
-    if (!a->process_result)
+    /* TODO: use actual time of ps-run, as time(NULL) may be later. */
+    time_t pstime = time(NULL);
+
+    for (const Item *ip = processes->next; ip != NULL; ip = ip->next)
     {
-        if (StringSetSize(process_select_attributes) == 0)
+        if (NULL_OR_EMPTY(ip->name))
         {
-            result = EvalProcessResult("", process_select_attributes);
+            continue;
         }
-        else
+
+        ProcessRecord *record = xcalloc(1, sizeof(ProcessRecord));
+        record->line = ip->name;
+
+        if (!SplitProcLine(ip->name, pstime, records->names, records->start, records->end,
+                           PS_COLUMN_ALGORITHM[VPSHARDCLASS], record->fields))
         {
-            Writer *w = StringWriter();
-            StringSetIterator iter = StringSetIteratorInit(process_select_attributes);
-            char *attr = StringSetIteratorNext(&iter);
-            WriterWrite(w, attr);
+            Log(LOG_LEVEL_VERBOSE, "Could not split process line '%s', ignoring it", ip->name);
+            ProcessRecordDestroy(record);
+            continue;
+        }
 
-            while ((attr = StringSetIteratorNext(&iter)))
-            {
-                WriterWriteChar(w, '.');
-                WriterWrite(w, attr);
-            }
+        ApplyPlatformExtraTable(records->names, record->fields);
 
-            result = EvalProcessResult(StringWriterData(w), process_select_attributes);
-            WriterClose(w);
+        for (int i = 0; records->names[i] != NULL; i++)
+        {
+            LogDebug(LOG_MOD_PS, "In ProcessRecordsNew, COL[%s] = '%s'",
+                     records->names[i], record->fields[i]);
         }
+
+        if (user_column != -1)
+        {
+            ProcessRecordsAddUser(records, user_index, record,
+                                  record->fields[user_column]);
+        }
+
+        SeqAppend(records->records, record);
     }
-    else
+
+    MapDestroy(user_index);
+    return records;
+}
+
+/**
+ * @return the records of PROCESSTABLE, split when first needed
+ */
+static ProcessRecords *GetProcessRecords(void)
+{
+    if (PROCESS_RECORDS != NULL && PROCESS_RECORDS->source != PROCESSTABLE)
     {
-        result = EvalProcessResult(a->process_result, process_select_attributes);
+        ProcessRecordsDestroy(PROCESS_RECORDS);
+        PROCESS_RECORDS = NULL;
     }
 
-cleanup:
-    StringSetDestroy(process_select_attributes);
-
-    for (int i = 0; column[i] != NULL; i++)
+    if (PROCESS_RECORDS == NULL && PROCESSTABLE != NULL)
     {
-        free(column[i]);
+        const ProcessTable *table = NULL;
+#ifdef __linux__
+        if (PROCESSTABLE == PROC_TABLE_LINES)
+        {
+            table = PROC_TABLE;
+        }
+#endif
+        PROCESS_RECORDS = ProcessRecordsNew(PROCESSTABLE, table);
     }
 
-    return result;
+    return PROCESS_RECORDS;
 }
 
-Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool attrselect)
+/**
+ * @return the value of a numeric #column of a process read from /proc,
+ *         CF_NOINT if it has none
+ */
+static long ProcessInfoValue(const ProcessInfo *info, ProcColumn column)
 {
-    assert(a != NULL);
-    const Item *processes = PROCESSTABLE;
-    Item *result = NULL;
+    switch (column)
+    {
+    case PROC_COLUMN_PID:
+        return info->pid;
+    case PROC_COLUMN_PPID:
+        return info->ppid;
+    case PROC_COLUMN_PGID:
+        return info->pgid;
+    case PROC_COLUMN_VSIZE:
+        return (long) info->vsize;
+    case PROC_COLUMN_RSIZE:
+        return (long) info->rss;
+    case PROC_COLUMN_TTIME:
+        return (long) info->cpu_time;
+    case PROC_COLUMN_STIME:
+        return (long) info->start_time;
+    case PROC_COLUMN_PRIORITY:
+        return info->nice;
+    case PROC_COLUMN_THREADS:
+        return info->threads;
+    default:
+        return CF_NOINT;
+    }
+}
 
-    if (processes == NULL)
+/**
+ * @return the text of #column of #record, NULL if it has none
+ */
+static const char *ProcessRecordText(const ProcessRecords *records,
+                                     const ProcessRecord *record,
+                                     ProcColumn column)
+{
+    const int i = records->columns[column];
+    if (i == -1)
     {
-        return result;
+        return NULL;
     }
 
-    char *names[CF_PROCCOLS];
-    int start[CF_PROCCOLS];
-    int end[CF_PROCCOLS];
-
-    GetProcessColumnNames(processes->name, names, start, end);
-
-    /* TODO: use actual time of ps-run, as time(NULL) may be later. */
-    time_t pstime = time(NULL);
+    if (record->info == NULL)
+    {
+        return record->fields[i];
+    }
 
-    for (Item *ip = processes->next; ip != NULL; ip = ip->next)
+    switch (column)
     {
-        if (NULL_OR_EMPTY(ip->name))
-        {
-            continue;
-        }
+    case PROC_COLUMN_USER:
+        return record->info->user;
+    case PROC_COLUMN_COMMAND:
+        return record->info->command;
+    case PROC_COLUMN_TTY:
+        return record->info->tty;
+    default:
+        return NULL;
+    }
+}
 
-        if (!SelectProcess(ip->name, pstime, names, start, end, process_name, a, attrselect))
-        {
-            continue;
-        }
+/**
+ * @return the value of a numeric #column of #record, CF_NOINT if it has
+ *         none
+ */
+static long ProcessRecordValue(const ProcessRecords *records, ProcessRecord *record,
+                               ProcColumn column)
+{
+    if (record->info != NULL)
+    {
+        return (records->columns[column] == -1) ?
+            CF_NOINT : ProcessInfoValue(record->info, column);
+    }
 
-        pid_t pid = ExtractPid(ip->name, names, end);
+    const unsigned int bit = 1U << column;
+    if ((record->parsed & bit) == 0)
+    {
+        const int i = records->columns[column];
+        long value = CF_NOINT;
 
-        if (pid == -1)
+        if (i != -1)
         {
-            Log(LOG_LEVEL_VERBOSE, "Unable to extract pid while looking for %s", process_name);
-            continue;
+            switch (column)
+            {
+            case PROC_COLUMN_TTIME:
+                value = TimeCounter2Int(record->fields[i]);
+                break;
+            case PROC_COLUMN_STIME:
+                value = (long) TimeAbs2Int(record->fields[i]);
+                break;
+            default:
+                value = IntFromString(record->fields[i]);
+                break;
+            }
         }
 
-        PrependItem(&result, ip->name, "");
-        result->counter = (int)pid;
+        record->values[column] = value;
+        record->parsed |= bit;
     }
 
-    for (int i = 0; i < CF_PROCCOLS; i++)
-    {
-        free(names[i]);
-    }
-
-    return result;
+    return record->values[column];
 }
 
-static bool SelectProcRangeMatch(char *name1, char *name2, int min, int max, char **names, char **line)
+static bool SelectProcRangeMatch(const ProcessRecords *records, ProcessRecord *record,
+                                 ProcColumn column, intmax_t min, intmax_t max)
 {
-    int i;
-    long value;
-
     if ((min == CF_NOINT) || (max == CF_NOINT))
     {
         return false;
     }
 
-    if ((i = GetProcColumnIndex(name1, name2, names)) != -1)
+    const int i = records->columns[column];
+    if (i == -1)
     {
-        value = IntFromString(line[i]);
+        return false;
+    }
 
-        if (value == CF_NOINT)
-        {
-            Log(LOG_LEVEL_INFO, "Failed to extract a valid integer from '%s' => '%s' in process list", names[i],
-                  line[i]);
-            return false;
-        }
+    const long value = ProcessRecordValue(records, record, column);
+    if (value == CF_NOINT)
+    {
+        Log(LOG_LEVEL_INFO, "Failed to extract a valid integer from '%s' => '%s' in process list",
+            records->names[i], (record->info == NULL) ? record->fields[i] : "");
+        return false;
+    }
 
-        if ((min <= value) && (value <= max))
-        {
-            return true;
-        }
-        else
+    if ((min <= value) && (value <= max))
+    {
+        if (column == PROC_COLUMN_TTIME || column == PROC_COLUMN_STIME)
         {
-            return false;
+            Log(LOG_LEVEL_VERBOSE, "Selection filter matched '%s' = '%s' in [%jd,%jd] (= %jd)",
+                records->names[i], (record->info == NULL) ? record->fields[i] : "",
+                min, max, (intmax_t) value);
         }
+        return true;
     }
 
     return false;
 }
 
-/***************************************************************************/
-
-static long TimeCounter2Int(const char *s)
+/**
+ * @param regex compiled regex, NULL if unset or invalid, which never matches
+ */
+static bool SelectProcRegexMatch(const ProcessRecords *records, const ProcessRecord *record,
+                                 ProcColumn column, const CachedRegex *regex, bool anchored)
 {
-    long days, hours, minutes, seconds;
-
-    if (s == NULL)
+    if (regex == NULL)
     {
-        return CF_NOINT;
+        return false;
     }
 
-    /* If we match dd-hh:mm[:ss], believe it: */
-    int got = sscanf(s, "%ld-%ld:%ld:%ld", &days, &hours, &minutes, &seconds);
-    if (got > 2)
+    const char *text = ProcessRecordText(records, record, column);
+    if (text == NULL)
     {
-        /* All but perhaps seconds set */
+        return false;
     }
-    /* Failing that, try matching hh:mm[:ss] */
-    else if (1 < (got = sscanf(s, "%ld:%ld:%ld", &hours, &minutes, &seconds)))
+
+    if (anchored)
     {
-        /* All but days and perhaps seconds set */
-        days = 0;
-        got++;
+        return CachedRegexMatchFull(regex, text);
     }
-    else
+
+    return CachedRegexMatch(regex, text);
+}
+
+/* The regexes of a selection, looked up once for all processes. */
+typedef struct
+{
+    CachedRegex *process_regex;
+    bool match_all;                     /* process_regex matches anything */
+    const ProcessSelect *a;
+    bool attrselect;
+    Seq *owners;                        /* CachedRegex */
+    signed char *owner_matches;         /* per user, -1 until known */
+    CachedRegex *status;
+    CachedRegex *command;
+    CachedRegex *tty;
+} ProcessSelector;
+
+static CachedRegex *GetSelectRegex(const char *regex)
+{
+    return (regex == NULL) ? NULL : RegexCacheGet(regex);
+}
+
+static void ReleaseSelectRegex(void *regex)
+{
+    RegexCacheRelease(regex);
+}
+
+static void ProcessSelectorDestroy(ProcessSelector *selector)
+{
+    if (selector != NULL)
     {
-        Log(LOG_LEVEL_ERR,
-            "Unable to parse 'ps' time field as [dd-]hh:mm[:ss], got '%s'",
-            s);
-        return CF_NOINT;
+        RegexCacheRelease(selector->process_regex);
+        SeqDestroy(selector->owners);
+        free(selector->owner_matches);
+        RegexCacheRelease(selector->status);
+        RegexCacheRelease(selector->command);
+        RegexCacheRelease(selector->tty);
+        free(selector);
     }
-    assert(got > 2); /* i.e. all but maybe seconds have been set */
-    /* Clear seconds if unset: */
-    if (got < 4)
+}
+
+static ProcessSelector *ProcessSelectorNew(const ProcessRecords *records,
+                                           const char *process_regex,
+                                           const ProcessSelect *a,
+                                           bool attrselect)
+{
+    assert(process_regex);
+    assert(a != NULL);
+
+    ProcessSelector *selector = xcalloc(1, sizeof(ProcessSelector));
+    selector->a = a;
+    selector->attrselect = attrselect;
+    selector->match_all = (process_regex[0] == '\0' || StringEqual(process_regex, ".*"));
+    if (!selector->match_all)
     {
-        seconds = 0;
+        selector->process_regex = RegexCacheGet(process_regex);
     }
 
-    LogDebug(LOG_MOD_PS, "TimeCounter2Int:"
-             " Parsed '%s' as elapsed time '%ld-%02ld:%02ld:%02ld'",
-             s, days, hours, minutes, seconds);
+    selector->owners = SeqNew(5, ReleaseSelectRegex);
+    if (attrselect)
+    {
+        for (const Rlist *rp = a->owner; rp != NULL; rp = rp->next)
+        {
+            if (rp->val.type == RVAL_TYPE_FNCALL)
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Function call '%s' in process_select body was not resolved, skipping",
+                    RlistFnCallValue(rp)->name);
+                continue;
+            }
 
-    /* Convert to seconds: */
-    return ((days * 24 + hours) * 60 + minutes) * 60 + seconds;
+            CachedRegex *owner = RegexCacheGet(RlistScalarValue(rp));
+            if (owner != NULL)
+            {
+                SeqAppend(selector->owners, owner);
+            }
+        }
+
+        const size_t n_users = SeqLength(records->users);
+        selector->owner_matches = xmalloc(n_users + 1);
+        memset(selector->owner_matches, -1, n_users + 1);
+
+        selector->status = GetSelectRegex(a->status);
+        selector->command = GetSelectRegex(a->command);
+        selector->tty = GetSelectRegex(a->tty);
+    }
+
+    return selector;
 }
 
-static bool SelectProcTimeCounterRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line)
+static bool SelectProcOwnerMatch(const ProcessRecords *records, const ProcessRecord *record,
+                                 ProcessSelector *selector)
 {
-    if ((min == CF_NOINT) || (max == CF_NOINT))
+    if (records->columns[PROC_COLUMN_USER] == -1)
     {
         return false;
     }
 
-    int i = GetProcColumnIndex(name1, name2, names);
-    if (i != -1)
+    /* Processes of the same owner give the same answer. */
+    signed char *match = selector->owner_matches + record->user;
+    if (*match == -1)
+    {
+        *match = 0;
+        const size_t n_owners = SeqLength(selector->owners);
+        for (size_t i = 0; i < n_owners; i++)
+        {
+            if (SelectProcRegexMatch(records, record, PROC_COLUMN_USER,
+                                     SeqAt(selector->owners, i), true))
+            {
+                *match = 1;
+                break;
+            }
+        }
+    }
+
+    return (*match == 1);
+}
+
+static bool SelectProcess(const ProcessRecords *records,
+                          ProcessRecord *record,
+                          ProcessSelector *selector)
+{
+    const ProcessSelect *a = selector->a;
+
+    if (selector->match_all)
     {
-        time_t value = (time_t) TimeCounter2Int(line[i]);
-
-        if (value == CF_NOINT)
+        if (records->columns[PROC_COLUMN_COMMAND] == -1)
         {
-            Log(LOG_LEVEL_INFO,
-                "Failed to extract a valid integer from %s => '%s' in process list",
-                names[i], line[i]);
             return false;
         }
+    }
+    else if (!SelectProcRegexMatch(records, record, PROC_COLUMN_COMMAND,
+                                   selector->process_regex, false))
+    {
+        return false;
+    }
 
-        if ((min <= value) && (value <= max))
-        {
-            Log(LOG_LEVEL_VERBOSE, "Selection filter matched counter range"
-                " '%s/%s' = '%s' in [%jd,%jd] (= %jd secs)",
-                  name1, name2, line[i], (intmax_t)min, (intmax_t)max, (intmax_t)value);
-            return true;
-        }
-        else
-        {
-            LogDebug(LOG_MOD_PS, "Selection filter REJECTED counter range"
-                     " '%s/%s' = '%s' in [%jd,%jd] (= %jd secs)",
-                     name1, name2, line[i],
-                     (intmax_t) min, (intmax_t) max, (intmax_t) value);
-            return false;
-        }
+    if (!selector->attrselect)
+    {
+        // If we are not considering attributes, then the matching is done.
+        return true;
     }
 
-    return false;
-}
+    StringSet *process_select_attributes = StringSetNew();
 
-static time_t TimeAbs2Int(const char *s)
-{
-    if (s == NULL)
+    if (SelectProcOwnerMatch(records, record, selector))
     {
-        return CF_NOINT;
+        StringSetAdd(process_select_attributes, xstrdup("process_owner"));
     }
 
-    struct tm tm;
-    localtime_r(&CFSTARTTIME, &tm);
-    tm.tm_sec = 0;
-    tm.tm_isdst = -1;
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_PID, a->min_pid, a->max_pid))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("pid"));
+    }
 
-    /* Try various ways to parse s: */
-    char word[4]; /* Abbreviated month name */
-    long ns[3]; /* Miscellaneous numbers, diverse readings */
-    int got = sscanf(s, "%2ld:%2ld:%2ld", ns, ns + 1, ns + 2);
-    if (1 < got) /* Hr:Min[:Sec] */
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_PPID, a->min_ppid, a->max_ppid))
     {
-        tm.tm_hour = ns[0];
-        tm.tm_min = ns[1];
-        if (got == 3)
-        {
-            tm.tm_sec = ns[2];
-        }
+        StringSetAdd(process_select_attributes, xstrdup("ppid"));
     }
-    /* or MMM dd (the %ld shall ignore any leading space) */
-    else if (sscanf(s, "%3[a-zA-Z]%ld", word, ns) == 2 &&
-             /* Only match if word is a valid month text: */
-             0 < (ns[1] = Month2Int(word)))
+
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_PGID, a->min_pgid, a->max_pgid))
     {
-        int month = ns[1] - 1;
-        if (tm.tm_mon < month)
-        {
-            /* Wrapped around */
-            tm.tm_year--;
-        }
-        tm.tm_mon = month;
-        tm.tm_mday = ns[0];
-        tm.tm_hour = 0;
-        tm.tm_min = 0;
+        StringSetAdd(process_select_attributes, xstrdup("pgid"));
     }
-    /* or just year, or seconds since 1970 */
-    else if (sscanf(s, "%ld", ns) == 1)
+
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_VSIZE, a->min_vsize, a->max_vsize))
     {
-        if (ns[0] > 9999)
-        {
-            /* Seconds since 1970.
-             *
-             * This is the amended value SplitProcLine() replaces
-             * start time with if it's imprecise and a better value
-             * can be calculated from elapsed time.
-             */
-            return (time_t)ns[0];
-        }
-        /* else year, at most four digits; either 4-digit CE or
-         * already relative to 1900. */
+        StringSetAdd(process_select_attributes, xstrdup("vsize"));
+    }
 
-        memset(&tm, 0, sizeof(tm));
-        tm.tm_year = ns[0] < 999 ? ns[0] : ns[0] - 1900;
-        tm.tm_isdst = -1;
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_RSIZE, a->min_rsize, a->max_rsize))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("rsize"));
     }
-    else
+
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_TTIME, a->min_ttime, a->max_ttime))
     {
-        return CF_NOINT;
+        StringSetAdd(process_select_attributes, xstrdup("ttime"));
     }
 
-    return mktime(&tm);
-}
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_STIME, a->min_stime, a->max_stime))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("stime"));
+    }
 
-static bool SelectProcTimeAbsRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line)
-{
-    int i;
-    time_t value;
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_PRIORITY, a->min_pri, a->max_pri))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("priority"));
+    }
 
-    if ((min == CF_NOINT) || (max == CF_NOINT))
+    if (SelectProcRangeMatch(records, record, PROC_COLUMN_THREADS, a->min_thread, a->max_thread))
     {
-        return false;
+        StringSetAdd(process_select_attributes, xstrdup("threads"));
+    }
+
+    if (SelectProcRegexMatch(records, record, PROC_COLUMN_STATUS, selector->status, true))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("status"));
     }
 
-    if ((i = GetProcColumnIndex(name1, name2, names)) != -1)
+    if (SelectProcRegexMatch(records, record, PROC_COLUMN_COMMAND, selector->command, true))
     {
-        value = TimeAbs2Int(line[i]);
+        StringSetAdd(process_select_attributes, xstrdup("command"));
+    }
 
-        if (value == CF_NOINT)
-        {
-            Log(LOG_LEVEL_INFO, "Failed to extract a valid integer from %c => '%s' in process list", name1[i],
-                  line[i]);
-            return false;
-        }
+    if (SelectProcRegexMatch(records, record, PROC_COLUMN_TTY, selector->tty, true))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("tty"));
+    }
 
-        if ((min <= value) && (value <= max))
+    bool result;
+    if (!a->process_result)
+    {
+        if (StringSetSize(process_select_attributes) == 0)
         {
-            Log(LOG_LEVEL_VERBOSE, "Selection filter matched absolute '%s/%s' = '%s(%jd)' in [%jd,%jd]", name1, name2, line[i], (intmax_t)value,
-                  (intmax_t)min, (intmax_t)max);
-            return true;
+            result = EvalProcessResult("", process_select_attributes);
         }
         else
         {
-            return false;
+            Writer *w = StringWriter();
+            StringSetIterator iter = StringSetIteratorInit(process_select_attributes);
+            char *attr = StringSetIteratorNext(&iter);
+            WriterWrite(w, attr);
+
+            while ((attr = StringSetIteratorNext(&iter)))
+            {
+                WriterWriteChar(w, '.');
+                WriterWrite(w, attr);
+            }
+
+            result = EvalProcessResult(StringWriterData(w), process_select_attributes);
+            WriterClose(w);
         }
     }
+    else
+    {
+        result = EvalProcessResult(a->process_result, process_select_attributes);
+    }
 
-    return false;
+    StringSetDestroy(process_select_attributes);
+    return result;
 }
 
-/***************************************************************************/
-
-static bool SelectProcRegexMatch(const char *name1, const char *name2,
-                                 const char *regex, bool anchored,
-                                 char **colNames, char **line)
+Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool attrselect)
 {
-    int i;
+    assert(a != NULL);
+    Item *result = NULL;
 
-    if (regex == NULL)
+    ProcessRecords *records = GetProcessRecords();
+    if (records == NULL)
     {
-        return false;
+        return result;
     }
 
-    if ((i = GetProcColumnIndex(name1, name2, colNames)) != -1)
+    ProcessSelector *selector = ProcessSelectorNew(records, process_name, a, attrselect);
+
+    const size_t length = SeqLength(records->records);
+    for (size_t i = 0; i < length; i++)
     {
-        if (anchored)
+        ProcessRecord *record = SeqAt(records->records, i);
+        if (!SelectProcess(records, record, selector))
         {
-            return StringMatchFull(regex, line[i]);
+            continue;
         }
-        else
+
+        pid_t pid = (record->info != NULL) ? record->info->pid :
+            ExtractPid((char *) record->line, records->names, records->end);
+
+        if (pid == -1)
         {
-            size_t s, e;
-            return StringMatch(regex, line[i], &s, &e);
+            Log(LOG_LEVEL_VERBOSE, "Unable to extract pid while looking for %s", process_name);
+            continue;
         }
+
+        PrependItem(&result, record->line, "");
+        result->counter = (int)pid;
     }
 
-    return false;
+    ProcessSelectorDestroy(selector);
+    return result;
 }
-
 static void PrintStringIndexLine(int prefix_spaces, int len)
 {
     char arrow_str[CF_BUFSIZE];
@@ -969,60 +1284,28 @@ static int GetProcColumnIndex(const char *name1, const char *name2, char **names
 
 bool IsProcessNameRunning(char *procNameRegex)
 {
-    char *colHeaders[CF_PROCCOLS];
-    int start[CF_PROCCOLS] = { 0 };
-    int end[CF_PROCCOLS] = { 0 };
-    bool matched = false;
-    int i;
-
-    memset(colHeaders, 0, sizeof(colHeaders));
-
-    if (PROCESSTABLE == NULL)
+    ProcessRecords *records = GetProcessRecords();
+    if (records == NULL)
     {
         Log(LOG_LEVEL_ERR, "IsProcessNameRunning: PROCESSTABLE is empty");
         return false;
     }
-    /* TODO: use actual time of ps-run, not time(NULL), which may be later. */
-    time_t pstime = time(NULL);
 
-    GetProcessColumnNames(PROCESSTABLE->name, colHeaders, start, end);
-
-    for (const Item *ip = PROCESSTABLE->next; !matched && ip != NULL; ip = ip->next) // iterate over ps lines
+    CachedRegex *regex = RegexCacheGet(procNameRegex);
+    if (regex == NULL)
     {
-        char *lineSplit[CF_PROCCOLS];
-        memset(lineSplit, 0, sizeof(lineSplit));
-
-        if (NULL_OR_EMPTY(ip->name))
-        {
-            continue;
-        }
-
-        if (!SplitProcLine(ip->name, pstime, colHeaders, start, end,
-                           PS_COLUMN_ALGORITHM[VPSHARDCLASS], lineSplit))
-        {
-            Log(LOG_LEVEL_ERR, "IsProcessNameRunning: Could not split process line '%s'", ip->name);
-            goto loop_cleanup;
-        }
-
-        ApplyPlatformExtraTable(colHeaders, lineSplit);
-
-        if (SelectProcRegexMatch("CMD", "COMMAND", procNameRegex, true, colHeaders, lineSplit))
-        {
-            matched = true;
-        }
-
-   loop_cleanup:
-        for (i = 0; lineSplit[i] != NULL; i++)
-        {
-            free(lineSplit[i]);
-        }
+        return false;
     }
 
-    for (i = 0; colHeaders[i] != NULL; i++)
+    bool matched = false;
+    const size_t length = SeqLength(records->records);
+    for (size_t i = 0; !matched && i < length; i++)
     {
-        free(colHeaders[i]);
+        matched = SelectProcRegexMatch(records, SeqAt(records->records, i),
+                                       PROC_COLUMN_COMMAND, regex, true);
     }
 
+    RegexCacheRelease(regex);
     return matched;
 }
 
@@ -1557,6 +1840,88 @@ static inline void ApplyPlatformExtraTable(ARG_UNUSED char **names, ARG_UNUSED c
 #endif
 
 #ifndef _WIN32
+/**
+ * Save the process table, and the processes of root and of the other users
+ * (with the header line), in the state directory.
+ */
+static void SaveProcessTable(Item *rootprocs, Item *otherprocs)
+{
+    char path[CF_MAXVARSIZE];
+    const char* const statedir = GetStateDir();
+
+    snprintf(path, CF_MAXVARSIZE, "%s%ccf_procs", statedir, FILE_SEPARATOR);
+    RawSaveItemList(PROCESSTABLE, path, NewLineMode_Unix);
+
+    if (otherprocs)
+    {
+        PrependItem(&rootprocs, otherprocs->name, NULL);
+    }
+
+    // TODO: Change safe_fopen() to default to 0600, then remove this.
+    const mode_t old_umask = SetUmask(0077);
+
+    snprintf(path, CF_MAXVARSIZE, "%s%ccf_rootprocs", statedir, FILE_SEPARATOR);
+    RawSaveItemList(rootprocs, path, NewLineMode_Unix);
+    DeleteItemList(rootprocs);
+
+    snprintf(path, CF_MAXVARSIZE, "%s%ccf_otherprocs", statedir, FILE_SEPARATOR);
+    RawSaveItemList(otherprocs, path, NewLineMode_Unix);
+    DeleteItemList(otherprocs);
+
+    RestoreUmask(old_umask);
+}
+
+static void SplitProcessTableByUser(Item **rootprocs, Item **otherprocs)
+{
+    CopyList(rootprocs, PROCESSTABLE);
+    CopyList(otherprocs, PROCESSTABLE);
+
+    while (DeleteItemNotContaining(rootprocs, "root"))
+    {
+    }
+
+    while (DeleteItemContaining(otherprocs, "root"))
+    {
+    }
+}
+
+# ifdef __linux__
+/**
+ * Read the process table from /proc instead of running ps, on the Linux
+ * flavours whose ps output it reproduces.
+ */
+static bool LoadProcessTableFromProc(void)
+{
+    if (VPSHARDCLASS != PLATFORM_CONTEXT_LINUX ||
+        strncmp(VSYSNAME.release, "2.4", 3) == 0)
+    {
+        return false;
+    }
+
+    if (PROC_TABLE == NULL)
+    {
+        PROC_TABLE = ProcessTableNew();
+    }
+
+    if (!ProcessTableLoadProc(PROC_TABLE, "/proc"))
+    {
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Observe process table with /proc (%zu processes)",
+        ProcessTableLength(PROC_TABLE));
+    PROCESSTABLE = ProcessTableToPsOutput(PROC_TABLE);
+    PROC_TABLE_LINES = PROCESSTABLE;
+
+    Item *rootprocs = NULL;
+    Item *otherprocs = NULL;
+    SplitProcessTableByUser(&rootprocs, &otherprocs);
+    SaveProcessTable(rootprocs, otherprocs);
+
+    return true;
+}
+# endif
+
 bool LoadProcessTable()
 {
     FILE *prp;
@@ -1571,6 +1936,13 @@ bool LoadProcessTable()
         return true;
     }
 
+# ifdef __linux__
+    if (LoadProcessTableFromProc())
+    {
+        return true;
+    }
+# endif
+
     LoadPlatformExtraTable();
 
     CheckPsLineLimitations();
@@ -1660,13 +2032,6 @@ bool LoadProcessTable()
 
     cf_pclose(prp);
 
-/* Now save the data */
-    const char* const statedir = GetStateDir();
-
-    snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_procs", statedir, FILE_SEPARATOR);
-
-    RawSaveItemList(PROCESSTABLE, vbuff, NewLineMode_Unix);
-
 # ifdef HAVE_GETZONEID
     if (global_zone) /* pidlist and rootpidlist are empty if we're not in the global zone */
     {
@@ -1688,34 +2053,10 @@ bool LoadProcessTable()
     else
 # endif
     {
-        CopyList(&rootprocs, PROCESSTABLE);
-        CopyList(&otherprocs, PROCESSTABLE);
-
-        while (DeleteItemNotContaining(&rootprocs, "root"))
-        {
-        }
-
-        while (DeleteItemContaining(&otherprocs, "root"))
-        {
-        }
-    }
-    if (otherprocs)
-    {
-        PrependItem(&rootprocs, otherprocs->name, NULL);
+        SplitProcessTableByUser(&rootprocs, &otherprocs);
     }
 
-    // TODO: Change safe_fopen() to default to 0600, then remove this.
-    const mode_t old_umask = SetUmask(0077);
-
-    snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_rootprocs", statedir, FILE_SEPARATOR);
-    RawSaveItemList(rootprocs, vbuff, NewLineMode_Unix);
-    DeleteItemList(rootprocs);
-
-    snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_otherprocs", statedir, FILE_SEPARATOR);
-    RawSaveItemList(otherprocs, vbuff, NewLineMode_Unix);
-    DeleteItemList(otherprocs);
-
-    RestoreUmask(old_umask);
+    SaveProcessTable(rootprocs, otherprocs);
 
     free(vbuff);
     return true;
@@ -1726,6 +2067,12 @@ void ClearProcessTable(void)
 {
     ClearPlatformExtraTable();
 
+    ProcessRecordsDestroy(PROCESS_RECORDS);
+    PROCESS_RECORDS = NULL;
+
     DeleteItemList(PROCESSTABLE);
     PROCESSTABLE = NULL;
+#ifdef __linux__
+    PROC_TABLE_LINES = NULL;
+#endif
 }
@@ -0,0 +1,278 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <profiling.h>
+
+#include <map.h>
+#include <sequence.h>
+#include <string_lib.h>
+#include <misc_lib.h>                                   /* xclock_gettime */
+#include <file_lib.h>                                   /* safe_fopen */
+
+bool PROFILING = false;
+
+static const char *const PROFILE_FRAME_TYPES[] =
+{
+    [PROFILE_FRAME_BUNDLE] = "bundle",
+    [PROFILE_FRAME_PROMISE] = "promise",
+    [PROFILE_FRAME_FUNCTION] = "function",
+};
+
+static const char *const PROFILE_COUNTER_NAMES[PROFILE_COUNTER_MAX] =
+{
+    [PROFILE_COUNTER_EXPANSIONS] = "expansions",
+    [PROFILE_COUNTER_ITERATIONS] = "iterations",
+    [PROFILE_COUNTER_CLASS_EVALUATIONS] = "class_evaluations",
+    [PROFILE_COUNTER_DB_OPERATIONS] = "db_operations",
+    [PROFILE_COUNTER_REGEX_CACHE_HITS] = "regex_cache_hits",
+    [PROFILE_COUNTER_REGEX_CACHE_MISSES] = "regex_cache_misses",
+};
+
+/* A frame, for each different path of frames entered. A frame can't be
+ * entered again before it is left, recursion makes new frames below it. */
+typedef struct ProfileFrame_ ProfileFrame;
+struct ProfileFrame_
+{
+    char *name;
+    ProfileFrameType type;
+    ProfileFrame *parent;
+    Seq *children;                      /* in the order first entered */
+    Map *children_by_name;
+    uint64_t count;
+    uint64_t start_ns;
+    uint64_t total_ns;
+    uint64_t counters[PROFILE_COUNTER_MAX];   /* while no child is entered */
+};
+
+static ProfileFrame *PROFILE_ROOT = NULL;
+static ProfileFrame *PROFILE_CURRENT = NULL;
+
+/* The thread that started profiling, the frames are only its own. Worker
+ * threads also go through the database and regex wrappers. */
+static pthread_t PROFILE_THREAD;
+
+static inline bool ProfilingThisThread(void)
+{
+    return PROFILING && pthread_equal(pthread_self(), PROFILE_THREAD);
+}
+
+static uint64_t NowNs(void)
+{
+    struct timespec ts;
+    xclock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static ProfileFrame *ProfileFrameNew(ProfileFrameType type, const char *name,
+                                     ProfileFrame *parent)
+{
+    ProfileFrame *frame = xcalloc(1, sizeof(ProfileFrame));
+    frame->name = xstrdup(name);
+    frame->type = type;
+    frame->parent = parent;
+    return frame;
+}
+
+static void ProfileFrameDestroy(void *data)
+{
+    ProfileFrame *frame = data;
+    if (frame != NULL)
+    {
+        MapDestroy(frame->children_by_name);
+        SeqDestroy(frame->children);
+        free(frame->name);
+        free(frame);
+    }
+}
+
+void ProfilingStart(void)
+{
+    ProfilingStop();
+
+    PROFILE_ROOT = ProfileFrameNew(PROFILE_FRAME_BUNDLE, "all", NULL);
+    PROFILE_ROOT->count = 1;
+    PROFILE_ROOT->start_ns = NowNs();
+    PROFILE_CURRENT = PROFILE_ROOT;
+    PROFILE_THREAD = pthread_self();
+    PROFILING = true;
+}
+
+void ProfilingStop(void)
+{
+    PROFILING = false;
+    ProfileFrameDestroy(PROFILE_ROOT);
+    PROFILE_ROOT = NULL;
+    PROFILE_CURRENT = NULL;
+}
+
+void ProfileEnter(ProfileFrameType type, const char *category, const char *name)
+{
+    if (!ProfilingThisThread())
+    {
+        return;
+    }
+
+    char label[CF_BUFSIZE];
+    if (category != NULL)
+    {
+        snprintf(label, sizeof(label), "%s %s", category, name);
+    }
+    else
+    {
+        snprintf(label, sizeof(label), "%s()", name);
+    }
+
+    ProfileFrame *parent = PROFILE_CURRENT;
+    if (parent->children == NULL)
+    {
+        parent->children = SeqNew(10, ProfileFrameDestroy);
+        parent->children_by_name = MapNew(StringHash_untyped, StringEqual_untyped, NULL, NULL);
+    }
+
+    ProfileFrame *frame = MapGet(parent->children_by_name, label);
+    if (frame == NULL)
+    {
+        frame = ProfileFrameNew(type, label, parent);
+        SeqAppend(parent->children, frame);
+        MapInsert(parent->children_by_name, frame->name, frame);
+    }
+
+    frame->count++;
+    frame->start_ns = NowNs();
+    PROFILE_CURRENT = frame;
+}
+
+void ProfileLeave(void)
+{
+    if (!ProfilingThisThread())
+    {
+        return;
+    }
+
+    ProfileFrame *frame = PROFILE_CURRENT;
+    if (frame->parent == NULL)
+    {
+        ProgrammingError("Leaving a profile frame that was not entered");
+    }
+
+    frame->total_ns += NowNs() - frame->start_ns;
+    PROFILE_CURRENT = frame->parent;
+}
+
+void ProfileCount(ProfileCounter counter)
+{
+    if (ProfilingThisThread())
+    {
+        PROFILE_CURRENT->counters[counter]++;
+    }
+}
+
+/**
+ * @param counters the counters of #frame and all below it, added to
+ */
+static JsonElement *ProfileFrameToJson(const ProfileFrame *frame, uint64_t total_ns,
+                                       uint64_t *counters)
+{
+    JsonElement *json = JsonObjectCreate(8);
+    JsonObjectAppendString(json, "name", frame->name);
+    JsonObjectAppendString(json, "type", PROFILE_FRAME_TYPES[frame->type]);
+    JsonObjectAppendInteger64(json, "value", total_ns / 1000);
+    JsonObjectAppendInteger64(json, "count", frame->count);
+    JsonObjectAppendReal(json, "total_time", total_ns / 1e9);
+
+    uint64_t frame_counters[PROFILE_COUNTER_MAX];
+    memcpy(frame_counters, frame->counters, sizeof(frame_counters));
+
+    uint64_t self_ns = total_ns;
+    const size_t n_children = (frame->children != NULL) ? SeqLength(frame->children) : 0;
+    if (n_children > 0)
+    {
+        JsonElement *children = JsonArrayCreate(n_children);
+        for (size_t i = 0; i < n_children; i++)
+        {
+            const ProfileFrame *child = SeqAt(frame->children, i);
+            JsonArrayAppendObject(children,
+                                  ProfileFrameToJson(child, child->total_ns, frame_counters));
+            self_ns -= MIN(self_ns, child->total_ns);
+        }
+        JsonObjectAppendArray(json, "children", children);
+    }
+    JsonObjectAppendReal(json, "self_time", self_ns / 1e9);
+
+    JsonElement *json_counters = JsonObjectCreate(PROFILE_COUNTER_MAX);
+    for (int c = 0; c < PROFILE_COUNTER_MAX; c++)
+    {
+        JsonObjectAppendInteger64(json_counters, PROFILE_COUNTER_NAMES[c], frame_counters[c]);
+        counters[c] += frame_counters[c];
+    }
+    JsonObjectAppendObject(json, "counters", json_counters);
+
+    return json;
+}
+
+JsonElement *ProfilingReport(void)
+{
+    if (!PROFILING)
+    {
+        return NULL;
+    }
+
+    /* Frames still entered count until now. */
+    const uint64_t now = NowNs();
+    for (ProfileFrame *frame = PROFILE_CURRENT; frame->parent != NULL; frame = frame->parent)
+    {
+        frame->total_ns += now - frame->start_ns;
+        frame->start_ns = now;
+    }
+
+    uint64_t counters[PROFILE_COUNTER_MAX] = { 0 };
+    return ProfileFrameToJson(PROFILE_ROOT, now - PROFILE_ROOT->start_ns, counters);
+}
+
+bool ProfilingWriteReport(const char *path)
+{
+    JsonElement *report = ProfilingReport();
+    if (report == NULL)
+    {
+        return false;
+    }
+
+    FILE *fp = safe_fopen(path, "w");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write the profile to '%s' (fopen: %s)",
+            path, GetErrorStr());
+        JsonDestroy(report);
+        return false;
+    }
+
+    Writer *w = FileWriter(fp);
+    JsonWrite(w, report, 0);
+    WriterWrite(w, "\n");
+    WriterClose(w);
+    JsonDestroy(report);
+
+    Log(LOG_LEVEL_VERBOSE, "Wrote the profile to '%s'", path);
+    return true;
+}
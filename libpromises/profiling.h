@@ -0,0 +1,86 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_PROFILING_H
+#define CFENGINE_PROFILING_H
+
+#include <cf3.defs.h>
+#include <json.h>
+
+/**
+ * An in-memory profile of the evaluation: how often each bundle, promise and
+ * function call was entered and how long it took, nested like they were
+ * called, and how many expansions, iterations, class expressions, database
+ * operations and regex cache lookups were done within each.
+ *
+ * Everything is a no-op costing a branch unless profiling was started. Only
+ * the thread that started profiling is profiled, calls from other threads
+ * are ignored. Start and stop profiling while no other threads run.
+ */
+
+typedef enum
+{
+    PROFILE_FRAME_BUNDLE,
+    PROFILE_FRAME_PROMISE,
+    PROFILE_FRAME_FUNCTION,
+} ProfileFrameType;
+
+typedef enum
+{
+    PROFILE_COUNTER_EXPANSIONS,
+    PROFILE_COUNTER_ITERATIONS,
+    PROFILE_COUNTER_CLASS_EVALUATIONS,
+    PROFILE_COUNTER_DB_OPERATIONS,
+    PROFILE_COUNTER_REGEX_CACHE_HITS,
+    PROFILE_COUNTER_REGEX_CACHE_MISSES,
+    PROFILE_COUNTER_MAX
+} ProfileCounter;
+
+extern bool PROFILING;
+
+void ProfilingStart(void);
+
+/**
+ * Stop profiling and forget the profile.
+ */
+void ProfilingStop(void);
+
+/**
+ * @param category bundle or promise type, NULL for functions
+ */
+void ProfileEnter(ProfileFrameType type, const char *category, const char *name);
+void ProfileLeave(void);
+void ProfileCount(ProfileCounter counter);
+
+/**
+ * The profile so far, as a tree of frames with "name", "value" (total time
+ * in microseconds) and "children", which flame graph tools like
+ * d3-flame-graph read as is.
+ *
+ * @return NULL if not profiling
+ */
+JsonElement *ProfilingReport(void);
+bool ProfilingWriteReport(const char *path);
+
+#endif
@@ -0,0 +1,295 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <regex_cache.h>
+
+#include <cf3.defs.h>                                    /* OVECCOUNT */
+#include <map.h>
+#include <mutex.h>
+#include <alloc.h>
+#include <logging.h>
+#include <profiling.h>
+
+struct CachedRegex_
+{
+    char *pattern;
+    pcre *rx;
+    pcre_extra *extra;
+    size_t refs;                        /* users, and one while cached */
+    CachedRegex *newer;
+    CachedRegex *older;
+};
+
+static pthread_mutex_t REGEX_CACHE_LOCK = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+static Map *REGEX_CACHE = NULL;         /* pattern -> CachedRegex */
+static CachedRegex *REGEX_CACHE_NEWEST = NULL;
+static CachedRegex *REGEX_CACHE_OLDEST = NULL;
+static size_t REGEX_CACHE_COUNT = 0;
+static size_t REGEX_CACHE_HITS = 0;
+static size_t REGEX_CACHE_MISSES = 0;
+
+static CachedRegex *CachedRegexNew(const char *pattern)
+{
+    pcre *rx = CompileRegex(pattern);
+    if (rx == NULL)
+    {
+        return NULL;
+    }
+
+    const char *errptr = NULL;
+#ifdef PCRE_STUDY_JIT_COMPILE
+    pcre_extra *extra = pcre_study(rx, PCRE_STUDY_JIT_COMPILE, &errptr);
+#else
+    pcre_extra *extra = pcre_study(rx, 0, &errptr);
+#endif
+    if (errptr != NULL)
+    {
+        Log(LOG_LEVEL_DEBUG, "Could not study regex '%s' (pcre_study: %s)",
+            pattern, errptr);
+    }
+
+    CachedRegex *regex = xcalloc(1, sizeof(CachedRegex));
+    regex->pattern = xstrdup(pattern);
+    regex->rx = rx;
+    regex->extra = extra;
+    regex->refs = 1;
+    return regex;
+}
+
+static void CachedRegexDestroy(CachedRegex *regex)
+{
+    if (regex->extra != NULL)
+    {
+#ifdef PCRE_STUDY_JIT_COMPILE
+        pcre_free_study(regex->extra);
+#else
+        pcre_free(regex->extra);
+#endif
+    }
+    pcre_free(regex->rx);
+    free(regex->pattern);
+    free(regex);
+}
+
+/* Call with REGEX_CACHE_LOCK held. */
+static void RegexCacheUnlink(CachedRegex *regex)
+{
+    if (regex->newer != NULL)
+    {
+        regex->newer->older = regex->older;
+    }
+    else
+    {
+        REGEX_CACHE_NEWEST = regex->older;
+    }
+
+    if (regex->older != NULL)
+    {
+        regex->older->newer = regex->newer;
+    }
+    else
+    {
+        REGEX_CACHE_OLDEST = regex->newer;
+    }
+
+    regex->newer = NULL;
+    regex->older = NULL;
+}
+
+/* Call with REGEX_CACHE_LOCK held. */
+static void RegexCacheLinkNewest(CachedRegex *regex)
+{
+    regex->older = REGEX_CACHE_NEWEST;
+    if (REGEX_CACHE_NEWEST != NULL)
+    {
+        REGEX_CACHE_NEWEST->newer = regex;
+    }
+    REGEX_CACHE_NEWEST = regex;
+    if (REGEX_CACHE_OLDEST == NULL)
+    {
+        REGEX_CACHE_OLDEST = regex;
+    }
+}
+
+/* Call with REGEX_CACHE_LOCK held. */
+static void RegexCacheEvict(CachedRegex *regex)
+{
+    RegexCacheUnlink(regex);
+    MapRemove(REGEX_CACHE, regex->pattern);
+    REGEX_CACHE_COUNT--;
+
+    if (--(regex->refs) == 0)
+    {
+        CachedRegexDestroy(regex);
+    }
+}
+
+CachedRegex *RegexCacheGet(const char *pattern)
+{
+    assert(pattern != NULL);
+
+    ThreadLock(&REGEX_CACHE_LOCK);
+    if (REGEX_CACHE == NULL)
+    {
+        REGEX_CACHE = MapNew(StringHash_untyped, StringEqual_untyped, NULL, NULL);
+    }
+
+    CachedRegex *regex = MapGet(REGEX_CACHE, pattern);
+    if (regex != NULL)
+    {
+        REGEX_CACHE_HITS++;
+        RegexCacheUnlink(regex);
+        RegexCacheLinkNewest(regex);
+        regex->refs++;
+        ThreadUnlock(&REGEX_CACHE_LOCK);
+
+        ProfileCount(PROFILE_COUNTER_REGEX_CACHE_HITS);
+        return regex;
+    }
+    REGEX_CACHE_MISSES++;
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+
+    ProfileCount(PROFILE_COUNTER_REGEX_CACHE_MISSES);
+
+    /* Compiled outside of the lock, invalid patterns are not remembered so
+     * that they keep being reported where they are used. */
+    CachedRegex *new_regex = CachedRegexNew(pattern);
+    if (new_regex == NULL)
+    {
+        return NULL;
+    }
+
+    ThreadLock(&REGEX_CACHE_LOCK);
+    regex = MapGet(REGEX_CACHE, pattern);
+    if (regex != NULL)
+    {
+        /* Another thread was faster. */
+        CachedRegexDestroy(new_regex);
+        RegexCacheUnlink(regex);
+        RegexCacheLinkNewest(regex);
+    }
+    else
+    {
+        regex = new_regex;
+        MapInsert(REGEX_CACHE, regex->pattern, regex);
+        RegexCacheLinkNewest(regex);
+        REGEX_CACHE_COUNT++;
+        while (REGEX_CACHE_COUNT > REGEX_CACHE_SIZE)
+        {
+            RegexCacheEvict(REGEX_CACHE_OLDEST);
+        }
+    }
+    regex->refs++;
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+
+    return regex;
+}
+
+void RegexCacheRelease(CachedRegex *regex)
+{
+    if (regex == NULL)
+    {
+        return;
+    }
+
+    ThreadLock(&REGEX_CACHE_LOCK);
+    assert(regex->refs > 0);
+    const bool last = (--(regex->refs) == 0);
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+
+    if (last)
+    {
+        CachedRegexDestroy(regex);
+    }
+}
+
+int CachedRegexExec(const CachedRegex *regex, const char *str,
+                    int *ovector, int ovecsize)
+{
+    assert(regex != NULL);
+    assert(str != NULL);
+
+    const int len = strlen(str);
+    int rc = pcre_exec(regex->rx, regex->extra, str, len, 0, 0, ovector, ovecsize);
+#ifdef PCRE_ERROR_JIT_STACKLIMIT
+    if (rc == PCRE_ERROR_JIT_STACKLIMIT)
+    {
+        /* The interpreter is not limited by the JIT stack. */
+        rc = pcre_exec(regex->rx, NULL, str, len, 0, 0, ovector, ovecsize);
+    }
+#endif
+    return rc;
+}
+
+bool CachedRegexMatch(const CachedRegex *regex, const char *str)
+{
+    int ovector[OVECCOUNT];
+    return (CachedRegexExec(regex, str, ovector, OVECCOUNT) >= 0);
+}
+
+bool CachedRegexMatchFull(const CachedRegex *regex, const char *str)
+{
+    int ovector[OVECCOUNT];
+    if (CachedRegexExec(regex, str, ovector, OVECCOUNT) >= 0)
+    {
+        return (ovector[0] == 0) && ((size_t) ovector[1] == strlen(str));
+    }
+    return false;
+}
+
+bool RegexCacheMatchFull(const char *pattern, const char *str)
+{
+    CachedRegex *regex = RegexCacheGet(pattern);
+    if (regex == NULL)
+    {
+        return false;
+    }
+
+    const bool matched = CachedRegexMatchFull(regex, str);
+    RegexCacheRelease(regex);
+    return matched;
+}
+
+void RegexCacheClear(void)
+{
+    ThreadLock(&REGEX_CACHE_LOCK);
+    while (REGEX_CACHE_OLDEST != NULL)
+    {
+        RegexCacheEvict(REGEX_CACHE_OLDEST);
+    }
+    REGEX_CACHE_HITS = 0;
+    REGEX_CACHE_MISSES = 0;
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+}
+
+void RegexCacheStats(size_t *hits, size_t *misses, size_t *size)
+{
+    ThreadLock(&REGEX_CACHE_LOCK);
+    *hits = REGEX_CACHE_HITS;
+    *misses = REGEX_CACHE_MISSES;
+    *size = REGEX_CACHE_COUNT;
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+}
@@ -0,0 +1,73 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_REGEX_CACHE_H
+#define CFENGINE_REGEX_CACHE_H
+
+#include <platform.h>
+#include <regex.h>                                      /* pcre */
+
+/**
+ * Regexes compiled once and shared by the whole process, for code matching
+ * the same patterns over and over, like classesmatching() or select_line_matching.
+ * Patterns are compiled like CompileRegex() does and studied, with JIT where
+ * PCRE has it. The least recently used ones are forgotten once there are
+ * more than REGEX_CACHE_SIZE of them. Lookups are counted as
+ * regex_cache_hits and regex_cache_misses when profiling.
+ *
+ * Thread-safe.
+ */
+
+#define REGEX_CACHE_SIZE 512
+
+typedef struct CachedRegex_ CachedRegex;
+
+/**
+ * @return NULL if #pattern doesn't compile, logged by CompileRegex()
+ * @note Release with RegexCacheRelease(), the regex stays usable until then
+ */
+CachedRegex *RegexCacheGet(const char *pattern);
+void RegexCacheRelease(CachedRegex *regex);
+
+/**
+ * pcre_exec() with the study data of #regex.
+ */
+int CachedRegexExec(const CachedRegex *regex, const char *str,
+                    int *ovector, int ovecsize);
+bool CachedRegexMatch(const CachedRegex *regex, const char *str);
+bool CachedRegexMatchFull(const CachedRegex *regex, const char *str);
+
+/**
+ * StringMatchFull() through the cache.
+ */
+bool RegexCacheMatchFull(const char *pattern, const char *str);
+
+/**
+ * Forget all the regexes not in use and reset the statistics.
+ */
+void RegexCacheClear(void);
+void RegexCacheStats(size_t *hits, size_t *misses, size_t *size);
+
+#endif
@@ -32,6 +32,7 @@
 #include <fncall.h>
 #include <string_lib.h>                                       /* StringHash */
 #include <regex.h>          /* StringMatchWithPrecompiledRegex,CompileRegex */
+#include <regex_cache.h>    /* RegexCacheGet,CachedRegexMatchFull,RegexCacheMatchFull */
 #include <misc_lib.h>
 #include <assoc.h>
 #include <eval_context.h>
@@ -241,7 +242,7 @@ bool RlistMatchesRegex(const Rlist *list, const char *regex)
         return false;
     }
 
-    pcre *rx = CompileRegex(regex);
+    CachedRegex *rx = RegexCacheGet(regex);
     if (!rx)
     {
         return false;
@@ -250,14 +251,14 @@ bool RlistMatchesRegex(const Rlist *list, const char *regex)
     for (const Rlist *rp = list; rp != NULL; rp = rp->next)
     {
         if (rp->val.type == RVAL_TYPE_SCALAR &&
-            StringMatchFullWithPrecompiledRegex(rx, RlistScalarValue(rp)))
+            CachedRegexMatchFull(rx, RlistScalarValue(rp)))
         {
-            pcre_free(rx);
+            RegexCacheRelease(rx);
             return true;
         }
     }
 
-    pcre_free(rx);
+    RegexCacheRelease(rx);
     return false;
 }
 
@@ -280,7 +281,7 @@ bool RlistIsInListOfRegex(const Rlist *list, const char *str)
     for (const Rlist *rp = list; rp != NULL; rp = rp->next)
     {
         if (rp->val.type == RVAL_TYPE_SCALAR &&
-            StringMatchFull(RlistScalarValue(rp), str))
+            RegexCacheMatchFull(RlistScalarValue(rp), str))
         {
             return true;
         }
@@ -35,7 +35,7 @@
 #include <scope.h>
 #include <fncall.h>
 #include <string_lib.h>                                  /* IsStrIn */
-#include <regex.h>                                       /* StringMatchFull */
+#include <regex_cache.h>                                 /* RegexCacheMatchFull */
 #include <misc_lib.h>
 #include <rlist.h>
 #include <vars.h>
@@ -556,7 +556,7 @@ static SyntaxTypeMatch CheckParseString(const char *lval, const char *s, const c
     }
 
     /* FIXME: review this strcmp. Moved out from StringMatch */
-    if (!strcmp(range, s) || StringMatchFull(range, s))
+    if (!strcmp(range, s) || RegexCacheMatchFull(range, s))
     {
         return SYNTAX_TYPE_MATCH_OK;
     }
@@ -591,7 +591,7 @@ SyntaxTypeMatch CheckParseContext(const char *context, const char *range)
     }
 
     /* FIXME: review this strcmp. Moved out from StringMatch */
-    if (!strcmp(range, context) || StringMatchFull(range, context))
+    if (!strcmp(range, context) || RegexCacheMatchFull(range, context))
     {
         return SYNTAX_TYPE_MATCH_OK;
     }
@@ -27,6 +27,7 @@
 #include <rlist.h>
 #include <writer.h>
 #include <conversion.h>                                 /* DataTypeToString */
+#include <name_index.h>
 
 #define VARIABLE_TAG_SECRET "secret"
 
@@ -152,12 +153,16 @@ TYPED_MAP_DEFINE(Var, VarRef *, Variable *,
 struct VariableTable_
 {
     VarMap *vars;
+    NameIndex *index;                     /* by qualified VarRefToString() and tags */
 };
 
 struct VariableTableIterator_
 {
+    const VariableTable *table;
     VarRef *ref;
     MapIterator iter;
+    Seq *candidates;                      /* NULL unless narrowed */
+    size_t next_candidate;
 };
 
 VariableTable *VariableTableNew(void)
@@ -165,6 +170,7 @@ VariableTable *VariableTableNew(void)
     VariableTable *table = xmalloc(sizeof(VariableTable));
 
     table->vars = VarMapNew();
+    table->index = NameIndexNew();
 
     return table;
 }
@@ -173,6 +179,7 @@ void VariableTableDestroy(VariableTable *table)
 {
     if (table)
     {
+        NameIndexDestroy(table->index);
         VarMapDestroy(table->vars);
         free(table);
     }
@@ -225,8 +232,19 @@ Variable *VariableTableGet(const VariableTable *table, const VarRef *ref)
     return v;
 }
 
+static void NameIndexPutVariable(NameIndex *index, Variable *var)
+{
+    char *expr = VarRefToString(var->ref, true);
+    NameIndexPut(index, expr, var, var->tags);
+    free(expr);
+}
+
 bool VariableTableRemove(VariableTable *table, const VarRef *ref)
 {
+    if (NameIndexStarted(table->index))
+    {
+        NameIndexRemove(table->index, VarMapGet(table->vars, ref));
+    }
     return VarMapRemove(table->vars, ref);
 }
 
@@ -254,7 +272,20 @@ bool VariableTablePut(VariableTable *table, const VarRef *ref,
 
     Variable *var = VariableNew(VarRefCopy(ref), RvalCopy(*rval), type,
                                 tags, comment, promise);
-    return VarMapInsert(table->vars, var->ref, var);
+
+    if (NameIndexStarted(table->index))
+    {
+        /* Replaced and freed by the insertion. */
+        NameIndexRemove(table->index, VarMapGet(table->vars, ref));
+    }
+
+    bool ret = VarMapInsert(table->vars, var->ref, var);
+
+    if (NameIndexStarted(table->index))
+    {
+        NameIndexPutVariable(table->index, var);
+    }
+    return ret;
 }
 
 bool VariableTableClear(VariableTable *table, const char *ns, const char *scope, const char *lval)
@@ -263,6 +294,7 @@ bool VariableTableClear(VariableTable *table, const char *ns, const char *scope,
 
     if (!ns && !scope && !lval)
     {
+        NameIndexClear(table->index);
         VarMapClear(table->vars);
         bool has_vars = (vars_num > 0);
         return has_vars;
@@ -328,8 +360,11 @@ VariableTableIterator *VariableTableIteratorNewFromVarRef(const VariableTable *t
 {
     VariableTableIterator *iter = xmalloc(sizeof(VariableTableIterator));
 
+    iter->table = table;
     iter->ref = VarRefCopy(ref);
     iter->iter = MapIteratorInit(table->vars->impl);
+    iter->candidates = NULL;
+    iter->next_candidate = 0;
 
     return iter;
 }
@@ -344,13 +379,51 @@ VariableTableIterator *VariableTableIteratorNew(const VariableTable *table, cons
     return VariableTableIteratorNewFromVarRef(table, &ref);
 }
 
+void VariableTableIteratorNarrow(VariableTableIterator *iter,
+                                 const char *regex, const Rlist *tag_regexes)
+{
+    assert(iter != NULL);
+    assert(regex != NULL);
+
+    const VariableTable *table = iter->table;
+    if (!NameIndexStarted(table->index))
+    {
+        NameIndexStart(table->index);
+
+        MapIterator it = MapIteratorInit(table->vars->impl);
+        MapKeyValue *item;
+        while ((item = MapIteratorNext(&it)) != NULL)
+        {
+            NameIndexPutVariable(table->index, item->value);
+        }
+    }
+
+    SeqDestroy(iter->candidates);
+    iter->candidates = NameIndexLookup(table->index, regex, tag_regexes);
+    iter->next_candidate = 0;
+}
+
+static Variable *VariableTableIteratorNextCandidate(VariableTableIterator *iter)
+{
+    if (iter->candidates != NULL)
+    {
+        if (iter->next_candidate < SeqLength(iter->candidates))
+        {
+            return SeqAt(iter->candidates, iter->next_candidate++);
+        }
+        return NULL;
+    }
+
+    MapKeyValue *keyvalue = MapIteratorNext(&iter->iter);
+    return (keyvalue != NULL) ? keyvalue->value : NULL;
+}
+
 Variable *VariableTableIteratorNext(VariableTableIterator *iter)
 {
-    MapKeyValue *keyvalue;
+    Variable *var;
 
-    while ((keyvalue = MapIteratorNext(&iter->iter)) != NULL)
+    while ((var = VariableTableIteratorNextCandidate(iter)) != NULL)
     {
-        Variable *var = keyvalue->value;
         const char *key_ns = var->ref->ns ? var->ref->ns : "default";
 
         if (iter->ref->ns && strcmp(key_ns, iter->ref->ns) != 0)
@@ -401,6 +474,7 @@ void VariableTableIteratorDestroy(VariableTableIterator *iter)
 {
     if (iter)
     {
+        SeqDestroy(iter->candidates);
         VarRefDestroy(iter->ref);
         free(iter);
     }
@@ -75,6 +75,14 @@ bool VariableTableClear(VariableTable *table, const char *ns, const char *scope,
 
 VariableTableIterator *VariableTableIteratorNew(const VariableTable *table, const char *ns, const char *scope, const char *lval);
 VariableTableIterator *VariableTableIteratorNewFromVarRef(const VariableTable *table, const VarRef *ref);
+/**
+ * Restricts #iter to the variables whose qualified name #regex could match
+ * and, unless #tag_regexes is NULL, that are untagged or have a tag one of
+ * them could match, looked up in an index of the table. They are still to
+ * be matched.
+ */
+void VariableTableIteratorNarrow(VariableTableIterator *iter,
+                                 const char *regex, const Rlist *tag_regexes);
 Variable *VariableTableIteratorNext(VariableTableIterator *iter);
 void VariableTableIteratorDestroy(VariableTableIterator *iter);
 
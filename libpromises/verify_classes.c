@@ -34,7 +34,7 @@
 #include <conversion.h>
 #include <logic_expressions.h>
 #include <string_lib.h>                                  /* StringHash */
-#include <regex.h>                                       /* StringMatchFull */
+#include <regex_cache.h>                                 /* RegexCacheMatchFull */
 
 
 static bool EvalClassExpression(EvalContext *ctx, Constraint *cp, const Promise *pp);
@@ -61,7 +61,7 @@ PromiseResult VerifyClassPromise(EvalContext *ctx, const Promise *pp, ARG_UNUSED
 
     Attributes a = GetClassContextAttributes(ctx, pp);
 
-    if (!StringMatchFull("[a-zA-Z0-9_]+", pp->promiser))
+    if (!RegexCacheMatchFull("[a-zA-Z0-9_]+", pp->promiser))
     {
         Log(LOG_LEVEL_VERBOSE, "Class identifier '%s' contains illegal characters - canonifying", pp->promiser);
         CanonifyNameInPlace(pp->promiser);
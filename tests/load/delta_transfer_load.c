@@ -0,0 +1,259 @@
+#include <transfer_load_harness.h>
+#include <client_code.h>                    /* CopyRegularFileNetDelta */
+#include <misc_lib.h>                                 /* xclock_gettime */
+#include <files_lib.h>                                /* FullWrite */
+
+#include <libgen.h>                                   /* basename */
+
+
+/* Compares updating an outdated copy of a file with a full GET and with
+ * CF_PROTOCOL_DELTA. Both ends run in this process; their socketpairs are
+ * joined by a relay that counts the bytes that went over the "wire" in
+ * each direction. */
+
+
+char CFWORKDIR[CF_BUFSIZE];
+
+typedef struct
+{
+    int from;
+    int to;
+    uint64_t bytes;
+} RelayArgs;
+
+
+static void print_usage(const char *argv0)
+{
+    printf("\
+\n\
+Usage:\n\
+	%s [-s SIZE_MB] [-r ROUNDS]\n\
+\n\
+Updates a SIZE_MB file (default 64) with a few changes ROUNDS times\n\
+(default 3) with a full GET and with a delta transfer, and prints the bytes\n\
+sent each way and the time taken.\n\
+\n",
+           argv0);
+}
+
+/* Same as #source, with bytes overwritten in two places and inserted in a
+ * third one. */
+static bool CreateBasisFile(const char *source, const char *basis, off_t size)
+{
+    FILE *in = fopen(source, "r");
+    FILE *out = fopen(basis, "w");
+    if (in == NULL || out == NULL)
+    {
+        perror("fopen");
+        return false;
+    }
+
+    const off_t insert_at = size / 3;
+    char buf[65536];
+    off_t copied = 0;
+    size_t n;
+    while ((n = fread(buf, 1, MIN(sizeof(buf), (size_t) (insert_at - copied)), in)) > 0)
+    {
+        fwrite(buf, 1, n, out);
+        copied += n;
+    }
+    fputs("a few bytes only the outdated copy has", out);
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        fwrite(buf, 1, n, out);
+    }
+    fclose(in);
+
+    const off_t overwrite_at[] = { size / 10, size / 10 * 7 };
+    for (size_t i = 0; i < sizeof(overwrite_at) / sizeof(overwrite_at[0]); i++)
+    {
+        fseeko(out, overwrite_at[i], SEEK_SET);
+        fputs("changed", out);
+    }
+
+    return (fclose(out) == 0);
+}
+
+static void *RelayThread(void *arg)
+{
+    RelayArgs *args = arg;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(args->from, buf, sizeof(buf))) > 0)
+    {
+        if (FullWrite(args->to, buf, n) < 0)
+        {
+            break;
+        }
+        args->bytes += n;
+    }
+    shutdown(args->to, SHUT_WR);
+    return NULL;
+}
+
+static bool UpdateOnce(ProtocolVersion version, const char *source,
+                       const char *basis, const char *dest, off_t size,
+                       double *wall, uint64_t *sent, uint64_t *received)
+{
+    int client_sv[2], server_sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, client_sv) == -1 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, server_sv) == -1)
+    {
+        perror("socketpair");
+        return false;
+    }
+
+    SSL *server_ssl = SSL_new(SERVER_CTX);
+    SSL *client_ssl = SSL_new(CLIENT_CTX);
+    SSL_set_fd(server_ssl, server_sv[0]);
+    SSL_set_fd(client_ssl, client_sv[0]);
+
+    RelayArgs upstream = { .from = client_sv[1], .to = server_sv[1] };
+    RelayArgs downstream = { .from = server_sv[1], .to = client_sv[1] };
+    ServerThreadArgs args = { .ssl = server_ssl, .version = version };
+    pthread_t up_tid, down_tid, server_tid;
+    if (pthread_create(&up_tid, NULL, RelayThread, &upstream) != 0 ||
+        pthread_create(&down_tid, NULL, RelayThread, &downstream) != 0 ||
+        pthread_create(&server_tid, NULL, ServerThread, &args) != 0)
+    {
+        perror("pthread_create");
+        return false;
+    }
+
+    bool ok = (SSL_connect(client_ssl) == 1);
+
+    AgentConnection *conn = NewClientConn(client_sv[0], client_ssl, version);
+
+    /* Don't count the TLS handshake. */
+    const uint64_t sent_before = upstream.bytes;
+    const uint64_t received_before = downstream.bytes;
+
+    struct timespec start, stop;
+    xclock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (ProtocolSupportsDelta(version))
+    {
+        ok = ok && CopyRegularFileNetDelta(source, basis, dest, size, conn);
+    }
+    else
+    {
+        ok = ok && CopyRegularFileNet(source, dest, size, false, conn);
+    }
+
+    xclock_gettime(CLOCK_MONOTONIC, &stop);
+    *wall = Seconds(&stop) - Seconds(&start);
+
+    pthread_join(server_tid, NULL);
+
+    /* Closing both ends lets the relays run dry. */
+    shutdown(client_sv[0], SHUT_RDWR);
+    shutdown(server_sv[0], SHUT_RDWR);
+    pthread_join(up_tid, NULL);
+    pthread_join(down_tid, NULL);
+    *sent = upstream.bytes - sent_before;
+    *received = downstream.bytes - received_before;
+
+    ok = ok && args.ok && FilesEqual(source, dest);
+
+    DestroyClientConn(conn);
+    SSL_free(server_ssl);
+    SSL_free(client_ssl);
+    close(client_sv[0]);
+    close(client_sv[1]);
+    close(server_sv[0]);
+    close(server_sv[1]);
+    unlink(dest);
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    long size_mb = 64;
+    int rounds = 3;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:r:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            size_mb = atol(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            print_usage(basename(argv[0]));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (size_mb <= 0 || rounds <= 0)
+    {
+        print_usage(basename(argv[0]));
+        exit(EXIT_FAILURE);
+    }
+
+    char tmpdir[] = "/tmp/delta_transfer_load.XXXXXX";
+    if (mkdtemp(tmpdir) == NULL)
+    {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    strlcpy(CFWORKDIR, tmpdir, sizeof(CFWORKDIR));
+    signal(SIGPIPE, SIG_IGN);
+
+    char source[PATH_MAX], basis[PATH_MAX], dest[PATH_MAX];
+    xsnprintf(source, sizeof(source), "%s/source", tmpdir);
+    xsnprintf(basis, sizeof(basis), "%s/basis", tmpdir);
+    xsnprintf(dest, sizeof(dest), "%s/dest", tmpdir);
+
+    const off_t size = (off_t) size_mb * 1024 * 1024;
+    if (!SetupTLS() || !CreateSourceFile(source, size) ||
+        !CreateBasisFile(source, basis, size))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    const ProtocolVersion versions[] = { CF_PROTOCOL_LARGEBLOCKS,
+                                         CF_PROTOCOL_DELTA };
+    int ret = EXIT_SUCCESS;
+
+    printf("Updating a %ld MB file, %d rounds per protocol version\n",
+           size_mb, rounds);
+    printf("%-12s %14s %14s %10s\n", "", "bytes sent", "bytes received",
+           "wall");
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++)
+    {
+        double best_wall = 0;
+        uint64_t sent = 0, received = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            double wall;
+            if (!UpdateOnce(versions[v], source, basis, dest, size,
+                            &wall, &sent, &received))
+            {
+                fprintf(stderr, "Update with protocol %s failed!\n",
+                        ProtocolVersionString(versions[v]));
+                ret = EXIT_FAILURE;
+                break;
+            }
+            if (r == 0 || wall < best_wall)
+            {
+                best_wall = wall;
+            }
+        }
+
+        if (best_wall > 0)
+        {
+            printf("%-12s %14ju %14ju %8.3f s\n",
+                   ProtocolVersionString(versions[v]),
+                   (uintmax_t) sent, (uintmax_t) received, best_wall);
+        }
+    }
+
+    unlink(source);
+    unlink(basis);
+    rmdir(tmpdir);
+    return ret;
+}
@@ -0,0 +1,172 @@
+#include <transfer_load_harness.h>
+#include <client_code.h>                              /* CopyRegularFileNet */
+#include <misc_lib.h>                                 /* xclock_gettime */
+
+#include <sys/resource.h>                             /* getrusage */
+#include <libgen.h>                                   /* basename */
+
+
+/* Compares throughput of GET over TLS with the classic 2048 byte blocks
+ * (protocol "cookie") and with CF_PROTOCOL_LARGEBLOCKS. Both ends run in
+ * this process, connected through a socketpair, so what is measured is the
+ * CPU cost of CfGetFile() and CopyRegularFileNet(), not the network. */
+
+
+char CFWORKDIR[CF_BUFSIZE];
+
+
+static void print_usage(const char *argv0)
+{
+    printf("\
+\n\
+Usage:\n\
+	%s [-s SIZE_MB] [-r ROUNDS]\n\
+\n\
+Transfers a SIZE_MB file (default 256) ROUNDS times (default 3) with every\n\
+protocol version and prints the throughput.\n\
+\n",
+           argv0);
+}
+
+static double CPUSeconds(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static bool TransferOnce(ProtocolVersion version, const char *source,
+                         const char *dest, off_t size,
+                         double *wall, double *cpu)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+    {
+        perror("socketpair");
+        return false;
+    }
+
+    SSL *server_ssl = SSL_new(SERVER_CTX);
+    SSL *client_ssl = SSL_new(CLIENT_CTX);
+    SSL_set_fd(server_ssl, sv[0]);
+    SSL_set_fd(client_ssl, sv[1]);
+
+    ServerThreadArgs args = { .ssl = server_ssl, .version = version };
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, ServerThread, &args) != 0)
+    {
+        perror("pthread_create");
+        return false;
+    }
+
+    bool ok = (SSL_connect(client_ssl) == 1);
+
+    AgentConnection *conn = NewClientConn(sv[1], client_ssl, version);
+
+    struct timespec start, stop;
+    xclock_gettime(CLOCK_MONOTONIC, &start);
+    double cpu_start = CPUSeconds();
+
+    ok = ok && CopyRegularFileNet(source, dest, size, false, conn);
+
+    xclock_gettime(CLOCK_MONOTONIC, &stop);
+    *wall = Seconds(&stop) - Seconds(&start);
+    *cpu = CPUSeconds() - cpu_start;
+
+    pthread_join(tid, NULL);
+    ok = ok && args.ok && FilesEqual(source, dest);
+
+    DestroyClientConn(conn);
+    SSL_free(server_ssl);
+    SSL_free(client_ssl);
+    close(sv[0]);
+    close(sv[1]);
+    unlink(dest);
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    long size_mb = 256;
+    int rounds = 3;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:r:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            size_mb = atol(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            print_usage(basename(argv[0]));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (size_mb <= 0 || rounds <= 0)
+    {
+        print_usage(basename(argv[0]));
+        exit(EXIT_FAILURE);
+    }
+
+    char tmpdir[] = "/tmp/file_transfer_load.XXXXXX";
+    if (mkdtemp(tmpdir) == NULL)
+    {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    strlcpy(CFWORKDIR, tmpdir, sizeof(CFWORKDIR));
+
+    char source[PATH_MAX], dest[PATH_MAX];
+    xsnprintf(source, sizeof(source), "%s/source", tmpdir);
+    xsnprintf(dest, sizeof(dest), "%s/dest", tmpdir);
+
+    const off_t size = (off_t) size_mb * 1024 * 1024;
+    if (!SetupTLS() || !CreateSourceFile(source, size))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    const ProtocolVersion versions[] = { CF_PROTOCOL_COOKIE,
+                                         CF_PROTOCOL_LARGEBLOCKS };
+    int ret = EXIT_SUCCESS;
+
+    printf("Transferring %ld MB, %d rounds per protocol version\n",
+           size_mb, rounds);
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++)
+    {
+        double best_wall = 0, best_cpu = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            double wall, cpu;
+            if (!TransferOnce(versions[v], source, dest, size, &wall, &cpu))
+            {
+                fprintf(stderr, "Transfer with protocol %s failed!\n",
+                        ProtocolVersionString(versions[v]));
+                ret = EXIT_FAILURE;
+                break;
+            }
+            if (r == 0 || wall < best_wall)
+            {
+                best_wall = wall;
+                best_cpu = cpu;
+            }
+        }
+
+        if (best_wall > 0)
+        {
+            printf("%-12s %8.1f MB/s %8.3f s wall %8.3f s CPU\n",
+                   ProtocolVersionString(versions[v]),
+                   size_mb / best_wall, best_wall, best_cpu);
+        }
+    }
+
+    unlink(source);
+    rmdir(tmpdir);
+    return ret;
+}
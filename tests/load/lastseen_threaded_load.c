@@ -10,6 +10,7 @@
 
 
 unsigned int ROUND_DURATION = 10;          /* how long to run each loop */
+unsigned int GROUP_COMMIT_MS = 0;          /* 0: commit every update */
 #define NHOSTS 5000                        /* how many hosts to store in db */
 #define MAX_NUM_THREADS 10000
 #define MAX_NUM_FORKS   10000
@@ -391,6 +392,8 @@ Options:\n\
 	-c N:	After finishing all rounds with threads, N spawned child\n\
 		processes shall apply a mixed workload to the database each one\n\
 		for another round (default is 0, i.e. don't fork children)\n\
+	-g N:	Commit the updates of the threads together, at most N\n\
+		milliseconds apart (default is 0, i.e. commit each update)\n\
 \n",
                argv0);
 }
@@ -439,6 +442,21 @@ void parse_args(int argc, char *argv[],
             *num_forked_children = N;
             break;
         }
+        case 'g':
+        {
+            i++;
+            int N = -1;
+            int ret = sscanf((argv[i] != NULL) ? argv[i] : "",
+                             "%d", &N);
+            if (ret != 1 || N < 0)
+            {
+                print_usage(basename(argv[0]));
+                exit(EXIT_FAILURE);
+            }
+
+            GROUP_COMMIT_MS = N;
+            break;
+        }
         default:
             print_usage(basename(argv[0]));
             exit(EXIT_FAILURE);
@@ -567,6 +585,18 @@ int main(int argc, char *argv[])
     }
 
 
+    /* Only now, the flusher thread would not survive the fork(). */
+    if (GROUP_COMMIT_MS > 0)
+    {
+        if (!DBSetGroupCommit(dbid_lastseen, NHOSTS, GROUP_COMMIT_MS))
+        {
+            fprintf(stderr, "Could not enable group commit!\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Committing lastseen updates at most %ums apart\n",
+               GROUP_COMMIT_MS);
+    }
+
     printf("Showing number of operations per second:\n\n");
 
     /* === CREATE lastsaw() WORKER THREADS === */
@@ -677,6 +707,12 @@ int main(int argc, char *argv[])
     }
     ThreadUnlock(&end_mtx);
 
+    /* Commits what is left. */
+    if (GROUP_COMMIT_MS > 0)
+    {
+        DBSetGroupCommit(dbid_lastseen, 0, 0);
+    }
+
     /* === CLEAN UP TODO register these with atexit() === */
 
     int retval = EXIT_SUCCESS;
@@ -0,0 +1,264 @@
+#include <cf3.defs.h>
+#include <policy.h>
+#include <loading.h>                                          /* LoadPolicy */
+#include <generic_agent.h>
+#include <eval_context.h>
+#include <known_dirs.h>                                       /* GetStateDir */
+#include <misc_lib.h>                                 /* xclock_gettime */
+#include <string_lib.h>                                      /* StringFormat */
+#include <file_lib.h>                                         /* FullWrite */
+#include <writer.h>
+
+#include <libgen.h>                                           /* basename */
+
+
+/* Loads a synthetic policy of many input files, parsing them one by one and
+ * in parallel jobs, and from the policy cache. Then times merging as many
+ * partial policies one by one and in bulk, at a few sizes, to show that
+ * merging is linear in the total size. */
+
+
+char CFWORKDIR[CF_BUFSIZE];
+
+
+static void print_usage(const char *argv0)
+{
+    printf("\
+\n\
+Usage:\n\
+	%s [-n FILES] [-j JOBS]\n\
+\n\
+Writes a policy with FILES input files (default 1000), each with one bundle\n\
+and one body, and prints the time LoadPolicy() takes to load it without\n\
+the policy cache, parsing in JOBS parallel jobs (default 4) and from the\n\
+cache. Then prints the time merging FILES partial policies takes.\n\
+\n",
+           argv0);
+}
+
+static double Seconds(const struct timespec *ts)
+{
+    return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+static double SecondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    xclock_gettime(CLOCK_MONOTONIC, &now);
+    return Seconds(&now) - Seconds(start);
+}
+
+static bool WriteFile(const char *path, const char *contents)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+    {
+        perror(path);
+        return false;
+    }
+    bool ok = (FullWrite(fd, contents, strlen(contents)) >= 0);
+    close(fd);
+    return ok;
+}
+
+static bool WritePolicy(const char *dir, int n_files)
+{
+    Writer *main_cf = StringWriter();
+    WriterWrite(main_cf,
+                "body common control\n"
+                "{\n"
+                "  bundlesequence => { \"main\" };\n"
+                "  inputs => {\n");
+
+    for (int i = 0; i < n_files; i++)
+    {
+        char *path = StringFormat("%s/input%d.cf", dir, i);
+        char *contents = StringFormat(
+            "bundle agent b%d\n"
+            "{\n"
+            "  vars:\n"
+            "      \"v\" string => \"value %d\";\n"
+            "  classes:\n"
+            "      \"c%d\" expression => \"any\";\n"
+            "  files:\n"
+            "    c%d::\n"
+            "      \"/tmp/nonexistent%d\" perms => p%d;\n"
+            "}\n"
+            "body perms p%d\n"
+            "{\n"
+            "  mode => \"0600\";\n"
+            "}\n",
+            i, i, i, i, i, i, i);
+        bool ok = WriteFile(path, contents);
+        free(contents);
+        free(path);
+        if (!ok)
+        {
+            WriterClose(main_cf);
+            return false;
+        }
+
+        WriterWriteF(main_cf, "    \"input%d.cf\",\n", i);
+    }
+
+    WriterWrite(main_cf,
+                "  };\n"
+                "}\n"
+                "bundle agent main\n"
+                "{\n"
+                "}\n");
+
+    char *path = StringFormat("%s/promises.cf", dir);
+    bool ok = WriteFile(path, StringWriterData(main_cf));
+    free(path);
+    WriterClose(main_cf);
+    return ok;
+}
+
+static void ClearPolicyCache(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, sizeof(cmd), "rm -rf '%s/policy_cache'", GetStateDir());
+    system(cmd);
+}
+
+static double TimeLoadPolicy(const char *dir, unsigned int parse_jobs)
+{
+    GenericAgentConfig *config = GenericAgentConfigNewDefault(AGENT_TYPE_AGENT, false);
+    GenericAgentConfigSetInputFile(config, dir, "promises.cf");
+    config->parse_jobs = parse_jobs;
+    EvalContext *ctx = EvalContextNew();
+
+    struct timespec start;
+    xclock_gettime(CLOCK_MONOTONIC, &start);
+    Policy *policy = LoadPolicy(ctx, config);
+    double wall = SecondsSince(&start);
+
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+    GenericAgentConfigDestroy(config);
+    return wall;
+}
+
+static Seq *NewPartialPolicies(int n)
+{
+    Seq *policies = SeqNew(n, NULL);
+    for (int i = 0; i < n; i++)
+    {
+        char name[32];
+        xsnprintf(name, sizeof(name), "b%d", i);
+
+        Policy *policy = PolicyNew();
+        PolicyAppendBundle(policy, "default", name, "agent", NULL, NULL);
+        PolicyAppendBody(policy, "default", name, "perms", NULL, NULL, false);
+        SeqAppend(policies, policy);
+    }
+    return policies;
+}
+
+static double TimeMergeOneByOne(int n)
+{
+    Seq *policies = NewPartialPolicies(n);
+
+    struct timespec start;
+    xclock_gettime(CLOCK_MONOTONIC, &start);
+    Policy *policy = PolicyNew();
+    for (int i = 0; i < n; i++)
+    {
+        policy = PolicyMerge(policy, SeqAt(policies, i));
+    }
+    double wall = SecondsSince(&start);
+
+    PolicyDestroy(policy);
+    SeqDestroy(policies);
+    return wall;
+}
+
+static double TimeMergeAll(int n)
+{
+    Seq *policies = NewPartialPolicies(n);
+
+    struct timespec start;
+    xclock_gettime(CLOCK_MONOTONIC, &start);
+    Policy *policy = PolicyMergeAll(policies);
+    double wall = SecondsSince(&start);
+
+    PolicyDestroy(policy);
+    SeqDestroy(policies);
+    return wall;
+}
+
+int main(int argc, char *argv[])
+{
+    int n_files = 1000;
+    int parse_jobs = 4;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:j:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            n_files = atoi(optarg);
+            break;
+        case 'j':
+            parse_jobs = atoi(optarg);
+            break;
+        default:
+            print_usage(basename(argv[0]));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (n_files <= 0 || parse_jobs <= 0)
+    {
+        print_usage(basename(argv[0]));
+        exit(EXIT_FAILURE);
+    }
+
+    char tmpdir[] = "/tmp/policy_merge_load.XXXXXX";
+    if (mkdtemp(tmpdir) == NULL)
+    {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    strlcpy(CFWORKDIR, tmpdir, sizeof(CFWORKDIR));
+
+    char *envvar = StringFormat("CFENGINE_TEST_OVERRIDE_WORKDIR=%s", tmpdir);
+    putenv(envvar);
+    mkdir(GetStateDir(), 0700);
+
+    char *inputs = StringFormat("%s/inputs", tmpdir);
+    mkdir(inputs, 0700);
+    if (!WritePolicy(inputs, n_files))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Loading a policy of %d input files\n", n_files);
+    printf("%-24s %10s\n", "", "wall");
+
+    ClearPolicyCache();
+    printf("%-24s %8.3f s\n", "parsing", TimeLoadPolicy(inputs, 1));
+
+    ClearPolicyCache();
+    char label[64];
+    xsnprintf(label, sizeof(label), "parsing, %d jobs", parse_jobs);
+    printf("%-24s %8.3f s\n", label, TimeLoadPolicy(inputs, parse_jobs));
+
+    printf("%-24s %8.3f s\n", "policy cache", TimeLoadPolicy(inputs, 1));
+
+    printf("\nMerging partial policies\n");
+    printf("%-10s %14s %14s\n", "policies", "one by one", "all at once");
+    for (int n = n_files; n <= n_files * 100; n *= 10)
+    {
+        printf("%-10d %12.4f s %12.4f s\n",
+               n, TimeMergeOneByOne(n), TimeMergeAll(n));
+    }
+
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, sizeof(cmd), "rm -rf '%s'", tmpdir);
+    system(cmd);
+    free(inputs);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,5 @@
+#!/bin/sh
+
+echo "Starting run_delta_transfer_load.sh test"
+
+./delta_transfer_load -s 16 -r 2
@@ -0,0 +1,5 @@
+#!/bin/sh
+
+echo "Starting run_file_transfer_load.sh test"
+
+./file_transfer_load -s 32 -r 2
@@ -8,4 +8,5 @@ fi
 
 echo "Starting run_lastseen_threaded_load.sh test"
 
-./lastseen_threaded_load -c 1   4 1 1
+./lastseen_threaded_load -c 1   4 1 1 || exit 1
+./lastseen_threaded_load -g 100 4 1 1
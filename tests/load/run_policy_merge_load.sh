@@ -0,0 +1,5 @@
+#!/bin/sh
+
+echo "Starting run_policy_merge_load.sh test"
+
+./policy_merge_load -n 1000 -j 4
@@ -0,0 +1,205 @@
+#include <transfer_load_harness.h>
+
+#include <communication.h>                            /* NewAgentConn */
+#include <net.h>                                      /* ReceiveTransaction */
+#include <tls_generic.h>                              /* TLSGenerateCertFromPrivKey */
+#include <file_delta.h>                               /* DeltaTLSRead */
+#include <server.h>                                   /* ServerConnectionState */
+#include <server_common.h>                            /* CfGetFile,CfDeltaFile */
+
+#include <openssl/rsa.h>
+#include <openssl/bn.h>
+
+
+SSL_CTX *SERVER_CTX;
+SSL_CTX *CLIENT_CTX;
+
+
+bool SetupTLS(void)
+{
+    SSL_library_init();
+    SSL_load_error_strings();
+
+    RSA *rsa = RSA_new();
+    BIGNUM *bn = BN_new();
+    BN_set_word(bn, RSA_F4);
+    if (RSA_generate_key_ex(rsa, 2048, bn, NULL) != 1)
+    {
+        fprintf(stderr, "RSA_generate_key_ex failed\n");
+        return false;
+    }
+    BN_free(bn);
+
+    X509 *cert = TLSGenerateCertFromPrivKey(rsa);
+    if (cert == NULL)
+    {
+        fprintf(stderr, "Failed to generate certificate\n");
+        return false;
+    }
+
+    SERVER_CTX = SSL_CTX_new(SSLv23_server_method());
+    CLIENT_CTX = SSL_CTX_new(SSLv23_client_method());
+    TLSSetDefaultOptions(SERVER_CTX, NULL);
+    TLSSetDefaultOptions(CLIENT_CTX, NULL);
+
+    if (SSL_CTX_use_certificate(SERVER_CTX, cert) != 1 ||
+        SSL_CTX_use_RSAPrivateKey(SERVER_CTX, rsa) != 1)
+    {
+        fprintf(stderr, "Failed to load server certificate\n");
+        return false;
+    }
+    SSL_CTX_set_verify(CLIENT_CTX, SSL_VERIFY_NONE, NULL);
+
+    X509_free(cert);
+    RSA_free(rsa);
+    return true;
+}
+
+void *ServerThread(void *arg)
+{
+    ServerThreadArgs *args = arg;
+
+    if (SSL_accept(args->ssl) != 1)
+    {
+        fprintf(stderr, "SSL_accept failed\n");
+        return NULL;
+    }
+
+    ConnectionInfo *info = ConnectionInfoNew();
+    ConnectionInfoSetSocket(info, SSL_get_fd(args->ssl));
+    ConnectionInfoSetSSL(info, args->ssl);
+    ConnectionInfoSetProtocolVersion(info, args->version);
+
+    ServerConnectionState conn = {
+        .conn_info = info,
+        .uid = 0,                                  /* skip TransferRights() */
+    };
+
+    char recvbuffer[CF_BUFSIZE + CF_BUFEXT] = "";
+    char sendbuffer[CF_BUFSIZE] = "";
+    char filename[CF_BUFSIZE] = "";
+    ServerFileGetState get_args = { 0 };
+    long block_size, num_blocks;
+    intmax_t basis_size;
+
+    if (ReceiveTransaction(info, recvbuffer, NULL) == -1)
+    {
+        /* args->ok stays false */
+    }
+    else if (sscanf(recvbuffer, "GET %d %[^\n]", &get_args.buf_size, filename) == 2)
+    {
+        get_args.conn = &conn;
+        get_args.replybuff = sendbuffer;
+        get_args.replyfile = filename;
+        CfGetFile(&get_args);
+        args->ok = true;
+    }
+    else if (sscanf(recvbuffer, "DELTA %ld %ld %jd %[^\n]",
+                    &block_size, &num_blocks, &basis_size, filename) == 4)
+    {
+        const size_t signatures_size = num_blocks * DELTA_SIGNATURE_SIZE;
+        unsigned char *signatures = xmalloc(signatures_size + 1);
+        if (signatures_size == 0 ||
+            DeltaTLSRead(args->ssl, signatures, signatures_size))
+        {
+            CfDeltaFile(&conn, filename, signatures, num_blocks,
+                        block_size, basis_size);
+            args->ok = true;
+        }
+        free(signatures);
+    }
+
+    /* SSL and socket are freed by the main thread. */
+    ConnectionInfoSetSSL(info, NULL);
+    ConnectionInfoSetSocket(info, -1);
+    ConnectionInfoDestroy(&info);
+    return NULL;
+}
+
+AgentConnection *NewClientConn(int sd, SSL *ssl, ProtocolVersion version)
+{
+    ConnectionFlags flags = { .protocol_version = version };
+    AgentConnection *conn = NewAgentConn("localhost", CFENGINE_PORT_STR, flags);
+    ConnectionInfoSetSocket(conn->conn_info, sd);
+    ConnectionInfoSetSSL(conn->conn_info, ssl);
+    ConnectionInfoSetProtocolVersion(conn->conn_info, version);
+    return conn;
+}
+
+void DestroyClientConn(AgentConnection *conn)
+{
+    ConnectionInfoSetSSL(conn->conn_info, NULL);
+    ConnectionInfoSetSocket(conn->conn_info, -1);
+    DeleteAgentConn(conn);
+}
+
+bool CreateSourceFile(const char *path, size_t size)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return false;
+    }
+
+    /* Pseudo-random, so that nothing along the way can shortcut it. */
+    uint32_t x = 2463534242U;
+    char block[65536];
+    size_t written = 0;
+    while (written < size)
+    {
+        for (size_t i = 0; i < sizeof(block); i += sizeof(x))
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            memcpy(block + i, &x, sizeof(x));
+        }
+        size_t n = MIN(sizeof(block), size - written);
+        if (fwrite(block, 1, n, f) != n)
+        {
+            perror("fwrite");
+            fclose(f);
+            return false;
+        }
+        written += n;
+    }
+
+    fclose(f);
+    chmod(path, 0644);
+    return true;
+}
+
+bool FilesEqual(const char *path1, const char *path2)
+{
+    FILE *f1 = fopen(path1, "r");
+    FILE *f2 = fopen(path2, "r");
+    bool equal = (f1 != NULL && f2 != NULL);
+
+    char buf1[65536], buf2[65536];
+    while (equal)
+    {
+        size_t n1 = fread(buf1, 1, sizeof(buf1), f1);
+        size_t n2 = fread(buf2, 1, sizeof(buf2), f2);
+        equal = (n1 == n2 && memcmp(buf1, buf2, n1) == 0);
+        if (n1 == 0)
+        {
+            break;
+        }
+    }
+
+    if (f1 != NULL)
+    {
+        fclose(f1);
+    }
+    if (f2 != NULL)
+    {
+        fclose(f2);
+    }
+    return equal;
+}
+
+double Seconds(const struct timespec *ts)
+{
+    return ts->tv_sec + ts->tv_nsec / 1e9;
+}
@@ -0,0 +1,41 @@
+#ifndef CFENGINE_TRANSFER_LOAD_HARNESS_H
+#define CFENGINE_TRANSFER_LOAD_HARNESS_H
+
+#include <cf3.defs.h>
+#include <cfnet.h>                                    /* AgentConnection */
+
+#include <openssl/ssl.h>
+
+
+/* What the file transfer load tests share: a TLS server and client talking
+ * over socketpairs within the same process, the server serving a single
+ * GET or DELTA request the way cf-serverd does. */
+
+
+extern SSL_CTX *SERVER_CTX;
+extern SSL_CTX *CLIENT_CTX;
+
+typedef struct
+{
+    SSL *ssl;
+    ProtocolVersion version;
+    bool ok;                                /* set if the request was served */
+} ServerThreadArgs;
+
+/* Generates a throw-away key and certificate for SERVER_CTX. */
+bool SetupTLS(void);
+
+/* The relevant part of BusyWithNewProtocol() for a single GET or DELTA,
+ * with #arg a ServerThreadArgs. */
+void *ServerThread(void *arg);
+
+/* A connection as left by ServerConnection(), over #sd and #ssl which the
+ * caller still owns after DestroyClientConn(). */
+AgentConnection *NewClientConn(int sd, SSL *ssl, ProtocolVersion version);
+void DestroyClientConn(AgentConnection *conn);
+
+bool CreateSourceFile(const char *path, size_t size);
+bool FilesEqual(const char *path1, const char *path2);
+double Seconds(const struct timespec *ts);
+
+#endif
@@ -1,6 +1,8 @@
 #include <test.h>
 
 #include <class.h>
+#include <rlist.h>
+#include <writer.h>
 
 static void test_class_ref(void)
 {
@@ -106,6 +108,73 @@ static void test_put_replace(void)
     ClassTableDestroy(t);
 }
 
+/* Names of the classes #iter yields, in order. */
+static char *IteratedNames(ClassTableIterator *iter)
+{
+    Writer *w = StringWriter();
+    Class *cls;
+    while ((cls = ClassTableIteratorNext(iter)) != NULL)
+    {
+        char *expr = ClassRefToString(cls->ns, cls->name);
+        WriterWriteF(w, "%s ", expr);
+        free(expr);
+    }
+    ClassTableIteratorDestroy(iter);
+    return StringWriterClose(w);
+}
+
+static void test_iterator_narrow(void)
+{
+    ClassTable *t = ClassTableNew();
+    ClassTablePut(t, NULL, "linux", true, CONTEXT_SCOPE_NAMESPACE,
+                  StringSetFromString("os", ','), NULL);
+    ClassTablePut(t, NULL, "linux_x86_64", true, CONTEXT_SCOPE_NAMESPACE,
+                  StringSetFromString("arch", ','), NULL);
+    ClassTablePut(t, "ns", "linux_arm", true, CONTEXT_SCOPE_NAMESPACE, NULL, NULL);
+    ClassTablePut(t, NULL, "windows", true, CONTEXT_SCOPE_NAMESPACE,
+                  StringSetFromString("os", ','), NULL);
+
+    ClassTableIterator *iter = ClassTableIteratorNew(t, NULL, true, true);
+    ClassTableIteratorNarrow(iter, "linux.*", NULL);
+    char *names = IteratedNames(iter);
+    assert_string_equal(names, "linux linux_x86_64 ");
+    free(names);
+
+    Rlist *tags = NULL;
+    RlistAppendScalar(&tags, "o.");
+    iter = ClassTableIteratorNew(t, NULL, true, true);
+    ClassTableIteratorNarrow(iter, ".*", tags);
+    names = IteratedNames(iter);
+    assert_string_equal(names, "linux windows ");
+    free(names);
+
+    /* Kept up to date once in use. */
+    ClassTablePut(t, NULL, "linux_new", true, CONTEXT_SCOPE_NAMESPACE, NULL, NULL);
+    ClassTableRemove(t, NULL, "linux");
+    ClassTableAddTag(t, NULL, "linux_x86_64", "os");
+    iter = ClassTableIteratorNew(t, NULL, true, true);
+    ClassTableIteratorNarrow(iter, "linux_.*", tags);
+    names = IteratedNames(iter);
+    assert_string_equal(names, "linux_x86_64 ");
+    free(names);
+
+    iter = ClassTableIteratorNew(t, NULL, true, true);
+    ClassTableIteratorNarrow(iter, "ns:.*", NULL);
+    names = IteratedNames(iter);
+    assert_string_equal(names, "ns:linux_arm ");
+    free(names);
+
+    ClassTableClear(t);
+    iter = ClassTableIteratorNew(t, NULL, true, true);
+    ClassTableIteratorNarrow(iter, ".*", NULL);
+    names = IteratedNames(iter);
+    assert_string_equal(names, "");
+    free(names);
+
+    RlistDestroy(tags);
+    ClassTableDestroy(t);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -115,6 +184,7 @@ int main()
         unit_test(test_ns),
         unit_test(test_class_ref),
         unit_test(test_put_replace),
+        unit_test(test_iterator_narrow),
     };
 
     return run_tests(tests);
@@ -0,0 +1,213 @@
+#include <test.h>
+
+#include <data_file_cache.h>
+#include <file_lib.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+#include <known_dirs.h>
+#include <dir.h>
+#include <utime.h>
+
+char CFWORKDIR[CF_BUFSIZE];
+static char DATA_FILE[CF_BUFSIZE];
+
+static void tests_setup(void)
+{
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/data_file_cache_test.XXXXXX";
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    mkdtemp(workdir);
+    strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
+    putenv(env);
+    mkdir(GetStateDir(), 0700);
+
+    xsnprintf(DATA_FILE, sizeof(DATA_FILE), "%s/data.json", CFWORKDIR);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", GetStateDir());
+    system(cmd);
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+/* Written #age seconds ago, old enough to be cached. */
+static void WriteDataFile(const char *contents, time_t age)
+{
+    FILE *f = fopen(DATA_FILE, "w");
+    assert_true(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+
+    const time_t then = time(NULL) - age;
+    struct utimbuf times = { .actime = then, .modtime = then };
+    assert_int_equal(utime(DATA_FILE, &times), 0);
+}
+
+static char *ReadDataFileAsString(void)
+{
+    JsonElement *json = DataFileCacheRead("test", DATA_FILE, DATAFILETYPE_JSON, CF_INFINITY);
+    assert_true(json != NULL);
+
+    Writer *w = StringWriter();
+    JsonWriteCompact(w, json);
+    JsonDestroy(json);
+    return StringWriterClose(w);
+}
+
+static void AssertStats(size_t expected_hits, size_t expected_misses,
+                        size_t expected_disk_hits)
+{
+    size_t hits, misses, disk_hits;
+    DataFileCacheStats(&hits, &misses, &disk_hits, NULL);
+    assert_int_equal(hits, expected_hits);
+    assert_int_equal(misses, expected_misses);
+    assert_int_equal(disk_hits, expected_disk_hits);
+}
+
+static void test_memory(void)
+{
+    DataFileCacheClear();
+    WriteDataFile("{ \"a\": [1, 2.5, true, null, \"x\"] }", 60);
+    /* Its ctime can't be set, it is only cached once it is old enough. */
+    free(ReadDataFileAsString());
+    AssertStats(0, 0, 0);
+    sleep(DATA_FILE_CACHE_MIN_AGE);
+
+    char *first = ReadDataFileAsString();
+    char *second = ReadDataFileAsString();
+    assert_string_equal(first, second);
+    AssertStats(1, 1, 0);
+    free(first);
+    free(second);
+
+    /* Changed files are read again. */
+    WriteDataFile("{ \"b\": 3 }", 60);
+    sleep(DATA_FILE_CACHE_MIN_AGE);
+    char *changed = ReadDataFileAsString();
+    assert_string_equal(changed, "{\"b\":3}");
+    free(changed);
+    AssertStats(1, 2, 0);
+
+    DataFileCacheClear();
+}
+
+static void test_memory_size(void)
+{
+    DataFileCacheClear();
+
+    /* What counts is the parsed data, not the whitespace around it. */
+    char padded[100000];
+    memset(padded, ' ', sizeof(padded) - 1);
+    padded[sizeof(padded) - 1] = '\0';
+    memcpy(padded, "[\"x\"]", strlen("[\"x\"]"));
+    WriteDataFile(padded, 60);
+    sleep(DATA_FILE_CACHE_MIN_AGE);
+
+    char *read = ReadDataFileAsString();
+    assert_string_equal(read, "[\"x\"]");
+    free(read);
+
+    size_t size;
+    DataFileCacheStats(NULL, NULL, NULL, &size);
+    assert_true(size > 0);
+    assert_true(size < 1000);
+
+    DataFileCacheClear();
+    DataFileCacheStats(NULL, NULL, NULL, &size);
+    assert_int_equal(size, 0);
+}
+
+static size_t CountCacheFiles(void)
+{
+    char path[CF_BUFSIZE];
+    xsnprintf(path, sizeof(path), "%s/data_cache", GetStateDir());
+    Dir *dir = DirOpen(path);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (const struct dirent *entry = DirRead(dir); entry != NULL; entry = DirRead(dir))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            count++;
+        }
+    }
+    DirClose(dir);
+    return count;
+}
+
+static void test_persistent(void)
+{
+    DataFileCacheClear();
+    DataFileCacheSetPersistent(true);
+
+    WriteDataFile("{ \"c\": { \"d\": [\"e\", -1, 1e3] } }", 60);
+    sleep(DATA_FILE_CACHE_MIN_AGE);
+
+    char *parsed = ReadDataFileAsString();
+    AssertStats(0, 1, 0);
+
+    /* As in the next run. */
+    DataFileCacheClear();
+    char *loaded = ReadDataFileAsString();
+    AssertStats(0, 1, 1);
+    assert_string_equal(parsed, loaded);
+
+    free(parsed);
+    free(loaded);
+    DataFileCacheSetPersistent(false);
+    DataFileCacheClear();
+}
+
+static void test_purge(void)
+{
+    DataFileCacheClear();
+    DataFileCacheSetPersistent(true);
+
+    WriteDataFile("{ \"f\": 1 }", 60);
+    sleep(DATA_FILE_CACHE_MIN_AGE);
+    free(ReadDataFileAsString());
+    assert_int_equal(CountCacheFiles(), 1);
+
+    /* Used recently enough. */
+    DataFileCachePurge(time(NULL));
+    assert_int_equal(CountCacheFiles(), 1);
+
+    /* Not used for too long, the next run parses the file again. */
+    DataFileCachePurge(time(NULL) + DATA_FILE_CACHE_HORIZON + 1);
+    assert_int_equal(CountCacheFiles(), 0);
+
+    DataFileCacheClear();
+    free(ReadDataFileAsString());
+    AssertStats(0, 1, 0);
+    assert_int_equal(CountCacheFiles(), 1);
+
+    DataFileCacheSetPersistent(false);
+    DataFileCacheClear();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_memory),
+        unit_test(test_memory_size),
+        unit_test(test_persistent),
+        unit_test(test_purge),
+    };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+
+    return ret;
+}
@@ -225,6 +225,110 @@ void test_old_workdir_db_location(void)
     free(new_db);
 }
 
+/* What other processes see, cursors only see committed writes. */
+static bool CommittedHasKey(dbid id, const char *wanted)
+{
+    /* Closing ends the cursor's transaction, which would hold off commits. */
+    CF_DB *db;
+    assert_true(OpenDB(&db, id));
+
+    CF_DBC *cursor;
+    assert_true(NewDBCursor(db, &cursor));
+
+    bool found = false;
+    char *key;
+    void *value;
+    int ksize, vsize;
+    while (NextDB(cursor, &key, &ksize, &value, &vsize))
+    {
+        if (strcmp(key, wanted) == 0)
+        {
+            found = true;
+        }
+    }
+    DeleteDBCursor(cursor);
+    CloseDB(db);
+
+    return found;
+}
+
+void test_batch(void)
+{
+    CF_DB *db;
+    char value[CF_BUFSIZE];
+
+    assert_true(OpenDB(&db, dbid_observations));
+    assert_true(WriteDB(db, "old", "abc", 4));
+    CloseDB(db);
+
+    assert_true(OpenDB(&db, dbid_observations));
+    DBBeginBatch(db);
+    assert_true(WriteDB(db, "new", "def", 4));
+    assert_true(DeleteDB(db, "old"));
+
+    /* Seen right away through the API, ... */
+    assert_true(ReadDB(db, "new", value, sizeof(value)));
+    assert_string_equal(value, "def");
+    assert_true(HasKeyDB(db, "new", 4));
+    assert_int_equal(ValueSizeDB(db, "new", 4), 4);
+    assert_false(ReadDB(db, "old", value, sizeof(value)));
+    assert_false(HasKeyDB(db, "old", 4));
+    assert_int_equal(ValueSizeDB(db, "old", 4), 0);
+
+    /* ... but not committed until the outermost batch ends. */
+    DBBeginBatch(db);
+    assert_true(DBEndBatch(db));
+    assert_false(CommittedHasKey(dbid_observations, "new"));
+    assert_true(CommittedHasKey(dbid_observations, "old"));
+
+    assert_true(DBEndBatch(db));
+    assert_true(CommittedHasKey(dbid_observations, "new"));
+    assert_false(CommittedHasKey(dbid_observations, "old"));
+
+    /* Written straight to the DB again, where our own cursors see it. */
+    assert_true(WriteDB(db, "after", "ghi", 4));
+    assert_true(CommittedHasKey(dbid_observations, "after"));
+    CloseDB(db);
+}
+
+void test_group_commit(void)
+{
+    CF_DB *db;
+    char value[CF_BUFSIZE];
+
+    /* Every other write, and no time limit. */
+    assert_true(DBSetGroupCommit(dbid_observations, 2, 0));
+
+    assert_true(OpenDB(&db, dbid_observations));
+    assert_true(WriteDB(db, "first", "1", 2));
+    CloseDB(db);
+
+    assert_true(OpenDB(&db, dbid_observations));
+    assert_true(ReadDB(db, "first", value, sizeof(value)));
+    assert_false(CommittedHasKey(dbid_observations, "first"));
+
+    assert_true(WriteDB(db, "second", "2", 2));
+    bool committed = false;
+    for (int i = 0; i < 100 && !committed; i++)
+    {
+        usleep(10000);
+        committed = (CommittedHasKey(dbid_observations, "first") &&
+                     CommittedHasKey(dbid_observations, "second"));
+    }
+    assert_true(committed);
+
+    /* Stopping commits the rest. */
+    assert_true(WriteDB(db, "third", "3", 2));
+    assert_false(CommittedHasKey(dbid_observations, "third"));
+    assert_true(DBSetGroupCommit(dbid_observations, 0, 0));
+    assert_true(CommittedHasKey(dbid_observations, "third"));
+
+    /* And writes are no longer held back. */
+    assert_true(WriteDB(db, "fourth", "4", 2));
+    assert_true(CommittedHasKey(dbid_observations, "fourth"));
+    CloseDB(db);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -238,6 +342,8 @@ int main()
             unit_test(test_iter_delete_entry),
             unit_test(test_recreate),
             unit_test(test_old_workdir_db_location),
+            unit_test(test_batch),
+            unit_test(test_group_commit),
         };
 
     PRINT_TEST_BANNER();
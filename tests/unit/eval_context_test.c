@@ -100,6 +100,104 @@ static void test_class_persistence(void)
     EvalContextDestroy(ctx);
 }
 
+static void test_class_expression_cache(void)
+{
+    EvalContext *ctx = EvalContextNew();
+
+    assert_false(IsDefinedClass(ctx, "foo.bar"));
+    assert_true(IsDefinedClass(ctx, "any"));
+
+    /* Cached values must follow the classes. */
+    uint64_t generation = EvalContextClassGeneration(ctx);
+    EvalContextClassPutHard(ctx, "foo", NULL);
+    EvalContextClassPutHard(ctx, "bar", NULL);
+    assert_true(EvalContextClassGeneration(ctx) != generation);
+    assert_true(IsDefinedClass(ctx, "foo.bar"));
+    assert_true(IsDefinedClass(ctx, "foo . bar"));
+    assert_true(IsDefinedClass(ctx, "foo.bar"));
+
+    /* The value doesn't change as long as the classes don't. */
+    generation = EvalContextClassGeneration(ctx);
+    assert_true(IsDefinedClass(ctx, "foo.!baz"));
+    assert_int_equal(EvalContextClassGeneration(ctx), generation);
+
+    EvalContextHeapRemoveHard(ctx, "bar");
+    assert_false(IsDefinedClass(ctx, "foo.bar"));
+    assert_true(IsDefinedClass(ctx, "foo|bar"));
+
+    /* Bundle classes disappear with their frame. */
+    {
+        Policy *p = PolicyNew();
+        Bundle *bp = PolicyAppendBundle(p, "default", "bundle1", "agent", NULL, NULL);
+
+        EvalContextStackPushBundleFrame(ctx, bp, NULL, false);
+        EvalContextClassPutSoft(ctx, "local", CONTEXT_SCOPE_BUNDLE, NULL);
+        assert_true(IsDefinedClass(ctx, "foo.local"));
+        EvalContextStackPopFrame(ctx);
+        assert_false(IsDefinedClass(ctx, "foo.local"));
+
+        PolicyDestroy(p);
+    }
+
+    assert_int_equal(CheckClassExpression(ctx, "foo.(bar"), EXPRESSION_VALUE_ERROR);
+    assert_int_equal(CheckClassExpression(ctx, "foo.(bar"), EXPRESSION_VALUE_ERROR);
+    assert_int_equal(CheckClassExpression(ctx, "foo bar"), EXPRESSION_VALUE_ERROR);
+
+    EvalContextDestroy(ctx);
+}
+
+static void test_promise_inputs(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    VarRef *x = VarRefParseFromScope("x", "test");
+    VarRef *y = VarRefParseFromScope("y", "test");
+    VarRef *z = VarRefParseFromScope("z", "test");
+    EvalContextVariablePut(ctx, x, "1", CF_DATA_TYPE_STRING, NULL);
+
+    /* Reads x and foo, writes y. */
+    PromiseInputs *inputs = PromiseInputsNew();
+    assert_false(EvalContextPromiseInputsRecording(ctx));
+    PromiseInputs *previous = EvalContextPromiseInputsBegin(ctx, inputs);
+    assert_true(EvalContextPromiseInputsRecording(ctx));
+    assert_true(EvalContextVariableGet(ctx, x, NULL) != NULL);
+    assert_false(IsDefinedClass(ctx, "foo"));
+    EvalContextVariablePut(ctx, y, "2", CF_DATA_TYPE_STRING, NULL);
+    assert_true(EvalContextVariableGet(ctx, y, NULL) != NULL);
+    EvalContextPromiseInputsEnd(ctx, previous);
+    assert_false(EvalContextPromiseInputsRecording(ctx));
+
+    /* Its own write doesn't count, unrelated changes don't either. */
+    assert_false(EvalContextPromiseInputsChanged(ctx, inputs));
+    EvalContextVariablePut(ctx, z, "3", CF_DATA_TYPE_STRING, NULL);
+    EvalContextClassPutHard(ctx, "bar", NULL);
+    assert_false(EvalContextPromiseInputsChanged(ctx, inputs));
+
+    EvalContextClassPutHard(ctx, "foo", NULL);
+    assert_true(EvalContextPromiseInputsChanged(ctx, inputs));
+
+    /* Record again, now someone else changes what it wrote. */
+    previous = EvalContextPromiseInputsBegin(ctx, inputs);
+    assert_true(EvalContextVariableGet(ctx, x, NULL) != NULL);
+    assert_true(IsDefinedClass(ctx, "foo"));
+    EvalContextVariablePut(ctx, y, "2", CF_DATA_TYPE_STRING, NULL);
+    EvalContextPromiseInputsEnd(ctx, previous);
+    assert_false(EvalContextPromiseInputsChanged(ctx, inputs));
+    EvalContextVariableRemove(ctx, y);
+    assert_true(EvalContextPromiseInputsChanged(ctx, inputs));
+
+    /* Unresolved variables have to be looked up again. */
+    previous = EvalContextPromiseInputsBegin(ctx, inputs);
+    assert_true(EvalContextVariableGet(ctx, y, NULL) == NULL);
+    EvalContextPromiseInputsEnd(ctx, previous);
+    assert_true(EvalContextPromiseInputsChanged(ctx, inputs));
+
+    PromiseInputsDestroy(inputs);
+    VarRefDestroy(x);
+    VarRefDestroy(y);
+    VarRefDestroy(z);
+    EvalContextDestroy(ctx);
+}
+
 void test_changes_chroot(void)
 {
     /* Should add '/' to the end implicitly. */
@@ -132,6 +230,8 @@ int main()
     const UnitTest tests[] =
     {
         unit_test(test_class_persistence),
+        unit_test(test_class_expression_cache),
+        unit_test(test_promise_inputs),
         unit_test(test_changes_chroot),
     };
 
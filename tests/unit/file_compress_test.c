@@ -0,0 +1,210 @@
+#include <test.h>
+
+#include <file_compress.h>
+#include <alloc.h>
+
+
+typedef struct
+{
+    unsigned char *data;
+    size_t len;
+    size_t pos;
+} MemStream;
+
+static bool MemWrite(void *stream, const void *buf, size_t len)
+{
+    MemStream *s = stream;
+    s->data = xrealloc(s->data, s->len + len);
+    memcpy(s->data + s->len, buf, len);
+    s->len += len;
+    return true;
+}
+
+static bool MemRead(void *stream, void *buf, size_t len)
+{
+    MemStream *s = stream;
+    if (s->len - s->pos < len)
+    {
+        return false;
+    }
+    memcpy(buf, s->data + s->pos, len);
+    s->pos += len;
+    return true;
+}
+
+static int TempFileWith(const unsigned char *data, size_t len)
+{
+    FILE *f = tmpfile();
+    assert_true(f != NULL);
+    int fd = dup(fileno(f));
+    fclose(f);
+
+    assert_int_equal(write(fd, data, len), len);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    return fd;
+}
+
+/* Compressible, but not trivially so. */
+static unsigned char *TextData(size_t len)
+{
+    static const char words[] = "bundle agent files promise copy_from ";
+    unsigned char *data = xmalloc(len + 1);
+    srand(42);
+    for (size_t i = 0; i < len; i++)
+    {
+        data[i] = (rand() % 16 == 0) ? '\n' : words[i % (sizeof(words) - 1)];
+    }
+    return data;
+}
+
+static void assert_fd_contents(int fd, const unsigned char *data, size_t len)
+{
+    unsigned char *buf = xmalloc(len + 1);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    assert_int_equal(read(fd, buf, len + 1), len);
+    assert_memory_equal(buf, data, len);
+    free(buf);
+}
+
+static void test_round_trip(void)
+{
+    if (!CompressAvailable())
+    {
+        return;
+    }
+
+    const size_t sizes[] = { 0, 1, 4096, 3 * COMPRESS_FRAME_MAX + 17 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        unsigned char *data = TextData(sizes[i]);
+        int src_fd = TempFileWith(data, sizes[i]);
+
+        MemStream stream = { 0 };
+        assert_true(CompressSendFile(src_fd, sizes[i], MemWrite, &stream));
+
+        int dest_fd = TempFileWith(NULL, 0);
+        uint64_t wire_bytes = 0;
+        assert_int_equal(CompressReceive(MemRead, &stream, dest_fd, sizes[i],
+                                         &wire_bytes),
+                         COMPRESS_RESULT_OK);
+        assert_int_equal(wire_bytes, stream.len);
+        assert_int_equal(stream.pos, stream.len);
+        assert_fd_contents(dest_fd, data, sizes[i]);
+        if (sizes[i] > 4096)
+        {
+            assert_true(wire_bytes < sizes[i] / 2);
+        }
+
+        close(dest_fd);
+        close(src_fd);
+        free(stream.data);
+        free(data);
+    }
+}
+
+static void test_buffer_round_trip(void)
+{
+    if (!CompressAvailable())
+    {
+        return;
+    }
+
+    const size_t size = 2 * COMPRESS_FRAME_MAX + 5;
+    unsigned char *data = TextData(size);
+    int src_fd = TempFileWith(data, size);
+
+    unsigned char *compressed;
+    size_t compressed_len;
+    assert_true(CompressFileToBuffer(src_fd, size, &compressed, &compressed_len));
+
+    /* The same buffer is sent to more than one client. */
+    for (int i = 0; i < 2; i++)
+    {
+        MemStream stream = { 0 };
+        assert_true(CompressSendBuffer(compressed, compressed_len,
+                                       MemWrite, &stream));
+
+        int dest_fd = TempFileWith(NULL, 0);
+        uint64_t wire_bytes;
+        assert_int_equal(CompressReceive(MemRead, &stream, dest_fd, size,
+                                         &wire_bytes),
+                         COMPRESS_RESULT_OK);
+        assert_fd_contents(dest_fd, data, size);
+        close(dest_fd);
+        free(stream.data);
+    }
+
+    free(compressed);
+    close(src_fd);
+    free(data);
+}
+
+static void test_file_changed(void)
+{
+    if (!CompressAvailable())
+    {
+        return;
+    }
+
+    /* The file is shorter than announced, as if truncated while sent. */
+    const size_t size = 10000;
+    unsigned char *data = TextData(size);
+    int src_fd = TempFileWith(data, size / 2);
+
+    MemStream stream = { 0 };
+    assert_false(CompressSendFile(src_fd, size, MemWrite, &stream));
+
+    /* The stream still ends properly, the session stays usable. */
+    int dest_fd = TempFileWith(NULL, 0);
+    uint64_t wire_bytes;
+    assert_int_equal(CompressReceive(MemRead, &stream, dest_fd, size,
+                                     &wire_bytes),
+                     COMPRESS_RESULT_FAILED);
+    assert_int_equal(stream.pos, stream.len);
+
+    close(dest_fd);
+    close(src_fd);
+    free(stream.data);
+    free(data);
+}
+
+static void test_truncated_stream(void)
+{
+    if (!CompressAvailable())
+    {
+        return;
+    }
+
+    const size_t size = 10000;
+    unsigned char *data = TextData(size);
+    int src_fd = TempFileWith(data, size);
+
+    MemStream stream = { 0 };
+    assert_true(CompressSendFile(src_fd, size, MemWrite, &stream));
+    stream.len -= 3;
+
+    int dest_fd = TempFileWith(NULL, 0);
+    uint64_t wire_bytes;
+    assert_int_equal(CompressReceive(MemRead, &stream, dest_fd, size,
+                                     &wire_bytes),
+                     COMPRESS_RESULT_STREAM_ERROR);
+
+    close(dest_fd);
+    close(src_fd);
+    free(stream.data);
+    free(data);
+}
+
+int main()
+{
+    const UnitTest tests[] =
+        {
+            unit_test(test_round_trip),
+            unit_test(test_buffer_round_trip),
+            unit_test(test_file_changed),
+            unit_test(test_truncated_stream),
+        };
+
+    PRINT_TEST_BANNER();
+    return run_tests(tests);
+}
@@ -0,0 +1,239 @@
+#include <test.h>
+
+#include <file_delta.h>
+#include <alloc.h>
+
+
+typedef struct
+{
+    unsigned char *data;
+    size_t len;
+    size_t pos;
+} MemStream;
+
+static bool MemWrite(void *stream, const void *buf, size_t len)
+{
+    MemStream *s = stream;
+    s->data = xrealloc(s->data, s->len + len);
+    memcpy(s->data + s->len, buf, len);
+    s->len += len;
+    return true;
+}
+
+static bool MemRead(void *stream, void *buf, size_t len)
+{
+    MemStream *s = stream;
+    if (s->len - s->pos < len)
+    {
+        return false;
+    }
+    memcpy(buf, s->data + s->pos, len);
+    s->pos += len;
+    return true;
+}
+
+static int TempFileWith(const unsigned char *data, size_t len)
+{
+    FILE *f = tmpfile();
+    assert_true(f != NULL);
+    int fd = dup(fileno(f));
+    fclose(f);
+
+    assert_int_equal(write(fd, data, len), len);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    return fd;
+}
+
+static unsigned char *RandomData(size_t len, unsigned int seed)
+{
+    unsigned char *data = xmalloc(len + 1);
+    srand(seed);
+    for (size_t i = 0; i < len; i++)
+    {
+        data[i] = rand() & 0xFF;
+    }
+    return data;
+}
+
+/* Rebuild #new_data from #basis through a delta, check the result. */
+static void assert_delta_round_trip(const unsigned char *basis, size_t basis_len,
+                                    const unsigned char *new_data, size_t new_len,
+                                    DeltaStats *gen_stats)
+{
+    const size_t block_size = DeltaBlockSize(basis_len);
+    const size_t num_blocks = DeltaNumBlocks(basis_len, block_size);
+
+    int basis_fd = TempFileWith(basis, basis_len);
+    unsigned char *signatures = DeltaSignatures(basis_fd, block_size, num_blocks);
+    assert_true(signatures != NULL);
+
+    int new_fd = TempFileWith(new_data, new_len);
+    MemStream stream = { 0 };
+    assert_true(DeltaGenerate(new_fd, new_len, signatures, num_blocks,
+                              block_size, basis_len,
+                              MemWrite, &stream, gen_stats));
+    assert_int_equal(gen_stats->literal_bytes + gen_stats->copied_bytes, new_len);
+
+    int dest_fd = TempFileWith(NULL, 0);
+    DeltaStats apply_stats;
+    assert_int_equal(DeltaApply(MemRead, &stream, basis_fd, basis_len,
+                                block_size, dest_fd, &apply_stats),
+                     DELTA_RESULT_OK);
+    assert_int_equal(stream.pos, stream.len);
+    assert_int_equal(apply_stats.literal_bytes, gen_stats->literal_bytes);
+    assert_int_equal(apply_stats.copied_bytes, gen_stats->copied_bytes);
+
+    unsigned char *result = xmalloc(new_len + 1);
+    assert_int_equal(lseek(dest_fd, 0, SEEK_SET), 0);
+    assert_int_equal(read(dest_fd, result, new_len + 1), new_len);
+    assert_memory_equal(result, new_data, new_len);
+
+    free(result);
+    free(stream.data);
+    free(signatures);
+    close(dest_fd);
+    close(new_fd);
+    close(basis_fd);
+}
+
+static void test_block_size(void)
+{
+    assert_int_equal(DeltaBlockSize(0), DELTA_MIN_BLOCKSIZE);
+    assert_int_equal(DeltaBlockSize(1000), DELTA_MIN_BLOCKSIZE);
+    assert_int_equal(DeltaBlockSize((off_t) 1 << 30), 32768);
+    assert_int_equal(DeltaBlockSize((off_t) 1 << 41), 0);
+
+    assert_int_equal(DeltaNumBlocks(0, 2048), 0);
+    assert_int_equal(DeltaNumBlocks(2048, 2048), 1);
+    assert_int_equal(DeltaNumBlocks(2049, 2048), 2);
+}
+
+static void test_weak_roll(void)
+{
+    const size_t len = 64;
+    unsigned char *data = RandomData(1024, 1);
+
+    uint32_t weak = DeltaWeakChecksum(data, len);
+    for (size_t i = 0; i + len < 1024; i++)
+    {
+        weak = DeltaWeakRoll(weak, len, data[i], data[i + len]);
+        assert_int_equal(weak, DeltaWeakChecksum(data + i + 1, len));
+    }
+    free(data);
+}
+
+static void test_identical(void)
+{
+    const size_t len = 100000;
+    unsigned char *data = RandomData(len, 2);
+
+    DeltaStats stats;
+    assert_delta_round_trip(data, len, data, len, &stats);
+    assert_int_equal(stats.literal_bytes, 0);
+    assert_int_equal(stats.copied_bytes, len);
+    free(data);
+}
+
+static void test_small_changes(void)
+{
+    const size_t len = 300000;
+    unsigned char *basis = RandomData(len, 3);
+
+    /* Overwrite a few bytes, insert some and drop some elsewhere. */
+    unsigned char *new_data = xmalloc(len + 100);
+    memcpy(new_data, basis, 100000);
+    memcpy(new_data + 100000, "changed", 7);
+    memcpy(new_data + 100007, basis + 100007, 100000);
+    memcpy(new_data + 200007, "inserted", 8);
+    memcpy(new_data + 200015, basis + 200007 + 50, len - 200007 - 50);
+    const size_t new_len = len + 8 - 50;
+
+    DeltaStats stats;
+    assert_delta_round_trip(basis, len, new_data, new_len, &stats);
+
+    /* At most the blocks touched by the two changes are sent. */
+    const size_t block_size = DeltaBlockSize(len);
+    assert_true(stats.literal_bytes <= 4 * block_size);
+    free(new_data);
+    free(basis);
+}
+
+static void test_no_basis(void)
+{
+    const size_t len = 200000;
+    unsigned char *data = RandomData(len, 4);
+
+    DeltaStats stats;
+    assert_delta_round_trip((const unsigned char *) "", 0, data, len, &stats);
+    assert_int_equal(stats.literal_bytes, len);
+    free(data);
+}
+
+static void test_short_last_block(void)
+{
+    /* Both files end in the same short block. */
+    const size_t len = 5 * DELTA_MIN_BLOCKSIZE + 123;
+    unsigned char *basis = RandomData(len, 5);
+    unsigned char *new_data = xmemdup(basis, len);
+    new_data[DELTA_MIN_BLOCKSIZE] ^= 0xFF;
+
+    DeltaStats stats;
+    assert_delta_round_trip(basis, len, new_data, len, &stats);
+    assert_int_equal(stats.copied_bytes, len - DELTA_MIN_BLOCKSIZE);
+    free(new_data);
+    free(basis);
+}
+
+static void test_changed_size(void)
+{
+    const size_t len = 10000;
+    unsigned char *data = RandomData(len, 6);
+    const size_t block_size = DeltaBlockSize(len);
+    const size_t num_blocks = DeltaNumBlocks(len, block_size);
+
+    int basis_fd = TempFileWith(data, len);
+    unsigned char *signatures = DeltaSignatures(basis_fd, block_size, num_blocks);
+
+    /* The file is not the size it had when the request came in. */
+    int new_fd = TempFileWith(data, len);
+    MemStream stream = { 0 };
+    DeltaStats stats;
+    assert_false(DeltaGenerate(new_fd, len + 1, signatures, num_blocks,
+                               block_size, len, MemWrite, &stream, &stats));
+
+    int dest_fd = TempFileWith(NULL, 0);
+    assert_int_equal(DeltaApply(MemRead, &stream, basis_fd, len, block_size,
+                                dest_fd, &stats),
+                     DELTA_RESULT_FAILED);
+
+    /* A stream cut short leaves the connection out of sync. */
+    stream.pos = 0;
+    stream.len = 3;
+    assert_int_equal(DeltaApply(MemRead, &stream, basis_fd, len, block_size,
+                                dest_fd, &stats),
+                     DELTA_RESULT_STREAM_ERROR);
+
+    free(stream.data);
+    free(signatures);
+    free(data);
+    close(dest_fd);
+    close(new_fd);
+    close(basis_fd);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_block_size),
+        unit_test(test_weak_roll),
+        unit_test(test_identical),
+        unit_test(test_small_changes),
+        unit_test(test_no_basis),
+        unit_test(test_short_last_block),
+        unit_test(test_changed_size),
+    };
+
+    return run_tests(tests);
+}
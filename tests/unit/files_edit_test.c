@@ -0,0 +1,210 @@
+#include <test.h>
+
+#include <files_edit.h>
+#include <item_lib.h>
+
+
+static EditContext *NewTestContext(const char *const *lines, size_t count)
+{
+    EditContext *ec = xcalloc(1, sizeof(EditContext));
+    for (size_t i = 0; i < count; i++)
+    {
+        AppendItem(&(ec->file_start), lines[i], NULL);
+    }
+    return ec;
+}
+
+static void DestroyTestContext(EditContext *ec)
+{
+    DeleteItemList(ec->file_start);
+    if (ec->line_counts != NULL)
+    {
+        MapDestroy(ec->line_counts);
+    }
+    free(ec);
+}
+
+/* The lines of #ec joined by commas, to compare the list in one go. */
+static const char *Lines(const EditContext *ec)
+{
+    static char buf[CF_BUFSIZE];
+    buf[0] = '\0';
+    for (const Item *ip = ec->file_start; ip != NULL; ip = ip->next)
+    {
+        strlcat(buf, ip->name, sizeof(buf));
+        if (ip->next != NULL)
+        {
+            strlcat(buf, ",", sizeof(buf));
+        }
+    }
+    return buf;
+}
+
+/* The index agrees with the list, whatever was looked up before. */
+static void assert_index_matches(EditContext *ec)
+{
+    const Item *last = NULL;
+    for (const Item *ip = ec->file_start; ip != NULL; ip = ip->next)
+    {
+        assert_true(EditLineExists(ec, ip->name));
+        last = ip;
+    }
+    assert_true(EditLineLast(ec) == last);
+}
+
+static void test_lookup(void)
+{
+    const char *lines[] = { "a", "b", "c" };
+    EditContext *ec = NewTestContext(lines, sizeof(lines) / sizeof(lines[0]));
+
+    assert_true(ec->line_counts == NULL);
+    assert_true(EditLineExists(ec, "b"));
+    assert_false(EditLineExists(ec, "x"));
+    assert_false(EditLineExists(ec, ""));
+    assert_string_equal(EditLineLast(ec)->name, "c");
+
+    DestroyTestContext(ec);
+
+    /* Nothing to index yet. */
+    ec = NewTestContext(NULL, 0);
+    assert_false(EditLineExists(ec, "a"));
+    assert_true(EditLineLast(ec) == NULL);
+    DestroyTestContext(ec);
+}
+
+static void test_insert(void)
+{
+    const char *lines[] = { "a", "b", "c" };
+    EditContext *ec = NewTestContext(lines, sizeof(lines) / sizeof(lines[0]));
+    assert_index_matches(ec);
+
+    /* After a line, which is before the one following it. */
+    EditLineInsertAfter(ec, ec->file_start->next, "after b");
+    assert_string_equal(Lines(ec), "a,b,after b,c");
+    assert_true(EditLineExists(ec, "after b"));
+    assert_string_equal(EditLineLast(ec)->name, "c");
+
+    /* Before the first line. */
+    EditLinePrepend(ec, "first");
+    assert_string_equal(Lines(ec), "first,a,b,after b,c");
+    assert_true(EditLineExists(ec, "first"));
+
+    /* After the last line, and appended. */
+    EditLineInsertAfter(ec, EditLineLast(ec), "after c");
+    assert_string_equal(EditLineLast(ec)->name, "after c");
+    EditLineInsertAfter(ec, NULL, "appended");
+    assert_string_equal(Lines(ec), "first,a,b,after b,c,after c,appended");
+    assert_string_equal(EditLineLast(ec)->name, "appended");
+
+    assert_index_matches(ec);
+    DestroyTestContext(ec);
+
+    /* Appending to an empty file. */
+    ec = NewTestContext(NULL, 0);
+    assert_true(EditLineLast(ec) == NULL);
+    EditLineInsertAfter(ec, NULL, "only");
+    assert_string_equal(Lines(ec), "only");
+    assert_true(EditLineExists(ec, "only"));
+    assert_true(EditLineLast(ec) == ec->file_start);
+    DestroyTestContext(ec);
+}
+
+static void test_delete(void)
+{
+    const char *lines[] = { "a", "b", "a", "c" };
+    EditContext *ec = NewTestContext(lines, sizeof(lines) / sizeof(lines[0]));
+    assert_index_matches(ec);
+
+    /* A line that's there twice is still there after deleting one. */
+    Item *next = EditLineDelete(ec, ec->file_start, NULL);
+    assert_true(next == ec->file_start);
+    assert_string_equal(Lines(ec), "b,a,c");
+    assert_true(EditLineExists(ec, "a"));
+
+    next = EditLineDelete(ec, ec->file_start->next, ec->file_start);
+    assert_string_equal(next->name, "c");
+    assert_string_equal(Lines(ec), "b,c");
+    assert_false(EditLineExists(ec, "a"));
+
+    /* The last one, the one before it is last then. */
+    next = EditLineDelete(ec, ec->file_start->next, ec->file_start);
+    assert_true(next == NULL);
+    assert_false(EditLineExists(ec, "c"));
+    assert_string_equal(EditLineLast(ec)->name, "b");
+
+    next = EditLineDelete(ec, ec->file_start, NULL);
+    assert_true(next == NULL);
+    assert_true(ec->file_start == NULL);
+    assert_false(EditLineExists(ec, "b"));
+    assert_true(EditLineLast(ec) == NULL);
+
+    /* Appending after the index went empty. */
+    EditLineInsertAfter(ec, NULL, "new");
+    assert_string_equal(Lines(ec), "new");
+    assert_index_matches(ec);
+
+    DestroyTestContext(ec);
+}
+
+static void test_replace(void)
+{
+    const char *lines[] = { "a", "b", "b" };
+    EditContext *ec = NewTestContext(lines, sizeof(lines) / sizeof(lines[0]));
+    assert_index_matches(ec);
+
+    EditLineRename(ec, ec->file_start, xstrdup("x"));
+    assert_string_equal(Lines(ec), "x,b,b");
+    assert_false(EditLineExists(ec, "a"));
+    assert_true(EditLineExists(ec, "x"));
+
+    /* Only gone once neither copy is left. */
+    EditLineRename(ec, ec->file_start->next, xstrdup("y"));
+    assert_true(EditLineExists(ec, "b"));
+    EditLineRename(ec, EditLineLast(ec), xstrdup("x"));
+    assert_string_equal(Lines(ec), "x,y,x");
+    assert_false(EditLineExists(ec, "b"));
+
+    /* Back to a line there already. */
+    EditLineRename(ec, ec->file_start->next, xstrdup("x"));
+    assert_false(EditLineExists(ec, "y"));
+    EditLineDelete(ec, ec->file_start, NULL);
+    EditLineDelete(ec, ec->file_start, NULL);
+    assert_true(EditLineExists(ec, "x"));
+
+    assert_index_matches(ec);
+    DestroyTestContext(ec);
+}
+
+/* Changes made before the index is built are picked up when it is. */
+static void test_unindexed_changes(void)
+{
+    const char *lines[] = { "a", "b" };
+    EditContext *ec = NewTestContext(lines, sizeof(lines) / sizeof(lines[0]));
+
+    EditLinePrepend(ec, "first");
+    EditLineRename(ec, ec->file_start->next, xstrdup("renamed"));
+    EditLineDelete(ec, ec->file_start->next->next, ec->file_start->next);
+    assert_true(ec->line_counts == NULL);
+
+    assert_string_equal(Lines(ec), "first,renamed");
+    assert_false(EditLineExists(ec, "a"));
+    assert_false(EditLineExists(ec, "b"));
+    assert_index_matches(ec);
+
+    DestroyTestContext(ec);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_lookup),
+        unit_test(test_insert),
+        unit_test(test_delete),
+        unit_test(test_replace),
+        unit_test(test_unindexed_changes),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,118 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <files_hash_pool.h>
+#include <hash.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+
+char TESTDIR[CF_BUFSIZE];
+char FILE1[CF_BUFSIZE];
+char FILE2[CF_BUFSIZE];
+
+static void WriteTestFile(const char *path, const char *contents)
+{
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    assert_true(fputs(contents, f) >= 0);
+    assert_int_equal(fclose(f), 0);
+}
+
+static void tests_setup(void)
+{
+    OpenSSL_add_all_digests();
+
+    xsnprintf(TESTDIR, sizeof(TESTDIR), "/tmp/files_hash_pool_test.XXXXXX");
+    assert_true(mkdtemp(TESTDIR) != NULL);
+
+    xsnprintf(FILE1, sizeof(FILE1), "%s/file1", TESTDIR);
+    xsnprintf(FILE2, sizeof(FILE2), "%s/file2", TESTDIR);
+    WriteTestFile(FILE1, "first file\n");
+    WriteTestFile(FILE2, "second file\n");
+
+    /* Files modified within the current second are left to the agent. */
+    struct stat sb;
+    assert_int_equal(stat(FILE2, &sb), 0);
+    while (time(NULL) <= sb.st_ctime)
+    {
+        usleep(10000);
+    }
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", TESTDIR);
+    system(cmd);
+}
+
+static void assert_claimed_digest_correct(FileHashPool *pool, const char *path)
+{
+    unsigned char expected[EVP_MAX_MD_SIZE + 1] = { 0 };
+    unsigned char claimed[EVP_MAX_MD_SIZE + 1] = { 0 };
+
+    HashFile(path, expected, HASH_METHOD_SHA256, false);
+    assert_true(FileHashPoolClaim(pool, path, HASH_METHOD_SHA256, claimed));
+    assert_memory_equal(claimed, expected, sizeof(expected));
+}
+
+static void test_claim(void)
+{
+    FileHashPool *pool = FileHashPoolNew(2);
+    FileHashPoolQueueDirectory(pool, TESTDIR, HASH_METHOD_SHA256);
+
+    /* Waits for the listing and the hashing. */
+    FileHashPoolWait(pool);
+    assert_claimed_digest_correct(pool, FILE2);
+    assert_claimed_digest_correct(pool, FILE1);
+
+    /* Only once, and only with the queued method. */
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    assert_false(FileHashPoolClaim(pool, FILE1, HASH_METHOD_SHA256, digest));
+    assert_false(FileHashPoolClaim(pool, FILE2, HASH_METHOD_MD5, digest));
+
+    FileHashPoolDestroy(pool);
+}
+
+static void test_not_queued(void)
+{
+    FileHashPool *pool = FileHashPoolNew(1);
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    assert_false(FileHashPoolClaim(pool, FILE1, HASH_METHOD_SHA256, digest));
+
+    FileHashPoolDestroy(pool);
+}
+
+static void test_changed_since(void)
+{
+    FileHashPool *pool = FileHashPoolNew(1);
+    FileHashPoolQueueDirectory(pool, TESTDIR, HASH_METHOD_SHA256);
+    FileHashPoolWait(pool);
+
+    /* Changed by the agent after it was hashed. */
+    WriteTestFile(FILE1, "first file, changed\n");
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    assert_false(FileHashPoolClaim(pool, FILE1, HASH_METHOD_SHA256, digest));
+
+    FileHashPoolDestroy(pool);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_claim),
+        unit_test(test_not_queued),
+        unit_test(test_changed_since),
+    };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+
+    return ret;
+}
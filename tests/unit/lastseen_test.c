@@ -244,6 +244,106 @@ static void test_remove_ip(void)
     CloseDB(db);
 }
 
+static bool CountConnections(ARG_UNUSED const char *hostkey,
+                             ARG_UNUSED const char *address,
+                             ARG_UNUSED bool incoming,
+                             ARG_UNUSED const KeyHostSeen *quality,
+                             void *ctx)
+{
+    (*(int *) ctx)++;
+    return true;
+}
+
+static void test_snapshot(void)
+{
+    setup();
+
+    UpdateLastSawHost(KEY1, IP1, true, 100);
+    UpdateLastSawHost(KEY1, IP1, false, 300);
+    UpdateLastSawHost(KEY2, IP2, true, 200);
+
+    LastSeenSnapshot *snapshot = LastSeenSnapshotAcquire();
+    assert_true(snapshot != NULL);
+    assert_int_equal(LastSeenSnapshotHostCount(snapshot), 2);
+    assert_string_equal(LastSeenSnapshotAddress(snapshot, KEY2), IP2);
+    assert_string_equal(LastSeenSnapshotHostkey(snapshot, IP1), KEY1);
+    assert_true(LastSeenSnapshotAddress(snapshot, KEY3) == NULL);
+    assert_true(LastSeenSnapshotHostkey(snapshot, IP3) == NULL);
+
+    int count = 0;
+    LastSeenSnapshotScan(snapshot, 0, CountConnections, &count);
+    assert_int_equal(count, 3);
+    count = 0;
+    LastSeenSnapshotScan(snapshot, 200, CountConnections, &count);
+    assert_int_equal(count, 2);
+    count = 0;
+    LastSeenSnapshotScan(snapshot, 301, CountConnections, &count);
+    assert_int_equal(count, 0);
+
+#ifdef LMDB
+    /* Unchanged database, the same snapshot. */
+    LastSeenSnapshot *same = LastSeenSnapshotAcquire();
+    assert_true(same == snapshot);
+    LastSeenSnapshotRelease(same);
+#endif
+
+    /* Loaded again once changed, the old one stays usable until released. */
+    UpdateLastSawHost(KEY3, IP3, true, 400);
+    LastSeenSnapshot *changed = LastSeenSnapshotAcquire();
+    assert_true(changed != NULL);
+    assert_int_equal(LastSeenSnapshotHostCount(changed), 3);
+    assert_int_equal(LastSeenSnapshotHostCount(snapshot), 2);
+    assert_int_equal(LastSeenHostKeyCount(), 3);
+
+#ifdef LMDB
+    /* What other processes commit is only looked for after a minute. */
+    DBHandle *db;
+    assert_true(OpenDB(&db, dbid_lastseen));
+    assert_true(DBPutStr(db, "kSHA=key4", "127.0.0.124"));
+    CloseDB(db);
+    LastSeenSnapshot *recent = LastSeenSnapshotAcquire();
+    assert_true(recent == changed);
+    assert_int_equal(LastSeenSnapshotHostCount(recent), 3);
+    LastSeenSnapshotRelease(recent);
+#endif
+
+    LastSeenSnapshotRelease(snapshot);
+    LastSeenSnapshotRelease(changed);
+}
+
+static bool AppendConnection(const char *hostkey, ARG_UNUSED const char *address,
+                             bool incoming, ARG_UNUSED const KeyHostSeen *quality,
+                             void *ctx)
+{
+    char *order = ctx;
+    strlcat(order, hostkey, CF_BUFSIZE);
+    strlcat(order, incoming ? "<" : ">", CF_BUFSIZE);
+    return true;
+}
+
+static void test_scan_order(void)
+{
+    setup();
+
+    UpdateLastSawHost(KEY3, IP3, false, 100);
+    UpdateLastSawHost(KEY1, IP1, false, 200);
+    UpdateLastSawHost(KEY2, IP2, true, 300);
+    UpdateLastSawHost(KEY1, IP1, true, 400);
+
+    /* By hostkey, what cf-key -s shows. */
+    char order[CF_BUFSIZE] = "";
+    assert_true(ScanLastSeenQuality(AppendConnection, order));
+    assert_string_equal(order, KEY1 "<" KEY1 ">" KEY2 "<" KEY3 ">");
+
+    /* By time, what hostsseen() scans. */
+    order[0] = '\0';
+    LastSeenSnapshot *snapshot = LastSeenSnapshotAcquire();
+    assert_true(snapshot != NULL);
+    LastSeenSnapshotScan(snapshot, 0, AppendConnection, order);
+    assert_string_equal(order, KEY3 ">" KEY1 ">" KEY2 "<" KEY1 "<");
+    LastSeenSnapshotRelease(snapshot);
+}
+
 
 /* These tests can't be multi-threaded anyway. */
 static DBHandle *DBH;
@@ -623,6 +723,8 @@ int main()
             unit_test(test_remove),
             unit_test(test_remove_no_a_entry),
             unit_test(test_remove_ip),
+            unit_test(test_snapshot),
+            unit_test(test_scan_order),
 
             unit_test_setup_teardown(test_consistent_1a, begin, end),
             unit_test_setup_teardown(test_consistent_1b, begin, end),
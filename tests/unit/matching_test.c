@@ -34,11 +34,35 @@ void test_has_regex_meta_chars(void)
     assert_true(HasRegexMetaChars("\\d"));
 }
 
+static void test_regex_literal_prefix(void)
+{
+    char *prefix;
+#define ASSERT_PREFIX(regex, expected)              \
+    prefix = RegexLiteralPrefix(regex);             \
+    assert_string_equal(prefix, expected);          \
+    free(prefix)
+
+    ASSERT_PREFIX("string", "string");
+    ASSERT_PREFIX("^linux_.*", "linux_");
+    ASSERT_PREFIX("default:sys\\.fqhost", "default:sys.fqhost");
+    ASSERT_PREFIX("ab*c", "a");
+    ASSERT_PREFIX("ab?c", "a");
+    ASSERT_PREFIX("ab{2}", "a");
+    ASSERT_PREFIX("ab+c", "ab");
+    ASSERT_PREFIX("ab[cd]", "ab");
+    ASSERT_PREFIX("ab\\d", "ab");
+    ASSERT_PREFIX("(?i)linux", "");
+    ASSERT_PREFIX("linux|windows", "");
+    ASSERT_PREFIX(".*", "");
+#undef ASSERT_PREFIX
+}
+
 int main()
 {
     const UnitTest tests[] =
     {
         unit_test(test_has_regex_meta_chars),
+        unit_test(test_regex_literal_prefix),
     };
 
     PRINT_TEST_BANNER();
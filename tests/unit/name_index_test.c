@@ -0,0 +1,127 @@
+#include <test.h>
+
+#include <name_index.h>
+#include <rlist.h>
+
+static int VALUES[5];
+
+static StringSet *Tags(const char *tag)
+{
+    StringSet *tags = StringSetNew();
+    StringSetAdd(tags, xstrdup(tag));
+    return tags;
+}
+
+static int CompareChars(const void *a, const void *b)
+{
+    return *(const char *) a - *(const char *) b;
+}
+
+/* The indexes in VALUES of the values found, in their order unless
+ * #any_order, values of the same name have none. */
+static void AssertFound(NameIndex *index, const char *name_regex,
+                        const Rlist *tag_regexes, const char *expected,
+                        bool any_order)
+{
+    Seq *values = NameIndexLookup(index, name_regex, tag_regexes);
+    char found[16] = "";
+    for (size_t i = 0; i < SeqLength(values); i++)
+    {
+        const int *value = SeqAt(values, i);
+        const char digit[2] = { '0' + (value - VALUES), '\0' };
+        strlcat(found, digit, sizeof(found));
+    }
+    SeqDestroy(values);
+
+    if (any_order)
+    {
+        qsort(found, strlen(found), 1, CompareChars);
+    }
+    assert_string_equal(found, expected);
+}
+
+#define AssertLookup(index, name_regex, tag_regexes, expected) \
+    AssertFound(index, name_regex, tag_regexes, expected, false)
+
+static void test_lookup(void)
+{
+    NameIndex *index = NameIndexNew();
+
+    /* Not started, nothing is indexed. */
+    NameIndexPut(index, "a1", &VALUES[1], NULL);
+    assert_false(NameIndexStarted(index));
+    NameIndexStart(index);
+    AssertLookup(index, "a.*", NULL, "");
+
+    StringSet *inventory = Tags("inventory");
+    NameIndexPut(index, "b1", &VALUES[3], inventory);
+    NameIndexPut(index, "a2", &VALUES[2], inventory);
+    NameIndexPut(index, "a1", &VALUES[1], NULL);
+    StringSetDestroy(inventory);
+
+    /* By name, whatever the order they were put in. */
+    AssertLookup(index, "a.*", NULL, "12");
+    AssertLookup(index, ".*", NULL, "123");
+    AssertLookup(index, "c.*", NULL, "");
+
+    Rlist *tag_regexes = NULL;
+    RlistAppendScalar(&tag_regexes, "inv.*");
+    AssertLookup(index, "a.*", tag_regexes, "12");   /* untagged included */
+    AssertLookup(index, "b.*", tag_regexes, "3");
+
+    /* Putting a value again moves it to its new name. */
+    NameIndexPut(index, "c1", &VALUES[2], NULL);
+    AssertLookup(index, "a.*", NULL, "1");
+    AssertLookup(index, "c.*", NULL, "2");
+    AssertLookup(index, "a.*", tag_regexes, "1");
+
+    NameIndexRemove(index, &VALUES[1]);
+    NameIndexRemove(index, &VALUES[4]);                 /* never put */
+    AssertLookup(index, ".*", NULL, "32");
+    AssertLookup(index, ".*", tag_regexes, "32");
+
+    RlistDestroy(tag_regexes);
+    NameIndexDestroy(index);
+}
+
+static void test_remove(void)
+{
+    NameIndex *index = NameIndexNew();
+    NameIndexStart(index);
+
+    /* Removed before and after being sorted, with the same name. */
+    NameIndexPut(index, "x", &VALUES[0], NULL);
+    NameIndexPut(index, "x", &VALUES[1], NULL);
+    NameIndexPut(index, "x", &VALUES[2], NULL);
+    AssertFound(index, "x", NULL, "012", true);
+
+    NameIndexRemove(index, &VALUES[1]);
+    NameIndexPut(index, "x", &VALUES[3], NULL);
+    NameIndexRemove(index, &VALUES[3]);
+    AssertFound(index, "x", NULL, "02", true);
+
+    /* Removing most of them, the index compacts itself. */
+    NameIndexRemove(index, &VALUES[0]);
+    NameIndexRemove(index, &VALUES[2]);
+    AssertLookup(index, "x", NULL, "");
+
+    NameIndexPut(index, "x", &VALUES[1], NULL);
+    AssertLookup(index, "x", NULL, "1");
+
+    NameIndexClear(index);
+    AssertLookup(index, ".*", NULL, "");
+
+    NameIndexDestroy(index);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_lookup),
+        unit_test(test_remove),
+    };
+
+    return run_tests(tests);
+}
@@ -2,6 +2,10 @@
 
 #include <cf3.defs.h>
 #include <locks.h>
+#include <dbm_api.h>
+#include <eval_context.h>
+#include <policy.h>
+#include <string_lib.h>                                     /* StringStartsWith */
 #include <misc_lib.h>                                          /* xsnprintf */
 #include <known_dirs.h>
 
@@ -10,10 +14,15 @@ char CFWORKDIR[CF_BUFSIZE];
 
 static void tests_setup(void)
 {
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/persistent_lock_test.XXXXXX";
+
     OpenSSL_add_all_digests();
-    /* FIXME: get rid of hardcoded filenames */
-    xsnprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/persistent_lock_test.XXXXXX");
-    mkdtemp(CFWORKDIR);
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    mkdtemp(workdir);
+    strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
+    putenv(env);
 
     char buf[CF_BUFSIZE];
     xsnprintf(buf, CF_BUFSIZE, "%s", GetStateDir());
@@ -27,6 +36,189 @@ static void tests_teardown(void)
     system(cmd);
 }
 
+/* Whether the lock database has a lock starting with #prefix. */
+static bool LockDBHas(const char *prefix)
+{
+    CF_DB *dbp = OpenLock();
+    assert_true(dbp != NULL);
+
+    CF_DBC *dbcp;
+    assert_true(NewDBCursor(dbp, &dbcp));
+
+    bool found = false;
+    char *key;
+    void *value;
+    int ksize, vsize;
+    while (NextDB(dbcp, &key, &ksize, &value, &vsize))
+    {
+        if (StringStartsWith(key, prefix))
+        {
+            found = true;
+        }
+    }
+    DeleteDBCursor(dbcp);
+    CloseLock(dbp);
+
+    return found;
+}
+
+static void test_lock_cache(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Policy *policy = PolicyNew();
+    Bundle *bp = PolicyAppendBundle(policy, "default", "main", "agent", NULL, NULL);
+    BundleSection *section = BundleAppendSection(bp, "files");
+    const Promise *pp = BundleSectionAppendPromise(section, "/etc/motd",
+                                                   (Rval) { NULL, RVAL_TYPE_NOPROMISEE },
+                                                   "any", NULL);
+    const time_t now = time(NULL);
+
+    SetLockCaching(true);
+
+    CfLock lock = AcquireLock(ctx, "op", "host", now, 1, 60, pp, false);
+    assert_true(lock.lock != NULL);
+    YieldCurrentLockAndRemoveFromCache(ctx, lock, "op", pp);
+
+    /* Done less than a minute ago, only known in memory so far. */
+    lock = AcquireLock(ctx, "op", "host", now, 1, 60, pp, false);
+    assert_true(lock.lock == NULL);
+    assert_false(LockDBHas("last."));
+
+    assert_true(FlushLockCache());
+    assert_true(LockDBHas("last."));
+    /* Taken and yielded in between, so never written. */
+    assert_false(LockDBHas("lock."));
+
+    /* Read back in by the next run. */
+    SetLockCaching(false);
+    SetLockCaching(true);
+    EvalContext *next_ctx = EvalContextNew();
+    lock = AcquireLock(next_ctx, "op", "host", now, 1, 60, pp, false);
+    assert_true(lock.lock == NULL);
+    EvalContextDestroy(next_ctx);
+
+    SetLockCaching(false);
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+}
+
+/* The number of running lock files. */
+static int RunningLockFiles(void)
+{
+    char path[CF_BUFSIZE];
+    xsnprintf(path, sizeof(path), "%s/running_locks", GetStateDir());
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    const struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+/* Acquires #pp's lock at #now in a fresh context, as a new agent run. */
+static CfLock AcquireLockAt(const Promise *pp, time_t now)
+{
+    EvalContext *ctx = EvalContextNew();
+    CfLock lock = AcquireLock(ctx, "op", "host", now, 0, 60, pp, false);
+    EvalContextDestroy(ctx);
+    return lock;
+}
+
+static void test_running_lock(void)
+{
+    Policy *policy = PolicyNew();
+    Bundle *bp = PolicyAppendBundle(policy, "default", "main", "agent", NULL, NULL);
+    BundleSection *section = BundleAppendSection(bp, "commands");
+    const Promise *pp = BundleSectionAppendPromise(section, "/bin/sleep",
+                                                   (Rval) { NULL, RVAL_TYPE_NOPROMISEE },
+                                                   "any", NULL);
+
+    /* The lock entries of the child are not seen, only its running lock. */
+    SetLockCaching(true);
+
+    /* Reaped right away, not left a zombie when killed. */
+    signal(SIGCHLD, SIG_IGN);
+
+    int fds[2];
+    assert_int_equal(pipe(fds), 0);
+    const time_t taken = time(NULL);
+    const pid_t child = fork();
+    assert_true(child != -1);
+    if (child == 0)
+    {
+        CfLock lock = AcquireLockAt(pp, taken);
+        const char held = (lock.lock != NULL) ? 'y' : 'n';
+        if (write(fds[1], &held, 1) != 1)
+        {
+            _exit(1);
+        }
+        for (;;)
+        {
+            pause();
+        }
+    }
+
+    char held;
+    assert_int_equal(read(fds[0], &held, 1), 1);
+    assert_int_equal(held, 'y');
+
+    /* Taken less than expireafter before, however long the child ran. */
+    CfLock lock = AcquireLockAt(pp, taken + 59 * 60);
+    assert_true(lock.lock == NULL);
+    assert_int_equal(kill(child, 0), 0);
+
+    /* Then the child is killed and the lock is ours. */
+    lock = AcquireLockAt(pp, taken + 61 * 60);
+    assert_true(lock.lock != NULL);
+    assert_int_equal(kill(child, 0), -1);
+
+    signal(SIGCHLD, SIG_DFL);
+
+    /* Expiring our own lock entry takes the running lock once more. */
+    CfLock inner = AcquireLockAt(pp, taken + 180 * 60);
+    assert_true(inner.lock != NULL);
+    YieldCurrentLock(inner);
+
+    /* The outer hold is still seen by other processes. */
+    const pid_t other = fork();
+    assert_true(other != -1);
+    if (other == 0)
+    {
+        _exit((AcquireLockAt(pp, taken + 30 * 60).lock == NULL) ? 0 : 1);
+    }
+    int status;
+    assert_int_equal(waitpid(other, &status, 0), other);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+    assert_int_equal(RunningLockFiles(), 1);
+
+    /* The file goes away with the last hold. */
+    SetLockCaching(false);
+    YieldCurrentLock(lock);
+    assert_int_equal(RunningLockFiles(), 0);
+
+    /* Without lock_cache, the lock entries are enough. */
+    lock = AcquireLockAt(pp, taken + 240 * 60);
+    assert_true(lock.lock != NULL);
+    assert_int_equal(RunningLockFiles(), 0);
+    YieldCurrentLock(lock);
+
+    close(fds[0]);
+    close(fds[1]);
+    PolicyDestroy(policy);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -34,7 +226,8 @@ int main()
 
     const UnitTest tests[] =
       {
-
+          unit_test(test_lock_cache),
+          unit_test(test_running_lock),
       };
 
     int ret = run_tests(tests);
@@ -0,0 +1,156 @@
+#include <test.h>
+
+#include <policy_cache.h>
+#include <policy.h>
+#include <parser.h>
+#include <bootstrap.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+#include <known_dirs.h>
+
+char CFWORKDIR[CF_BUFSIZE];
+char FAILSAFE[CF_BUFSIZE];
+
+static void tests_setup(void)
+{
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/policy_cache_test.XXXXXX";
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    assert(workdir - 1 && workdir[0] == '/');
+
+    mkdtemp(workdir);
+    strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
+    putenv(env);
+    mkdir(GetStateDir(), (S_IRWXU | S_IRWXG | S_IRWXO));
+
+    xsnprintf(FAILSAFE, sizeof(FAILSAFE), "%s/failsafe.cf", CFWORKDIR);
+    WriteBuiltinFailsafePolicyToPath(FAILSAFE);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", GetStateDir());
+    system(cmd);
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static Policy *ParseTestPolicy(const char *path)
+{
+    Policy *policy = ParserParseFile(AGENT_TYPE_AGENT, path, 0, 0);
+    assert_true(policy != NULL);
+    return policy;
+}
+
+static char *PolicyToJsonString(const Policy *policy)
+{
+    JsonElement *json = PolicyToJson(policy);
+    Writer *w = StringWriter();
+    JsonWrite(w, json, 0);
+    JsonDestroy(json);
+    return StringWriterClose(w);
+}
+
+static void assert_policies_equal(const Policy *expected, const Policy *actual)
+{
+    char *expected_json = PolicyToJsonString(expected);
+    char *actual_json = PolicyToJsonString(actual);
+    assert_string_equal(expected_json, actual_json);
+    free(expected_json);
+    free(actual_json);
+
+    /* Not all of the offset is in the JSON. */
+    const Bundle *expected_bundle = SeqAt(expected->bundles, 0);
+    const Bundle *actual_bundle = SeqAt(actual->bundles, 0);
+    assert_memory_equal(&expected_bundle->offset, &actual_bundle->offset,
+                        sizeof(SourceOffset));
+}
+
+static void test_round_trip(void)
+{
+    const char *files[] = { FAILSAFE, TESTDATADIR "/benchmark.cf" };
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        Policy *parsed = ParseTestPolicy(files[i]);
+        Buffer *serialized = PolicyCacheSerialize(parsed, files[i], "SHA=1");
+
+        Policy *cached = PolicyCacheDeserialize(BufferData(serialized),
+                                                BufferSize(serialized),
+                                                files[i], "SHA=1");
+        assert_true(cached != NULL);
+        assert_policies_equal(parsed, cached);
+
+        PolicyDestroy(cached);
+        BufferDestroy(serialized);
+        PolicyDestroy(parsed);
+    }
+}
+
+static void test_corrupt(void)
+{
+    Policy *parsed = ParseTestPolicy(FAILSAFE);
+    Buffer *serialized = PolicyCacheSerialize(parsed, FAILSAFE, "SHA=1");
+    const char *data = BufferData(serialized);
+    const size_t size = BufferSize(serialized);
+
+    /* Every truncation is detected. */
+    for (size_t len = 0; len < size; len++)
+    {
+        assert_true(PolicyCacheDeserialize(data, len, FAILSAFE, "SHA=1") == NULL);
+    }
+
+    /* So is trailing garbage. */
+    char *longer = xmalloc(size + 1);
+    memcpy(longer, data, size);
+    longer[size] = 'x';
+    assert_true(PolicyCacheDeserialize(longer, size + 1, FAILSAFE, "SHA=1") == NULL);
+    free(longer);
+
+    BufferDestroy(serialized);
+    PolicyDestroy(parsed);
+}
+
+static void test_store_load(void)
+{
+    Policy *parsed = ParseTestPolicy(FAILSAFE);
+
+    assert_true(PolicyCacheLoad(FAILSAFE, "SHA=1") == NULL);
+    assert_false(PolicyCacheIsFresh(FAILSAFE, "SHA=1"));
+
+    Buffer *serialized = PolicyCacheSerialize(parsed, FAILSAFE, "SHA=1");
+    assert_true(PolicyCacheStore(FAILSAFE, serialized));
+    BufferDestroy(serialized);
+
+    Policy *cached = PolicyCacheLoad(FAILSAFE, "SHA=1");
+    assert_true(cached != NULL);
+    assert_policies_equal(parsed, cached);
+    PolicyDestroy(cached);
+    assert_true(PolicyCacheIsFresh(FAILSAFE, "SHA=1"));
+
+    /* The file changed, or another file with the same cache file name. */
+    assert_true(PolicyCacheLoad(FAILSAFE, "SHA=2") == NULL);
+    assert_true(PolicyCacheLoad("/some/other/file.cf", "SHA=1") == NULL);
+    assert_false(PolicyCacheIsFresh(FAILSAFE, "SHA=2"));
+
+    PolicyDestroy(parsed);
+}
+
+int main()
+{
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_round_trip),
+            unit_test(test_corrupt),
+            unit_test(test_store_load),
+        };
+
+    PRINT_TEST_BANNER();
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
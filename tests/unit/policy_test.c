@@ -336,6 +336,91 @@ static void test_policy_json_offsets(void)
 }
 
 
+static void test_policy_lookup(void)
+{
+    Policy *a = PolicyNew();
+    Bundle *main_a = PolicyAppendBundle(a, "default", "main", "agent", NULL, NULL);
+    Body *perms_a = PolicyAppendBody(a, "default", "p", "perms", NULL, NULL, false);
+
+    Policy *b = PolicyNew();
+    Bundle *main_b = PolicyAppendBundle(b, "ns1", "main", "agent", NULL, NULL);
+    Bundle *common_b = PolicyAppendBundle(b, "ns1", "main", "common", NULL, NULL);
+    Body *perms_b = PolicyAppendBody(b, "ns1", "p", "perms", NULL, NULL, false);
+
+    Policy *policy = PolicyMerge(a, b);
+
+    /* The first match in the policy wins. */
+    assert_true(PolicyGetBundle(policy, NULL, "agent", "main") == main_a);
+    assert_true(PolicyGetBundle(policy, NULL, NULL, "main") == main_a);
+    assert_true(PolicyGetBundle(policy, "ns1", "agent", "main") == main_b);
+    assert_true(PolicyGetBundle(policy, "ns1", "agent", "ns1:main") == main_b);
+    assert_true(PolicyGetBundle(policy, NULL, "common", "main") == common_b);
+    assert_true(PolicyGetBundle(policy, NULL, "agent", "other") == NULL);
+    assert_true(PolicyGetBundle(policy, "ns2", "agent", "main") == NULL);
+
+    assert_true(PolicyGetBody(policy, NULL, "perms", "p") == perms_a);
+    assert_true(PolicyGetBody(policy, "ns1", "perms", "p") == perms_b);
+    assert_true(PolicyGetBody(policy, NULL, "acl", "p") == NULL);
+
+    /* Appending keeps the indexes up to date. */
+    Body *acl = PolicyAppendBody(policy, "default", "p", "acl", NULL, NULL, false);
+    assert_true(PolicyGetBody(policy, NULL, "acl", "p") == acl);
+
+    /* Renaming needs a rebuild. */
+    free(main_a->name);
+    main_a->name = xstrdup("renamed");
+    PolicyRebuildIndexes(policy);
+    assert_true(PolicyGetBundle(policy, NULL, "agent", "main") == main_b);
+    assert_true(PolicyGetBundle(policy, NULL, "agent", "renamed") == main_a);
+
+    PolicyDestroy(policy);
+}
+
+static void test_policy_merge_all(void)
+{
+    Seq *policies = SeqNew(10, NULL);
+    for (int i = 0; i < 10; i++)
+    {
+        char name[16];
+        xsnprintf(name, sizeof(name), "b%d", i);
+
+        Policy *part = PolicyNew();
+        PolicyAppendBundle(part, "default", name, "agent", NULL, NULL);
+        PolicyAppendBody(part, "default", name, "perms", NULL, NULL, false);
+        SeqAppend(policies, part);
+    }
+
+    Policy *policy = PolicyMergeAll(policies);
+    assert_true(policy == SeqAt(policies, 0));
+    SeqDestroy(policies);
+
+    /* Everything is there, in order, and belongs to the merged policy. */
+    assert_int_equal(10, SeqLength(policy->bundles));
+    assert_int_equal(10, SeqLength(policy->bodies));
+    for (int i = 0; i < 10; i++)
+    {
+        char name[16];
+        xsnprintf(name, sizeof(name), "b%d", i);
+
+        const Bundle *bp = SeqAt(policy->bundles, i);
+        assert_string_equal(name, bp->name);
+        assert_true(bp->parent_policy == policy);
+        assert_true(PolicyGetBundle(policy, NULL, "agent", name) == bp);
+
+        const Body *bdp = SeqAt(policy->bodies, i);
+        assert_true(bdp->parent_policy == policy);
+        assert_true(PolicyGetBody(policy, NULL, "perms", name) == bdp);
+    }
+
+    PolicyDestroy(policy);
+
+    policies = SeqNew(1, NULL);
+    policy = PolicyMergeAll(policies);
+    assert_int_equal(0, SeqLength(policy->bundles));
+    PolicyDestroy(policy);
+    SeqDestroy(policies);
+}
+
 static void test_util_bundle_qualified_name(void)
 {
     Bundle *b = xcalloc(1, sizeof(struct Bundle_));
@@ -472,6 +557,8 @@ int main()
 
         unit_test(test_policy_json_to_from),
         unit_test(test_policy_json_offsets),
+        unit_test(test_policy_lookup),
+        unit_test(test_policy_merge_all),
 
         unit_test(test_util_bundle_qualified_name),
         unit_test(test_util_qualified_name_components),
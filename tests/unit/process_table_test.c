@@ -0,0 +1,210 @@
+#include <test.h>
+
+#include <process_table.h>
+#include <item_lib.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+#include <string_lib.h>
+
+/* A fake /proc with just what ProcessTableLoadProc() reads. */
+static char PROC_DIR[] = "/tmp/process_table_test.XXXXXX";
+
+#define BOOT_TIME 1600000000
+
+static void WriteProcFile(const char *name, const char *contents)
+{
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/%s", PROC_DIR, name);
+    FILE *fp = fopen(path, "w");
+    assert_true(fp != NULL);
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+/* The arguments, each NUL-terminated. */
+static void WriteCmdline(pid_t pid, const char *const *args)
+{
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/%jd/cmdline", PROC_DIR, (intmax_t) pid);
+    FILE *fp = fopen(path, "w");
+    assert_true(fp != NULL);
+    for (int i = 0; args[i] != NULL; i++)
+    {
+        fwrite(args[i], 1, strlen(args[i]) + 1, fp);
+    }
+    fclose(fp);
+}
+
+static void WriteProcess(pid_t pid, const char *comm, char state,
+                         unsigned long long start_ticks, uid_t uid)
+{
+    char name[64], contents[CF_BUFSIZE];
+
+    xsnprintf(name, sizeof(name), "%s/%jd", PROC_DIR, (intmax_t) pid);
+    mkdir(name, 0700);
+
+    /* 2 seconds of CPU, 2 threads, 8 MiB virtual, 256 pages resident. */
+    xsnprintf(name, sizeof(name), "%jd/stat", (intmax_t) pid);
+    xsnprintf(contents, sizeof(contents),
+              "%jd (%s) %c 1 %jd %jd 34816 0 4202752 0 0 0 0 150 50 0 0 20 -5 2 0 "
+              "%llu 8388608 256 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0\n",
+              (intmax_t) pid, comm, state, (intmax_t) pid, (intmax_t) pid,
+              start_ticks);
+    WriteProcFile(name, contents);
+
+    xsnprintf(name, sizeof(name), "%jd/status", (intmax_t) pid);
+    xsnprintf(contents, sizeof(contents),
+              "Name:\t%s\nState:\t%c\nPid:\t%jd\nUid:\t1\t%ju\t1\t1\n",
+              comm, state, (intmax_t) pid, (uintmax_t) uid);
+    WriteProcFile(name, contents);
+}
+
+static void tests_setup(void)
+{
+    assert_true(mkdtemp(PROC_DIR) != NULL);
+
+    WriteProcFile("stat",
+                  "cpu  1 2 3 4\n"
+                  "intr 1 2 3\n"
+                  "btime 1600000000\n");
+    /* Up for a day. */
+    WriteProcFile("uptime", "86400.00 10.00\n");
+    WriteProcFile("meminfo", "MemTotal:        1024000 kB\n");
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", PROC_DIR);
+    system(cmd);
+}
+
+static void test_load(void)
+{
+    const long ticks = sysconf(_SC_CLK_TCK);
+
+    /* Started 200 seconds after boot. */
+    WriteProcess(42, "my (daemon)", 'S', 200 * ticks, 0);
+    const char *const args[] = { "/usr/sbin/daemon", "-f", "a b", NULL };
+    WriteCmdline(42, args);
+
+    /* A kernel thread, no command line. */
+    WriteProcess(7, "kworker/0:1", 'I', 0, 0);
+    const char *const no_args[] = { NULL };
+    WriteCmdline(7, no_args);
+
+    ProcessTable *table = ProcessTableNew();
+    assert_true(ProcessTableLoadProc(table, PROC_DIR));
+    assert_int_equal(ProcessTableTime(table), BOOT_TIME + 86400);
+
+    /* Sorted by pid. */
+    assert_int_equal(ProcessTableLength(table), 2);
+    assert_int_equal(ProcessTableAt(table, 0)->pid, 7);
+    assert_int_equal(ProcessTableAt(table, 1)->pid, 42);
+    assert_true(ProcessTableGet(table, 43) == NULL);
+
+    const ProcessInfo *info = ProcessTableGet(table, 42);
+    assert_true(info != NULL);
+    assert_string_equal(info->comm, "my (daemon)");
+    assert_string_equal(info->command, "/usr/sbin/daemon -f a b");
+    assert_string_equal(info->user, "root");
+    assert_int_equal(info->ppid, 1);
+    assert_int_equal(info->pgid, 42);
+    assert_int_equal(info->state, 'S');
+    assert_int_equal(info->nice, -5);
+    assert_int_equal(info->threads, 2);
+    assert_int_equal(info->vsize, 8192);
+    assert_int_equal(info->rss, 256 * (sysconf(_SC_PAGESIZE) / 1024));
+    assert_int_equal(info->start_time, BOOT_TIME + 200);
+    assert_int_equal(info->cpu_time, 200 / ticks);
+    assert_string_equal(info->tty, "pts/0");
+
+    assert_string_equal(ProcessTableGet(table, 7)->command, "[kworker/0:1]");
+
+    /* The ps view has a header and a line per process. */
+    Item *lines = ProcessTableToPsOutput(table);
+    assert_int_equal(ListLen(lines), 3);
+    assert_true(StringStartsWith(lines->name, "USER"));
+    assert_true(StringEndsWith(lines->name, "COMMAND"));
+    assert_true(StringStartsWith(lines->next->next->name, "root "));
+    assert_true(StringEndsWith(lines->next->next->name,
+                               " 12:30    23:56:40    00:00:02 /usr/sbin/daemon -f a b"));
+    assert_int_equal(lines->next->next->counter, 42);
+    /* Up as long as the system, a day. */
+    assert_true(StringEndsWith(lines->next->name,
+                               "  1-00:00:00    00:00:02 [kworker/0:1]"));
+    DeleteItemList(lines);
+
+    ProcessTableDestroy(table);
+}
+
+static void test_reload(void)
+{
+    const long ticks = sysconf(_SC_CLK_TCK);
+
+    WriteProcess(100, "sleep", 'S', 1000 * ticks, 54321);
+    const char *const args[] = { "sleep", "60", NULL };
+    WriteCmdline(100, args);
+
+    ProcessTable *table = ProcessTableNew();
+    assert_true(ProcessTableLoadProc(table, PROC_DIR));
+    const ProcessInfo *info = ProcessTableGet(table, 100);
+    assert_true(info != NULL);
+    assert_string_equal(info->command, "sleep 60");
+
+    /* The same process, changing its state and its title. */
+    const char *const changed_args[] = { "sleep", "120", NULL };
+    WriteCmdline(100, changed_args);
+    WriteProcess(100, "sleep", 'R', 1000 * ticks, 54321);
+    assert_true(ProcessTableLoadProc(table, PROC_DIR));
+    info = ProcessTableGet(table, 100);
+    assert_int_equal(info->state, 'R');
+    assert_string_equal(info->command, "sleep 120");
+
+    /* setuid() without an exec. */
+    WriteProcess(100, "sleep", 'R', 1000 * ticks, 0);
+    assert_true(ProcessTableLoadProc(table, PROC_DIR));
+    info = ProcessTableGet(table, 100);
+    assert_int_equal(info->uid, 0);
+    assert_string_equal(info->user, "root");
+
+    /* Another process with the same pid. */
+    const char *const other_args[] = { "sh", "-c", "true", NULL };
+    WriteCmdline(100, other_args);
+    WriteProcess(100, "sh", 'R', 2000 * ticks, 54321);
+    assert_true(ProcessTableLoadProc(table, PROC_DIR));
+    assert_string_equal(ProcessTableGet(table, 100)->command, "sh -c true");
+
+    /* Gone. */
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s/100'", PROC_DIR);
+    system(cmd);
+    assert_true(ProcessTableLoadProc(table, PROC_DIR));
+    assert_true(ProcessTableGet(table, 100) == NULL);
+
+    /* A broken /proc leaves the table alone. */
+    assert_false(ProcessTableLoadProc(table, "/nonexistent"));
+    assert_true(ProcessTableGet(table, 42) != NULL);
+
+    ProcessTableDestroy(table);
+}
+
+int main()
+{
+    /* Fixed, for the STIME in the ps view. */
+    putenv("TZ=UTC");
+    tzset();
+
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_load),
+            unit_test(test_reload),
+        };
+
+    PRINT_TEST_BANNER();
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
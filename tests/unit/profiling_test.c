@@ -0,0 +1,161 @@
+#include <test.h>
+
+#include <profiling.h>
+
+static long GetInteger(const JsonElement *object, const char *key)
+{
+    const JsonElement *value = JsonObjectGet(object, key);
+    assert_true(value != NULL);
+    return JsonPrimitiveGetAsInteger(value);
+}
+
+static void test_disabled(void)
+{
+    assert_false(PROFILING);
+
+    /* No-ops. */
+    ProfileEnter(PROFILE_FRAME_BUNDLE, "agent", "main");
+    ProfileCount(PROFILE_COUNTER_EXPANSIONS);
+    ProfileLeave();
+
+    assert_true(ProfilingReport() == NULL);
+}
+
+static void test_frames(void)
+{
+    ProfilingStart();
+    assert_true(PROFILING);
+
+    ProfileEnter(PROFILE_FRAME_BUNDLE, "agent", "main");
+    for (int i = 0; i < 3; i++)
+    {
+        ProfileEnter(PROFILE_FRAME_PROMISE, "files", "/etc/motd");
+        ProfileCount(PROFILE_COUNTER_ITERATIONS);
+        ProfileEnter(PROFILE_FRAME_FUNCTION, NULL, "readfile");
+        ProfileCount(PROFILE_COUNTER_EXPANSIONS);
+        ProfileLeave();
+        ProfileLeave();
+    }
+    ProfileEnter(PROFILE_FRAME_PROMISE, "vars", "x");
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    ProfileLeave();
+    ProfileLeave();
+
+    /* Still in this one, it counts until now. */
+    ProfileEnter(PROFILE_FRAME_BUNDLE, "agent", "other");
+    ProfileCount(PROFILE_COUNTER_CLASS_EVALUATIONS);
+
+    JsonElement *report = ProfilingReport();
+    assert_true(report != NULL);
+    assert_string_equal(JsonObjectGetAsString(report, "name"), "all");
+
+    JsonElement *bundles = JsonObjectGetAsArray(report, "children");
+    assert_int_equal(JsonLength(bundles), 2);
+
+    JsonElement *main_bundle = JsonArrayGetAsObject(bundles, 0);
+    assert_string_equal(JsonObjectGetAsString(main_bundle, "name"), "agent main");
+    assert_string_equal(JsonObjectGetAsString(main_bundle, "type"), "bundle");
+    assert_int_equal(GetInteger(main_bundle, "count"), 1);
+
+    /* The counters of a frame include those below it. */
+    JsonElement *counters = JsonObjectGetAsObject(main_bundle, "counters");
+    assert_int_equal(GetInteger(counters, "iterations"), 3);
+    assert_int_equal(GetInteger(counters, "expansions"), 3);
+    assert_int_equal(GetInteger(counters, "db_operations"), 1);
+    assert_int_equal(GetInteger(counters, "class_evaluations"), 0);
+
+    JsonElement *promises = JsonObjectGetAsArray(main_bundle, "children");
+    assert_int_equal(JsonLength(promises), 2);
+    JsonElement *files = JsonArrayGetAsObject(promises, 0);
+    assert_string_equal(JsonObjectGetAsString(files, "name"), "files /etc/motd");
+    assert_string_equal(JsonObjectGetAsString(files, "type"), "promise");
+    assert_int_equal(GetInteger(files, "count"), 3);
+
+    JsonElement *functions = JsonObjectGetAsArray(files, "children");
+    assert_int_equal(JsonLength(functions), 1);
+    JsonElement *readfile = JsonArrayGetAsObject(functions, 0);
+    assert_string_equal(JsonObjectGetAsString(readfile, "name"), "readfile()");
+    assert_string_equal(JsonObjectGetAsString(readfile, "type"), "function");
+    assert_int_equal(GetInteger(readfile, "count"), 3);
+    assert_true(JsonObjectGet(readfile, "children") == NULL);
+
+    /* A frame takes at least as long as those below it. */
+    assert_true(GetInteger(main_bundle, "value") >= GetInteger(files, "value"));
+    assert_true(GetInteger(files, "value") >= GetInteger(readfile, "value"));
+
+    counters = JsonObjectGetAsObject(report, "counters");
+    assert_int_equal(GetInteger(counters, "class_evaluations"), 1);
+    assert_int_equal(GetInteger(counters, "expansions"), 3);
+
+    JsonDestroy(report);
+
+    ProfileLeave();
+    ProfilingStop();
+    assert_false(PROFILING);
+}
+
+static void *CountInThread(ARG_UNUSED void *arg)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+    }
+    ProfileEnter(PROFILE_FRAME_FUNCTION, NULL, "readfile");
+    ProfileLeave();
+    return NULL;
+}
+
+static void test_other_threads(void)
+{
+    ProfilingStart();
+    ProfileCount(PROFILE_COUNTER_DB_OPERATIONS);
+
+    /* Ignored, like database operations of worker threads are. */
+    pthread_t tid;
+    assert_int_equal(pthread_create(&tid, NULL, CountInThread, NULL), 0);
+    assert_int_equal(pthread_join(tid, NULL), 0);
+
+    JsonElement *report = ProfilingReport();
+    JsonElement *counters = JsonObjectGetAsObject(report, "counters");
+    assert_int_equal(GetInteger(counters, "db_operations"), 1);
+    assert_true(JsonObjectGet(report, "children") == NULL);
+    JsonDestroy(report);
+
+    ProfilingStop();
+}
+
+static void test_write_report(void)
+{
+    char path[] = "/tmp/profiling_test.XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd != -1);
+    close(fd);
+
+    assert_false(ProfilingWriteReport(path));
+
+    ProfilingStart();
+    ProfileEnter(PROFILE_FRAME_BUNDLE, "agent", "main");
+    ProfileLeave();
+    assert_true(ProfilingWriteReport(path));
+    ProfilingStop();
+
+    struct stat sb;
+    assert_int_equal(stat(path, &sb), 0);
+    assert_true(sb.st_size > 0);
+
+    unlink(path);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_disabled),
+        unit_test(test_frames),
+        unit_test(test_other_threads),
+        unit_test(test_write_report),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,85 @@
+#include <test.h>
+
+#include <regex_cache.h>
+#include <profiling.h>
+
+static void test_match(void)
+{
+    RegexCacheClear();
+
+    assert_true(RegexCacheMatchFull("a.*z", "abcz"));
+    assert_false(RegexCacheMatchFull("a.*z", "abcz "));
+    assert_false(RegexCacheMatchFull("b", "abc"));
+    /* Invalid regexes don't match and are not cached. */
+    assert_false(RegexCacheMatchFull("(", "("));
+
+    CachedRegex *regex = RegexCacheGet("b");
+    assert_true(regex != NULL);
+    assert_true(CachedRegexMatch(regex, "abc"));
+    assert_false(CachedRegexMatchFull(regex, "abc"));
+    RegexCacheRelease(regex);
+
+    size_t hits, misses, size;
+    RegexCacheStats(&hits, &misses, &size);
+    assert_int_equal(hits, 2);
+    assert_int_equal(misses, 3);
+    assert_int_equal(size, 2);
+}
+
+static void test_eviction(void)
+{
+    RegexCacheClear();
+
+    /* Still usable after being pushed out. */
+    CachedRegex *held = RegexCacheGet("held");
+    assert_true(held != NULL);
+
+    char pattern[32];
+    for (int i = 0; i < REGEX_CACHE_SIZE + 10; i++)
+    {
+        snprintf(pattern, sizeof(pattern), "p%d", i);
+        assert_true(RegexCacheMatchFull(pattern, pattern));
+    }
+
+    size_t hits, misses, size;
+    RegexCacheStats(&hits, &misses, &size);
+    assert_int_equal(size, REGEX_CACHE_SIZE);
+
+    assert_true(CachedRegexMatchFull(held, "held"));
+    RegexCacheRelease(held);
+
+    /* The most recently used ones stay. */
+    RegexCacheMatchFull(pattern, pattern);
+    RegexCacheStats(&hits, &misses, &size);
+    assert_int_equal(hits, 1);
+}
+
+static void test_profiling(void)
+{
+    RegexCacheClear();
+    ProfilingStart();
+
+    RegexCacheMatchFull("x+", "xx");
+    RegexCacheMatchFull("x+", "xxx");
+
+    JsonElement *report = ProfilingReport();
+    JsonElement *counters = JsonObjectGetAsObject(report, "counters");
+    assert_int_equal(JsonPrimitiveGetAsInteger(JsonObjectGet(counters, "regex_cache_hits")), 1);
+    assert_int_equal(JsonPrimitiveGetAsInteger(JsonObjectGet(counters, "regex_cache_misses")), 1);
+    JsonDestroy(report);
+
+    ProfilingStop();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_match),
+        unit_test(test_eviction),
+        unit_test(test_profiling),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,188 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <server_compress_cache.h>
+#include <file_compress.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+
+char TESTDIR[] = "/tmp/server_compress_cache_test.XXXXXX";
+char FILE1[CF_BUFSIZE];
+char FILE2[CF_BUFSIZE];
+
+static void WriteTestFile(const char *path, const char *contents)
+{
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    assert_true(fputs(contents, f) >= 0);
+    assert_int_equal(fclose(f), 0);
+}
+
+static void tests_setup(void)
+{
+    assert_true(mkdtemp(TESTDIR) != NULL);
+
+    xsnprintf(FILE1, sizeof(FILE1), "%s/file1", TESTDIR);
+    xsnprintf(FILE2, sizeof(FILE2), "%s/file2", TESTDIR);
+    WriteTestFile(FILE1, "first file\n");
+    WriteTestFile(FILE2, "second file\n");
+
+    /* Files modified within the current second are not cached. */
+    sleep(1);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", TESTDIR);
+    system(cmd);
+}
+
+static void setup(void)
+{
+    ServerCompressCacheConfigure(0);
+}
+
+/* Get #path through the cache, check it decompresses to the file. */
+static void assert_get(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    assert_true(fd != -1);
+    struct stat sb;
+    assert_int_equal(fstat(fd, &sb), 0);
+
+    CompressCacheEntry *entry = ServerCompressCacheGet(path, fd, &sb);
+    assert_true(entry != NULL);
+
+    size_t len;
+    const unsigned char *data = CompressCacheEntryData(entry, &len);
+    unsigned char *expected;
+    size_t expected_len;
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    assert_true(CompressFileToBuffer(fd, sb.st_size, &expected, &expected_len));
+    assert_int_equal(len, expected_len);
+    assert_memory_equal(data, expected, len);
+
+    free(expected);
+    ServerCompressCacheRelease(entry);
+    close(fd);
+}
+
+static void test_disabled(void)
+{
+    setup();
+
+    ServerCompressCacheStats stats;
+    assert_false(ServerCompressCacheGetStats(&stats));
+
+    int fd = open(FILE1, O_RDONLY);
+    struct stat sb;
+    assert_int_equal(fstat(fd, &sb), 0);
+    assert_true(ServerCompressCacheGet(FILE1, fd, &sb) == NULL);
+    close(fd);
+}
+
+static void test_hit(void)
+{
+    setup();
+    ServerCompressCacheConfigure(1024 * 1024);
+
+    assert_get(FILE1);
+    assert_get(FILE1);
+    assert_get(FILE1);
+
+    ServerCompressCacheStats stats;
+    assert_true(ServerCompressCacheGetStats(&stats));
+    assert_int_equal(stats.entries, 1);
+    assert_int_equal(stats.misses, 1);
+    assert_int_equal(stats.hits, 2);
+    assert_true(stats.bytes > 0);
+}
+
+static void test_eviction(void)
+{
+    setup();
+    ServerCompressCacheConfigure(1024 * 1024);
+
+    assert_get(FILE1);
+    assert_get(FILE2);
+
+    /* Shrinking evicts the least recently used one. */
+    ServerCompressCacheStats stats;
+    assert_true(ServerCompressCacheGetStats(&stats));
+    assert_int_equal(stats.entries, 2);
+    ServerCompressCacheConfigure(stats.bytes - 1);
+
+    assert_get(FILE2);
+
+    assert_true(ServerCompressCacheGetStats(&stats));
+    assert_int_equal(stats.entries, 1);
+    assert_int_equal(stats.hits, 1);
+    assert_int_equal(stats.evictions, 1);
+}
+
+static void test_release_after_clear(void)
+{
+    setup();
+    ServerCompressCacheConfigure(1024 * 1024);
+
+    int fd = open(FILE1, O_RDONLY);
+    struct stat sb;
+    assert_int_equal(fstat(fd, &sb), 0);
+    CompressCacheEntry *entry = ServerCompressCacheGet(FILE1, fd, &sb);
+    assert_true(entry != NULL);
+
+    /* Still being sent, must stay valid until released. */
+    ServerCompressCacheClear();
+    size_t len;
+    assert_true(CompressCacheEntryData(entry, &len) != NULL);
+    assert_true(len > 0);
+    ServerCompressCacheRelease(entry);
+    close(fd);
+
+    ServerCompressCacheStats stats;
+    assert_true(ServerCompressCacheGetStats(&stats));
+    assert_int_equal(stats.entries, 0);
+    assert_int_equal(stats.bytes, 0);
+}
+
+static void test_changed_file(void)
+{
+    setup();
+    ServerCompressCacheConfigure(1024 * 1024);
+
+    assert_get(FILE2);
+    WriteTestFile(FILE2, "second file, changed\n");
+    assert_get(FILE2);
+
+    ServerCompressCacheStats stats;
+    assert_true(ServerCompressCacheGetStats(&stats));
+    assert_int_equal(stats.misses, 2);
+    assert_int_equal(stats.hits, 0);
+}
+
+int main()
+{
+    if (!CompressAvailable())
+    {
+        return 0;
+    }
+
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_disabled),
+            unit_test(test_hit),
+            unit_test(test_eviction),
+            unit_test(test_release_after_clear),
+            /* Last, files changed within the current second aren't cached. */
+            unit_test(test_changed_file),
+        };
+
+    PRINT_TEST_BANNER();
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
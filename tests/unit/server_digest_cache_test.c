@@ -0,0 +1,243 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <server_digest_cache.h>
+#include <hash.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+#include <known_dirs.h>
+
+
+char CFWORKDIR[CF_BUFSIZE];
+char FILE1[CF_BUFSIZE];
+char FILE2[CF_BUFSIZE];
+char THREAD_FILES[4][CF_BUFSIZE];
+
+static void WriteTestFile(const char *path, const char *contents)
+{
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    assert_true(fputs(contents, f) >= 0);
+    assert_int_equal(fclose(f), 0);
+}
+
+static void tests_setup(void)
+{
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/server_digest_cache_test.XXXXXX";
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    assert(workdir - 1 && workdir[0] == '/');
+
+    OpenSSL_add_all_digests();
+    mkdtemp(workdir);
+    strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
+    putenv(env);
+    mkdir(GetStateDir(), (S_IRWXU | S_IRWXG | S_IRWXO));
+
+    xsnprintf(FILE1, sizeof(FILE1), "%s/file1", CFWORKDIR);
+    xsnprintf(FILE2, sizeof(FILE2), "%s/file2", CFWORKDIR);
+    WriteTestFile(FILE1, "first file\n");
+    WriteTestFile(FILE2, "second file\n");
+    for (size_t i = 0; i < sizeof(THREAD_FILES) / sizeof(THREAD_FILES[0]); i++)
+    {
+        xsnprintf(THREAD_FILES[i], sizeof(THREAD_FILES[i]),
+                  "%s/thread_file%zu", CFWORKDIR, i);
+        WriteTestFile(THREAD_FILES[i], THREAD_FILES[i]);
+    }
+
+    /* Files modified within the current second are not cached. */
+    sleep(1);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", GetStateDir());
+    system(cmd);
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static void setup(void)
+{
+    ServerDigestCacheConfigure(0, false);
+}
+
+static void assert_digest_correct(const char *path)
+{
+    unsigned char expected[EVP_MAX_MD_SIZE + 1] = { 0 };
+    unsigned char actual[EVP_MAX_MD_SIZE + 1] = { 0 };
+
+    HashFile(path, expected, HASH_METHOD_MD5, false);
+    ServerDigestCacheHashFile(path, actual, HASH_METHOD_MD5);
+    assert_memory_equal(expected, actual, sizeof(expected));
+}
+
+static void test_disabled(void)
+{
+    setup();
+
+    ServerDigestCacheStats stats;
+    assert_false(ServerDigestCacheGetStats(&stats));
+    assert_digest_correct(FILE1);
+}
+
+static void test_hit(void)
+{
+    setup();
+    ServerDigestCacheConfigure(10, false);
+
+    assert_digest_correct(FILE1);
+    assert_digest_correct(FILE1);
+    assert_digest_correct(FILE1);
+
+    ServerDigestCacheStats stats;
+    assert_true(ServerDigestCacheGetStats(&stats));
+    assert_int_equal(stats.entries, 1);
+    assert_int_equal(stats.misses, 1);
+    assert_int_equal(stats.hits, 2);
+}
+
+static void test_changed_file(void)
+{
+    setup();
+    ServerDigestCacheConfigure(10, false);
+
+    assert_digest_correct(FILE2);
+    WriteTestFile(FILE2, "second file, changed\n");
+    assert_digest_correct(FILE2);
+
+    ServerDigestCacheStats stats;
+    assert_true(ServerDigestCacheGetStats(&stats));
+    assert_int_equal(stats.misses, 2);
+    assert_int_equal(stats.hits, 0);
+}
+
+static void test_eviction(void)
+{
+    setup();
+    ServerDigestCacheConfigure(1, false);
+
+    assert_digest_correct(FILE1);
+    assert_digest_correct(FILE2);
+    assert_digest_correct(FILE1);
+
+    ServerDigestCacheStats stats;
+    assert_true(ServerDigestCacheGetStats(&stats));
+    assert_int_equal(stats.entries, 1);
+    assert_int_equal(stats.misses, 3);
+    assert_int_equal(stats.evictions, 2);
+}
+
+static void test_persistent(void)
+{
+    setup();
+    ServerDigestCacheConfigure(10, true);
+
+    assert_digest_correct(FILE1);
+
+    /* Forget the in-memory entries, the database still has them. */
+    ServerDigestCacheClear();
+    ServerDigestCacheConfigure(10, true);
+
+    assert_digest_correct(FILE1);
+    assert_digest_correct(FILE1);
+
+    ServerDigestCacheStats stats;
+    assert_true(ServerDigestCacheGetStats(&stats));
+    assert_true(stats.persistent);
+    assert_int_equal(stats.misses, 1);
+    assert_int_equal(stats.db_hits, 1);
+    assert_int_equal(stats.hits, 1);
+
+    ServerDigestCacheConfigure(0, false);
+}
+
+static void *HashThreadFiles(void *arg)
+{
+    size_t first = *(size_t *) arg;
+    for (int round = 0; round < 20; round++)
+    {
+        for (size_t i = 0; i < sizeof(THREAD_FILES) / sizeof(THREAD_FILES[0]); i++)
+        {
+            size_t n = (first + i) % (sizeof(THREAD_FILES) / sizeof(THREAD_FILES[0]));
+            unsigned char expected[EVP_MAX_MD_SIZE + 1] = { 0 };
+            unsigned char actual[EVP_MAX_MD_SIZE + 1] = { 0 };
+            HashFile(THREAD_FILES[n], expected, HASH_METHOD_MD5, false);
+            ServerDigestCacheHashFile(THREAD_FILES[n], actual, HASH_METHOD_MD5);
+            if (memcmp(expected, actual, sizeof(expected)) != 0)
+            {
+                return arg;
+            }
+        }
+        /* Evict now and then, so that threads read the database while
+         * others write to it. */
+        if (round % 5 == 0)
+        {
+            ServerDigestCacheConfigure(1, true);
+            ServerDigestCacheConfigure(10, true);
+        }
+    }
+    return NULL;
+}
+
+/* Connection threads share the database, each of them must commit its own
+ * writes without holding off the others. */
+static void test_persistent_threads(void)
+{
+    setup();
+    ServerDigestCacheConfigure(10, true);
+
+    pthread_t threads[8];
+    size_t firsts[8];
+    const size_t num_threads = sizeof(threads) / sizeof(threads[0]);
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        firsts[i] = i;
+        assert_int_equal(pthread_create(&threads[i], NULL, HashThreadFiles,
+                                        &firsts[i]), 0);
+    }
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        void *failed;
+        assert_int_equal(pthread_join(threads[i], &failed), 0);
+        assert_true(failed == NULL);
+    }
+
+    /* What the threads wrote outlives them. */
+    ServerDigestCacheConfigure(0, false);
+    ServerDigestCacheConfigure(10, true);
+    for (size_t i = 0; i < sizeof(THREAD_FILES) / sizeof(THREAD_FILES[0]); i++)
+    {
+        assert_digest_correct(THREAD_FILES[i]);
+    }
+
+    ServerDigestCacheStats stats;
+    assert_true(ServerDigestCacheGetStats(&stats));
+    assert_int_equal(stats.misses, 0);
+    assert_int_equal(stats.db_hits, 4);
+
+    ServerDigestCacheConfigure(0, false);
+}
+
+int main()
+{
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_disabled),
+            unit_test(test_hit),
+            unit_test(test_eviction),
+            unit_test(test_persistent),
+            unit_test(test_persistent_threads),
+            /* Last, files changed within the current second aren't cached. */
+            unit_test(test_changed_file),
+        };
+
+    PRINT_TEST_BANNER();
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
@@ -0,0 +1,162 @@
+#include <test.h>
+
+#include <server_workers.h>
+
+
+/* Jobs are ints, the handler records them and blocks while GATE_CLOSED. */
+static pthread_mutex_t LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t COND = PTHREAD_COND_INITIALIZER;
+static bool GATE_CLOSED = false;
+static int STARTED = 0;
+static int HANDLED = 0;
+static int DISCARDED = 0;
+
+static void reset(bool gate_closed)
+{
+    pthread_mutex_lock(&LOCK);
+    GATE_CLOSED = gate_closed;
+    STARTED = 0;
+    HANDLED = 0;
+    DISCARDED = 0;
+    pthread_mutex_unlock(&LOCK);
+}
+
+static void Handler(void *job)
+{
+    pthread_mutex_lock(&LOCK);
+    STARTED++;
+    pthread_cond_broadcast(&COND);
+    while (GATE_CLOSED)
+    {
+        pthread_cond_wait(&COND, &LOCK);
+    }
+    HANDLED += *(int *) job;
+    pthread_cond_broadcast(&COND);
+    pthread_mutex_unlock(&LOCK);
+}
+
+static void Discard(void *job)
+{
+    pthread_mutex_lock(&LOCK);
+    DISCARDED += *(int *) job;
+    pthread_mutex_unlock(&LOCK);
+}
+
+static void OpenGate(void)
+{
+    pthread_mutex_lock(&LOCK);
+    GATE_CLOSED = false;
+    pthread_cond_broadcast(&COND);
+    pthread_mutex_unlock(&LOCK);
+}
+
+static void WaitFor(int *counter, int value)
+{
+    pthread_mutex_lock(&LOCK);
+    while (*counter < value)
+    {
+        pthread_cond_wait(&COND, &LOCK);
+    }
+    pthread_mutex_unlock(&LOCK);
+}
+
+static void test_all_handled(void)
+{
+    static int one = 1;
+    reset(false);
+
+    assert_false(ServerWorkerPoolIsRunning());
+    assert_true(ServerWorkerPoolStart(4, 100, Handler, Discard));
+    assert_true(ServerWorkerPoolIsRunning());
+
+    for (int i = 0; i < 100; i++)
+    {
+        assert_true(ServerWorkerPoolSubmit(&one));
+    }
+    WaitFor(&HANDLED, 100);
+
+    ServerWorkerPoolStats stats;
+    assert_true(ServerWorkerPoolGetStats(&stats));
+    assert_int_equal(stats.workers, 4);
+    assert_int_equal(stats.dispatched, 100);
+    assert_int_equal(stats.rejected, 0);
+    assert_int_equal(stats.queued, 0);
+
+    ServerWorkerPoolStop();
+    assert_false(ServerWorkerPoolIsRunning());
+    assert_false(ServerWorkerPoolGetStats(&stats));
+    assert_false(ServerWorkerPoolSubmit(&one));
+    assert_int_equal(DISCARDED, 0);
+}
+
+static void test_queue_full(void)
+{
+    static int one = 1;
+    reset(true);
+
+    assert_true(ServerWorkerPoolStart(1, 1, Handler, Discard));
+
+    /* Taken by the only worker, which then blocks. */
+    assert_true(ServerWorkerPoolSubmit(&one));
+    WaitFor(&STARTED, 1);
+
+    /* Waits in the queue, which is then full. */
+    assert_true(ServerWorkerPoolSubmit(&one));
+    assert_false(ServerWorkerPoolSubmit(&one));
+
+    ServerWorkerPoolStats stats;
+    assert_true(ServerWorkerPoolGetStats(&stats));
+    assert_int_equal(stats.busy, 1);
+    assert_int_equal(stats.queued, 1);
+    assert_int_equal(stats.queue_high_watermark, 1);
+    assert_int_equal(stats.rejected, 1);
+
+    OpenGate();
+    WaitFor(&HANDLED, 2);
+
+    assert_true(ServerWorkerPoolGetStats(&stats));
+    assert_int_equal(stats.dispatched, 2);
+    assert_int_equal(stats.queued, 0);
+
+    ServerWorkerPoolStop();
+}
+
+static void test_stop_discards(void)
+{
+    static int one = 1;
+    reset(true);
+
+    assert_true(ServerWorkerPoolStart(1, 10, Handler, Discard));
+    assert_true(ServerWorkerPoolSubmit(&one));
+    WaitFor(&STARTED, 1);
+    assert_true(ServerWorkerPoolSubmit(&one));
+    assert_true(ServerWorkerPoolSubmit(&one));
+
+    /* The queued jobs are discarded, the running one finishes. */
+    ServerWorkerPoolStop();
+    assert_int_equal(DISCARDED, 2);
+
+    OpenGate();
+    WaitFor(&HANDLED, 1);
+    assert_int_equal(STARTED, 1);
+
+    /* A new pool can be started while the old worker is still exiting. */
+    reset(false);
+    assert_true(ServerWorkerPoolStart(2, 10, Handler, Discard));
+    assert_true(ServerWorkerPoolSubmit(&one));
+    WaitFor(&HANDLED, 1);
+    ServerWorkerPoolStop();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_all_handled),
+        unit_test(test_queue_full),
+        unit_test(test_stop_discards),
+    };
+
+    return run_tests(tests);
+}
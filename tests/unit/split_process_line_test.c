@@ -901,6 +901,121 @@ static void test_platform_specific_ps_examples(void)
     }
 }
 
+static void test_select_processes(void)
+{
+    static const char *lines[] = {
+        "USER       PID  PPID  NI NLWP TTY      S COMMAND",
+        "root         1     0   0    1 ?        S /sbin/init",
+        "daemon     100     1   0    4 ?        S /usr/sbin/daemon -f",
+        "johndoe    200     1   5    1 pts/0    R sleep 60",
+        "root       300     1   0    1 ?        S /usr/sbin/daemon -x",
+        NULL
+    };
+
+    ClearProcessTable();
+    for (int i = 0; lines[i] != NULL; i++)
+    {
+        AppendItem(&PROCESSTABLE, lines[i], "");
+    }
+
+    /* Unanchored match on the command line, last process first. */
+    ProcessSelect a = PROCESS_SELECT_INIT;
+    Item *result = SelectProcesses("daemon", &a, false);
+    assert_int_equal(ListLen(result), 2);
+    assert_int_equal(result->counter, 300);
+    assert_int_equal(result->next->counter, 100);
+    DeleteItemList(result);
+
+    /* The table is split once for all selections. */
+    ProcessRecords *records = PROCESS_RECORDS;
+    assert_true(records != NULL);
+    assert_int_equal(SeqLength(records->records), 4);
+    assert_int_equal(SeqLength(records->users), 3);
+
+    RlistAppendScalar(&a.owner, "ro+t");
+    a.process_result = "process_owner";
+    result = SelectProcesses(".*", &a, true);
+    assert_int_equal(ListLen(result), 2);
+    assert_int_equal(result->counter, 300);
+    assert_int_equal(result->next->counter, 1);
+    DeleteItemList(result);
+    assert_true(PROCESS_RECORDS == records);
+
+    a.min_ppid = 1;
+    a.max_ppid = 1;
+    a.min_thread = 2;
+    a.max_thread = 10;
+    a.process_result = "ppid.!process_owner.!threads";
+    result = SelectProcesses(".*", &a, true);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, 200);
+    DeleteItemList(result);
+
+    /* Without process_result, any of the attributes matching selects. */
+    RlistDestroy(a.owner);
+    ProcessSelect b = PROCESS_SELECT_INIT;
+    b.tty = "pts/.*";
+    b.status = "R";
+    result = SelectProcesses(".*", &b, true);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, 200);
+    DeleteItemList(result);
+
+    /* Anchored. */
+    assert_true(IsProcessNameRunning(".*daemon.*"));
+    assert_false(IsProcessNameRunning("daemon"));
+    assert_true(IsProcessNameRunning("sleep 60"));
+
+    ClearProcessTable();
+    assert_true(PROCESS_RECORDS == NULL);
+    assert_false(IsProcessNameRunning(".*"));
+}
+
+static void test_select_proc_processes(void)
+{
+#ifdef __linux__
+    ClearProcessTable();
+    if (PROC_TABLE == NULL)
+    {
+        PROC_TABLE = ProcessTableNew();
+    }
+    assert_true(ProcessTableLoadProc(PROC_TABLE, "/proc"));
+    PROCESSTABLE = ProcessTableToPsOutput(PROC_TABLE);
+    PROC_TABLE_LINES = PROCESSTABLE;
+
+    const pid_t pid = getpid();
+    const ProcessInfo *self = ProcessTableGet(PROC_TABLE, pid);
+    assert_true(self != NULL);
+
+    /* The start time is exact, ps only prints the minute or the day. */
+    ProcessSelect a = PROCESS_SELECT_INIT;
+    a.min_pid = pid;
+    a.max_pid = pid;
+    a.min_stime = self->start_time;
+    a.max_stime = self->start_time;
+    RlistAppendScalar(&a.owner, self->user);
+    a.process_result = "pid.stime.process_owner";
+    Item *result = SelectProcesses(".*", &a, true);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, pid);
+    DeleteItemList(result);
+    RlistDestroy(a.owner);
+
+    /* Selected on the processes, their lines are not split. */
+    ProcessRecords *records = PROCESS_RECORDS;
+    assert_int_equal(SeqLength(records->records), ProcessTableLength(PROC_TABLE));
+    for (size_t i = 0; i < SeqLength(records->records); i++)
+    {
+        const ProcessRecord *record = SeqAt(records->records, i);
+        assert_true(record->info != NULL);
+        assert_true(record->fields[0] == NULL);
+    }
+
+    ClearProcessTable();
+    assert_true(PROC_TABLE_LINES == NULL);
+#endif
+}
+
 int main(void)
 {
     PRINT_TEST_BANNER();
@@ -914,6 +1029,8 @@ int main(void)
             unit_test(test_split_line_serious_overspill),
             unit_test(test_platform_extra_table),
             unit_test(test_platform_specific_ps_examples),
+            unit_test(test_select_processes),
+            unit_test(test_select_proc_processes),
         };
 
     return run_tests(tests);
@@ -0,0 +1,153 @@
+#include <test.h>
+
+#include <stat_cache.h>
+#include <communication.h>                     /* NewAgentConn */
+
+
+/* A regular file of 1234 bytes, inode 77 on device 5. */
+#define FILE_STAT_REPLY "OK: 0 420 0 1000 1000 1234 10 20 30 0 77 1 5"
+/* A link to a directory. */
+#define LINK_STAT_REPLY "OK: 2 493 511 0 0 4096 10 20 30 0 78 2 5"
+
+static AgentConnection *NewConn(void)
+{
+    ConnectionFlags flags = { .protocol_version = CF_PROTOCOL_LATEST };
+    /* Never connected, any request would fail. */
+    return NewAgentConn("localhost", CFENGINE_PORT_STR, flags);
+}
+
+static void test_join_path(void)
+{
+    char key[CF_BUFSIZE];
+
+    assert_true(StatCacheJoinPath(key, sizeof(key), "/srv/files", "a"));
+    assert_string_equal(key, "/srv/files/a");
+    assert_true(StatCacheJoinPath(key, sizeof(key), "/srv/files/", "a"));
+    assert_string_equal(key, "/srv/files/a");
+    assert_true(StatCacheJoinPath(key, sizeof(key), "/srv/files//", "a"));
+    assert_string_equal(key, "/srv/files/a");
+    assert_true(StatCacheJoinPath(key, sizeof(key), "/", "etc"));
+    assert_string_equal(key, "/etc");
+
+    char small[8];
+    assert_false(StatCacheJoinPath(small, sizeof(small), "/srv/files", "a"));
+}
+
+static void test_prefetch_lookup(void)
+{
+    AgentConnection *conn = NewConn();
+
+    char key[CF_BUFSIZE];
+    assert_true(StatCacheJoinPath(key, sizeof(key), "/", "etc"));
+    assert_true(StatCachePrefetch(conn, key, FILE_STAT_REPLY, "OK:",
+                                  "MD5=0123456789abcdef0123456789abcdef"));
+
+    /* Found under the key the agent looks it up with, no round trip. */
+    struct stat sb;
+    assert_int_equal(cf_remote_stat(conn, false, "/etc", &sb, "file"), 0);
+    assert_true(S_ISREG(sb.st_mode));
+    assert_int_equal(sb.st_mode & 07777, 0644);
+    assert_int_equal(sb.st_size, 1234);
+    assert_int_equal(sb.st_uid, 1000);
+    assert_int_equal(sb.st_mtime, 20);
+    assert_int_equal(sb.st_ino, 77);
+
+    const Stat *sp = StatCacheLookup(conn, "/etc", conn->this_server);
+    assert_true(sp != NULL);
+    assert_string_equal(sp->cf_digest, "MD5=0123456789abcdef0123456789abcdef");
+    assert_true(sp->cf_readlink == NULL);
+
+    /* Not for another server, nor under another name. */
+    assert_true(StatCacheLookup(conn, "/etc", "otherhost") == NULL);
+    assert_true(StatCacheLookup(conn, "//etc", conn->this_server) == NULL);
+
+    /* Links keep their own mode and target. */
+    assert_true(StatCachePrefetch(conn, "/srv/link", LINK_STAT_REPLY,
+                                  "OK:/srv/target", NULL));
+    assert_int_equal(cf_remote_stat(conn, false, "/srv/link", &sb, "link"), 0);
+    assert_true(S_ISLNK(sb.st_mode));
+    assert_int_equal(cf_remote_stat(conn, false, "/srv/link", &sb, "file"), 0);
+    assert_true(S_ISDIR(sb.st_mode));
+    sp = StatCacheLookup(conn, "/srv/link", conn->this_server);
+    assert_string_equal(sp->cf_readlink, "/srv/target");
+    assert_true(sp->cf_digest == NULL);
+
+    /* A prefetch replaces what was cached. */
+    assert_true(StatCachePrefetch(conn, "/etc", LINK_STAT_REPLY, "OK:", NULL));
+    assert_int_equal(cf_remote_stat(conn, false, "/etc", &sb, "file"), 0);
+    assert_true(S_ISDIR(sb.st_mode));
+
+    /* Failed STATs are not cached. */
+    assert_false(StatCachePrefetch(conn, "/missing", "BAD: no such file", "", NULL));
+    assert_false(StatCachePrefetch(conn, "/garbage", "OK: 0 420", "OK:", NULL));
+    assert_true(StatCacheLookup(conn, "/missing", conn->this_server) == NULL);
+    assert_true(StatCacheLookup(conn, "/garbage", conn->this_server) == NULL);
+
+    StatCacheDestroy(conn);
+    assert_true(StatCacheLookup(conn, "/etc", conn->this_server) == NULL);
+    DeleteAgentConn(conn);
+}
+
+static void test_listing(void)
+{
+    AgentConnection *conn = NewConn();
+
+    assert_true(StatCacheLookupListing(conn, "/srv/files") == NULL);
+
+    Seq *names = SeqNew(2, free);
+    SeqAppend(names, xstrdup("a"));
+    SeqAppend(names, xstrdup("b"));
+    StatCacheStoreListing(conn, "/srv/files", names);
+
+    const Seq *listed = StatCacheLookupListing(conn, "/srv/files");
+    assert_true(listed == names);
+    assert_int_equal(SeqLength(listed), 2);
+    assert_true(StatCacheLookupListing(conn, "/srv") == NULL);
+
+    /* Storing it again replaces it. */
+    names = SeqNew(1, free);
+    SeqAppend(names, xstrdup("c"));
+    StatCacheStoreListing(conn, "/srv/files", names);
+    listed = StatCacheLookupListing(conn, "/srv/files");
+    assert_int_equal(SeqLength(listed), 1);
+    assert_string_equal(SeqAt(listed, 0), "c");
+
+    DeleteAgentConn(conn);
+}
+
+static void test_forget_manifest(void)
+{
+    AgentConnection *conn = NewConn();
+
+    StatCacheForgetManifest(conn);                  /* nothing cached yet */
+
+    assert_true(StatCachePrefetch(conn, "/srv/files/a", FILE_STAT_REPLY, "OK:",
+                                  "MD5=0123456789abcdef0123456789abcdef"));
+    Seq *names = SeqNew(1, free);
+    SeqAppend(names, xstrdup("a"));
+    StatCacheStoreListing(conn, "/srv/files", names);
+
+    /* The next copy lists the directory and compares digests again. */
+    StatCacheForgetManifest(conn);
+    assert_true(StatCacheLookupListing(conn, "/srv/files") == NULL);
+    const Stat *sp = StatCacheLookup(conn, "/srv/files/a", conn->this_server);
+    assert_true(sp != NULL);
+    assert_true(sp->cf_digest == NULL);
+    assert_int_equal(sp->cf_size, 1234);
+
+    DeleteAgentConn(conn);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_join_path),
+        unit_test(test_prefetch_lookup),
+        unit_test(test_listing),
+        unit_test(test_forget_manifest),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,144 @@
+#include <test.h>
+
+#include <verify_users_pam.c> // Include .c file to test static functions
+
+#include <utime.h>
+
+static char TEST_DIR[] = "/tmp/verify_users_pam_test.XXXXXX";
+static char PASSWD_FILE[PATH_MAX];
+static char GROUP_FILE[PATH_MAX];
+static char SHADOW_FILE[PATH_MAX];
+
+static void tests_setup(void)
+{
+    assert_true(mkdtemp(TEST_DIR) != NULL);
+    xsnprintf(PASSWD_FILE, sizeof(PASSWD_FILE), "%s/passwd", TEST_DIR);
+    xsnprintf(GROUP_FILE, sizeof(GROUP_FILE), "%s/group", TEST_DIR);
+    xsnprintf(SHADOW_FILE, sizeof(SHADOW_FILE), "%s/shadow", TEST_DIR);
+
+    /* Read these instead of the system's files. */
+    USER_DB.passwd_file.path = PASSWD_FILE;
+    USER_DB.group_file.path = GROUP_FILE;
+#if HAVE_FGETSPENT
+    USER_DB.shadow_file.path = SHADOW_FILE;
+#endif
+}
+
+static void tests_teardown(void)
+{
+    UserDbInvalidate();
+    UserDbRefresh();
+
+    char cmd[PATH_MAX + 10];
+    xsnprintf(cmd, sizeof(cmd), "rm -rf '%s'", TEST_DIR);
+    system(cmd);
+}
+
+static void WriteDbFile(const char *path, const char *contents)
+{
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+}
+
+static void test_users(void)
+{
+    WriteDbFile(PASSWD_FILE,
+                "alice:x:1001:1001::/home/alice:/bin/sh\n"
+                "bob:x:1002:1002::/home/bob:/bin/sh\n");
+    UserDbRefresh();
+
+    struct passwd *alice = GetPwEntry("alice");
+    assert_true(alice != NULL);
+    assert_int_equal(alice->pw_uid, 1001);
+    assert_true(GetPwEntry("carol") == NULL);
+    assert_int_equal(errno, 0);
+
+    /* Within a promise, lookups are served from the snapshot. */
+    WriteDbFile(PASSWD_FILE,
+                "alice:x:1001:1001::/home/alice:/bin/sh\n"
+                "bob:x:1002:1002::/home/bob:/bin/sh\n"
+                "carol:x:1003:1003::/home/carol:/bin/sh\n");
+    assert_true(GetPwEntry("alice") == alice);
+    assert_true(GetPwEntry("carol") == NULL);
+
+    /* The next promise sees the change. */
+    UserDbRefresh();
+    struct passwd *carol = GetPwEntry("carol");
+    assert_true(carol != NULL);
+    assert_int_equal(carol->pw_uid, 1003);
+    assert_int_equal(GetPwEntry("alice")->pw_uid, 1001);
+}
+
+static void test_users_invalidated(void)
+{
+    WriteDbFile(PASSWD_FILE, "dave:x:1004:1004::/home/dave:/bin/sh\n");
+    UserDbRefresh();
+    assert_int_equal(GetPwEntry("dave")->pw_uid, 1004);
+
+    /* As by usermod within the same second, with the same size. */
+    struct stat sb;
+    assert_int_equal(stat(PASSWD_FILE, &sb), 0);
+    WriteDbFile(PASSWD_FILE, "dave:x:1005:1004::/home/dave:/bin/sh\n");
+    struct utimbuf times = { .actime = sb.st_atime, .modtime = sb.st_mtime };
+    assert_int_equal(utime(PASSWD_FILE, &times), 0);
+    assert_int_equal(GetPwEntry("dave")->pw_uid, 1004);
+
+    UserDbInvalidate();
+    UserDbRefresh();
+    assert_int_equal(GetPwEntry("dave")->pw_uid, 1005);
+}
+
+static void test_groups(void)
+{
+    WriteDbFile(GROUP_FILE,
+                "staff:x:50:alice\n"
+                "wheel:x:10:bob,alice\n");
+    UserDbRefresh();
+
+    assert_string_equal(GetGrEntryByName("wheel")->gr_name, "wheel");
+    assert_string_equal(GetGrEntryByGid("50")->gr_name, "staff");
+    assert_true(GetGrEntryByName("audio") == NULL);
+
+    StringSet *member_of = MapGet(USER_DB.memberships, "alice");
+    assert_true(member_of != NULL);
+    assert_int_equal(StringSetSize(member_of), 2);
+    assert_true(StringSetContains(member_of, "staff"));
+    assert_true(StringSetContains(member_of, "wheel"));
+
+    /* Within a promise, lookups are served from the snapshot. */
+    WriteDbFile(GROUP_FILE,
+                "staff:x:50:alice\n"
+                "wheel:x:10:bob,alice\n"
+                "audio:x:63:alice\n");
+    assert_true(GetGrEntryByName("audio") == NULL);
+    assert_true(GetGrEntryByGid("63") == NULL);
+
+    /* The next promise sees the change. */
+    UserDbRefresh();
+    assert_string_equal(GetGrEntryByName("audio")->gr_name, "audio");
+    assert_string_equal(GetGrEntryByGid("63")->gr_name, "audio");
+    member_of = MapGet(USER_DB.memberships, "alice");
+    assert_int_equal(StringSetSize(member_of), 3);
+    assert_true(StringSetContains(member_of, "audio"));
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_users),
+        unit_test(test_users_invalidated),
+        unit_test(test_groups),
+    };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+
+    return ret;
+}